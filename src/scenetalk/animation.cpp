@@ -0,0 +1,90 @@
+#include "animation.h"
+#include "vertex_encoding.h"
+
+namespace scene_talk {
+
+void delta_encode_samples(std::span<const float> values, size_t components, std::vector<float>& out) {
+    if (components == 0) {
+        out.assign(values.begin(), values.end());
+        return;
+    }
+
+    // The last components entries track the sample the receiver reconstructs
+    out.resize(values.size() + components);
+    float* reconstructed = out.data() + values.size();
+    for (size_t i = 0; i < values.size(); i++) {
+        size_t c = i % components;
+        out[i] = i < components ? values[i] : values[i] - reconstructed[c];
+        reconstructed[c] = i < components ? values[i] : reconstructed[c] + out[i];
+    }
+    out.resize(values.size());
+}
+
+void quantize_samples(std::span<const float> values, size_t components, bool delta,
+                      std::vector<float>& min, std::vector<float>& max, std::vector<uint16_t>& out) {
+    q16_bounds(values, components, min, max);
+    if (components == 0) {
+        out.clear();
+        return;
+    }
+
+    out.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        size_t c = i % components;
+        out[i] = q16_quantize(values[i], min[c], max[c]);
+    }
+
+    // Differences wrap around, walking backwards keeps the previous sample intact
+    if (delta) {
+        for (size_t i = values.size(); i-- > components;) {
+            out[i] = static_cast<uint16_t>(out[i] - out[i - components]);
+        }
+    }
+}
+
+void read_float_array(std::span<const uint8_t> bytes, std::vector<float>& out) {
+    size_t offset = out.size();
+    out.resize(offset + bytes.size() / sizeof(float));
+    for (size_t i = offset; i < out.size(); i++) {
+        out[i] = read_le<float>(bytes.data() + (i - offset) * sizeof(float));
+    }
+}
+
+bool decode_samples(uint64_t tag, std::span<const uint8_t> bytes, size_t components, bool delta,
+                    std::span<const float> min, std::span<const float> max, std::vector<float>& out) {
+    if (min.empty()) {
+        if (tag != TAG_FLOAT32_LE || bytes.size() % sizeof(float) != 0) {
+            return false;
+        }
+        out.clear();
+        read_float_array(bytes, out);
+        if (delta) {
+            for (size_t i = components; i < out.size(); i++) {
+                out[i] += out[i - components];
+            }
+        }
+        return true;
+    }
+
+    if (tag != (delta ? TAG_SINT16_LE : TAG_UINT16_LE) || bytes.size() % sizeof(uint16_t) != 0 ||
+        min.size() != components || max.size() != components) {
+        return false;
+    }
+
+    // Undo the differences on the 16-bit values first, floats hold them exactly
+    out.resize(bytes.size() / sizeof(uint16_t));
+    for (size_t i = 0; i < out.size(); i++) {
+        auto q = read_le<uint16_t>(bytes.data() + i * sizeof(uint16_t));
+        if (delta && i >= components) {
+            q = static_cast<uint16_t>(q + static_cast<uint16_t>(out[i - components]));
+        }
+        out[i] = q;
+    }
+    for (size_t i = 0; i < out.size(); i++) {
+        size_t c = i % components;
+        out[i] = min[c] + out[i] / Q16_SCALE * (max[c] - min[c]);
+    }
+    return true;
+}
+
+} // namespace scene_talk
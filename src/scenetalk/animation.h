@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace scene_talk {
+
+/**
+ * @brief How the encoder packs the values of an ANIMATION frame
+ *
+ * ANIMATION payloads carry a batch of samples of one attribute:
+ * {"name": name, "type": type, "components": n, "times": float32[], "values": ...}
+ * with n values per time. Quantized values add "enc": "q16" and per-component
+ * "min" and "max" float32 arrays, delta coded values add "delta": true.
+ */
+struct sample_options {
+    // Send each sample as its difference to the previous one
+    bool delta = false;
+
+    // Send 16-bit values within per-component bounds instead of float32
+    bool quantize = false;
+};
+
+/**
+ * @brief A view of every n-th element
+ */
+template<typename T>
+struct strided_span {
+    const T* data = nullptr;
+    size_t count = 0;
+    size_t stride = 1;
+
+    [[nodiscard]] size_t size() const { return count; }
+    const T& operator[](size_t i) const { return data[i * stride]; }
+};
+
+/**
+ * @brief Decoded samples of an ANIMATION frame
+ *
+ * The spans are only valid for the duration of the visitor call.
+ */
+struct animation_samples {
+    std::span<const float> times;
+    std::span<const float> values;   // components values per time, sample after sample
+    size_t components;
+
+    [[nodiscard]] size_t count() const { return times.size(); }
+
+    // Values of one sample
+    [[nodiscard]] std::span<const float> sample(size_t i) const {
+        return values.subspan(i * components, components);
+    }
+
+    // One component of every sample
+    [[nodiscard]] strided_span<float> channel(size_t component) const {
+        return {values.data() + component, count(), components};
+    }
+};
+
+/**
+ * @brief Differences of each sample to the one before, the first sample as is
+ *
+ * Differences are taken against the values the receiver reconstructs, so
+ * float rounding does not add up over the samples.
+ */
+void delta_encode_samples(std::span<const float> values, size_t components, std::vector<float>& out);
+
+/**
+ * @brief Quantize samples to 16 bits within the per-component bounds
+ *
+ * @param min, max Receive the bounds, components values each
+ * @param delta Store each quantized sample as its difference to the previous one, modulo 2^16
+ */
+void quantize_samples(std::span<const float> values, size_t components, bool delta,
+                      std::vector<float>& min, std::vector<float>& max, std::vector<uint16_t>& out);
+
+/**
+ * @brief Append the values of a little endian float32 typed array
+ */
+void read_float_array(std::span<const uint8_t> bytes, std::vector<float>& out);
+
+/**
+ * @brief Reconstruct float samples from the values of an ANIMATION frame
+ *
+ * @param tag Typed array tag of the values
+ * @param bytes The values
+ * @param min, max Bounds of quantized values, empty otherwise
+ * @return False if the tag does not match the encoding
+ */
+bool decode_samples(uint64_t tag, std::span<const uint8_t> bytes, size_t components, bool delta,
+                    std::span<const float> min, std::span<const float> max, std::vector<float>& out);
+
+} // namespace scene_talk
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace scene_talk {
+
+/**
+ * @brief Integer keys of a compact ATTRIBUTE payload
+ *
+ * Once CAP_ATTRIBUTE_IDS is negotiated ATTRIBUTE payloads are sent as
+ * {0: name, 1: type, 2: value}. Names and types in the registries below are
+ * sent as their ids, others keep their strings.
+ */
+constexpr uint8_t ATTR_KEY_NAME = 0;
+constexpr uint8_t ATTR_KEY_TYPE = 1;
+constexpr uint8_t ATTR_KEY_VALUE = 2;
+
+/**
+ * @brief Value types with registry ids
+ */
+enum class value_type : uint8_t {
+    str = 1,
+    u32,
+    f32,
+    vec2f,
+    vec3f,
+    vec4f,
+    mat4f,
+    f32_array,
+    u32_array
+};
+
+struct value_type_info {
+    value_type id;
+    std::string_view name;
+};
+
+inline constexpr std::array<value_type_info, 9> VALUE_TYPES = {{
+    {value_type::str, "str"},
+    {value_type::u32, "u32"},
+    {value_type::f32, "f32"},
+    {value_type::vec2f, "vec2f"},
+    {value_type::vec3f, "vec3f"},
+    {value_type::vec4f, "vec4f"},
+    {value_type::mat4f, "mat4f"},
+    {value_type::f32_array, "f32[]"},
+    {value_type::u32_array, "u32[]"},
+}};
+
+/**
+ * @brief Core attributes of the RFC with registry ids
+ */
+enum class core_attr : uint8_t {
+    type_name = 1,
+    kind,
+    name,
+    parent,
+    layer,
+    layer_ref,
+    scene_scale_mm,
+    object_up,
+    object_right,
+    object_front,
+    transform,
+    points,
+    normals,
+    velocities,
+    face_vertex_counts,
+    face_vertex_indices,
+    display_color,
+    opacity,
+    material_binding,
+    purpose
+};
+
+struct core_attr_info {
+    core_attr id;
+    std::string_view name;
+    value_type type;
+};
+
+inline constexpr std::array<core_attr_info, 20> CORE_ATTRIBUTES = {{
+    {core_attr::type_name, "typeName", value_type::str},
+    {core_attr::kind, "kind", value_type::str},
+    {core_attr::name, "name", value_type::str},
+    {core_attr::parent, "parent", value_type::str},
+    {core_attr::layer, "layer", value_type::str},
+    {core_attr::layer_ref, "layerRef", value_type::str},
+    {core_attr::scene_scale_mm, "sceneScaleMM", value_type::u32},
+    {core_attr::object_up, "objectUp", value_type::vec3f},
+    {core_attr::object_right, "objectRight", value_type::vec3f},
+    {core_attr::object_front, "objectFront", value_type::vec3f},
+    {core_attr::transform, "transform", value_type::mat4f},
+    {core_attr::points, "points", value_type::vec3f},
+    {core_attr::normals, "normals", value_type::vec3f},
+    {core_attr::velocities, "velocities", value_type::vec3f},
+    {core_attr::face_vertex_counts, "faceVertexCounts", value_type::u32_array},
+    {core_attr::face_vertex_indices, "faceVertexIndices", value_type::u32_array},
+    {core_attr::display_color, "displayColor", value_type::vec3f},
+    {core_attr::opacity, "opacity", value_type::f32_array},
+    {core_attr::material_binding, "materialBinding", value_type::str},
+    {core_attr::purpose, "purpose", value_type::str},
+}};
+
+// Ids are positions in the tables, so looking them up is an index
+template<typename Table>
+constexpr bool ids_are_positions(const Table& table) {
+    for (size_t i = 0; i < table.size(); i++) {
+        if (static_cast<size_t>(table[i].id) != i + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(ids_are_positions(VALUE_TYPES));
+static_assert(ids_are_positions(CORE_ATTRIBUTES));
+
+// Value type with the given id, nullptr if not registered
+constexpr const value_type_info* value_type_by_id(uint64_t id) {
+    return id >= 1 && id <= VALUE_TYPES.size() ? &VALUE_TYPES[id - 1] : nullptr;
+}
+
+// Value type with the given name, nullptr if not registered
+constexpr const value_type_info* find_value_type(std::string_view name) {
+    for (const auto& info : VALUE_TYPES) {
+        if (info.name == name) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+// Core attribute with the given id, nullptr if not registered
+constexpr const core_attr_info* core_attr_by_id(uint64_t id) {
+    return id >= 1 && id <= CORE_ATTRIBUTES.size() ? &CORE_ATTRIBUTES[id - 1] : nullptr;
+}
+
+// Core attribute with the given name, nullptr for custom attributes
+constexpr const core_attr_info* find_core_attr(std::string_view name) {
+    for (const auto& info : CORE_ATTRIBUTES) {
+        if (info.name == name) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Compile-time key of a core attribute
+ *
+ * Value is the C++ type the encoder accepts for the attribute, passing
+ * anything else does not compile.
+ */
+template<core_attr Id, typename Value>
+struct attr_key {
+    static constexpr core_attr id = Id;
+    using value = Value;
+
+    static constexpr const core_attr_info& info() { return CORE_ATTRIBUTES[static_cast<size_t>(Id) - 1]; }
+};
+
+namespace attrs {
+
+using vec3f = std::array<float, 3>;
+using mat4f = std::array<float, 16>;
+
+inline constexpr attr_key<core_attr::type_name, std::string_view> type_name{};
+inline constexpr attr_key<core_attr::kind, std::string_view> kind{};
+inline constexpr attr_key<core_attr::name, std::string_view> name{};
+inline constexpr attr_key<core_attr::parent, std::string_view> parent{};
+inline constexpr attr_key<core_attr::layer, std::string_view> layer{};
+inline constexpr attr_key<core_attr::layer_ref, std::string_view> layer_ref{};
+inline constexpr attr_key<core_attr::scene_scale_mm, uint32_t> scene_scale_mm{};
+inline constexpr attr_key<core_attr::object_up, vec3f> object_up{};
+inline constexpr attr_key<core_attr::object_right, vec3f> object_right{};
+inline constexpr attr_key<core_attr::object_front, vec3f> object_front{};
+inline constexpr attr_key<core_attr::transform, mat4f> transform{};
+inline constexpr attr_key<core_attr::points, std::span<const float>> points{};
+inline constexpr attr_key<core_attr::normals, std::span<const float>> normals{};
+inline constexpr attr_key<core_attr::velocities, std::span<const float>> velocities{};
+inline constexpr attr_key<core_attr::face_vertex_counts, std::span<const uint32_t>> face_vertex_counts{};
+inline constexpr attr_key<core_attr::face_vertex_indices, std::span<const uint32_t>> face_vertex_indices{};
+inline constexpr attr_key<core_attr::display_color, std::span<const float>> display_color{};
+inline constexpr attr_key<core_attr::opacity, std::span<const float>> opacity{};
+inline constexpr attr_key<core_attr::material_binding, std::string_view> material_binding{};
+inline constexpr attr_key<core_attr::purpose, std::string_view> purpose{};
+
+} // namespace attrs
+
+} // namespace scene_talk
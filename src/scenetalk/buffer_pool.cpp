@@ -1,92 +1,509 @@
 #include "buffer_pool.h"
+#include <algorithm>
 #include <cassert>
+#include <new>
+#include <thread>
+#include <vector>
 
 namespace scene_talk {
 
+namespace {
+
+// Buffers each thread caches per pool and size class, two depot batches
+constexpr size_t MAGAZINE_SIZE = 32;
+
+// Size classes 0 up to MAX_CACHED_BUFFER_SIZE are cached per thread
+constexpr size_t CACHED_CLASS_COUNT = 11;
+static_assert(MIN_BUFFER_SIZE << (CACHED_CLASS_COUNT - 1) == MAX_CACHED_BUFFER_SIZE);
+
+// Most idle buffers the depot holds per size class
+constexpr size_t DEPOT_CAPACITY = 1024;
+
+std::atomic<uint64_t> next_pool_id{1};
+
+void destroy_buffer(buffer* b) {
+    b->~buffer();
+    ::operator delete(b, std::align_val_t(alignof(buffer)));
+}
+
+} // namespace
+
+/**
+ * @brief Idle buffers one thread caches for one pool, by size class
+ *
+ * Only its thread uses it, except for trim() releasing it from another
+ * thread, so the lock is all but uncontended.
+ */
+struct thread_magazine {
+    uint64_t pool_id;
+    std::weak_ptr<buffer_pool> pool;
+    buffer* buffers[CACHED_CLASS_COUNT][MAGAZINE_SIZE];
+    size_t count[CACHED_CLASS_COUNT];
+    uint64_t hits;
+    std::atomic_flag busy;
+
+    void lock() {
+        while (busy.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock() { busy.clear(std::memory_order_release); }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t c = 0; c < CACHED_CLASS_COUNT; ++c) {
+            total += count[c];
+        }
+        return total;
+    }
+
+    void destroy() {
+        for (size_t c = 0; c < CACHED_CLASS_COUNT; ++c) {
+            std::for_each(buffers[c], buffers[c] + count[c], destroy_buffer);
+            count[c] = 0;
+        }
+    }
+};
+
+/**
+ * @brief Idle buffers cached by one thread, one magazine per pool
+ */
+struct thread_cache {
+    using magazine = thread_magazine;
+
+    ~thread_cache() {
+        // Detach first, returning buffers may destroy the last pool reference
+        auto detached = std::move(magazines);
+        magazines.clear();
+        last = nullptr;
+
+        for (auto& mag : detached) {
+            if (auto pool = mag->pool.lock()) {
+                // Out of reach of trim() before it is flushed for the last time
+                pool->remove_cache(mag.get());
+                flush(*pool, *mag);
+            } else {
+                mag->destroy();
+            }
+        }
+    }
+
+    // Release everything a magazine holds to its pool
+    static void flush(buffer_pool& pool, magazine& mag) {
+        pool.hits_.fetch_add(mag.hits, std::memory_order_relaxed);
+        mag.hits = 0;
+
+        for (size_t c = 0; c < CACHED_CLASS_COUNT; ++c) {
+            pool.release(c, mag.buffers[c], mag.count[c]);
+            mag.count[c] = 0;
+        }
+    }
+
+    magazine* find(uint64_t pool_id) {
+        if (last && last->pool_id == pool_id) {
+            return last;
+        }
+        for (auto& mag : magazines) {
+            if (mag->pool_id == pool_id) {
+                last = mag.get();
+                return last;
+            }
+        }
+        return nullptr;
+    }
+
+    magazine& get(buffer_pool* pool) {
+        if (magazine* mag = find(pool->id_)) {
+            return *mag;
+        }
+
+        // Drop magazines of pools that no longer exist
+        std::erase_if(magazines, [](const std::unique_ptr<magazine>& mag) {
+            if (!mag->pool.expired()) {
+                return false;
+            }
+            mag->destroy();
+            return true;
+        });
+
+        auto mag = std::make_unique<magazine>();
+        mag->pool_id = pool->id_;
+        mag->pool = pool->weak_from_this();
+        std::fill(mag->count, mag->count + CACHED_CLASS_COUNT, 0);
+        mag->hits = 0;
+        pool->add_cache(mag.get());
+        last = mag.get();
+        magazines.push_back(std::move(mag));
+        return *last;
+    }
+
+    void erase(uint64_t pool_id) {
+        std::erase_if(magazines, [pool_id](const std::unique_ptr<magazine>& mag) {
+            return mag->pool_id == pool_id;
+        });
+        last = nullptr;
+    }
+
+    std::vector<std::unique_ptr<magazine>> magazines;
+    magazine* last = nullptr;
+};
+
+static thread_local thread_cache local_cache;
+
+// Holds a magazine while its thread uses it
+class magazine_guard {
+public:
+    explicit magazine_guard(thread_magazine& mag) : mag_(mag) { mag_.lock(); }
+    ~magazine_guard() { mag_.unlock(); }
+
+    magazine_guard(const magazine_guard&) = delete;
+    magazine_guard& operator=(const magazine_guard&) = delete;
+
+private:
+    thread_magazine& mag_;
+};
+
 // buffer implementation
-buffer::buffer(uint8_t* data, size_t capacity, buffer_pool* pool)
-    : data_(data), size_(0), capacity_(capacity), pool_(pool) {
+buffer::buffer(size_t capacity, uint8_t size_class, buffer_pool* pool)
+    : size_(0), capacity_(capacity), pool_(pool), size_class_(size_class) {
 }
 
-buffer::buffer(buffer&& other) noexcept
-    : data_(other.data_), size_(other.size_), capacity_(other.capacity_), pool_(other.pool_) {
-    other.data_ = nullptr;
-    other.pool_ = nullptr;
+void buffer::resize(size_t new_size) {
+    assert(new_size <= capacity_);
+    size_ = new_size;
 }
 
-buffer& buffer::operator=(buffer&& other) noexcept {
+// buffer_ptr implementation
+buffer_ptr& buffer_ptr::operator=(buffer_ptr&& other) noexcept {
     if (this != &other) {
-        if (data_ && pool_) {
-            pool_->return_buffer(data_);
+        reset();
+        buffer_ = other.buffer_;
+        other.buffer_ = nullptr;
+    }
+    return *this;
+}
+
+void buffer_ptr::reset() {
+    if (buffer_) {
+        buffer* b = buffer_;
+        buffer_ = nullptr;
+        b->pool_->return_buffer(b);
+    }
+}
+
+// depot implementation
+void buffer_pool::depot::slot_stack::push(slot* slots, uint32_t index) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        slots[index].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (index + 1);
+    } while (!head_.compare_exchange_weak(head, next, std::memory_order_release,
+                                          std::memory_order_relaxed));
+}
+
+buffer_pool::depot::slot* buffer_pool::depot::slot_stack::pop(slot* slots) {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t next;
+    do {
+        uint32_t top = static_cast<uint32_t>(head);
+        if (top == 0) {
+            return nullptr;
         }
 
-        data_ = other.data_;
-        size_ = other.size_;
-        capacity_ = other.capacity_;
-        pool_ = other.pool_;
+        // Slots are never freed, a stale next only fails the exchange
+        uint32_t below = slots[top - 1].next.load(std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | below;
+    } while (!head_.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                          std::memory_order_acquire));
+
+    return &slots[static_cast<uint32_t>(head) - 1];
+}
 
-        other.data_ = nullptr;
-        other.pool_ = nullptr;
+buffer_pool::depot::depot(size_t capacity)
+    : slots_(new slot[(capacity + BATCH_SIZE - 1) / BATCH_SIZE]),
+      size_(0) {
+    uint32_t slot_count = static_cast<uint32_t>((capacity + BATCH_SIZE - 1) / BATCH_SIZE);
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        slots_[i].count = 0;
+        empty_.push(slots_.get(), i);
     }
-    return *this;
 }
 
-buffer::~buffer() {
-    if (data_ && pool_) {
-        pool_->return_buffer(data_);
+bool buffer_pool::depot::push(buffer* const* buffers, size_t count) {
+    assert(count <= BATCH_SIZE);
+    slot* s = empty_.pop(slots_.get());
+    if (!s) {
+        return false;
     }
+
+    std::copy(buffers, buffers + count, s->buffers);
+    s->count = count;
+    size_.fetch_add(count, std::memory_order_relaxed);
+    full_.push(slots_.get(), static_cast<uint32_t>(s - slots_.get()));
+    return true;
 }
 
-void buffer::resize(size_t new_size) {
-    assert(new_size <= capacity_);
-    size_ = new_size;
+size_t buffer_pool::depot::pop(buffer** buffers) {
+    slot* s = full_.pop(slots_.get());
+    if (!s) {
+        return 0;
+    }
+
+    size_t count = s->count;
+    std::copy(s->buffers, s->buffers + count, buffers);
+    size_.fetch_sub(count, std::memory_order_relaxed);
+    empty_.push(slots_.get(), static_cast<uint32_t>(s - slots_.get()));
+    return count;
 }
 
 // buffer_pool implementation
-std::shared_ptr<buffer_pool> buffer_pool::create(size_t buffer_size, size_t initial_pool_size) {
-    return std::shared_ptr<buffer_pool>(new buffer_pool(buffer_size, initial_pool_size));
+std::shared_ptr<buffer_pool> buffer_pool::create(size_t buffer_size, size_t initial_pool_size,
+                                                 const pool_limits& limits) {
+    return std::shared_ptr<buffer_pool>(new buffer_pool(buffer_size, initial_pool_size, limits));
 }
 
-buffer_pool::buffer_pool(size_t buffer_size, size_t initial_pool_size)
-    : buffer_size_(buffer_size) {
-    for (size_t i = 0; i < initial_pool_size; ++i) {
-        available_buffers_.push(allocate_buffer());
+buffer_pool::buffer_pool(size_t buffer_size, size_t initial_pool_size, const pool_limits& limits)
+    : buffer_size_(buffer_size),
+      default_class_(size_class(buffer_size)),
+      limits_(limits),
+      id_(next_pool_id.fetch_add(1, std::memory_order_relaxed)),
+      hits_(0),
+      steals_(0),
+      misses_(0),
+      allocated_(0),
+      high_water_(0),
+      allocated_bytes_(0),
+      idle_bytes_(0) {
+    assert(default_class_ < SIZE_CLASS_COUNT);
+
+    // Depots only need to hold what fits under the idle memory ceiling
+    for (size_t c = 0; c < SIZE_CLASS_COUNT; ++c) {
+        size_t capacity = std::min(DEPOT_CAPACITY, limits_.max_idle_bytes / class_capacity(c));
+        if (c == default_class_) {
+            capacity = std::max(capacity, initial_pool_size);
+        }
+        if (c >= CACHED_CLASS_COUNT) {
+            // Uncached buffers move through the depot one per slot
+            capacity *= BATCH_SIZE;
+        }
+        available_buffers_[c] = std::make_unique<depot>(capacity);
+    }
+
+    buffer* batch[BATCH_SIZE];
+    for (size_t filled = 0; filled < initial_pool_size;) {
+        size_t count = std::min(BATCH_SIZE, initial_pool_size - filled);
+        for (size_t i = 0; i < count; ++i) {
+            batch[i] = allocate_buffer(default_class_);
+        }
+        available_buffers_[default_class_]->push(batch, count);
+        idle_bytes_.fetch_add(count * class_capacity(default_class_), std::memory_order_relaxed);
+        filled += count;
     }
 }
 
 buffer_pool::~buffer_pool() {
-    while (!available_buffers_.empty()) {
-        delete[] available_buffers_.front();
-        available_buffers_.pop();
+    // Buffers cached by other threads are freed when those threads exit
+    if (auto* mag = local_cache.find(id_)) {
+        mag->destroy();
+        local_cache.erase(id_);
+    }
+
+    buffer* batch[BATCH_SIZE];
+    for (auto& depot : available_buffers_) {
+        while (size_t count = depot->pop(batch)) {
+            std::for_each(batch, batch + count, destroy_buffer);
+        }
+    }
+}
+
+size_t buffer_pool::size_class(size_t size) {
+    size_t c = 0;
+    while (c < SIZE_CLASS_COUNT && class_capacity(c) < size) {
+        ++c;
+    }
+    return c;
+}
+
+buffer_ptr buffer_pool::get_buffer() {
+    return get_buffer(buffer_size_);
+}
+
+buffer_ptr buffer_pool::get_buffer(size_t min_size) {
+    size_t c = size_class(min_size);
+    if (c >= SIZE_CLASS_COUNT) {
+        return nullptr;
+    }
+
+    // Large buffers bypass the thread cache
+    if (c >= CACHED_CLASS_COUNT) {
+        buffer* batch[BATCH_SIZE];
+        size_t count = acquire(c, batch);
+        if (count == 0) {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return buffer_ptr(allocate_buffer(c));
+        }
+        release(c, batch + 1, count - 1);
+        batch[0]->size_ = 0;
+        return buffer_ptr(batch[0]);
+    }
+
+    auto& mag = local_cache.get(this);
+    magazine_guard guard(mag);
+
+    if (mag.count[c] == 0) {
+        // Publish local hits while we are touching shared state anyway
+        hits_.fetch_add(mag.hits, std::memory_order_relaxed);
+        mag.hits = 0;
+
+        // Refill a batch from the shared depot
+        mag.count[c] = acquire(c, mag.buffers[c]);
+
+        if (mag.count[c] == 0) {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return buffer_ptr(allocate_buffer(c));
+        }
     }
+
+    ++mag.hits;
+    buffer* b = mag.buffers[c][--mag.count[c]];
+    b->size_ = 0;
+    return buffer_ptr(b);
 }
 
-std::unique_ptr<buffer> buffer_pool::get_buffer() {
-    std::lock_guard<std::mutex> lock(mutex_);
+void buffer_pool::return_buffer(buffer* b) {
+    size_t c = b->size_class_;
+    if (c >= CACHED_CLASS_COUNT) {
+        release(c, &b, 1);
+        return;
+    }
+
+    auto& mag = local_cache.get(this);
+    magazine_guard guard(mag);
+
+    if (mag.count[c] == MAGAZINE_SIZE) {
+        hits_.fetch_add(mag.hits, std::memory_order_relaxed);
+        mag.hits = 0;
+
+        // Spill the older batch to the shared depot
+        buffer** buffers = mag.buffers[c];
+        release(c, buffers, BATCH_SIZE);
+        std::copy(buffers + BATCH_SIZE, buffers + MAGAZINE_SIZE, buffers);
+        mag.count[c] = MAGAZINE_SIZE - BATCH_SIZE;
+    }
+
+    mag.buffers[c][mag.count[c]++] = b;
+}
+
+void buffer_pool::release(size_t size_class, buffer* const* buffers, size_t count) {
+    auto& depot = *available_buffers_[size_class];
+    for (size_t offset = 0; offset < count; offset += BATCH_SIZE) {
+        size_t batch = std::min(BATCH_SIZE, count - offset);
+        size_t bytes = batch * class_capacity(size_class);
+
+        // Keep the batch only if it fits under the idle memory ceiling
+        size_t idle = idle_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (idle > limits_.max_idle_bytes || !depot.push(buffers + offset, batch)) {
+            idle_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            std::for_each(buffers + offset, buffers + offset + batch,
+                          [this](buffer* b) { free_buffer(b); });
+        }
+    }
+}
+
+size_t buffer_pool::acquire(size_t size_class, buffer** buffers) {
+    size_t count = available_buffers_[size_class]->pop(buffers);
+    if (count > 0) {
+        idle_bytes_.fetch_sub(count * class_capacity(size_class), std::memory_order_relaxed);
+        steals_.fetch_add(count, std::memory_order_relaxed);
+    }
+    return count;
+}
 
-    uint8_t* data;
-    if (available_buffers_.empty()) {
-        data = allocate_buffer();
-    } else {
-        data = available_buffers_.front();
-        available_buffers_.pop();
+buffer* buffer_pool::allocate_buffer(size_t size_class) {
+    size_t capacity = class_capacity(size_class);
+    size_t allocated = allocated_.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (allocated > high_water &&
+           !high_water_.compare_exchange_weak(high_water, allocated, std::memory_order_relaxed)) {
+        // Retry with the updated high-water mark
     }
+    allocated_bytes_.fetch_add(capacity, std::memory_order_relaxed);
+
+    void* memory = ::operator new(sizeof(buffer) + capacity, std::align_val_t(alignof(buffer)));
+    return new (memory) buffer(capacity, static_cast<uint8_t>(size_class), this);
+}
 
-    return std::unique_ptr<buffer>(new buffer(data, buffer_size_, this));
+void buffer_pool::free_buffer(buffer* b) {
+    allocated_.fetch_sub(1, std::memory_order_relaxed);
+    allocated_bytes_.fetch_sub(b->capacity_, std::memory_order_relaxed);
+    destroy_buffer(b);
 }
 
-void buffer_pool::return_buffer(uint8_t* data) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    available_buffers_.push(data);
+void buffer_pool::add_cache(thread_magazine* mag) {
+    std::lock_guard<std::mutex> lock(caches_mutex_);
+    caches_.push_back(mag);
 }
 
-uint8_t* buffer_pool::allocate_buffer() {
-    return new uint8_t[buffer_size_];
+void buffer_pool::remove_cache(thread_magazine* mag) {
+    std::lock_guard<std::mutex> lock(caches_mutex_);
+    std::erase(caches_, mag);
+}
+
+size_t buffer_pool::trim() {
+    // Return the caches of all threads so they can be trimmed as well
+    {
+        std::lock_guard<std::mutex> lock(caches_mutex_);
+        for (thread_magazine* mag : caches_) {
+            magazine_guard guard(*mag);
+            thread_cache::flush(*this, *mag);
+        }
+    }
+
+    size_t freed = 0;
+    buffer* batch[BATCH_SIZE];
+    for (size_t c = SIZE_CLASS_COUNT; c-- > 0;) {
+        while (idle_bytes_.load(std::memory_order_relaxed) > limits_.low_water_bytes) {
+            size_t count = available_buffers_[c]->pop(batch);
+            if (count == 0) {
+                break;
+            }
+            size_t bytes = count * class_capacity(c);
+            idle_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            std::for_each(batch, batch + count, [this](buffer* b) { free_buffer(b); });
+            freed += bytes;
+        }
+    }
+    return freed;
 }
 
 size_t buffer_pool::pool_size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return available_buffers_.size();
+    size_t idle = 0;
+    for (const auto& depot : available_buffers_) {
+        idle += depot->size();
+    }
+    if (auto* mag = local_cache.find(id_)) {
+        magazine_guard guard(*mag);
+        idle += mag->size();
+    }
+    return idle;
+}
+
+pool_stats buffer_pool::stats() const {
+    uint64_t local_hits = 0;
+    if (auto* mag = local_cache.find(id_)) {
+        magazine_guard guard(*mag);
+        local_hits = mag->hits;
+    }
+    return {
+        hits_.load(std::memory_order_relaxed) + local_hits,
+        steals_.load(std::memory_order_relaxed),
+        misses_.load(std::memory_order_relaxed),
+        high_water_.load(std::memory_order_relaxed),
+        allocated_bytes_.load(std::memory_order_relaxed),
+        idle_bytes_.load(std::memory_order_relaxed)
+    };
 }
 
-} // namespace scene_talk
\ No newline at end of file
+} // namespace scene_talk
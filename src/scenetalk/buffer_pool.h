@@ -1,28 +1,39 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <vector>
 
 namespace scene_talk {
 
+// Smallest pooled buffer, size classes double from here
+constexpr size_t MIN_BUFFER_SIZE = 64;
+
+// Number of size classes, the largest holds 4 GB
+constexpr size_t SIZE_CLASS_COUNT = 27;
+
+// Largest size class kept in per-thread caches
+constexpr size_t MAX_CACHED_BUFFER_SIZE = 64 * 1024;
+
+class buffer_pool;
+struct thread_magazine;
+
 /**
  * @brief A simple memory buffer from a pool
+ *
+ * The buffer header lives at the start of its own allocation directly in front
+ * of the data, so handing a buffer out never allocates.
  */
-class buffer {
+class alignas(16) buffer {
 public:
     buffer(const buffer&) = delete;
     buffer& operator=(const buffer&) = delete;
 
-    buffer(buffer&&) noexcept;
-    buffer& operator=(buffer&&) noexcept;
-
-    ~buffer();
-
-    uint8_t* data() { return data_; }
-    const uint8_t* data() const { return data_; }
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(this + 1); }
 
     size_t size() const { return size_; }
     void resize(size_t new_size);
@@ -31,41 +42,205 @@ public:
 
 private:
     friend class buffer_pool;
+    friend class buffer_ptr;
 
-    buffer(uint8_t* data, size_t capacity, class buffer_pool* pool);
+    buffer(size_t capacity, uint8_t size_class, buffer_pool* pool);
 
-    uint8_t* data_;
     size_t size_;
     size_t capacity_;
-    class buffer_pool* pool_;
+    buffer_pool* pool_;
+    uint8_t size_class_;
+};
+
+/**
+ * @brief Owning handle to a pooled buffer, returns it to the pool when dropped
+ */
+class buffer_ptr {
+public:
+    buffer_ptr() noexcept : buffer_(nullptr) {}
+    buffer_ptr(std::nullptr_t) noexcept : buffer_(nullptr) {}
+
+    buffer_ptr(const buffer_ptr&) = delete;
+    buffer_ptr& operator=(const buffer_ptr&) = delete;
+
+    buffer_ptr(buffer_ptr&& other) noexcept : buffer_(other.buffer_) { other.buffer_ = nullptr; }
+    buffer_ptr& operator=(buffer_ptr&& other) noexcept;
+
+    ~buffer_ptr() { reset(); }
+
+    buffer* get() const { return buffer_; }
+    buffer* operator->() const { return buffer_; }
+    buffer& operator*() const { return *buffer_; }
+    explicit operator bool() const { return buffer_ != nullptr; }
+    bool operator==(std::nullptr_t) const { return buffer_ == nullptr; }
+
+    // Return the buffer to its pool
+    void reset();
+
+private:
+    friend class buffer_pool;
+
+    explicit buffer_ptr(buffer* b) : buffer_(b) {}
+
+    buffer* buffer_;
 };
 
 /**
- * @brief A pool of fixed-size buffers to minimize allocations
+ * @brief Pool usage counters
+ *
+ * Hits are counted per thread and published when a thread exchanges buffers
+ * with the shared depot, so counts from other threads may lag.
+ */
+struct pool_stats {
+    uint64_t hits;            // Served from the calling thread's cache
+    uint64_t steals;          // Taken from the shared depot
+    uint64_t misses;          // Newly allocated
+    size_t high_water;        // Most buffers allocated at once
+    size_t allocated_bytes;   // Capacity of all buffers currently allocated
+    size_t idle_bytes;        // Capacity of buffers idle in the shared depot
+};
+
+/**
+ * @brief Memory limits for a buffer pool
+ */
+struct pool_limits {
+    // Idle buffers in the shared depot beyond this many bytes are freed instead of pooled
+    size_t max_idle_bytes = 64 * 1024 * 1024;
+
+    // trim() shrinks idle memory down to this many bytes
+    size_t low_water_bytes = 1024 * 1024;
+};
+
+/**
+ * @brief A pool of power-of-two sized buffers to minimize allocations
+ *
+ * Each thread keeps a small cache of buffers per pool and size class and only
+ * touches the shared lock-free depot to refill or spill that cache a batch at
+ * a time. Idle memory in the depot is capped by pool_limits, and trim()
+ * reclaims the caches of all threads as well after a burst.
  */
 class buffer_pool : public std::enable_shared_from_this<buffer_pool> {
 public:
-    static std::shared_ptr<buffer_pool> create(size_t buffer_size, size_t initial_pool_size = 8);
+    static std::shared_ptr<buffer_pool> create(size_t buffer_size, size_t initial_pool_size = 8,
+                                               const pool_limits& limits = {});
     ~buffer_pool();
 
-    // Get a buffer from the pool
-    std::unique_ptr<buffer> get_buffer();
+    // Get a buffer of the default buffer size
+    buffer_ptr get_buffer();
 
-    // Return a buffer to the pool
-    void return_buffer(uint8_t* buffer);
+    // Get a buffer from the smallest size class holding min_size bytes
+    buffer_ptr get_buffer(size_t min_size);
 
     size_t buffer_size() const { return buffer_size_; }
+
+    // Idle buffers in the shared depot and the calling thread's cache
     size_t pool_size() const;
 
+    pool_stats stats() const;
+
+    /**
+     * @brief Free idle buffers, largest first, until idle memory is at the low-water mark
+     *
+     * The caches of all threads using the pool are released to the depot
+     * first, so their buffers are trimmed as well.
+     *
+     * @return Number of bytes freed
+     */
+    size_t trim();
+
+    // Size class of a buffer holding at least size bytes
+    static size_t size_class(size_t size);
+
+    // Capacity of buffers in a size class
+    static size_t class_capacity(size_t size_class) { return MIN_BUFFER_SIZE << size_class; }
+
 private:
-    explicit buffer_pool(size_t buffer_size, size_t initial_pool_size);
+    friend class buffer_ptr;
+    friend struct thread_cache;
+
+    // Buffers moved between a thread cache and the depot at a time
+    static constexpr size_t BATCH_SIZE = 16;
+
+    /**
+     * @brief Lock-free store of idle buffers shared by all threads
+     *
+     * Buffers move in and out in batches held by slots that live as long as
+     * the pool, so the lock-free stacks linking the slots never touch freed
+     * memory. A generation tag in each stack head guards against ABA.
+     */
+    class depot {
+    public:
+        explicit depot(size_t capacity);
+
+        // Store a batch of buffers, false if the depot is full
+        bool push(buffer* const* buffers, size_t count);
+
+        // Take a batch of up to BATCH_SIZE buffers, returns the count
+        size_t pop(buffer** buffers);
+
+        size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    private:
+        struct slot {
+            buffer* buffers[BATCH_SIZE];
+            size_t count;
+            std::atomic<uint32_t> next;
+        };
+
+        // Treiber stack of slot indices, the head packs a tag with index + 1
+        class slot_stack {
+        public:
+            slot_stack() : head_(0) {}
+
+            void push(slot* slots, uint32_t index);
+            slot* pop(slot* slots);
+
+        private:
+            std::atomic<uint64_t> head_;
+        };
+
+        std::unique_ptr<slot[]> slots_;
+        alignas(64) slot_stack full_;
+        alignas(64) slot_stack empty_;
+        std::atomic<size_t> size_;
+    };
+
+    buffer_pool(size_t buffer_size, size_t initial_pool_size, const pool_limits& limits);
+
+    // Return a buffer to the pool
+    void return_buffer(buffer* b);
+
+    // Allocate and free buffers
+    buffer* allocate_buffer(size_t size_class);
+    void free_buffer(buffer* b);
+
+    // Move idle buffers of one size class to the depot, freeing them past the ceiling
+    void release(size_t size_class, buffer* const* buffers, size_t count);
+
+    // Take a batch of idle buffers of one size class from the depot
+    size_t acquire(size_t size_class, buffer** buffers);
 
-    // Allocate a new buffer
-    uint8_t* allocate_buffer();
+    // Track the caches of the threads using the pool, so trim() can reach them
+    void add_cache(thread_magazine* mag);
+    void remove_cache(thread_magazine* mag);
 
     size_t buffer_size_;
-    mutable std::mutex mutex_;
-    std::queue<uint8_t*> available_buffers_;
+    size_t default_class_;
+    pool_limits limits_;
+    uint64_t id_;
+    std::unique_ptr<depot> available_buffers_[SIZE_CLASS_COUNT];
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> steals_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<size_t> allocated_;
+    std::atomic<size_t> high_water_;
+    std::atomic<size_t> allocated_bytes_;
+    std::atomic<size_t> idle_bytes_;
+
+    // Per-thread caches of this pool, guarded by caches_mutex_
+    std::mutex caches_mutex_;
+    std::vector<thread_magazine*> caches_;
 };
 
-} // namespace scene_talk
\ No newline at end of file
+} // namespace scene_talk
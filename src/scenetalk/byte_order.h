@@ -0,0 +1,24 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+namespace scene_talk {
+
+/**
+ * @brief Read a little endian value from unaligned bytes
+ */
+template<typename T>
+T read_le(const uint8_t* data) {
+    std::array<uint8_t, sizeof(T)> raw;
+    std::memcpy(raw.data(), data, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        std::reverse(raw.begin(), raw.end());
+    }
+    return std::bit_cast<T>(raw);
+}
+
+} // namespace scene_talk
@@ -0,0 +1,192 @@
+#include "cbor_reader.h"
+#include <limits>
+
+namespace scene_talk {
+
+namespace {
+
+// Nesting limit for skipped items, guards the stack against hostile input
+constexpr int MAX_SKIP_DEPTH = 64;
+
+constexpr uint8_t INDEFINITE = 31;
+constexpr uint8_t BREAK = 0xFF;
+
+constexpr uint64_t SIMPLE_FALSE = 20;
+constexpr uint64_t SIMPLE_TRUE = 21;
+
+} // namespace
+
+uint8_t cbor_reader::peek_major() const {
+    if (at_end()) {
+        throw cbor_truncated();
+    }
+    return data_[pos_] >> 5;
+}
+
+uint64_t cbor_reader::read_head(uint8_t& major, bool& indefinite) {
+    if (at_end()) {
+        throw cbor_truncated();
+    }
+
+    uint8_t initial = data_[pos_++];
+    major = initial >> 5;
+    uint8_t info = initial & 0x1F;
+    indefinite = false;
+
+    if (info < 24) {
+        return info;
+    }
+    if (info == INDEFINITE) {
+        indefinite = true;
+        return 0;
+    }
+    if (info > 27) {
+        throw cbor_error("invalid additional information");
+    }
+
+    // 24..27 are followed by a 1, 2, 4 or 8 byte big endian argument
+    auto bytes = take(size_t(1) << (info - 24));
+    uint64_t value = 0;
+    for (uint8_t byte : bytes) {
+        value = (value << 8) | byte;
+    }
+    return value;
+}
+
+uint64_t cbor_reader::read_definite(uint8_t expected_major) {
+    uint8_t major;
+    bool indefinite;
+    uint64_t value = read_head(major, indefinite);
+    if (major != expected_major) {
+        throw cbor_error("unexpected item type");
+    }
+    if (indefinite) {
+        throw cbor_error("unexpected indefinite length item");
+    }
+    return value;
+}
+
+std::span<const uint8_t> cbor_reader::take(uint64_t size) {
+    if (size > data_.size() - pos_) {
+        throw cbor_truncated();
+    }
+    auto result = data_.subspan(pos_, size);
+    pos_ += size;
+    return result;
+}
+
+uint64_t cbor_reader::read_uint() {
+    return read_definite(CBOR_UINT);
+}
+
+bool cbor_reader::read_bool() {
+    uint8_t major;
+    bool indefinite;
+    uint64_t value = read_head(major, indefinite);
+    if (major != CBOR_SIMPLE || (value != SIMPLE_FALSE && value != SIMPLE_TRUE)) {
+        throw cbor_error("unexpected item type");
+    }
+    return value == SIMPLE_TRUE;
+}
+
+int64_t cbor_reader::read_int() {
+    uint8_t major = peek_major();
+    if (major == CBOR_UINT) {
+        uint64_t value = read_uint();
+        if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+            throw cbor_error("integer out of range");
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    uint64_t value = read_definite(CBOR_NEGATIVE);
+    if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        throw cbor_error("integer out of range");
+    }
+    return -1 - static_cast<int64_t>(value);
+}
+
+std::string_view cbor_reader::read_text() {
+    auto bytes = take(read_definite(CBOR_TEXT));
+    return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+std::span<const uint8_t> cbor_reader::read_bytes() {
+    return take(read_definite(CBOR_BYTES));
+}
+
+uint64_t cbor_reader::read_bytes_size() {
+    return read_definite(CBOR_BYTES);
+}
+
+uint64_t cbor_reader::read_tag() {
+    return read_definite(CBOR_TAG);
+}
+
+size_t cbor_reader::read_map() {
+    return read_definite(CBOR_MAP);
+}
+
+size_t cbor_reader::read_array() {
+    return read_definite(CBOR_ARRAY);
+}
+
+std::span<const uint8_t> cbor_reader::skip() {
+    size_t start = pos_;
+    skip_item(0);
+    return data_.subspan(start, pos_ - start);
+}
+
+void cbor_reader::skip_item(int depth) {
+    if (depth > MAX_SKIP_DEPTH) {
+        throw cbor_error("nesting too deep");
+    }
+
+    uint8_t major;
+    bool indefinite;
+    uint64_t value = read_head(major, indefinite);
+
+    // Indefinite length items run until a break byte
+    if (indefinite) {
+        if (major == CBOR_UINT || major == CBOR_NEGATIVE || major == CBOR_TAG) {
+            throw cbor_error("invalid indefinite length item");
+        }
+        if (major == CBOR_SIMPLE) {
+            throw cbor_error("unexpected break");
+        }
+        while (!at_end() && data_[pos_] != BREAK) {
+            skip_item(depth + 1);
+            if (major == CBOR_MAP) {
+                skip_item(depth + 1);
+            }
+        }
+        take(1);
+        return;
+    }
+
+    switch (major) {
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            take(value);
+            break;
+        case CBOR_ARRAY:
+            for (uint64_t i = 0; i < value; i++) {
+                skip_item(depth + 1);
+            }
+            break;
+        case CBOR_MAP:
+            for (uint64_t i = 0; i < value; i++) {
+                skip_item(depth + 1);
+                skip_item(depth + 1);
+            }
+            break;
+        case CBOR_TAG:
+            skip_item(depth + 1);
+            break;
+        default:
+            // Integers, simple values and floats have no content past the head
+            break;
+    }
+}
+
+} // namespace scene_talk
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace scene_talk {
+
+/**
+ * @brief Error raised by cbor_reader on malformed or unexpected input
+ */
+class cbor_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Raised when the input ends inside an item, more data may complete it
+ */
+class cbor_truncated : public cbor_error {
+public:
+    cbor_truncated() : cbor_error("unexpected end of input") {}
+};
+
+// CBOR major types
+constexpr uint8_t CBOR_UINT = 0;
+constexpr uint8_t CBOR_NEGATIVE = 1;
+constexpr uint8_t CBOR_BYTES = 2;
+constexpr uint8_t CBOR_TEXT = 3;
+constexpr uint8_t CBOR_ARRAY = 4;
+constexpr uint8_t CBOR_MAP = 5;
+constexpr uint8_t CBOR_TAG = 6;
+constexpr uint8_t CBOR_SIMPLE = 7;
+
+/**
+ * @brief Pull parser over a CBOR buffer
+ *
+ * Strings and byte strings are returned as views into the buffer, nothing is
+ * allocated. Reading an item of the wrong type throws cbor_error.
+ */
+class cbor_reader {
+public:
+    explicit cbor_reader(std::span<const uint8_t> data) : data_(data), pos_(0) {}
+
+    [[nodiscard]] bool at_end() const { return pos_ >= data_.size(); }
+
+    // Offset of the next item in the buffer
+    [[nodiscard]] size_t position() const { return pos_; }
+
+    // Major type of the next item
+    [[nodiscard]] uint8_t peek_major() const;
+
+    uint64_t read_uint();
+    int64_t read_int();
+    std::string_view read_text();
+    std::span<const uint8_t> read_bytes();
+    bool read_bool();
+
+    // Read only the head of a byte string, returns its size. The content follows at position().
+    uint64_t read_bytes_size();
+    uint64_t read_tag();
+
+    // Number of entries, definite length maps and arrays only
+    size_t read_map();
+    size_t read_array();
+
+    // Skip the next item, returns its encoded bytes
+    std::span<const uint8_t> skip();
+
+private:
+    // Read an item head, returns its argument. Indefinite lengths set indefinite.
+    uint64_t read_head(uint8_t& major, bool& indefinite);
+
+    // Read a head of the expected major type with a definite argument
+    uint64_t read_definite(uint8_t expected_major);
+
+    std::span<const uint8_t> take(uint64_t size);
+
+    void skip_item(int depth);
+
+    std::span<const uint8_t> data_;
+    size_t pos_;
+};
+
+} // namespace scene_talk
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace scene_talk {
+
+/**
+ * @brief Minimal CBOR encoder appending to a byte vector
+ *
+ * Writes the few item kinds the encoder sends without building a json value
+ * first. The caller keeps the vector so its capacity is reused between frames,
+ * after which writing does not allocate.
+ */
+class cbor_writer {
+public:
+    explicit cbor_writer(std::vector<uint8_t>& out) : out_(out) {}
+
+    void map(size_t size) { head(5, size); }
+    void array(size_t size) { head(4, size); }
+    void tag(uint64_t tag) { head(6, tag); }
+
+    void uint(uint64_t value) { head(0, value); }
+
+    void integer(int64_t value) {
+        if (value < 0) {
+            head(1, static_cast<uint64_t>(-(value + 1)));
+        } else {
+            head(0, static_cast<uint64_t>(value));
+        }
+    }
+
+    void boolean(bool value) { out_.push_back(value ? 0xf5 : 0xf4); }
+
+    void float32(float value) {
+        out_.push_back(0xfa);
+        append_be(std::bit_cast<uint32_t>(value), 4);
+    }
+
+    void float64(double value) {
+        out_.push_back(0xfb);
+        append_be(std::bit_cast<uint64_t>(value), 8);
+    }
+
+    void text(std::string_view value) {
+        head(3, value.size());
+        out_.insert(out_.end(), value.begin(), value.end());
+    }
+
+    // Byte string, data is copied as is
+    void bytes(std::span<const uint8_t> value) {
+        head(2, value.size());
+        out_.insert(out_.end(), value.begin(), value.end());
+    }
+
+    /**
+     * @brief Typed array (RFC 8746) of little endian values
+     */
+    template<typename T>
+    void typed_array(uint64_t array_tag, std::span<const T> values) {
+        tag(array_tag);
+        head(2, values.size_bytes());
+
+        size_t offset = out_.size();
+        out_.resize(offset + values.size_bytes());
+        if constexpr (std::endian::native == std::endian::little) {
+            if (!values.empty()) {
+                std::memcpy(out_.data() + offset, values.data(), values.size_bytes());
+            }
+        } else {
+            for (const T& value : values) {
+                auto raw = std::bit_cast<std::array<uint8_t, sizeof(T)>>(value);
+                std::copy(raw.rbegin(), raw.rend(), out_.begin() + offset);
+                offset += sizeof(T);
+            }
+        }
+    }
+
+private:
+    // Major type and argument, using the shortest encoding
+    void head(uint8_t major, uint64_t value) {
+        uint8_t type = static_cast<uint8_t>(major << 5);
+        if (value < 24) {
+            out_.push_back(type | static_cast<uint8_t>(value));
+        } else if (value <= UINT8_MAX) {
+            out_.push_back(type | 24);
+            out_.push_back(static_cast<uint8_t>(value));
+        } else if (value <= UINT16_MAX) {
+            out_.push_back(type | 25);
+            append_be(value, 2);
+        } else if (value <= UINT32_MAX) {
+            out_.push_back(type | 26);
+            append_be(value, 4);
+        } else {
+            out_.push_back(type | 27);
+            append_be(value, 8);
+        }
+    }
+
+    void append_be(uint64_t value, int size) {
+        for (int i = size - 1; i >= 0; i--) {
+            out_.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    std::vector<uint8_t>& out_;
+};
+
+} // namespace scene_talk
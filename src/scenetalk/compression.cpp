@@ -0,0 +1,189 @@
+#include "compression.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace scene_talk {
+
+namespace {
+
+// Block format limits, see the LZ4 block format description
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;     // The block always ends with this many literals
+constexpr size_t MATCH_FIND_LIMIT = 12; // The last match starts at least this far from the end
+constexpr size_t MAX_OFFSET = 65535;
+
+// Hash table of recent positions, small enough to live on the stack
+constexpr int HASH_LOG = 12;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hash_sequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Write the extra bytes of a length whose token nibble is 15
+uint8_t* write_length(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+// Read the extra bytes of a length whose token nibble is 15
+bool read_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in == end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+uint8_t* write_literals(uint8_t* out, uint8_t* token, const uint8_t* literals, size_t count) {
+    *token = static_cast<uint8_t>(std::min<size_t>(count, 15) << 4);
+    if (count >= 15) {
+        out = write_length(out, count - 15);
+    }
+    if (count > 0) {
+        std::memcpy(out, literals, count);
+    }
+    return out + count;
+}
+
+uint8_t* write_sequence(uint8_t* out, const uint8_t* literals, size_t literal_count,
+                        size_t offset, size_t match_length) {
+    uint8_t* token = out++;
+    out = write_literals(out, token, literals, literal_count);
+
+    *out++ = static_cast<uint8_t>(offset & 0xFF);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+
+    size_t extra_length = match_length - MIN_MATCH;
+    *token |= static_cast<uint8_t>(std::min<size_t>(extra_length, 15));
+    if (extra_length >= 15) {
+        out = write_length(out, extra_length - 15);
+    }
+    return out;
+}
+
+} // namespace
+
+size_t block_compress(const uint8_t* src, size_t size, uint8_t* dst) {
+    const uint8_t* end = src + size;
+    const uint8_t* anchor = src;
+    uint8_t* out = dst;
+
+    if (size > MATCH_FIND_LIMIT) {
+        std::array<uint32_t, 1 << HASH_LOG> table{};
+        const uint8_t* match_start_limit = end - MATCH_FIND_LIMIT;
+        const uint8_t* match_end_limit = end - LAST_LITERALS;
+        const uint8_t* ip = src;
+
+        while (ip < match_start_limit) {
+            uint32_t h = hash_sequence(read32(ip));
+            const uint8_t* ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+
+            if (ref >= ip || static_cast<size_t>(ip - ref) > MAX_OFFSET || read32(ref) != read32(ip)) {
+                // Step faster through data that does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // Extend the match backwards into pending literals and then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t match_length = MIN_MATCH;
+            while (ip + match_length < match_end_limit && ip[match_length] == ref[match_length]) {
+                match_length++;
+            }
+
+            out = write_sequence(out, anchor, ip - anchor, ip - ref, match_length);
+            ip += match_length;
+            anchor = ip;
+
+            if (ip < match_start_limit) {
+                table[hash_sequence(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+            }
+        }
+    }
+
+    // The block ends with the remaining literals
+    uint8_t* token = out++;
+    out = write_literals(out, token, anchor, end - anchor);
+    return out - dst;
+}
+
+bool block_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* in = src;
+    const uint8_t* in_end = src + size;
+    uint8_t* out = dst;
+    uint8_t* out_end = dst + dst_size;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        // Literals
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !read_length(in, in_end, literal_count)) {
+            return false;
+        }
+        if (literal_count > static_cast<size_t>(in_end - in) ||
+            literal_count > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        if (literal_count > 0) {
+            std::memcpy(out, in, literal_count);
+        }
+        in += literal_count;
+        out += literal_count;
+
+        // The last sequence has no match
+        if (in == in_end) {
+            break;
+        }
+
+        // Match
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = static_cast<size_t>(in[0]) | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > static_cast<size_t>(out - dst)) {
+            return false;
+        }
+
+        size_t match_length = token & 0x0F;
+        if (match_length == 15 && !read_length(in, in_end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (match_length > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+
+        // Copy in runs of at most offset bytes so overlapping matches repeat
+        while (match_length > 0) {
+            size_t run = std::min(offset, match_length);
+            std::memcpy(out, out - offset, run);
+            out += run;
+            match_length -= run;
+        }
+    }
+
+    return out == out_end;
+}
+
+} // namespace scene_talk
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace scene_talk {
+
+// A compressed payload is the uncompressed size (u32 LE) followed by one block
+constexpr size_t COMPRESSED_HEADER_SIZE = 4;
+
+/**
+ * @brief Largest compressed size of size bytes of input
+ */
+constexpr size_t compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+/**
+ * @brief Compress a block in the LZ4 block format
+ *
+ * A greedy single pass compressor tuned for speed over ratio, the output can
+ * be read by any LZ4 block decoder.
+ *
+ * @param src Data to compress
+ * @param size Size of the data
+ * @param dst Output with room for compress_bound(size) bytes
+ * @return Size of the compressed block
+ */
+size_t block_compress(const uint8_t* src, size_t size, uint8_t* dst);
+
+/**
+ * @brief Decompress an LZ4 format block
+ *
+ * @param src Compressed block
+ * @param size Size of the compressed block
+ * @param dst Output buffer
+ * @param dst_size Exact size of the decompressed data
+ * @return False if the block is malformed or does not decompress to dst_size bytes
+ */
+bool block_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
+
+} // namespace scene_talk
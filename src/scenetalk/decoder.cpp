@@ -1,96 +1,402 @@
 #include "decoder.h"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <iterator>
 #include <utility>
 
 #include "encoder.h"
+#include "cbor_reader.h"
 
 namespace scene_talk {
 
-decoder::decoder(message_handler handler, const std::shared_ptr<buffer_pool> &pool)
-    : handler_(std::move(handler)),
+namespace {
+
+// Most reserved for a stream before its fragments arrive, a few standard frames
+constexpr size_t MAX_INITIAL_STREAM_RESERVE = 256 * 1024;
+
+} // namespace
+
+decoder::decoder(message_handler handler, const std::shared_ptr<buffer_pool> &pool,
+                 const decoder_limits& limits)
+    : json_visitor_(std::make_unique<json_visitor>(std::move(handler))),
+      visitor_(json_visitor_.get()),
       pool_(pool),
-      net_buffer_(pool, [this](const frame& f) { process_frame(f); }) {
+      limits_(limits),
+      net_buffer_(pool, [this](const frame_view& f) { process_frame(f); }) {
+    visitor_->set_string_table(&strings_);
+    net_buffer_.set_drop_handler([this](uint8_t type, size_t size) { frame_dropped(type, size); });
 }
 
-void decoder::process_frame(const frame& f) {
-    // Process the frame based on its type
-    if (f.type == PARTIAL) {
-        // This is a partial frame header
-        process_partial_frame(f.payload.data(), f.payload.size());
-    } else {
-        // This is a regular frame
-        process_content_frame(f.type, f.flags, f.payload.data(), f.payload.size());
+decoder::decoder(message_visitor& visitor, const std::shared_ptr<buffer_pool> &pool,
+                 const decoder_limits& limits)
+    : visitor_(&visitor),
+      pool_(pool),
+      limits_(limits),
+      net_buffer_(pool, [this](const frame_view& f) { process_frame(f); }) {
+    visitor_->set_string_table(&strings_);
+    net_buffer_.set_drop_handler([this](uint8_t type, size_t size) { frame_dropped(type, size); });
+}
+
+void decoder::set_dequantize(bool dequantize) {
+    if (json_visitor_) {
+        json_visitor_->set_dequantize(dequantize);
     }
 }
 
+void decoder::set_peer_caps(uint32_t peer_caps, size_t max_extended_size) {
+    net_buffer_.set_peer_caps(peer_caps, max_extended_size);
+    string_table_caps_ = (SUPPORTED_CAPS & peer_caps & CAP_STRING_TABLE) != 0;
+}
+
+void decoder::process_frame(const frame_view& f) {
+    if (!failed_) {
+        // Streams time out whatever frames keep arriving
+        if (!streams_.empty()) {
+            evict_stale_streams(clock::now());
+        }
+
+        // Process the frame based on its type
+        if (f.type == PARTIAL) {
+            // This is a partial frame header
+            process_partial_frame(f.payload.data(), f.payload.size());
+        } else {
+            // This is a regular frame
+            process_content_frame(f.type, f.flags, f.payload.data(), f.payload.size());
+        }
+    }
+
+    // Credit is returned once the handler is done with the frame, even one
+    // that was not decoded, or the peer's window shrinks for good
+    if (flow_ && flow_controlled(f.type)) {
+        flow_->consumed(flow_size(f));
+    }
+}
+
+void decoder::enable_flow_control(size_t window, receive_window::grant_handler grant) {
+    flow_.emplace(window, std::move(grant));
+    flow_->open();
+}
+
 void decoder::process_partial_frame(const uint8_t* data, size_t size) {
     try {
         // Parse the partial frame header
-        nlohmann::json header = nlohmann::json::from_cbor(std::vector<uint8_t>(data, data + size));
+        nlohmann::json header = nlohmann::json::from_cbor(data, data + size);
+        if (!track_fragment(header["id"], header["seq"], header.value("size", size_t(0)))) {
+            drop_frame();
+        }
+    } catch (const std::exception&) {
+        // Error parsing partial frame header, ignore it
+        drop_frame();
+    }
+}
 
-        // Update stream state with current ID
-        uint32_t seq = header["seq"];
-        stream_id_ = header["id"];
+bool decoder::track_fragment(uint32_t id, uint32_t seq, size_t expected_size) {
+    // Update stream state with current ID
+    stream_id_ = id;
 
-        // Find or create the stream
-        auto [stream_it, inserted] = streams_.emplace(
-            stream_id_, stream_state(std::vector<uint8_t>(), 1));
-        if (inserted) {
-            stream_it = streams_.find(stream_id_); // Reacquire iterator to ensure validity
+    auto now = clock::now();
+
+    // Find or create the stream
+    auto stream_it = streams_.find(stream_id_);
+    stream_state* stream = stream_it != streams_.end()
+        ? &stream_it->second
+        : open_stream(stream_id_, expected_size);
+    if (!stream) {
+        return false;
+    }
+    stream->last_active = now;
+
+    // Validate sequence number
+    if (seq == 0) {
+        stream->expected_seq = 0;
+    } else if (seq != stream->expected_seq) {
+        // Sequence error, discard the stream
+        std::cerr << "stream error " << seq << " != " << stream->expected_seq << std::endl;
+        close_stream(streams_.find(stream_id_));
+        return false;
+    } else {
+        // Update expected sequence for next frame
+        stream->expected_seq = seq + 1;
+    }
+    return true;
+}
+
+decoder::stream_state* decoder::open_stream(uint32_t id, size_t expected_size) {
+    if (streams_.size() >= limits_.max_streams) {
+        std::cerr << "stream " << id << " rejected, too many open streams" << std::endl;
+        return nullptr;
+    }
+    if (expected_size > limits_.max_reassembly_bytes - reassembly_bytes_) {
+        std::cerr << "stream " << id << " rejected, " << expected_size << " bytes over limit" << std::endl;
+        return nullptr;
+    }
+
+    stream_state state;
+    state.expected_size = expected_size;
+
+    // Reserve small payloads whole when the sender announced their size,
+    // larger ones grow as their fragments arrive so an announcement alone
+    // does not take memory. Visitors may get typed arrays streamed instead,
+    // which needs no buffer.
+    if (expected_size > 0 && json_visitor_) {
+        state.data = pool_->get_buffer(std::min(expected_size, MAX_INITIAL_STREAM_RESERVE));
+        if (!state.data) {
+            return nullptr;
         }
+        reassembly_bytes_ += state.data->capacity();
+    }
 
-        // Validate sequence number
-        auto& stream = stream_it->second;
-        if (seq == 0) {
-            stream.expected_seq = 0;
-        } else if (seq != stream.expected_seq) {
-            // Sequence error, discard the stream
-            streams_.erase(stream_it);
-            std::cerr << "stream error " << seq << " != " << stream.expected_seq;
-            return;
-        } else {
-            // Update expected sequence for next frame
-            stream.expected_seq = seq + 1;
+    return &streams_.emplace(id, std::move(state)).first->second;
+}
+
+bool decoder::append_fragment(stream_state& stream, const uint8_t* data, size_t size) {
+    size_t needed = stream.size + size;
+    if (stream.expected_size > 0 && needed > stream.expected_size) {
+        std::cerr << "stream " << stream_id_ << " exceeds its announced size" << std::endl;
+        return false;
+    }
+
+    // Grow geometrically, up to the announced size
+    size_t capacity = stream.data ? stream.data->capacity() : 0;
+    if (needed > capacity) {
+        size_t new_capacity = std::max(needed, capacity * 2);
+        if (stream.expected_size > 0) {
+            new_capacity = std::min(new_capacity, stream.expected_size);
+        }
+        if (new_capacity - capacity > limits_.max_reassembly_bytes - reassembly_bytes_) {
+            new_capacity = needed;
+        }
+        if (new_capacity - capacity > limits_.max_reassembly_bytes - reassembly_bytes_) {
+            std::cerr << "stream " << stream_id_ << " exceeds the reassembly limit" << std::endl;
+            return false;
+        }
+
+        buffer_ptr grown = pool_->get_buffer(new_capacity);
+        if (!grown) {
+            return false;
+        }
+        if (stream.size > 0) {
+            std::copy(stream.data->data(), stream.data->data() + stream.size, grown->data());
+        }
+        reassembly_bytes_ += grown->capacity() - capacity;
+        stream.data = std::move(grown);
+    }
+
+    std::copy(data, data + size, stream.data->data() + stream.size);
+    stream.size = needed;
+    stream.last_active = clock::now();
+    return true;
+}
+
+bool decoder::stream_fragment(stream_state& stream, const uint8_t* data, size_t size) {
+    if (stream.mode == stream_mode::streaming) {
+        stream.last_active = clock::now();
+        return emit_array_chunk(stream, std::span<const uint8_t>(data, size));
+    }
+
+    // Parse the first fragment in place, later ones once appended to the prefix
+    typed_array_prefix prefix;
+    std::span<const uint8_t> head(data, size);
+    prefix_status status = prefix_status::incomplete;
+    if (stream.size == 0) {
+        status = parse_typed_array_prefix(head, prefix, &strings_);
+    }
+    if (status != prefix_status::typed_array) {
+        if (!append_fragment(stream, data, size)) {
+            return false;
+        }
+        if (status == prefix_status::incomplete) {
+            head = std::span<const uint8_t>(stream.data->data(), stream.size);
+            status = parse_typed_array_prefix(head, prefix, &strings_);
+        }
+    }
+
+    if (status == prefix_status::incomplete && stream.size <= MAX_STREAM_PREFIX) {
+        return true;
+    }
+    if (status != prefix_status::typed_array) {
+        // Decode the whole payload once it is complete
+        stream.mode = stream_mode::buffering;
+        return true;
+    }
+
+    // The array length is read from the wire, it has to fit in what is left
+    // of the announced payload before visitors size anything by it
+    size_t announced = stream.expected_size > 0 ? stream.expected_size : limits_.max_reassembly_bytes;
+    if (prefix.data_offset > announced || prefix.data_size > announced - prefix.data_offset ||
+        prefix.data_size > limits_.max_reassembly_bytes) {
+        std::cerr << "stream " << stream_id_ << " announces a " << prefix.data_size
+                  << " byte typed array over its limit" << std::endl;
+        return false;
+    }
+
+    stream.mode = stream_mode::streaming;
+    stream.attr_name = prefix.name;
+    stream.attr_type = prefix.attr_type;
+
+    // The prefix is not decoded again, add the strings it defines
+    for (size_t i = 0; i < prefix.defined_count; i++) {
+        strings_.insert(prefix.defined[i]);
+    }
+    stream.array_tag = prefix.tag;
+    stream.array_size = prefix.data_size;
+    stream.last_active = clock::now();
+
+    // The chunk may point into the stream buffer, release it afterwards
+    bool ok = emit_array_chunk(stream, head.subspan(prefix.data_offset));
+    release_buffer(stream);
+    return ok;
+}
+
+bool decoder::emit_array_chunk(stream_state& stream, std::span<const uint8_t> chunk) {
+    if (chunk.size() > stream.array_size - stream.array_offset) {
+        std::cerr << "stream " << stream_id_ << " overruns its typed array" << std::endl;
+        return false;
+    }
+    // Empty arrays still get one call so they are delivered
+    if (chunk.empty() && stream.array_size > 0) {
+        return true;
+    }
+
+    visitor_->on_attr_typed_array_chunk(stream_id_, stream.attr_name, stream.attr_type, stream.array_tag,
+                                        stream.array_offset, chunk, stream.array_size);
+    stream.array_offset += chunk.size();
+    return true;
+}
+
+void decoder::release_buffer(stream_state& stream) {
+    if (stream.data) {
+        reassembly_bytes_ -= stream.data->capacity();
+        stream.data.reset();
+    }
+    stream.size = 0;
+}
+
+void decoder::close_stream(stream_map::iterator it) {
+    const stream_state& stream = it->second;
+    if (stream.mode == stream_mode::streaming && stream.array_offset != stream.array_size) {
+        visitor_->on_typed_array_dropped(it->first);
+    }
+    release_buffer(it->second);
+    streams_.erase(it);
+}
+
+void decoder::evict_stale_streams(clock::time_point now) {
+    bool dropped = false;
+    for (auto it = streams_.begin(); it != streams_.end();) {
+        auto next = std::next(it);
+        if (now - it->second.last_active > limits_.stream_timeout) {
+            std::cerr << "stream " << it->first << " timed out" << std::endl;
+            close_stream(it);
+            dropped = true;
+        }
+        it = next;
+    }
+    if (dropped) {
+        drop_frame();
+    }
+}
+
+void decoder::frame_dropped(uint8_t type, size_t size) {
+    // The peer spent credit on the frame all the same
+    if (flow_ && flow_controlled(type)) {
+        flow_->consumed(size);
+    }
+    drop_frame();
+}
+
+void decoder::drop_frame() {
+    // Strings the frame defined are missing here, later references would
+    // resolve to the wrong entries
+    if (!failed_ && (string_table_caps_ || strings_.entries() > 0)) {
+        std::cerr << "string table out of step with the peer, connection failed" << std::endl;
+        failed_ = true;
+        for (auto it = streams_.begin(); it != streams_.end();) {
+            auto next = std::next(it);
+            close_stream(it);
+            it = next;
         }
-    } catch (const std::exception&) {
-        // Error parsing partial frame header, ignore it
     }
 }
 
 void decoder::process_content_frame(uint8_t type, uint8_t flags, const uint8_t* data, size_t size) {
     try {
+        // Fragments that name their stream replace the PARTIAL frame
+        if (flags & FLAG_STREAM) {
+            stream_prefix prefix;
+            size_t prefix_size = unpack_stream_prefix(std::span<const uint8_t>(data, size), prefix);
+            if (prefix_size == 0) {
+                std::cerr << "truncated stream prefix" << std::endl;
+                drop_frame();
+                return;
+            }
+            if (!track_fragment(prefix.id, prefix.seq, static_cast<size_t>(prefix.total_size))) {
+                drop_frame();
+                return;
+            }
+            data += prefix_size;
+            size -= prefix_size;
+        }
+
         // Check if this is part of a partial frame sequence
-        if (flags != 0) {
+        if (flags & FLAG_PARTIAL) {
             // If stream doesn't exist, ignore the frame
             const auto it = streams_.find(stream_id_);
             if (it == streams_.end()) {
+                drop_frame();
                 return;
             }
 
-            // Append payload to stream data
+            // Typed array attributes are handed to visitors as they arrive,
+            // everything else is appended to the stream data
             stream_state& stream = it->second;
-            size_t current_size = stream.data.size();
-            stream.data.resize(current_size + size);
-            std::copy(data, data + size, stream.data.begin() + current_size);
+            if (stream.mode == stream_mode::detecting && (json_visitor_ || type != ATTRIBUTE)) {
+                stream.mode = stream_mode::buffering;
+            }
+            bool ok = stream.mode == stream_mode::buffering
+                ? append_fragment(stream, data, size)
+                : stream_fragment(stream, data, size);
+            if (!ok) {
+                close_stream(it);
+                drop_frame();
+                return;
+            }
 
-            // If this is the final fragment (seq=0), process the complete payload
-            if (stream.expected_seq == 0) {
-                nlohmann::json payload = nlohmann::json::from_cbor(stream.data);
-                handler_(type, payload);
+            if (stream.expected_seq == 0 && stream.mode == stream_mode::streaming) {
+                if (stream.array_offset != stream.array_size) {
+                    std::cerr << "stream " << stream_id_ << " ended inside its typed array" << std::endl;
+                }
+                close_stream(it);
+            } else if (stream.expected_seq == 0) {
+                // This is the final fragment (seq=0), take the data and remove
+                // the stream before parsing so a bad payload does not leave it open
+                buffer_ptr stream_data = std::move(stream.data);
+                size_t stream_size = stream.size;
+                if (stream_data) {
+                    reassembly_bytes_ -= stream_data->capacity();
+                }
+                close_stream(it);
 
-                // Remove the stream
-                streams_.erase(it);
+                const uint8_t* stream_bytes = stream_data ? stream_data->data() : data;
+                visitor_->on_message(type, std::span<const uint8_t>(stream_bytes, stream_size));
             }
         } else {
-            // This is a self-contained frame, decode it directly
-            nlohmann::json payload = nlohmann::json::from_cbor(std::vector<uint8_t>(data, data + size));
-            handler_(type, payload);
+            // This is a self-contained frame, possibly extended, decode it
+            // directly from the frame buffer
+            visitor_->on_message(type, std::span<const uint8_t>(data, size));
         }
     } catch (const json::parse_error &ex) {
         // Error parsing CBOR, ignore the frame
         std::cerr << "parse error at byte " << ex.byte << std::endl;
+        drop_frame();
+    } catch (const cbor_error &ex) {
+        std::cerr << "parse error: " << ex.what() << std::endl;
+        drop_frame();
     }
+
+    // Both sides trim the string table after each message
+    strings_.evict();
 }
 
 } // namespace scene_talk
\ No newline at end of file
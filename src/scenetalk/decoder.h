@@ -1,19 +1,34 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <functional>
 #include <nlohmann/json.hpp>
+#include "flow_control.h"
 #include "frame.h"
 #include "net_buffer.h"
+#include "message_visitor.h"
+#include "string_table.h"
 
 namespace scene_talk {
 
 /**
- * @brief Callback for handling decoded messages
+ * @brief Per-connection limits on PARTIAL stream reassembly
  */
-using message_handler = std::function<void(uint8_t type, const nlohmann::json& payload)>;
+struct decoder_limits {
+    // Bytes held by all streams being reassembled
+    size_t max_reassembly_bytes = 256 * 1024 * 1024;
+
+    // Streams being reassembled at once
+    size_t max_streams = 16;
+
+    // Streams without a fragment for this long are dropped
+    std::chrono::milliseconds stream_timeout{30000};
+};
 
 /**
  * @brief Decodes CBOR-encoded protocol frames
@@ -21,42 +36,180 @@ using message_handler = std::function<void(uint8_t type, const nlohmann::json& p
 class decoder {
 public:
     /**
-     * @brief Create a decoder
+     * @brief Create a decoder delivering json documents
      *
      * @param handler Callback for handling decoded messages
      * @param pool Buffer pool for allocations
+     * @param limits Limits on partial stream reassembly
+     */
+    decoder(message_handler handler, const std::shared_ptr<buffer_pool> &pool,
+            const decoder_limits& limits = {});
+
+    /**
+     * @brief Create a decoder calling a visitor without building json documents
+     *
+     * @param visitor Receives decoded messages, must outlive the decoder
+     * @param pool Buffer pool for allocations
+     * @param limits Limits on partial stream reassembly
      */
-    decoder(message_handler handler, const std::shared_ptr<buffer_pool> &pool);
+    decoder(message_visitor& visitor, const std::shared_ptr<buffer_pool> &pool,
+            const decoder_limits& limits = {});
+
+    decoder(const decoder&) = delete;
+    decoder& operator=(const decoder&) = delete;
 
     /**
      * @brief Process a frame
      *
-     * @param frame The frame to process
+     * @param frame The frame to process, the payload is only read during the call
+     */
+    void process_frame(const frame_view& frame);
+
+    /**
+     * @brief Dequantize typed vertex attributes into arrays of numbers
+     *
+     * Off by default, attribute values then keep their typed arrays, see
+     * read_vertex_array(). Only applies to decoders delivering json.
+     */
+    void set_dequantize(bool dequantize);
+
+    /**
+     * @brief Apply the capabilities negotiated with the peer
+     *
+     * Passes them on to the network buffer. Once CAP_STRING_TABLE is
+     * negotiated, or the peer defined a string anyway, a dropped frame fails
+     * the decoder, see failed().
+     */
+    void set_peer_caps(uint32_t peer_caps, size_t max_extended_size = MAX_EXTENDED_PAYLOAD_SIZE);
+
+    /**
+     * @brief Whether a frame was dropped while the peer used the string table
+     *
+     * The strings that frame defined are missing, so later references can
+     * no longer be resolved. Frames are ignored from then on and the
+     * connection should be closed, a new one starts with an empty table.
      */
-    void process_frame(const frame& frame);
+    [[nodiscard]] bool failed() const { return failed_; }
 
     /**
      * @brief Get the network buffer for receiving data
      */
     net_buffer& get_net_buffer() { return net_buffer_; }
 
+    /**
+     * @brief Number of partial streams being reassembled
+     */
+    [[nodiscard]] size_t open_streams() const { return streams_.size(); }
+
+    /**
+     * @brief Bytes of pooled buffers held by partial streams
+     */
+    [[nodiscard]] size_t reassembly_bytes() const { return reassembly_bytes_; }
+
+    /**
+     * @brief Drop partial streams idle past the timeout
+     *
+     * Every frame received does this, call it from a timer to also release
+     * the streams of a connection that went quiet.
+     */
+    void expire_streams() { evict_stale_streams(clock::now()); }
+
+    /**
+     * @brief Grant the peer credit as frames are handled
+     *
+     * Call once CAP_FLOW_CREDIT is negotiated. The whole window is granted
+     * right away, then credit for handled and dropped frames as it adds up.
+     *
+     * @param window Bytes the peer may send ahead of the handler
+     * @param grant Sends a FLOW frame, usually encoder::grant_credit() of this connection
+     */
+    void enable_flow_control(size_t window, receive_window::grant_handler grant);
+
+    /**
+     * @brief Flow control counters, all zero unless it is enabled
+     */
+    [[nodiscard]] receive_flow_stats flow_stats() const {
+        return flow_ ? flow_->stats() : receive_flow_stats{};
+    }
+
 private:
+    using clock = std::chrono::steady_clock;
+
+    // Prefix bytes buffered while looking for a streamable typed array
+    static constexpr size_t MAX_STREAM_PREFIX = 64 * 1024;
+
+    enum class stream_mode {
+        detecting,      // Looking for a typed array at the start of the payload
+        streaming,      // Passing typed array bytes to the visitor as they arrive
+        buffering       // Reassembling the whole payload
+    };
+
     // Stream state for handling partial frames
     struct stream_state {
-        std::vector<uint8_t> data;
-        uint32_t expected_seq;
+        buffer_ptr data;
+        size_t size = 0;
+        size_t expected_size = 0;   // Total size from the PARTIAL header, 0 if not sent
+        uint32_t expected_seq = 1;
+        clock::time_point last_active;
+
+        // Typed array being streamed
+        stream_mode mode = stream_mode::detecting;
+        std::string attr_name;
+        std::string attr_type;
+        uint64_t array_tag = 0;
+        size_t array_size = 0;
+        size_t array_offset = 0;
     };
 
+    using stream_map = std::unordered_map<uint32_t, stream_state>;
+
     // Process a partial frame
     void process_partial_frame(const uint8_t* data, size_t size);
 
+    // Track the next fragment of a stream, false if it is dropped
+    bool track_fragment(uint32_t id, uint32_t seq, size_t expected_size);
+
+    // Start reassembling a stream, nullptr if it would exceed the limits
+    stream_state* open_stream(uint32_t id, size_t expected_size);
+
+    // Append a fragment to a stream, false if it would exceed the limits
+    bool append_fragment(stream_state& stream, const uint8_t* data, size_t size);
+
+    // Pass a fragment of a typed array attribute to the visitor, false on error
+    bool stream_fragment(stream_state& stream, const uint8_t* data, size_t size);
+
+    // Pass typed array bytes to the visitor, false if they overrun the array
+    bool emit_array_chunk(stream_state& stream, std::span<const uint8_t> chunk);
+
+    // Release a stream's buffer
+    void release_buffer(stream_state& stream);
+
+    // Drop a stream and release its buffer
+    void close_stream(stream_map::iterator it);
+
+    // Drop streams that have been idle past the timeout
+    void evict_stale_streams(clock::time_point now);
+
+    // Note a frame that was not decoded, fails the decoder if the string table is in use
+    void drop_frame();
+
+    // Handle a frame the net_buffer dropped before it got here
+    void frame_dropped(uint8_t type, size_t size);
+
     // Process a content frame
     void process_content_frame(uint8_t type, uint8_t flags, const uint8_t* data, size_t size);
 
-    message_handler handler_;
+    std::unique_ptr<json_visitor> json_visitor_;
+    message_visitor* visitor_;
     std::shared_ptr<buffer_pool> pool_;
-    std::unordered_map<uint32_t, stream_state> streams_;
+    decoder_limits limits_;
+    stream_map streams_;
+    string_table strings_;
+    std::optional<receive_window> flow_;
+    size_t reassembly_bytes_ = 0;
     uint32_t stream_id_ = 0;
+    bool string_table_caps_ = false;
+    bool failed_ = false;
 
     // Network buffer for receiving data
     net_buffer net_buffer_;
@@ -0,0 +1,102 @@
+#include "delta_tracker.h"
+#include <algorithm>
+
+namespace scene_talk {
+
+void delta_tracker::begin_update() {
+    update_++;
+    updating_ = true;
+}
+
+void delta_tracker::end_update(std::vector<std::string>& removed_prims, std::vector<std::string>& removed_attrs) {
+    removed_prims.clear();
+    removed_attrs.clear();
+    if (!updating_) {
+        return;
+    }
+    updating_ = false;
+
+    for (auto it = prims_.begin(); it != prims_.end();) {
+        if (it->second.update != update_) {
+            removed_prims.push_back(it->first);
+            it = prims_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    stats_.prims_removed += removed_prims.size();
+
+    // Parents before their children
+    std::sort(removed_prims.begin(), removed_prims.end());
+    remove_stale(root_, removed_attrs);
+}
+
+void delta_tracker::begin_prim(std::string_view name) {
+    // Relative names are children of the enclosing prim
+    path_lengths_.push_back(path_.size());
+    if (name.starts_with('/')) {
+        path_.assign(name);
+    } else {
+        path_ += '/';
+        path_ += name;
+    }
+
+    prim_entry& prim = prims_[path_];
+    prim.update = update_;
+    open_.push_back(&prim);
+}
+
+void delta_tracker::end_prim(std::vector<std::string>& removed_attrs) {
+    removed_attrs.clear();
+    if (open_.empty()) {
+        return;
+    }
+
+    if (updating_) {
+        remove_stale(*open_.back(), removed_attrs);
+    }
+    open_.pop_back();
+    path_.resize(path_lengths_.back());
+    path_lengths_.pop_back();
+}
+
+bool delta_tracker::unchanged(std::string_view name, uint64_t hash) {
+    prim_entry& prim = current();
+    auto it = std::find_if(prim.attrs.begin(), prim.attrs.end(),
+                           [name](const attr_entry& attr) { return attr.name == name; });
+    if (it == prim.attrs.end()) {
+        prim.attrs.push_back({std::string(name), hash, update_});
+        stats_.attrs_sent++;
+        return false;
+    }
+
+    it->update = update_;
+    if (it->hash == hash) {
+        stats_.attrs_unchanged++;
+        return true;
+    }
+    it->hash = hash;
+    stats_.attrs_sent++;
+    return false;
+}
+
+void delta_tracker::reset() {
+    prims_.clear();
+    root_ = {};
+    open_.clear();
+    path_lengths_.clear();
+    path_.clear();
+    updating_ = false;
+}
+
+void delta_tracker::remove_stale(prim_entry& prim, std::vector<std::string>& removed_attrs) {
+    auto stale = std::stable_partition(prim.attrs.begin(), prim.attrs.end(),
+                                       [this](const attr_entry& attr) { return attr.update == update_; });
+    for (auto it = stale; it != prim.attrs.end(); ++it) {
+        removed_attrs.push_back(std::move(it->name));
+    }
+    stats_.attrs_removed += prim.attrs.end() - stale;
+    prim.attrs.erase(stale, prim.attrs.end());
+}
+
+} // namespace scene_talk
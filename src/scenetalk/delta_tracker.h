@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace scene_talk {
+
+/**
+ * @brief Counters of delta updates
+ */
+struct delta_update_stats {
+    uint64_t attrs_sent = 0;
+    uint64_t attrs_unchanged = 0;        // Suppressed as their value did not change
+    uint64_t attrs_removed = 0;
+    uint64_t prims_removed = 0;
+};
+
+/**
+ * @brief What an encoder sent in the previous scene update
+ *
+ * Keeps a hash of the last value of each attribute by prim path and name,
+ * with prim paths built from BEGIN names as the scene_store does. Within an
+ * update, attributes a prim had last time but not this time and prims not
+ * sent at all are reported so removal markers keep the receiver in step.
+ */
+class delta_tracker {
+public:
+    // Start a scene update, everything sent before counts as the previous one
+    void begin_update();
+
+    // Attributes outside of any prim and prims that were not sent again
+    void end_update(std::vector<std::string>& removed_prims, std::vector<std::string>& removed_attrs);
+
+    void begin_prim(std::string_view name);
+
+    // Attributes of the prim being closed that were not sent again in this update
+    void end_prim(std::vector<std::string>& removed_attrs);
+
+    /**
+     * @brief Note an attribute of the current prim
+     *
+     * @param hash Hash of the attribute's type and value
+     * @return True if the same value was sent last time
+     */
+    bool unchanged(std::string_view name, uint64_t hash);
+
+    // Forget everything sent, for a receiver starting over
+    void reset();
+
+    [[nodiscard]] const delta_update_stats& stats() const { return stats_; }
+
+    // Prims with attributes known
+    [[nodiscard]] size_t prim_count() const { return prims_.size(); }
+
+private:
+    struct attr_entry {
+        std::string name;
+        uint64_t hash;
+        uint64_t update;
+    };
+
+    struct prim_entry {
+        std::vector<attr_entry> attrs;
+        uint64_t update = 0;
+    };
+
+    prim_entry& current() { return open_.empty() ? root_ : *open_.back(); }
+
+    // Collect the attributes of a prim that were not sent in this update
+    void remove_stale(prim_entry& prim, std::vector<std::string>& removed_attrs);
+
+    std::unordered_map<std::string, prim_entry> prims_;
+    prim_entry root_;                    // Attributes outside of any prim
+    std::vector<prim_entry*> open_;      // Entries are stable, the map is node based
+    std::vector<size_t> path_lengths_;   // Length of path_ before each open prim
+    std::string path_;
+    uint64_t update_ = 0;
+    bool updating_ = false;
+    delta_update_stats stats_;
+};
+
+} // namespace scene_talk
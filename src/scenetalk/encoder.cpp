@@ -1,137 +1,873 @@
 #include "encoder.h"
 #include "file_ref.h"
+#include "compression.h"
+#include "cbor_writer.h"
+#include "hash.h"
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <stdexcept>
 
 namespace scene_talk {
 
+namespace {
+
+// Name of a core attribute's registered type
+std::string_view core_type_name(const core_attr_info& info) {
+    return value_type_by_id(static_cast<uint8_t>(info.type))->name;
+}
+
+} // namespace
+
+frame_writer make_gather_writer(gather_writer writer) {
+    return [writer = std::move(writer)](const frame_view& f) {
+        auto header = f.header();
+        std::array<byte_span, 2> segments = {byte_span(header), f.payload};
+        writer(segments);
+    };
+}
+
 encoder::encoder(frame_writer writer, size_t max_payload_size)
     : writer_(writer),
       max_payload_size_(max_payload_size),
-      next_stream_id_(1) {
+      next_stream_id_(1),
+      caps_(0),
+      compression_threshold_(DEFAULT_COMPRESSION_THRESHOLD),
+      cork_depth_(0) {
+}
+
+encoder::encoder(gather_writer writer, const batch_limits& limits, size_t max_payload_size)
+    : max_payload_size_(max_payload_size),
+      next_stream_id_(1),
+      caps_(0),
+      compression_threshold_(DEFAULT_COMPRESSION_THRESHOLD),
+      batch_writer_(std::move(writer)),
+      batch_limits_(limits),
+      cork_depth_(0) {
+    batch_.reserve(batch_limits_.max_bytes);
+}
+
+void encoder::uncork() {
+    assert(cork_depth_ > 0);
+    if (--cork_depth_ == 0) {
+        flush();
+    }
+}
+
+void encoder::flush() {
+    if (batch_.empty()) {
+        return;
+    }
+
+    byte_span segment(batch_);
+    batch_writer_(std::span<const byte_span>(&segment, 1));
+    batch_.clear();
+}
+
+byte_span encoder::compress_chunk(byte_span chunk) {
+    compressed_.resize(COMPRESSED_HEADER_SIZE + compress_bound(chunk.size()));
+
+    auto size_bytes = pack_uint32_le(static_cast<uint32_t>(chunk.size()));
+    std::copy(size_bytes.begin(), size_bytes.end(), compressed_.begin());
+    size_t compressed_size = COMPRESSED_HEADER_SIZE +
+        block_compress(chunk.data(), chunk.size(), compressed_.data() + COMPRESSED_HEADER_SIZE);
+
+    if (compressed_size >= chunk.size()) {
+        return {};
+    }
+    return byte_span(compressed_.data(), compressed_size);
+}
+
+void encoder::emit(const frame_view& f) {
+    if (!(caps_ & CAP_FLOW_CREDIT) || !flow_controlled(f.type)) {
+        write_out(f);
+        return;
+    }
+
+    size_t size = flow_size(f);
+    if (flow_mode_ == flow_mode::block) {
+        // Corked frames took credit already, the peer only grants more once it got them
+        if (!take_credit(size)) {
+            flush();
+            wait_for_credit(size);
+        }
+        write_out(f);
+        return;
+    }
+
+    // Frames keep their order, nothing overtakes the backlog
+    send_backlog();
+    if (backlog_.empty() && take_credit(size)) {
+        write_out(f);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(flow_mutex_);
+    if (backlog_.empty()) {
+        flow_stats_.stalls++;
+    }
+    backlog_.emplace_back(f);
+    flow_stats_.backlog_frames++;
+    flow_stats_.backlog_bytes += size;
+}
+
+bool encoder::take_credit(size_t size) {
+    std::lock_guard<std::mutex> lock(flow_mutex_);
+    if (!flow_active()) {
+        return true;
+    }
+    if (flow_stats_.credit <= 0) {
+        return false;
+    }
+    flow_stats_.credit -= static_cast<int64_t>(size);
+    flow_stats_.sent_bytes += size;
+    return true;
+}
+
+void encoder::wait_for_credit(size_t size) {
+    std::unique_lock<std::mutex> lock(flow_mutex_);
+    if (!flow_active()) {
+        return;
+    }
+    if (flow_stats_.credit <= 0) {
+        flow_stats_.stalls++;
+        auto start = std::chrono::steady_clock::now();
+        credit_cv_.wait(lock, [this] { return flow_stats_.credit > 0 || !flow_active(); });
+        flow_stats_.blocked += std::chrono::steady_clock::now() - start;
+    }
+    flow_stats_.credit -= static_cast<int64_t>(size);
+    flow_stats_.sent_bytes += size;
+}
+
+void encoder::send_backlog() {
+    while (!backlog_.empty()) {
+        size_t size = flow_size(backlog_.front());
+        if (!take_credit(size)) {
+            return;
+        }
+        write_out(backlog_.front());
+
+        std::lock_guard<std::mutex> lock(flow_mutex_);
+        backlog_.pop_front();
+        flow_stats_.backlog_frames--;
+        flow_stats_.backlog_bytes -= size;
+    }
+}
+
+void encoder::add_credit(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(flow_mutex_);
+        flow_stats_.credit += static_cast<int64_t>(bytes);
+        flow_stats_.granted_bytes += bytes;
+    }
+    credit_cv_.notify_all();
+}
+
+void encoder::disable_flow_control() {
+    {
+        std::lock_guard<std::mutex> lock(flow_mutex_);
+        flow_disabled_ = true;
+    }
+    credit_cv_.notify_all();
+}
+
+bool encoder::would_block() const {
+    std::lock_guard<std::mutex> lock(flow_mutex_);
+    return !backlog_.empty() || (flow_active() && flow_stats_.credit <= 0);
+}
+
+send_flow_stats encoder::flow_stats() const {
+    std::lock_guard<std::mutex> lock(flow_mutex_);
+    return flow_stats_;
+}
+
+void encoder::write_out(const frame_view& f) {
+    if (!batch_writer_) {
+        writer_(f);
+        return;
+    }
+
+    auto header = f.header();
+    size_t frame_size = header.size() + f.payload.size();
+
+    // Uncorked and oversized frames are written directly behind anything pending
+    if (cork_depth_ == 0 || frame_size > batch_limits_.max_bytes) {
+        flush();
+        std::array<byte_span, 2> segments = {byte_span(header), f.payload};
+        batch_writer_(segments);
+        return;
+    }
+
+    if (batch_.size() + frame_size > batch_limits_.max_bytes) {
+        flush();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (batch_.empty()) {
+        batch_started_ = now;
+    }
+    batch_.insert(batch_.end(), header.begin(), header.end());
+    batch_.insert(batch_.end(), f.payload.begin(), f.payload.end());
+
+    if (now - batch_started_ >= batch_limits_.max_delay) {
+        flush();
+    }
 }
 
 void encoder::write_frame(uint8_t frame_type, const json& payload) {
     // Convert payload to CBOR format
-    std::vector<uint8_t> payload_bytes = json::to_cbor(payload);
-    size_t payload_len = payload_bytes.size();
+    payload_.clear();
+    json::to_cbor(payload, payload_);
+    write_payload(frame_type, payload_);
+}
+
+cbor_writer encoder::start_payload() {
+    payload_.clear();
+    return cbor_writer(payload_);
+}
+
+void encoder::write_payload(uint8_t frame_type, byte_span payload_span) {
+    // Attributes belong to the prim open when they arrive, so queued
+    // fragments go out before the next BEGIN or END, which are never queued
+    bool structural = frame_type == BEGIN || frame_type == END;
+    if (structural) {
+        drain_streams();
+    }
+
+    size_t payload_len = payload_span.size();
     size_t sent_bytes = 0;
-    uint32_t stream_id = 0;
     uint32_t seq = 0;
-    uint8_t partial_flag = 0;
+    size_t max_chunk_len = max_chunk_size();
+
+    // Payloads that fit are sent in one frame
+    if (payload_len <= max_chunk_len) {
+        emit_chunk(frame_type, 0, payload_span);
+        return;
+    }
+    uint32_t stream_id = next_stream_id_++;
 
-    // Check if we need to split the payload across multiple frames
-    if (payload_len > max_payload_size_) {
-        partial_flag = 1;
-        stream_id = next_stream_id_++;
+    // Fragments naming their stream can be interleaved with other frames
+    if (caps_ & CAP_STREAM_PREFIX) {
+        pending_stream stream{frame_type, stream_id, 1, {}, 0};
+        if (interleave_ && !structural) {
+            stream.payload.assign(payload_span.begin(), payload_span.end());
+            streams_.push_back(std::move(stream));
+            return;
+        }
+        while (stream.offset < payload_len) {
+            write_fragment(stream, payload_span);
+        }
+        return;
     }
 
     while (sent_bytes < payload_len) {
         // Determine chunk size for this frame
-        size_t chunk_len = std::min(max_payload_size_, payload_len - sent_bytes);
-
-        // For split payloads, send partial frame header
-        if (partial_flag) {
-            // Determine sequence number (0 means final frame)
-            if (sent_bytes + chunk_len == payload_len) {
-                seq = 0;  // Final frame
-            } else {
-                seq += 1;
-            }
-
-            // Create partial frame payload
-            json partial_payload = {{"id", stream_id}, {"seq", seq}};
-            std::vector<uint8_t> partial_frame_payload = json::to_cbor(partial_payload);
-
-            // Send partial frame
-            frame partial_frame(PARTIAL, 0, std::move(partial_frame_payload));
-            writer_(partial_frame);
+        size_t chunk_len = std::min(max_chunk_len, payload_len - sent_bytes);
+
+        // Determine sequence number (0 means final frame)
+        if (sent_bytes + chunk_len == payload_len) {
+            seq = 0;  // Final frame
+        } else {
+            seq += 1;
         }
 
-        // Create slice of payload for this frame
-        std::vector<uint8_t> chunk(
-            payload_bytes.begin() + sent_bytes,
-            payload_bytes.begin() + sent_bytes + chunk_len
-        );
+        // Send the partial frame header, the first one announces the total size
+        // {"id": stream_id, "seq": seq, "size": payload_len}
+        partial_.clear();
+        cbor_writer writer(partial_);
+        writer.map(sent_bytes == 0 ? 3 : 2);
+        writer.text("id");
+        writer.uint(stream_id);
+        writer.text("seq");
+        writer.uint(seq);
+        if (sent_bytes == 0) {
+            writer.text("size");
+            writer.uint(payload_len);
+        }
+        emit(frame_view(PARTIAL, 0, partial_));
 
-        // Send content chunk frame
-        frame content_chunk_frame(frame_type, partial_flag, std::move(chunk));
-        writer_(content_chunk_frame);
+        // Send a slice of the encoded payload as the content chunk frame
+        emit_chunk(frame_type, FLAG_PARTIAL, payload_span.subspan(sent_bytes, chunk_len));
 
         sent_bytes += chunk_len;
     }
 }
 
+size_t encoder::max_chunk_size() const {
+    // Once the peer accepts extended frames only very large payloads are split,
+    // before that no frame may need an extended header
+    return (caps_ & CAP_EXTENDED_LENGTH)
+        ? std::max(max_payload_size_, MAX_EXTENDED_PAYLOAD_SIZE)
+        : std::min(max_payload_size_, MAX_PAYLOAD_SIZE);
+}
+
+void encoder::emit_chunk(uint8_t frame_type, uint8_t flags, byte_span chunk) {
+    // Compress chunks that are large enough, unless they do not shrink
+    if ((caps_ & CAP_COMPRESSION) && chunk.size() >= compression_threshold_) {
+        byte_span compressed = compress_chunk(chunk);
+        if (!compressed.empty()) {
+            chunk = compressed;
+            flags |= FLAG_COMPRESSED;
+        }
+    }
+    if (chunk.size() > MAX_PAYLOAD_SIZE) {
+        assert(caps_ & CAP_EXTENDED_LENGTH);
+        flags |= FLAG_EXTENDED;
+    }
+
+    emit(frame_view(frame_type, flags, chunk));
+}
+
+size_t encoder::write_fragment(pending_stream& stream, byte_span payload) {
+    stream_prefix prefix{stream.id, stream.seq, payload.size()};
+    size_t prefix_size = stream_prefix_size(stream.seq);
+    size_t chunk_len = std::min(max_chunk_size() - prefix_size, payload.size() - stream.offset);
+    if (stream.offset + chunk_len == payload.size()) {
+        prefix.seq = 0;  // Final fragment
+    }
+
+    fragment_.resize(prefix_size + chunk_len);
+    pack_stream_prefix(prefix, fragment_.data());
+    std::copy_n(payload.data() + stream.offset, chunk_len, fragment_.data() + prefix_size);
+    emit_chunk(stream.type, FLAG_PARTIAL | FLAG_STREAM, fragment_);
+
+    stream.seq++;
+    stream.offset += chunk_len;
+    return fragment_.size();
+}
+
+bool encoder::pump(size_t max_bytes) {
+    send_backlog();
+
+    // Round robin, one fragment per stream at a time
+    size_t sent_bytes = 0;
+    while (!streams_.empty() && backlog_.empty() && sent_bytes < max_bytes) {
+        pending_stream stream = std::move(streams_.front());
+        streams_.pop_front();
+
+        sent_bytes += write_fragment(stream, stream.payload);
+        if (stream.offset < stream.payload.size()) {
+            streams_.push_back(std::move(stream));
+        }
+    }
+    return !streams_.empty() || !backlog_.empty();
+}
+
+void encoder::drain_streams() {
+    while (!streams_.empty()) {
+        pending_stream& stream = streams_.front();
+        while (stream.offset < stream.payload.size()) {
+            write_fragment(stream, stream.payload);
+        }
+        streams_.pop_front();
+    }
+}
+
 void encoder::begin(const std::string& entity_type, const std::string& name, int depth) {
-    json payload = {
-        {"depth", depth},
-        {"type", entity_type},
-        {"name", name}
-    };
+    if (delta_updates_) {
+        delta_.begin_prim(name);
+    }
+
+    // {"depth": depth, "name": name, "type": entity_type}
+    cbor_writer writer = start_payload();
+    writer.map(3);
+    writer.text("depth");
+    writer.integer(depth);
+    writer.text("name");
+    write_string(writer, name);
+    writer.text("type");
+    write_string(writer, entity_type);
+
+    write_payload(BEGIN, payload_);
+}
+
+void encoder::write_string(cbor_writer& writer, std::string_view value) {
+    if (!(caps_ & CAP_STRING_TABLE) || interleave_ || shared_connection_) {
+        writer.text(value);
+        return;
+    }
 
-    write_frame(BEGIN, payload);
+    if (auto index = strings_.find(value)) {
+        writer.tag(STRING_REF_TAG);
+        writer.uint(*index);
+    } else if (string_table::indexable(value)) {
+        writer.tag(STRING_DEFINE_TAG);
+        writer.text(value);
+        strings_.insert(value);
+        strings_.evict();
+    } else {
+        writer.text(value);
+    }
 }
 
 void encoder::end(int depth) {
-    json payload = json::array({depth});
-    write_frame(END, payload);
+    if (delta_updates_) {
+        delta_.end_prim(removed_attrs_);
+        write_removed_attrs();
+    }
+
+    // [depth]
+    cbor_writer writer = start_payload();
+    writer.array(1);
+    writer.integer(depth);
+
+    write_payload(END, payload_);
+}
+
+void encoder::attr_head(cbor_writer& writer, std::string_view name, uint8_t name_id,
+                        std::string_view attr_type, uint8_t type_id) {
+    writer.map(3);
+
+    // {"name": name, "type": attr_type, "value": ...}
+    if (!(caps_ & CAP_ATTRIBUTE_IDS)) {
+        writer.text("name");
+        write_string(writer, name);
+        writer.text("type");
+        write_string(writer, attr_type);
+        writer.text("value");
+        return;
+    }
+
+    // {0: name or id, 1: type or id, 2: ...}
+    writer.uint(ATTR_KEY_NAME);
+    if (name_id) {
+        writer.uint(name_id);
+    } else {
+        write_string(writer, name);
+    }
+    writer.uint(ATTR_KEY_TYPE);
+    if (type_id) {
+        writer.uint(type_id);
+    } else {
+        write_string(writer, attr_type);
+    }
+    writer.uint(ATTR_KEY_VALUE);
+}
+
+void encoder::attr_head(cbor_writer& writer, std::string_view name, std::string_view attr_type) {
+    const core_attr_info* core = find_core_attr(name);
+    const value_type_info* type = find_value_type(attr_type);
+    attr_head(writer, name, core ? static_cast<uint8_t>(core->id) : 0,
+              attr_type, type ? static_cast<uint8_t>(type->id) : 0);
+}
+
+void encoder::core_attr_head(cbor_writer& writer, const core_attr_info& info) {
+    const value_type_info& type = *value_type_by_id(static_cast<uint8_t>(info.type));
+    attr_head(writer, info.name, static_cast<uint8_t>(info.id), type.name, static_cast<uint8_t>(type.id));
 }
 
 void encoder::attr(const std::string& name, const std::string& attr_type, const json& value) {
-    json payload = {
-        {"type", attr_type},
-        {"name", name},
-        {"value", value}
-    };
+    if (delta_updates_) {
+        delta_value_.clear();
+        json::to_cbor(value, delta_value_);
+        if (unchanged(name, attr_type, delta_value_)) {
+            return;
+        }
+    }
+
+    cbor_writer writer = start_payload();
+    attr_head(writer, name, attr_type);
+    if (value.is_string()) {
+        write_string(writer, value.get_ref<const std::string&>());
+    } else {
+        json::to_cbor(value, payload_);
+    }
 
-    write_frame(ATTRIBUTE, payload);
+    write_payload(ATTRIBUTE, payload_);
 }
 
-void encoder::ping_pong() {
+void encoder::animation(const std::string& name, std::string_view attr_type, std::span<const float> times,
+                        std::span<const float> values, const sample_options& options) {
+    write_animation(name, attr_type, times, values, options);
+}
+
+void encoder::write_animation(std::string_view name, std::string_view attr_type, std::span<const float> times,
+                              std::span<const float> values, const sample_options& options) {
+    size_t components = times.empty() ? 1 : values.size() / times.size();
+    if (components == 0 || values.size() != components * times.size()) {
+        throw std::invalid_argument("animation values do not match the sample times");
+    }
+
+    // {"name", "type", "components", "times", "values"} plus the encoding keys
+    cbor_writer writer = start_payload();
+    writer.map(5 + (options.quantize ? 3 : 0) + (options.delta ? 1 : 0));
+    writer.text("name");
+    write_attr_name(writer, name);
+    writer.text("type");
+    write_attr_type(writer, attr_type);
+    writer.text("components");
+    writer.uint(components);
+    writer.text("times");
+    writer.typed_array(TAG_FLOAT32_LE, times);
+
+    writer.text("values");
+    if (options.quantize) {
+        quantize_samples(values, components, options.delta, sample_min_, sample_max_, quantized_);
+        writer.typed_array(options.delta ? TAG_SINT16_LE : TAG_UINT16_LE, std::span<const uint16_t>(quantized_));
+        writer.text("enc");
+        writer.text("q16");
+        writer.text("min");
+        writer.typed_array(TAG_FLOAT32_LE, std::span<const float>(sample_min_));
+        writer.text("max");
+        writer.typed_array(TAG_FLOAT32_LE, std::span<const float>(sample_max_));
+    } else if (options.delta) {
+        delta_encode_samples(values, components, samples_);
+        writer.typed_array(TAG_FLOAT32_LE, std::span<const float>(samples_));
+    } else {
+        writer.typed_array(TAG_FLOAT32_LE, values);
+    }
+    if (options.delta) {
+        writer.text("delta");
+        writer.boolean(true);
+    }
+
+    write_payload(ANIMATION, payload_);
+}
+
+void encoder::write_attr_name(cbor_writer& writer, std::string_view name) {
+    const core_attr_info* core = (caps_ & CAP_ATTRIBUTE_IDS) ? find_core_attr(name) : nullptr;
+    if (core) {
+        writer.uint(static_cast<uint8_t>(core->id));
+    } else {
+        write_string(writer, name);
+    }
+}
+
+void encoder::write_attr_type(cbor_writer& writer, std::string_view attr_type) {
+    const value_type_info* type = (caps_ & CAP_ATTRIBUTE_IDS) ? find_value_type(attr_type) : nullptr;
+    if (type) {
+        writer.uint(static_cast<uint8_t>(type->id));
+    } else {
+        write_string(writer, attr_type);
+    }
+}
+
+template<typename T>
+void encoder::typed_attr(const std::string& name, std::string_view attr_type,
+                         uint64_t array_tag, std::span<const T> values) {
+    if (unchanged(name, attr_type, values)) {
+        return;
+    }
+
+    cbor_writer writer = start_payload();
+    attr_head(writer, name, attr_type);
+    writer.typed_array(array_tag, values);
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, std::string_view value) {
+    if (unchanged(info.name, core_type_name(info), std::span<const char>(value))) {
+        return;
+    }
+
+    cbor_writer writer = start_payload();
+    core_attr_head(writer, info);
+    write_string(writer, value);
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, uint32_t value) {
+    if (unchanged(info.name, core_type_name(info), std::span<const uint32_t>(&value, 1))) {
+        return;
+    }
+
+    cbor_writer writer = start_payload();
+    core_attr_head(writer, info);
+    writer.uint(value);
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, const attrs::vec3f& value) {
+    write_core_numbers(info, value);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, const attrs::mat4f& value) {
+    write_core_numbers(info, value);
+}
+
+void encoder::write_core_numbers(const core_attr_info& info, std::span<const float> values) {
+    if (unchanged(info.name, core_type_name(info), values)) {
+        return;
+    }
+
+    // Single vectors and matrices are arrays of numbers
+    cbor_writer writer = start_payload();
+    core_attr_head(writer, info);
+    writer.array(values.size());
+    for (float value : values) {
+        writer.float32(value);
+    }
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, std::span<const float> values) {
+    if (unchanged(info.name, core_type_name(info), values)) {
+        return;
+    }
+
+    cbor_writer writer = start_payload();
+    core_attr_head(writer, info);
+    writer.typed_array(TAG_FLOAT32_LE, values);
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::write_core_attr(const core_attr_info& info, std::span<const uint32_t> values) {
+    if (unchanged(info.name, core_type_name(info), values)) {
+        return;
+    }
+
+    cbor_writer writer = start_payload();
+    core_attr_head(writer, info);
+    writer.typed_array(TAG_UINT32_LE, values);
+
+    write_payload(ATTRIBUTE, payload_);
+}
+
+void encoder::set_delta_updates(bool enabled) {
+    delta_updates_ = enabled;
+    delta_.reset();
+}
+
+void encoder::begin_update() {
+    if (delta_updates_) {
+        delta_.begin_update();
+    }
+}
+
+void encoder::end_update() {
+    if (!delta_updates_) {
+        return;
+    }
+    delta_.end_update(removed_prims_, removed_attrs_);
+    write_removed_attrs();
+    write_removed_prims();
+}
+
+bool encoder::unchanged(std::string_view name, std::string_view attr_type, byte_span value) {
+    if (!delta_updates_) {
+        return false;
+    }
+    // Values of different types may have the same bytes
+    uint64_t seed = xxh64(byte_span(reinterpret_cast<const uint8_t*>(attr_type.data()), attr_type.size()));
+    return delta_.unchanged(name, xxh64(value, seed));
+}
+
+void encoder::write_removed_attrs() {
+    for (const auto& name : removed_attrs_) {
+        // {"name": name, "removed": true}
+        cbor_writer writer = start_payload();
+        writer.map(2);
+        writer.text("name");
+        write_attr_name(writer, name);
+        writer.text("removed");
+        writer.boolean(true);
+
+        write_payload(ATTRIBUTE, payload_);
+    }
+}
+
+void encoder::write_removed_prims() {
+    for (const auto& path : removed_prims_) {
+        // {"name": path, "removed": true}
+        cbor_writer writer = start_payload();
+        writer.map(2);
+        writer.text("name");
+        write_string(writer, path);
+        writer.text("removed");
+        writer.boolean(true);
+
+        write_payload(BEGIN, payload_);
+    }
+}
+
+void encoder::attr(const std::string& name, std::span<const float> values, size_t components) {
+    std::string attr_type = components > 1 ? "vec" + std::to_string(components) + "f" : "f32[]";
+    typed_attr(name, attr_type, TAG_FLOAT32_LE, values);
+}
+
+void encoder::attr(const std::string& name, std::span<const uint32_t> values) {
+    typed_attr(name, "u32[]", TAG_UINT32_LE, values);
+}
+
+void encoder::vertex_attr(const std::string& name, vertex_semantic semantic,
+                          std::span<const float> values, size_t components,
+                          vertex_precision precision) {
+    if (precision == vertex_precision::float32) {
+        attr(name, values, components);
+        return;
+    }
+
+    std::string attr_type = components > 1 ? "vec" + std::to_string(components) + "f" : "f32[]";
+    attr(name, attr_type, encode_vertex_array(values, components, semantic, precision));
+}
+
+static double ping_timestamp() {
     // Get current timestamp in seconds since epoch
     auto now = std::chrono::system_clock::now();
-    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
         now.time_since_epoch()).count() / 1000.0;
+}
+
+void encoder::ping_pong() {
+    // {"time_ms": timestamp}
+    cbor_writer writer = start_payload();
+    writer.map(1);
+    writer.text("time_ms");
+    writer.float64(ping_timestamp());
 
-    json payload = {{"time_ms", timestamp}};
-    write_frame(PING_PONG, payload);
+    write_payload(PING_PONG, payload_);
+}
+
+void encoder::ping_pong(uint32_t nonce) {
+    // {"nonce": nonce, "time_ms": timestamp}
+    cbor_writer writer = start_payload();
+    writer.map(2);
+    writer.text("nonce");
+    writer.uint(nonce);
+    writer.text("time_ms");
+    writer.float64(ping_timestamp());
+
+    write_payload(PING_PONG, payload_);
+}
+
+void encoder::echo_ping_pong(const json& ping) {
+    write_frame(PING_PONG, ping);
 }
 
 void encoder::flow_control(int backoff_value) {
-    json payload = {{"backoff", backoff_value}};
-    write_frame(FLOW, payload);
+    // {"backoff": backoff_value}
+    cbor_writer writer = start_payload();
+    writer.map(1);
+    writer.text("backoff");
+    writer.integer(backoff_value);
+
+    write_payload(FLOW, payload_);
 }
 
-void encoder::error(const std::string& msg) {
-    json payload = {
-        {"level", "error"},
-        {"text", msg}
-    };
+void encoder::grant_credit(size_t bytes) {
+    // {"credit": bytes}
+    cbor_writer writer = start_payload();
+    writer.map(1);
+    writer.text("credit");
+    writer.uint(bytes);
 
-    write_frame(LOG, payload);
+    write_payload(FLOW, payload_);
 }
 
-void encoder::info(const std::string& msg) {
-    json payload = {
-        {"level", "info"},
-        {"text", msg}
-    };
+void encoder::log(std::string_view level, const std::string& msg) {
+    // {"level": level, "text": msg}
+    cbor_writer writer = start_payload();
+    writer.map(2);
+    writer.text("level");
+    writer.text(level);
+    writer.text("text");
+    writer.text(msg);
 
-    write_frame(LOG, payload);
+    write_payload(LOG, payload_);
 }
 
-void encoder::warning(const std::string& msg) {
-    json payload = {
-        {"level", "warning"},
-        {"text", msg}
-    };
+void encoder::error(const std::string& msg) {
+    log("error", msg);
+}
+
+void encoder::info(const std::string& msg) {
+    log("info", msg);
+}
 
-    write_frame(LOG, payload);
+void encoder::warning(const std::string& msg) {
+    log("warning", msg);
 }
 
 void encoder::file(const file_ref& file_ref, bool status) {
+    // {"content_type": type, "file_id": id, "filename": name, "hash": hash, "size": size, "status": status}
+    size_t fields = 2 + file_ref.file_id().has_value() + file_ref.content_type().has_value() +
+        file_ref.content_hash().has_value() + file_ref.size().has_value();
+    cbor_writer writer = start_payload();
+    writer.map(fields);
+    if (file_ref.content_type()) {
+        writer.text("content_type");
+        writer.text(*file_ref.content_type());
+    }
+    if (file_ref.file_id()) {
+        writer.text("file_id");
+        writer.text(*file_ref.file_id());
+    }
+    writer.text("filename");
+    writer.text(file_ref.name());
+    if (file_ref.content_hash()) {
+        writer.text("hash");
+        writer.text(*file_ref.content_hash());
+    }
+    if (file_ref.size()) {
+        writer.text("size");
+        writer.uint(*file_ref.size());
+    }
+    writer.text("status");
+    writer.boolean(status);
+
+    write_payload(FILE_REF, payload_);
+}
+
+void encoder::file_have(std::string_view hash) {
+    // {"hash": hash, "have": true}
+    cbor_writer writer = start_payload();
+    writer.map(2);
+    writer.text("hash");
+    writer.text(hash);
+    writer.text("have");
+    writer.boolean(true);
+
+    write_payload(FILE_REF, payload_);
+}
+
+void encoder::file_need(std::string_view hash, std::span<const byte_range> ranges) {
+    // {"hash": hash, "need": [[offset, length], ...]}
+    cbor_writer writer = start_payload();
+    writer.map(2);
+    writer.text("hash");
+    writer.text(hash);
+    writer.text("need");
+    writer.array(ranges.size());
+    for (const auto& range : ranges) {
+        writer.array(2);
+        writer.uint(range.offset);
+        writer.uint(range.length);
+    }
+
+    write_payload(FILE_REF, payload_);
+}
+
+void encoder::file_error(std::string_view hash, std::string_view message) {
+    // {"error": message, "hash": hash}
+    cbor_writer writer = start_payload();
+    writer.map(2);
+    writer.text("error");
+    writer.text(message);
+    writer.text("hash");
+    writer.text(hash);
+
+    write_payload(FILE_REF, payload_);
+}
+
+void encoder::file_chunk(std::string_view hash, uint64_t offset, byte_span data) {
+    // {"data": bytes, "hash": hash, "offset": offset}
+    cbor_writer writer = start_payload();
+    writer.map(3);
+    writer.text("data");
+    writer.bytes(data);
+    writer.text("hash");
+    writer.text(hash);
+    writer.text("offset");
+    writer.uint(offset);
+
+    write_payload(FILE_REF, payload_);
 }
 
 void encoder::hello(const std::string& client, const std::optional<std::string>& auth_token) {
@@ -144,7 +880,8 @@ void encoder::hello(const std::string& client, const std::optional<std::string>&
     json payload = {
         {"ver", 0},
         {"client", client},
-        {"nonce", nonce}
+        {"nonce", nonce},
+        {"caps", SUPPORTED_CAPS}
     };
 
     if (auth_token) {
@@ -1,26 +1,69 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <limits>
 #include <string>
+#include <type_traits>
+#include <vector>
 #include <optional>
 #include <memory>
+#include <mutex>
 #include <functional>
 #include <nlohmann/json.hpp>
+#include "file_ref.h"
+#include "flow_control.h"
 #include "frame.h"
 #include "buffer_pool.h"
+#include "vertex_encoding.h"
+#include "cbor_writer.h"
+#include "animation.h"
+#include "attribute_registry.h"
+#include "delta_tracker.h"
+#include "string_table.h"
 
 namespace scene_talk {
 
 // Use CBOR functionality from nlohmann/json
 using json = nlohmann::json;
 
-// Forward decl for FileRef
-class file_ref;
 
 /**
  * @brief Callback type for frame writing
+ *
+ * The payload may be a slice of a larger encoded message and is only valid for
+ * the duration of the call.
  */
-using frame_writer = std::function<void(const frame&)>;
+using frame_writer = std::function<void(const frame_view&)>;
+
+/**
+ * @brief Callback type for writev style transports
+ *
+ * Receives the header and payload segments of one frame so they can be
+ * flushed with a single gather write.
+ */
+using gather_writer = std::function<void(std::span<const byte_span> segments)>;
+
+/**
+ * @brief Adapt a gather writer to a frame writer
+ */
+frame_writer make_gather_writer(gather_writer writer);
+
+// Payloads smaller than this are not worth compressing
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 512;
+
+/**
+ * @brief Thresholds for coalescing corked frames into one write
+ */
+struct batch_limits {
+    // Flush once the pending frames reach this many bytes
+    size_t max_bytes = 64 * 1024;
+
+    // Flush when a frame is written and the oldest pending frame is this old
+    std::chrono::microseconds max_delay{1000};
+};
 
 /**
  * @brief Encodes protocol frames with CBOR payloads
@@ -35,6 +78,38 @@ public:
      */
     explicit encoder(frame_writer writer, size_t max_payload_size = MAX_PAYLOAD_SIZE);
 
+    /**
+     * @brief Create an encoder that can coalesce frames
+     *
+     * Uncorked frames are written one at a time as header and payload
+     * segments. While corked, frames are packed into one buffer that is
+     * written as a single segment when it fills, when it gets older than the
+     * delay threshold or when the encoder is uncorked.
+     *
+     * @param writer Callback for writing encoded bytes
+     * @param limits Size and latency thresholds for corked frames
+     * @param max_payload_size Maximum payload size
+     */
+    encoder(gather_writer writer, const batch_limits& limits,
+            size_t max_payload_size = MAX_PAYLOAD_SIZE);
+
+    /**
+     * @brief Start coalescing frames, calls nest
+     *
+     * Has no effect on encoders writing frames.
+     */
+    void cork() { cork_depth_++; }
+
+    /**
+     * @brief Stop coalescing frames, the outermost call flushes
+     */
+    void uncork();
+
+    /**
+     * @brief Write out pending corked frames
+     */
+    void flush();
+
     /**
      * @brief Send a BEGIN frame
      */
@@ -50,16 +125,138 @@ public:
      */
     void attr(const std::string& name, const std::string& attr_type, const json& value);
 
+    /**
+     * @brief Send an ATTRIBUTE frame with a float32 typed array value
+     *
+     * The values are written into the payload with one copy instead of
+     * going through json. The attribute type is "vecNf" for N components,
+     * or "f32[]" for one.
+     *
+     * @param name Attribute name
+     * @param values Components of all elements, interleaved
+     * @param components Components per element
+     */
+    void attr(const std::string& name, std::span<const float> values, size_t components = 1);
+
+    /**
+     * @brief Send an ATTRIBUTE frame with a "u32[]" typed array value
+     */
+    void attr(const std::string& name, std::span<const uint32_t> values);
+
+    /**
+     * @brief Send an ATTRIBUTE frame of the core registry
+     *
+     * The value must have the type the registry declares for the attribute,
+     * for example enc.attr(attrs::points, positions) with a span of floats.
+     * Once CAP_ATTRIBUTE_IDS is negotiated the name and type go out as ids.
+     */
+    template<core_attr Id, typename Value>
+    void attr(attr_key<Id, Value> key, const std::type_identity_t<Value>& value) {
+        write_core_attr(key.info(), value);
+    }
+
+    /**
+     * @brief Send time samples of an attribute as one ANIMATION frame
+     *
+     * @param name Attribute name
+     * @param attr_type Type of each sample, such as "mat4f"
+     * @param times Sample times
+     * @param values Values of all samples in time order, the same number for each time
+     * @param options Delta coding and quantization of the values
+     * @throws std::invalid_argument if the values do not split evenly into at least one per time
+     */
+    void animation(const std::string& name, std::string_view attr_type, std::span<const float> times,
+                   std::span<const float> values, const sample_options& options = {});
+
+    /**
+     * @brief Send time samples of a vector or matrix core attribute
+     *
+     * For example enc.animation(attrs::transform, times, matrices).
+     */
+    template<core_attr Id, typename Value>
+        requires std::is_same_v<Value, attrs::vec3f> || std::is_same_v<Value, attrs::mat4f>
+    void animation(attr_key<Id, Value> key, std::span<const float> times,
+                   std::type_identity_t<std::span<const Value>> values, const sample_options& options = {}) {
+        const value_type_info& type = *value_type_by_id(static_cast<uint8_t>(key.info().type));
+        write_animation(key.info().name, type.name, times,
+                        std::span<const float>(values.data()->data(), values.size() * std::tuple_size_v<Value>),
+                        options);
+    }
+
+    /**
+     * @brief Send a per-vertex ATTRIBUTE frame such as points, normals or displayColor
+     *
+     * The attribute type is "vecNf" for N components, or "f32[]" for one.
+     *
+     * @param name Attribute name
+     * @param semantic What the values are, selects the quantized encoding
+     * @param values Components of all vertices, interleaved
+     * @param components Components per vertex
+     * @param precision Encoding precision, see vertex_precision
+     */
+    void vertex_attr(const std::string& name, vertex_semantic semantic,
+                     std::span<const float> values, size_t components,
+                     vertex_precision precision = vertex_precision::float32);
+
     /**
      * @brief Send a PING-PONG frame
      */
     void ping_pong();
 
+    /**
+     * @brief Send a ping the peer echoes, nonce from latency_tracker::start_ping()
+     */
+    void ping_pong(uint32_t nonce);
+
+    /**
+     * @brief Echo a ping of the peer unchanged
+     */
+    void echo_ping_pong(const json& ping);
+
     /**
      * @brief Send a FLOW control frame
      */
     void flow_control(int backoff_value);
 
+    /**
+     * @brief Send a FLOW frame granting the peer credit, see flow_control.h
+     */
+    void grant_credit(size_t bytes);
+
+    /**
+     * @brief Add credit granted by a FLOW frame from the peer
+     *
+     * Only used once CAP_FLOW_CREDIT is negotiated. Safe to call from any
+     * thread, frames backlogged in flow_mode::queue are sent by the next
+     * write or pump() on the encoder's thread.
+     */
+    void add_credit(size_t bytes);
+
+    /**
+     * @brief Choose between backlogging and blocking while out of credit
+     */
+    void set_flow_mode(flow_mode mode) { flow_mode_ = mode; }
+
+    /**
+     * @brief Stop waiting for credit, for example when the connection closes
+     *
+     * Wakes writers blocked in flow_mode::block and sends all further frames
+     * as if flow control was not negotiated. Safe to call from any thread.
+     */
+    void disable_flow_control();
+
+    /**
+     * @brief Whether the producer should hold off
+     *
+     * True while frames wait for credit in the backlog or no credit is left.
+     */
+    [[nodiscard]] bool would_block() const;
+
+    /**
+     * @brief Flow control counters
+     */
+    [[nodiscard]] send_flow_stats flow_stats() const;
+
     /**
      * @brief Send an ERROR log frame
      */
@@ -76,25 +273,309 @@ public:
     void warning(const std::string& msg);
 
     /**
-     * @brief Send a FILE frame
+     * @brief Send a FILE frame announcing a file
+     *
+     * @param status False to offer the file, true once its chunks were sent
      */
     void file(const file_ref& file_ref, bool status = false);
 
     /**
-     * @brief Send a HELLO frame
+     * @brief Reply to a file offer, the content is known already
+     */
+    void file_have(std::string_view hash);
+
+    /**
+     * @brief Reply to a file offer, asking for the missing ranges
+     */
+    void file_need(std::string_view hash, std::span<const byte_range> ranges);
+
+    /**
+     * @brief Reply to a file offer that cannot be accepted
+     */
+    void file_error(std::string_view hash, std::string_view message);
+
+    /**
+     * @brief Send a chunk of a file asked for with file_need()
+     */
+    void file_chunk(std::string_view hash, uint64_t offset, byte_span data);
+
+    /**
+     * @brief Send a HELLO frame advertising SUPPORTED_CAPS
      */
     void hello(const std::string& client,
               const std::optional<std::string>& auth_token = std::nullopt);
 
+    /**
+     * @brief Enable the capabilities both sides support
+     *
+     * @param peer_caps The "caps" field of the peer's HELLO, 0 for older peers
+     */
+    void set_peer_caps(uint32_t peer_caps) { caps_ = SUPPORTED_CAPS & peer_caps; }
+
+    /**
+     * @brief Set the id of the next split payload
+     *
+     * Encoders writing to the same connection need disjoint stream ids.
+     */
+    void set_next_stream_id(uint32_t id) { next_stream_id_ = id; }
+
+    /**
+     * @brief Get the negotiated capabilities
+     */
+    [[nodiscard]] uint32_t caps() const { return caps_; }
+
+    /**
+     * @brief Set the smallest payload compressed once compression is negotiated
+     */
+    void set_compression_threshold(size_t bytes) { compression_threshold_ = bytes; }
+
+    /**
+     * @brief Queue payloads that need splitting instead of sending them at once
+     *
+     * Only applies once CAP_STREAM_PREFIX is negotiated. Queued payloads are
+     * copied and their fragments sent by pump(), so frames written in the
+     * meantime are not held up behind them. Receivers get each payload when
+     * its last fragment arrives, possibly after frames written later. BEGIN
+     * and END are never queued and send all queued fragments first, so
+     * attributes still reach the prim they were written in. Strings are not
+     * sent through the string table meanwhile, as the peer would add them in
+     * a different order.
+     */
+    void set_interleave(bool interleave) { interleave_ = interleave; }
+
+    /**
+     * @brief Note that other encoders write to the same connection
+     *
+     * The peer keeps one string table per connection and cannot tell which
+     * encoder added an entry, so strings are sent as text even once
+     * CAP_STRING_TABLE is negotiated. See frame_scheduler::attach().
+     */
+    void set_shared_connection(bool shared) { shared_connection_ = shared; }
+
+    /**
+     * @brief Send frames waiting for credit, then fragments of queued payloads
+     *
+     * Fragments are sent one stream after another, and only while no frame
+     * waits for credit.
+     *
+     * @param max_bytes Stop once this many bytes of fragments were sent
+     * @return True if frames or fragments are still queued
+     */
+    bool pump(size_t max_bytes = std::numeric_limits<size_t>::max());
+
+    /**
+     * @brief Number of payloads with fragments still queued
+     */
+    [[nodiscard]] size_t queued_streams() const { return streams_.size(); }
+
+    /**
+     * @brief Only send attributes whose value changed since the last update
+     *
+     * The encoder keeps a hash of the last value sent for each attribute by
+     * prim path and name. Attributes sent again with the same type and value
+     * are skipped, as the receiver's scene_store still has them. Between
+     * begin_update() and end_update(), attributes and prims that are not sent
+     * again are removed on the receiver with markers:
+     * ATTRIBUTE {"name": name, "removed": true} before the prim's END and
+     * BEGIN {"name": path, "removed": true} without an END.
+     *
+     * Animations are always sent. Enabling or disabling forgets what was sent.
+     */
+    void set_delta_updates(bool enabled);
+
+    /**
+     * @brief Start sending the scene again, see set_delta_updates()
+     */
+    void begin_update();
+
+    /**
+     * @brief Finish an update, removing prims and root attributes not sent in it
+     */
+    void end_update();
+
+    /**
+     * @brief Forget what was sent, for a receiver that reset its scene or reconnected
+     */
+    void reset_delta() { delta_.reset(); }
+
+    /**
+     * @brief Counters of attributes sent and skipped as unchanged
+     */
+    [[nodiscard]] const delta_update_stats& delta_stats() const { return delta_.stats(); }
+
 private:
     /**
      * @brief Send a frame with CBOR-encoded payload
      */
     void write_frame(uint8_t frame_type, const json& payload);
 
+    // Clear payload_ and start writing a CBOR payload into it
+    cbor_writer start_payload();
+
+    // Send a LOG frame
+    void log(std::string_view level, const std::string& msg);
+
+    /**
+     * @brief Send a frame with an encoded payload, splitting it if needed
+     */
+    void write_payload(uint8_t frame_type, byte_span payload);
+
+    // A payload sent as FLAG_STREAM fragments
+    struct pending_stream {
+        uint8_t type;
+        uint32_t id;
+        uint32_t seq;
+        std::vector<uint8_t> payload;   // Copy of a queued payload, empty when sent right away
+        size_t offset;                  // Bytes of the payload sent
+    };
+
+    // Largest payload sent in one frame
+    size_t max_chunk_size() const;
+
+    // Send one frame of a payload, compressed if negotiated
+    void emit_chunk(uint8_t frame_type, uint8_t flags, byte_span chunk);
+
+    // Send the next fragment of a stream, returns the bytes sent
+    size_t write_fragment(pending_stream& stream, byte_span payload);
+
+    // Send every fragment of the queued payloads
+    void drain_streams();
+
+    // Send an ANIMATION frame
+    void write_animation(std::string_view name, std::string_view attr_type, std::span<const float> times,
+                         std::span<const float> values, const sample_options& options);
+
+    // Write an attribute name or type, as its registry id once CAP_ATTRIBUTE_IDS is negotiated
+    void write_attr_name(cbor_writer& writer, std::string_view name);
+    void write_attr_type(cbor_writer& writer, std::string_view attr_type);
+
+    // Write a string, through the string table once it is negotiated
+    void write_string(cbor_writer& writer, std::string_view value);
+
+    // Write the map head and keys of an ATTRIBUTE payload up to the value, ids of 0 are not registered
+    void attr_head(cbor_writer& writer, std::string_view name, uint8_t name_id,
+                   std::string_view attr_type, uint8_t type_id);
+
+    // Same, looking the name and type up in the registries
+    void attr_head(cbor_writer& writer, std::string_view name, std::string_view attr_type);
+
+    // Same for a core attribute with its registered type
+    void core_attr_head(cbor_writer& writer, const core_attr_info& info);
+
+    // Send ATTRIBUTE frames of the core registry
+    void write_core_attr(const core_attr_info& info, std::string_view value);
+    void write_core_attr(const core_attr_info& info, uint32_t value);
+    void write_core_attr(const core_attr_info& info, const attrs::vec3f& value);
+    void write_core_attr(const core_attr_info& info, const attrs::mat4f& value);
+    void write_core_attr(const core_attr_info& info, std::span<const float> values);
+    void write_core_attr(const core_attr_info& info, std::span<const uint32_t> values);
+
+    // Send a core attribute whose value is an array of numbers
+    void write_core_numbers(const core_attr_info& info, std::span<const float> values);
+
+    // Send an ATTRIBUTE frame whose value is a typed array
+    template<typename T>
+    void typed_attr(const std::string& name, std::string_view attr_type,
+                    uint64_t array_tag, std::span<const T> values);
+
+    // Whether an attribute can be skipped as it was sent with this value before
+    bool unchanged(std::string_view name, std::string_view attr_type, byte_span value);
+
+    // Same for a value of numbers or a string
+    template<typename T>
+    bool unchanged(std::string_view name, std::string_view attr_type, std::span<const T> values) {
+        return unchanged(name, attr_type, byte_span(reinterpret_cast<const uint8_t*>(values.data()),
+                                                    values.size_bytes()));
+    }
+
+    // Send removal markers, for attributes inside a prim or prims at absolute paths
+    void write_removed_attrs();
+    void write_removed_prims();
+
+    // Compress a content chunk into compressed_, empty if it does not shrink
+    byte_span compress_chunk(byte_span chunk);
+
+    // Pass a frame on once there is credit for it
+    void emit(const frame_view& f);
+
+    // Pass a frame to the writer or the pending batch
+    void write_out(const frame_view& f);
+
+    // Whether credit is counted, flow_mutex_ must be held
+    bool flow_active() const { return (caps_ & CAP_FLOW_CREDIT) && !flow_disabled_; }
+
+    // Take credit for a frame, false if there is none left
+    bool take_credit(size_t size);
+
+    // Wait until there is credit and take it, in flow_mode::block
+    void wait_for_credit(size_t size);
+
+    // Send backlogged frames while there is credit
+    void send_backlog();
+
     frame_writer writer_;
     size_t max_payload_size_;
     uint32_t next_stream_id_;
+    uint32_t caps_;
+    size_t compression_threshold_;
+    // Scratch buffers reused by every frame, so encoding does not allocate
+    // once they have grown to the largest payload
+    std::vector<uint8_t> compressed_;
+    std::vector<uint8_t> payload_;
+    std::vector<uint8_t> partial_;
+
+    // Scratch for delta coded and quantized animation samples
+    std::vector<float> samples_;
+    std::vector<float> sample_min_;
+    std::vector<float> sample_max_;
+    std::vector<uint16_t> quantized_;
+
+    // Streams with FLAG_STREAM fragments
+    std::vector<uint8_t> fragment_;
+    std::deque<pending_stream> streams_;
+    bool interleave_ = false;
+
+    // Strings repeated across messages, mirrored by the peer's decoder
+    string_table strings_;
+    bool shared_connection_ = false;
+
+    // Attribute values sent, when delta updates are enabled
+    bool delta_updates_ = false;
+    delta_tracker delta_;
+    std::vector<uint8_t> delta_value_;
+    std::vector<std::string> removed_attrs_;
+    std::vector<std::string> removed_prims_;
+
+    // Flow control once CAP_FLOW_CREDIT is negotiated, the counters are
+    // guarded by flow_mutex_ as credit may be added from another thread
+    flow_mode flow_mode_ = flow_mode::queue;
+    mutable std::mutex flow_mutex_;
+    std::condition_variable credit_cv_;
+    send_flow_stats flow_stats_;
+    bool flow_disabled_ = false;
+    std::deque<frame> backlog_;
+
+    // Coalescing of corked frames
+    gather_writer batch_writer_;
+    batch_limits batch_limits_;
+    std::vector<uint8_t> batch_;
+    std::chrono::steady_clock::time_point batch_started_;
+    uint32_t cork_depth_;
+};
+
+/**
+ * @brief Corks an encoder for the lifetime of the scope
+ */
+class cork_scope {
+public:
+    explicit cork_scope(encoder& enc) : encoder_(enc) { encoder_.cork(); }
+    ~cork_scope() { encoder_.uncork(); }
+
+    cork_scope(const cork_scope&) = delete;
+    cork_scope& operator=(const cork_scope&) = delete;
+
+private:
+    encoder& encoder_;
 };
 
 } // namespace scene_talk
\ No newline at end of file
@@ -1,10 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <optional>
 
 namespace scene_talk {
 
+/**
+ * @brief Range of bytes in a file
+ */
+struct byte_range {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+
+    bool operator==(const byte_range&) const = default;
+};
+
 /**
  * @brief Reference to a file in the protocol
  */
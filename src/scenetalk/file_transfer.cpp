@@ -0,0 +1,287 @@
+#include "file_transfer.h"
+#include "encoder.h"
+#include "hash.h"
+#include <algorithm>
+#include <iostream>
+
+namespace scene_talk {
+
+namespace {
+
+constexpr std::string_view HASH_PREFIX = "xxh64:";
+
+file_ref parse_file_ref(const nlohmann::json& payload) {
+    auto optional_string = [&](const char* key) -> std::optional<std::string> {
+        auto it = payload.find(key);
+        return it != payload.end() && it->is_string() ? std::optional(it->get<std::string>()) : std::nullopt;
+    };
+    std::optional<size_t> size;
+    if (auto it = payload.find("size"); it != payload.end() && it->is_number_unsigned()) {
+        size = it->get<size_t>();
+    }
+    return file_ref(payload.value("filename", ""), optional_string("file_id"),
+                    optional_string("content_type"), optional_string("hash"), size);
+}
+
+} // namespace
+
+std::string content_hash(std::span<const uint8_t> data) {
+    static constexpr char digits[] = "0123456789abcdef";
+    uint64_t h = xxh64(data);
+    std::string hash(HASH_PREFIX);
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        hash.push_back(digits[(h >> shift) & 0xf]);
+    }
+    return hash;
+}
+
+file_store::file_store(const file_store_limits& limits)
+    : limits_(limits) {}
+
+void file_store::put(const std::string& hash, std::vector<uint8_t> content) {
+    entry& e = entries_[hash];
+    bytes_ = bytes_ - e.content.size() + content.size();
+    e.received.assign(1, byte_range{0, content.size()});
+    e.content = std::move(content);
+    e.complete = true;
+}
+
+bool file_store::has(const std::string& hash) const {
+    auto it = entries_.find(hash);
+    return it != entries_.end() && it->second.complete;
+}
+
+std::span<const uint8_t> file_store::get(const std::string& hash) const {
+    auto it = entries_.find(hash);
+    if (it == entries_.end() || !it->second.complete) {
+        return {};
+    }
+    return it->second.content;
+}
+
+std::optional<std::vector<byte_range>> file_store::missing(const std::string& hash, uint64_t size) {
+    // Check the limits before the content is allocated
+    auto existing = entries_.find(hash);
+    size_t held = existing != entries_.end() ? existing->second.content.size() : 0;
+    if (existing != entries_.end() && existing->second.complete) {
+        return std::vector<byte_range>();
+    }
+    if (size > limits_.max_file_size || size > limits_.max_total_bytes ||
+        bytes_ - held > limits_.max_total_bytes - size) {
+        return std::nullopt;
+    }
+
+    auto [it, inserted] = entries_.try_emplace(hash);
+    entry& e = it->second;
+
+    // A different size for the same hash starts over
+    if (inserted || e.content.size() != size) {
+        bytes_ = bytes_ - e.content.size() + size;
+        e.content.assign(size, 0);
+        e.received.clear();
+    }
+
+    std::vector<byte_range> gaps;
+    uint64_t offset = 0;
+    for (const auto& range : e.received) {
+        if (range.offset > offset) {
+            gaps.push_back({offset, range.offset - offset});
+        }
+        offset = range.offset + range.length;
+    }
+    if (offset < size) {
+        gaps.push_back({offset, size - offset});
+    }
+    return gaps;
+}
+
+bool file_store::write(const std::string& hash, uint64_t offset, std::span<const uint8_t> data) {
+    auto it = entries_.find(hash);
+    if (it == entries_.end() || it->second.complete) {
+        return false;
+    }
+    entry& e = it->second;
+    if (offset > e.content.size() || data.size() > e.content.size() - offset) {
+        return false;
+    }
+    std::copy(data.begin(), data.end(), e.content.begin() + offset);
+
+    // Insert the range and merge it with its neighbours
+    byte_range range{offset, data.size()};
+    auto pos = std::lower_bound(e.received.begin(), e.received.end(), range,
+                                [](const byte_range& a, const byte_range& b) { return a.offset < b.offset; });
+    e.received.insert(pos, range);
+    std::vector<byte_range> merged;
+    merged.reserve(e.received.size());
+    for (const auto& r : e.received) {
+        if (!merged.empty() && r.offset <= merged.back().offset + merged.back().length) {
+            uint64_t end = std::max(merged.back().offset + merged.back().length, r.offset + r.length);
+            merged.back().length = end - merged.back().offset;
+        } else {
+            merged.push_back(r);
+        }
+    }
+    e.received = std::move(merged);
+    return true;
+}
+
+file_store::file_status file_store::finish(const std::string& hash) {
+    auto it = entries_.find(hash);
+    if (it == entries_.end()) {
+        return file_status::incomplete;
+    }
+    entry& e = it->second;
+    if (e.complete) {
+        return file_status::complete;
+    }
+    bool covered = e.content.empty() ||
+        (e.received.size() == 1 && e.received[0].length == e.content.size());
+    if (!covered) {
+        return file_status::incomplete;
+    }
+
+    // Hashes of other kinds are taken as they are
+    if (hash.starts_with(HASH_PREFIX) && content_hash(e.content) != hash) {
+        e.received.clear();
+        return file_status::corrupt;
+    }
+    e.complete = true;
+    return file_status::complete;
+}
+
+file_sender::file_sender(encoder& enc, size_t chunk_size)
+    : enc_(enc), chunk_size_(chunk_size) {}
+
+void file_sender::offer(const file_ref& ref, std::shared_ptr<const std::vector<uint8_t>> content) {
+    std::string hash = ref.content_hash() ? *ref.content_hash() : content_hash(*content);
+    file_ref announced(ref.name(), ref.file_id(), ref.content_type(), hash, content->size());
+
+    // Replies may come back before the offer returns
+    files_.insert_or_assign(hash, offered_file{announced, std::move(content)});
+    enc_.file(announced);
+}
+
+bool file_sender::handle(const nlohmann::json& payload) {
+    auto hash = payload.find("hash");
+    if (hash == payload.end() || !hash->is_string()) {
+        return false;
+    }
+    auto it = files_.find(hash->get<std::string>());
+    if (it == files_.end()) {
+        return false;
+    }
+
+    if (payload.contains("have")) {
+        files_.erase(it);
+        return true;
+    }
+    if (auto error = payload.find("error"); error != payload.end()) {
+        std::cerr << "File " << it->second.ref.name() << " refused: "
+                  << (error->is_string() ? error->get<std::string>() : error->dump()) << std::endl;
+        files_.erase(it);
+        return true;
+    }
+    auto need = payload.find("need");
+    if (need == payload.end() || !need->is_array()) {
+        return false;
+    }
+
+    // Content that never matches its hash is not sent forever
+    if (++it->second.rounds > MAX_FILE_SEND_ROUNDS) {
+        std::cerr << "Giving up on file " << it->second.ref.name() << " after "
+                  << MAX_FILE_SEND_ROUNDS << " attempts" << std::endl;
+        files_.erase(it);
+        return true;
+    }
+
+    // The receiver may confirm while the chunks go out and drop the entry
+    offered_file file = it->second;
+    std::span<const uint8_t> content(*file.content);
+    for (const auto& range : *need) {
+        if (!range.is_array() || range.size() != 2 ||
+            !range[0].is_number_unsigned() || !range[1].is_number_unsigned()) {
+            std::cerr << "Malformed range requested for file " << file.ref.name() << std::endl;
+            continue;
+        }
+        uint64_t offset = range[0].get<uint64_t>();
+        uint64_t length = range[1].get<uint64_t>();
+        if (offset > content.size() || length > content.size() - offset) {
+            std::cerr << "Invalid range requested for file " << file.ref.name() << std::endl;
+            continue;
+        }
+        for (uint64_t sent = 0; sent < length; sent += chunk_size_) {
+            size_t chunk_len = std::min<uint64_t>(chunk_size_, length - sent);
+            enc_.file_chunk(hash->get_ref<const std::string&>(), offset + sent,
+                            content.subspan(offset + sent, chunk_len));
+        }
+    }
+    enc_.file(file.ref, true);
+    return true;
+}
+
+file_receiver::file_receiver(encoder& enc, file_store& store, file_handler handler)
+    : enc_(enc), store_(store), handler_(std::move(handler)) {}
+
+bool file_receiver::handle(const nlohmann::json& payload) {
+    auto hash_it = payload.find("hash");
+    if (hash_it == payload.end() || !hash_it->is_string()) {
+        return false;
+    }
+    const std::string& hash = hash_it->get_ref<const std::string&>();
+
+    // Chunk of a file asked for
+    if (auto data = payload.find("data"); data != payload.end()) {
+        auto offset = payload.find("offset");
+        if (!data->is_binary() || offset == payload.end() || !offset->is_number_unsigned() ||
+            !store_.write(hash, offset->get<uint64_t>(), data->get_binary())) {
+            std::cerr << "Dropping file chunk for " << hash << std::endl;
+        }
+        return true;
+    }
+
+    if (!payload.contains("filename")) {
+        return false;
+    }
+    file_ref ref = parse_file_ref(payload);
+    if (store_.has(hash)) {
+        deliver(hash, ref);
+        return true;
+    }
+    if (!ref.size()) {
+        return false;
+    }
+
+    // The sender is done, anything still missing is asked for again
+    if (payload.value("status", false)) {
+        auto status = store_.finish(hash);
+        if (status == file_store::file_status::complete) {
+            deliver(hash, ref);
+            return true;
+        }
+        if (status == file_store::file_status::corrupt) {
+            std::cerr << "Content hash mismatch for file " << ref.name() << std::endl;
+        }
+    }
+
+    auto ranges = store_.missing(hash, *ref.size());
+    if (!ranges) {
+        std::cerr << "File " << ref.name() << " of " << *ref.size() << " bytes exceeds the store limits" << std::endl;
+        enc_.file_error(hash, "exceeds the store limits");
+        return true;
+    }
+    if (ranges->empty() && store_.finish(hash) == file_store::file_status::complete) {
+        deliver(hash, ref);
+        return true;
+    }
+    enc_.file_need(hash, *ranges);
+    return true;
+}
+
+void file_receiver::deliver(const std::string& hash, const file_ref& ref) {
+    enc_.file_have(hash);
+    if (handler_) {
+        handler_(ref, store_.get(hash));
+    }
+}
+
+} // namespace scene_talk
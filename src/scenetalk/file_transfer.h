@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "file_ref.h"
+
+namespace scene_talk {
+
+class encoder;
+
+/**
+ * @brief Content-addressed file transfer over FILE_REF frames
+ *
+ * The sender offers a file with its hash and size, the receiver answers
+ * {"hash": h, "have": true} when its store has the content already, or
+ * {"hash": h, "need": [[offset, length], ...]} with the ranges it misses.
+ * Only those ranges are sent as chunks {"hash": h, "offset": o, "data": bytes},
+ * followed by the offer again with "status": true. The receiver then checks
+ * the hash and answers "have", or "need" with whatever is still missing.
+ * Offers the receiver cannot store are answered {"hash": h, "error": text}.
+ *
+ * The store outlives connections, so a transfer cut short resumes with the
+ * missing ranges on the next offer and a repeated one costs a round trip.
+ */
+
+// Bytes per chunk frame, fits a frame without extended lengths
+constexpr size_t FILE_CHUNK_SIZE = 32 * 1024;
+
+/**
+ * @brief Content hash of a file, "xxh64:" and 16 hex digits
+ */
+std::string content_hash(std::span<const uint8_t> data);
+
+// Times the chunks of an offer are sent before the sender gives up on it
+constexpr int MAX_FILE_SEND_ROUNDS = 3;
+
+/**
+ * @brief Limits on what a file store accepts from senders
+ */
+struct file_store_limits {
+    // Largest file received
+    uint64_t max_file_size = 256 * 1024 * 1024;
+
+    // Bytes held by complete and partial files, files put directly still count
+    size_t max_total_bytes = 1024 * 1024 * 1024;
+};
+
+/**
+ * @brief Files known by content hash, complete or partially received
+ */
+class file_store {
+public:
+    enum class file_status {
+        complete,
+        incomplete,     // Ranges are still missing
+        corrupt         // Everything arrived but the hash does not match, received ranges are dropped
+    };
+
+    explicit file_store(const file_store_limits& limits = {});
+
+    // Add complete content, for example files found on disk
+    void put(const std::string& hash, std::vector<uint8_t> content);
+
+    [[nodiscard]] bool has(const std::string& hash) const;
+
+    // Content of a complete file, empty otherwise
+    [[nodiscard]] std::span<const uint8_t> get(const std::string& hash) const;
+
+    // Ranges still to receive, starts a new partial file if the hash is unknown.
+    // std::nullopt if the file would exceed the limits.
+    std::optional<std::vector<byte_range>> missing(const std::string& hash, uint64_t size);
+
+    // Store a received chunk, false unless it lies within a partial file
+    bool write(const std::string& hash, uint64_t offset, std::span<const uint8_t> data);
+
+    // Check a partial file once the sender is done with it
+    file_status finish(const std::string& hash);
+
+    // Bytes held by complete and partial files
+    [[nodiscard]] size_t bytes() const { return bytes_; }
+
+private:
+    struct entry {
+        std::vector<uint8_t> content;
+        std::vector<byte_range> received;   // Sorted and merged
+        bool complete = false;
+    };
+
+    file_store_limits limits_;
+    std::unordered_map<std::string, entry> entries_;
+    size_t bytes_ = 0;
+};
+
+/**
+ * @brief Offers files and sends the chunks a receiver asks for
+ */
+class file_sender {
+public:
+    explicit file_sender(encoder& enc, size_t chunk_size = FILE_CHUNK_SIZE);
+
+    /**
+     * @brief Offer a file, its hash is computed unless the reference has one
+     *
+     * The content is kept until the receiver has it, or refuses it, or still
+     * finds it corrupt after MAX_FILE_SEND_ROUNDS, as when the reference
+     * carries a wrong hash.
+     */
+    void offer(const file_ref& ref, std::shared_ptr<const std::vector<uint8_t>> content);
+
+    /**
+     * @brief Handle a FILE_REF payload from the receiver
+     *
+     * @return True if it was a reply to one of the offers
+     */
+    bool handle(const nlohmann::json& payload);
+
+    // Offers the receiver did not confirm yet
+    [[nodiscard]] size_t pending() const { return files_.size(); }
+
+private:
+    struct offered_file {
+        file_ref ref;
+        std::shared_ptr<const std::vector<uint8_t>> content;
+        int rounds = 0;     // Times chunks were sent
+    };
+
+    encoder& enc_;
+    size_t chunk_size_;
+    std::unordered_map<std::string, offered_file> files_;
+};
+
+/**
+ * @brief Answers file offers from a store and collects the chunks
+ */
+class file_receiver {
+public:
+    // Called once the content of an offered file is available
+    using file_handler = std::function<void(const file_ref& ref, std::span<const uint8_t> content)>;
+
+    file_receiver(encoder& enc, file_store& store, file_handler handler);
+
+    /**
+     * @brief Handle a FILE_REF payload from the sender
+     *
+     * @return False for payloads that are not part of a transfer, such as
+     *         references without a hash
+     */
+    bool handle(const nlohmann::json& payload);
+
+private:
+    void deliver(const std::string& hash, const file_ref& ref);
+
+    encoder& enc_;
+    file_store& store_;
+    file_handler handler_;
+};
+
+} // namespace scene_talk
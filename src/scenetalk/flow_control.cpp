@@ -0,0 +1,38 @@
+#include "flow_control.h"
+#include "compression.h"
+#include <algorithm>
+
+namespace scene_talk {
+
+size_t flow_size(const frame_view& f) {
+    if ((f.flags & FLAG_COMPRESSED) && f.payload.size() >= COMPRESSED_HEADER_SIZE) {
+        return unpack_uint32_le(f.payload.data());
+    }
+    return f.payload.size();
+}
+
+receive_window::receive_window(size_t window, grant_handler grant)
+    : grant_(std::move(grant)),
+      threshold_(std::max<size_t>(window / 4, 1)) {
+    stats_.window = window;
+}
+
+void receive_window::open() {
+    stats_.granted_bytes += stats_.window;
+    grant_(stats_.window);
+}
+
+void receive_window::consumed(size_t bytes) {
+    stats_.consumed_bytes += bytes;
+    stats_.pending_bytes += bytes;
+    if (stats_.pending_bytes < threshold_) {
+        return;
+    }
+
+    size_t credit = stats_.pending_bytes;
+    stats_.pending_bytes = 0;
+    stats_.granted_bytes += credit;
+    grant_(credit);
+}
+
+} // namespace scene_talk
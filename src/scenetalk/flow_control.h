@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "frame.h"
+
+namespace scene_talk {
+
+/**
+ * @brief Credit-based flow control
+ *
+ * Once CAP_FLOW_CREDIT is negotiated the receiver grants the sender byte
+ * credits with FLOW frames {"credit": bytes}, starting with its whole window
+ * and then as its handler consumes frames. The sender starts without credit
+ * and may write a frame while its credit is positive, so it overshoots by at
+ * most one frame. Credits count payload bytes as the receiver's handler sees
+ * them, after decompression. HELLO, PING-PONG and FLOW frames are not counted.
+ */
+
+// Receive window of a decoder unless set otherwise
+constexpr size_t DEFAULT_FLOW_WINDOW = 1024 * 1024;
+
+/**
+ * @brief What an encoder does with frames while it has no credit
+ */
+enum class flow_mode {
+    queue,      // Keep them in a backlog sent by pump(), see encoder::would_block()
+    block       // Wait until add_credit() is called, from another thread
+};
+
+/**
+ * @brief Sender side flow control counters
+ */
+struct send_flow_stats {
+    int64_t credit = 0;                  // Bytes that may still be sent, negative after an overshoot
+    uint64_t granted_bytes = 0;          // Credit received
+    uint64_t sent_bytes = 0;             // Counted bytes sent
+    size_t backlog_frames = 0;           // Frames waiting for credit
+    size_t backlog_bytes = 0;
+    uint64_t stalls = 0;                 // Times the sender ran out of credit
+    std::chrono::nanoseconds blocked{0}; // Time spent waiting for credit in flow_mode::block
+};
+
+/**
+ * @brief Receiver side flow control counters
+ */
+struct receive_flow_stats {
+    size_t window = 0;
+    uint64_t granted_bytes = 0;          // Credit granted, including the initial window
+    uint64_t consumed_bytes = 0;         // Counted bytes handled
+    size_t pending_bytes = 0;            // Consumed but not granted again yet
+};
+
+// Whether frames of a type count against the credit
+constexpr bool flow_controlled(uint8_t frame_type) {
+    return frame_type != HELLO && frame_type != PING_PONG && frame_type != FLOW;
+}
+
+/**
+ * @brief Bytes a frame counts against the credit
+ *
+ * The payload size, or the decompressed size of compressed payloads.
+ */
+size_t flow_size(const frame_view& f);
+
+/**
+ * @brief Grants credit as received frames are consumed
+ *
+ * Credit is granted in batches of a quarter of the window, so a FLOW frame
+ * goes out for every few frames instead of each one.
+ */
+class receive_window {
+public:
+    // Sends a FLOW frame granting credit
+    using grant_handler = std::function<void(size_t credit)>;
+
+    receive_window(size_t window, grant_handler grant);
+
+    // Grant the whole window, once flow control is negotiated
+    void open();
+
+    // Count a handled frame, grants credit once enough is pending
+    void consumed(size_t bytes);
+
+    [[nodiscard]] const receive_flow_stats& stats() const { return stats_; }
+
+private:
+    grant_handler grant_;
+    size_t threshold_;
+    receive_flow_stats stats_;
+};
+
+} // namespace scene_talk
@@ -1,4 +1,5 @@
 #include "frame.h"
+#include <algorithm>
 #include <cassert>
 
 namespace scene_talk {
@@ -14,18 +15,99 @@ uint16_t unpack_uint16_le(const uint8_t* data) {
     return static_cast<uint16_t>(data[0]) | (static_cast<uint16_t>(data[1]) << 8);
 }
 
+std::array<uint8_t, 4> pack_uint32_le(uint32_t value) {
+    return {
+        static_cast<uint8_t>(value & 0xFF),
+        static_cast<uint8_t>((value >> 8) & 0xFF),
+        static_cast<uint8_t>((value >> 16) & 0xFF),
+        static_cast<uint8_t>((value >> 24) & 0xFF)
+    };
+}
+
+uint32_t unpack_uint32_le(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) |
+           (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) |
+           (static_cast<uint32_t>(data[3]) << 24);
+}
+
+size_t unpack_payload_size(const uint8_t* header) {
+    if (header[1] & FLAG_EXTENDED) {
+        return unpack_uint32_le(&header[2]);
+    }
+    return unpack_uint16_le(&header[2]);
+}
+
+size_t pack_stream_prefix(const stream_prefix& prefix, uint8_t* out) {
+    auto id = pack_uint32_le(prefix.id);
+    auto seq = pack_uint32_le(prefix.seq);
+    std::copy(id.begin(), id.end(), out);
+    std::copy(seq.begin(), seq.end(), out + 4);
+    if (prefix.seq != 1) {
+        return STREAM_PREFIX_SIZE;
+    }
+
+    auto low = pack_uint32_le(static_cast<uint32_t>(prefix.total_size));
+    auto high = pack_uint32_le(static_cast<uint32_t>(prefix.total_size >> 32));
+    std::copy(low.begin(), low.end(), out + 8);
+    std::copy(high.begin(), high.end(), out + 12);
+    return FIRST_STREAM_PREFIX_SIZE;
+}
+
+size_t unpack_stream_prefix(byte_span payload, stream_prefix& prefix) {
+    if (payload.size() < STREAM_PREFIX_SIZE) {
+        return 0;
+    }
+    prefix.id = unpack_uint32_le(payload.data());
+    prefix.seq = unpack_uint32_le(payload.data() + 4);
+    prefix.total_size = 0;
+    if (prefix.seq != 1) {
+        return STREAM_PREFIX_SIZE;
+    }
+
+    if (payload.size() < FIRST_STREAM_PREFIX_SIZE) {
+        return 0;
+    }
+    prefix.total_size = unpack_uint32_le(payload.data() + 8) |
+                        (static_cast<uint64_t>(unpack_uint32_le(payload.data() + 12)) << 32);
+    return FIRST_STREAM_PREFIX_SIZE;
+}
+
+frame_view::frame_view(const frame& f)
+    : type(f.type), flags(f.flags), payload(f.payload), owner_(nullptr) {
+}
+
+buffer_ptr frame_view::take_buffer() const {
+    if (!owner_) {
+        return nullptr;
+    }
+    return std::move(*owner_);
+}
+
+frame_header frame_view::header() const {
+    // Type and flags followed by the payload length (little endian)
+    frame_header result{};
+    if (flags & FLAG_EXTENDED) {
+        assert(payload.size() <= UINT32_MAX);
+        auto length_bytes = pack_uint32_le(static_cast<uint32_t>(payload.size()));
+        result.bytes = {type, flags, length_bytes[0], length_bytes[1], length_bytes[2], length_bytes[3]};
+        result.length = EXTENDED_HEADER_SIZE;
+    } else {
+        assert(payload.size() <= UINT16_MAX);
+        auto length_bytes = pack_uint16_le(static_cast<uint16_t>(payload.size()));
+        result.bytes = {type, flags, length_bytes[0], length_bytes[1]};
+        result.length = FRAME_HEADER_SIZE;
+    }
+    return result;
+}
+
 std::vector<uint8_t> frame::serialize() const {
     std::vector<uint8_t> result;
-    result.reserve(FRAME_HEADER_SIZE + payload.size());
+    auto header_bytes = frame_view(*this).header();
+    result.reserve(header_bytes.size() + payload.size());
 
-    // Add type and flags
-    result.push_back(type);
-    result.push_back(flags);
-
-    // Add payload length (little endian)
-    auto length_bytes = pack_uint16_le((uint16_t)payload.size());
-    result.push_back(length_bytes[0]);
-    result.push_back(length_bytes[1]);
+    // Add header
+    result.insert(result.end(), header_bytes.begin(), header_bytes.end());
 
     // Add payload
     result.insert(result.end(), payload.begin(), payload.end());
@@ -42,16 +124,20 @@ std::optional<frame> frame::deserialize(const uint8_t* data, size_t size) {
     // Extract header fields
     uint8_t frame_type = data[0];
     uint8_t frame_flags = data[1];
-    uint16_t payload_length = unpack_uint16_le(&data[2]);
+    size_t header_size = frame_header_size(frame_flags);
+    if (size < header_size) {
+        return std::nullopt;
+    }
+    size_t payload_length = unpack_payload_size(data);
 
     // Check if we have enough data for the payload
-    if (size < FRAME_HEADER_SIZE + payload_length) {
+    if (size - header_size < payload_length) {
         return std::nullopt;
     }
 
     // Extract payload
-    std::vector<uint8_t> payload(data + FRAME_HEADER_SIZE,
-                                data + FRAME_HEADER_SIZE + payload_length);
+    std::vector<uint8_t> payload(data + header_size,
+                                data + header_size + payload_length);
 
     return frame(frame_type, frame_flags, std::move(payload));
 }
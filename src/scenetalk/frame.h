@@ -6,6 +6,8 @@
 #include <memory>
 #include <string>
 #include <optional>
+#include <span>
+#include "buffer_pool.h"
 
 namespace scene_talk {
 
@@ -16,16 +18,101 @@ constexpr uint8_t BEGIN = 'B';
 constexpr uint8_t END = 'E';
 constexpr uint8_t LOG = 'L';
 constexpr uint8_t ATTRIBUTE = 'S';
+constexpr uint8_t ANIMATION = 'A';
 constexpr uint8_t FILE_REF = 'F';
 constexpr uint8_t PARTIAL = 'Z';
 constexpr uint8_t FLOW = 'X';
 
+// Frame flag bits
+constexpr uint8_t FLAG_PARTIAL = 0x01;    // Content fragment of a split payload
+constexpr uint8_t FLAG_EXTENDED = 0x02;   // Header carries a 32-bit payload length
+constexpr uint8_t FLAG_COMPRESSED = 0x04; // Payload is compressed, see compression.h
+constexpr uint8_t FLAG_STREAM = 0x08;     // Fragment starts with a stream_prefix instead of following a PARTIAL frame
+
 // Frame header size (type + flags + length)
 constexpr size_t FRAME_HEADER_SIZE = 4;
 
+// Extended frame header size (type + flags + 32-bit length)
+constexpr size_t EXTENDED_HEADER_SIZE = 6;
+constexpr size_t MAX_FRAME_HEADER_SIZE = EXTENDED_HEADER_SIZE;
+
 // Maximum payload size
 constexpr size_t MAX_PAYLOAD_SIZE = (64 * 1024) - FRAME_HEADER_SIZE;
 
+// Default maximum payload size of an extended frame
+constexpr size_t MAX_EXTENDED_PAYLOAD_SIZE = 64 * 1024 * 1024;
+
+// Capability bits advertised in HELLO, a feature is only used when both peers advertise it
+constexpr uint32_t CAP_EXTENDED_LENGTH = 1u << 0;
+constexpr uint32_t CAP_COMPRESSION = 1u << 1;
+constexpr uint32_t CAP_STREAM_PREFIX = 1u << 2;
+constexpr uint32_t CAP_ATTRIBUTE_IDS = 1u << 3;
+constexpr uint32_t CAP_STRING_TABLE = 1u << 4;
+constexpr uint32_t CAP_FLOW_CREDIT = 1u << 5;
+
+// Capabilities implemented by this library
+constexpr uint32_t SUPPORTED_CAPS = CAP_EXTENDED_LENGTH | CAP_COMPRESSION | CAP_STREAM_PREFIX |
+                                    CAP_ATTRIBUTE_IDS | CAP_STRING_TABLE | CAP_FLOW_CREDIT;
+
+// Size of the header of a frame with the given flags
+constexpr size_t frame_header_size(uint8_t flags) {
+    return (flags & FLAG_EXTENDED) ? EXTENDED_HEADER_SIZE : FRAME_HEADER_SIZE;
+}
+
+// Payloads up to this size are received into inline storage instead of a pooled buffer
+constexpr size_t INLINE_PAYLOAD_SIZE = 32;
+
+// Contiguous run of bytes, one segment of a scatter-gather write
+using byte_span = std::span<const uint8_t>;
+
+struct frame;
+
+/**
+ * @brief Serialized frame header, standard or extended
+ */
+struct frame_header {
+    std::array<uint8_t, MAX_FRAME_HEADER_SIZE> bytes;
+    size_t length;
+
+    const uint8_t* data() const { return bytes.data(); }
+    size_t size() const { return length; }
+    const uint8_t* begin() const { return bytes.data(); }
+    const uint8_t* end() const { return bytes.data() + length; }
+};
+
+/**
+ * @brief A non-owning frame with its payload borrowed from the receive path
+ *
+ * The payload is only valid for the duration of the handler call. A handler
+ * that needs it for longer can take the pooled buffer holding it with
+ * take_buffer() or copy it into an owning frame.
+ */
+struct frame_view {
+    uint8_t type;
+    uint8_t flags;
+    std::span<const uint8_t> payload;
+
+    frame_view() : type(0), flags(0), payload(), owner_(nullptr) {}
+
+    frame_view(uint8_t t, uint8_t f, std::span<const uint8_t> p,
+               buffer_ptr* owner = nullptr)
+        : type(t), flags(f), payload(p), owner_(owner) {}
+
+    // View an owning frame
+    frame_view(const frame& f);
+
+    // Serialize the frame header, the payload follows it on the wire. Only
+    // frames with FLAG_EXTENDED get an extended header, others must fit a
+    // 16-bit length.
+    frame_header header() const;
+
+    // Take the pooled buffer holding the payload, nullptr if the payload is not pooled
+    buffer_ptr take_buffer() const;
+
+private:
+    buffer_ptr* owner_;
+};
+
 /**
  * @brief A simple frame structure with type, flags, and payload
  */
@@ -39,6 +126,10 @@ struct frame {
     frame(uint8_t t, uint8_t f, std::vector<uint8_t> p)
         : type(t), flags(f), payload(std::move(p)) {}
 
+    // Copy a borrowed frame into an owning frame
+    frame(const frame_view& view)
+        : type(view.type), flags(view.flags), payload(view.payload.begin(), view.payload.end()) {}
+
     // Serializes frame to a byte vector including header
     std::vector<uint8_t> serialize() const;
 
@@ -49,5 +140,37 @@ struct frame {
 // Utility functions
 std::array<uint8_t, 2> pack_uint16_le(uint16_t value);
 uint16_t unpack_uint16_le(const uint8_t* data);
+std::array<uint8_t, 4> pack_uint32_le(uint32_t value);
+uint32_t unpack_uint32_le(const uint8_t* data);
+
+// Payload length from a complete header
+size_t unpack_payload_size(const uint8_t* header);
+
+/**
+ * @brief Stream id and sequence number at the start of a FLAG_STREAM fragment
+ *
+ * Fragments of several streams can be interleaved with each other and with
+ * other frames since each one names its stream. Encoded little-endian as the
+ * 32-bit id and seq, followed by the 64-bit total size in the first fragment.
+ */
+struct stream_prefix {
+    uint32_t id = 0;
+    uint32_t seq = 0;           // 1 for the first fragment, then counting up, 0 for the last
+    uint64_t total_size = 0;    // Size of the whole payload, only sent with the first fragment
+};
+
+// Encoded size of a stream prefix
+constexpr size_t STREAM_PREFIX_SIZE = 8;
+constexpr size_t FIRST_STREAM_PREFIX_SIZE = 16;
+
+constexpr size_t stream_prefix_size(uint32_t seq) {
+    return seq == 1 ? FIRST_STREAM_PREFIX_SIZE : STREAM_PREFIX_SIZE;
+}
+
+// Encode a prefix, returns the number of bytes written to out
+size_t pack_stream_prefix(const stream_prefix& prefix, uint8_t* out);
+
+// Decode the prefix of a fragment, returns its size or 0 if the payload is too short
+size_t unpack_stream_prefix(byte_span payload, stream_prefix& prefix);
 
 } // namespace scene_talk
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include "frame_scheduler.h"
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+namespace scene_talk {
+
+// Segments passed to the writer in one call
+constexpr size_t MAX_SEGMENTS = 64;
+
+frame_priority default_priority(uint8_t frame_type) {
+    switch (frame_type) {
+        case HELLO:
+        case PING_PONG:
+        case FLOW:
+            return frame_priority::control;
+        case LOG:
+            return frame_priority::log;
+        default:
+            return frame_priority::bulk;
+    }
+}
+
+void frame_scheduler::mpsc_queue::push(queued_frame* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    queued_frame* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+frame_scheduler::queued_frame* frame_scheduler::mpsc_queue::pop() {
+    queued_frame* tail = tail_;
+    queued_frame* next = tail->next.load(std::memory_order_acquire);
+
+    // Skip the stub
+    if (tail == &stub_) {
+        if (!next) {
+            return nullptr;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+
+    // The tail is the last node unless a producer has not linked its node yet
+    if (tail != head_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    // Put the stub back behind the tail so the tail can be taken
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void frame_scheduler::frame_list::push_back(queued_frame* f) {
+    f->link = nullptr;
+    if (tail) {
+        tail->link = f;
+    } else {
+        head = f;
+    }
+    tail = f;
+}
+
+void frame_scheduler::frame_list::pop_front() {
+    head = head->link;
+    if (!head) {
+        tail = nullptr;
+    }
+}
+
+frame_scheduler::frame_scheduler(gather_writer writer, const std::shared_ptr<buffer_pool>& pool,
+                                 const scheduler_weights& weights)
+    : writer_(std::move(writer)),
+      pool_(pool),
+      quantum_{std::max(weights.control, 1u) * SCHEDULER_QUANTUM,
+               std::max(weights.log, 1u) * SCHEDULER_QUANTUM,
+               std::max(weights.bulk, 1u) * SCHEDULER_QUANTUM} {
+    segments_.reserve(MAX_SEGMENTS);
+    written_.reserve(MAX_SEGMENTS);
+}
+
+frame_scheduler::~frame_scheduler() {
+    collect();
+    for (auto& frames : classes_) {
+        while (!frames.empty()) {
+            queued_frame* f = frames.front();
+            frames.pop_front();
+            release(f);
+        }
+    }
+}
+
+frame_writer frame_scheduler::writer() {
+    auto state = std::make_shared<producer>();
+    return [this, state](const frame_view& f) {
+        enqueue(*state, default_priority(f.type), f);
+    };
+}
+
+frame_writer frame_scheduler::writer(frame_priority priority) {
+    auto state = std::make_shared<producer>();
+    return [this, state, priority](const frame_view& f) {
+        enqueue(*state, priority, f);
+    };
+}
+
+void frame_scheduler::attach(encoder& enc) {
+    // The top byte of the stream id tells the encoders apart
+    uint32_t index = attached_.fetch_add(1, std::memory_order_relaxed);
+    enc.set_next_stream_id(index << 24 | 1);
+    enc.set_shared_connection(true);
+}
+
+void frame_scheduler::enqueue(producer& state, frame_priority priority, const frame_view& f) {
+    auto header = f.header();
+    size_t frame_size = header.size() + f.payload.size();
+
+    // Hold a PARTIAL frame until its fragment arrives so no other fragment
+    // gets in between
+    if (f.type == PARTIAL) {
+        state.partial = pool_->get_buffer(frame_size);
+        std::copy(header.begin(), header.end(), state.partial->data());
+        std::copy(f.payload.begin(), f.payload.end(), state.partial->data() + header.size());
+        state.partial_size = frame_size;
+        return;
+    }
+
+    size_t size = state.partial_size + frame_size;
+    buffer_ptr data = pool_->get_buffer(sizeof(queued_frame) + size);
+    auto node = new (data->data()) queued_frame();
+    node->priority = priority;
+    node->size = size;
+    node->data = std::move(data);
+
+    uint8_t* out = node->bytes();
+    if (state.partial) {
+        out = std::copy(state.partial->data(), state.partial->data() + state.partial_size, out);
+        state.partial.reset();
+        state.partial_size = 0;
+    }
+    out = std::copy(header.begin(), header.end(), out);
+    std::copy(f.payload.begin(), f.payload.end(), out);
+
+    pending_bytes_.fetch_add(node->size, std::memory_order_relaxed);
+    queue_.push(node);
+}
+
+void frame_scheduler::release(queued_frame* f) {
+    // The buffer goes back to the pool once the node no longer uses it
+    buffer_ptr data = std::move(f->data);
+    f->~queued_frame();
+}
+
+void frame_scheduler::collect() {
+    while (queued_frame* f = queue_.pop()) {
+        classes_[static_cast<size_t>(f->priority)].push_back(f);
+    }
+}
+
+size_t frame_scheduler::run(size_t max_bytes) {
+    collect();
+
+    // Deficit round robin over the priority classes
+    size_t written_bytes = 0;
+    while (written_bytes < max_bytes) {
+        bool empty = std::all_of(classes_.begin(), classes_.end(),
+                                 [](const auto& frames) { return frames.empty(); });
+        if (empty) {
+            break;
+        }
+
+        auto& frames = classes_[current_class_];
+        if (frames.empty()) {
+            deficit_[current_class_] = 0;
+            next_class();
+            continue;
+        }
+
+        // Credit the class once per visit
+        if (!credited_) {
+            deficit_[current_class_] += quantum_[current_class_];
+            credited_ = true;
+        }
+
+        queued_frame* f = frames.front();
+        if (f->size > deficit_[current_class_]) {
+            next_class();
+            continue;
+        }
+
+        frames.pop_front();
+        deficit_[current_class_] -= f->size;
+        written_bytes += f->size;
+        segments_.emplace_back(f->bytes(), f->size);
+        written_.push_back(f);
+        if (segments_.size() == MAX_SEGMENTS) {
+            write_segments();
+        }
+    }
+
+    write_segments();
+    return written_bytes;
+}
+
+void frame_scheduler::write_segments() {
+    if (segments_.empty()) {
+        return;
+    }
+
+    writer_(segments_);
+
+    size_t written_bytes = 0;
+    for (queued_frame* f : written_) {
+        written_bytes += f->size;
+        release(f);
+    }
+    pending_bytes_.fetch_sub(written_bytes, std::memory_order_relaxed);
+    segments_.clear();
+    written_.clear();
+}
+
+void frame_scheduler::next_class() {
+    current_class_ = (current_class_ + 1) % PRIORITY_COUNT;
+    credited_ = false;
+}
+
+} // namespace scene_talk
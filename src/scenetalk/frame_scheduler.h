@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "frame.h"
+#include "buffer_pool.h"
+#include "encoder.h"
+
+namespace scene_talk {
+
+/**
+ * @brief Priority classes of outgoing frames
+ */
+enum class frame_priority : uint8_t {
+    control,    // HELLO, PING_PONG and FLOW
+    log,        // LOG frames, progress and errors
+    bulk        // Scene data
+};
+
+constexpr size_t PRIORITY_COUNT = 3;
+
+// Priority class of a frame type
+frame_priority default_priority(uint8_t frame_type);
+
+/**
+ * @brief Relative bandwidth shares of the priority classes
+ *
+ * Each round a class may send weight * SCHEDULER_QUANTUM bytes while it has
+ * frames queued.
+ */
+struct scheduler_weights {
+    uint32_t control = 16;
+    uint32_t log = 4;
+    uint32_t bulk = 1;
+};
+
+// Bytes per unit of weight in each scheduling round
+constexpr size_t SCHEDULER_QUANTUM = 16 * 1024;
+
+/**
+ * @brief Orders the frames of one connection by priority
+ *
+ * Producers on any thread write frames through writer(), which queues a copy
+ * in a lock-free queue. The connection's output thread calls run() to pass
+ * the queued frames to the transport, interleaving the priority classes by
+ * weight at frame granularity so control and log frames are not stuck
+ * behind bulk geometry. Frames of one writer and class keep their order, so
+ * the fragments of a split payload stay in sequence.
+ *
+ * Encoders sharing a connection need disjoint stream ids and cannot use
+ * the string table, since the peer keeps one for the whole connection and
+ * frames of different encoders may be reordered. attach() sets up an
+ * encoder for both.
+ */
+class frame_scheduler {
+public:
+    /**
+     * @brief Create a scheduler
+     *
+     * @param writer Receives the serialized frames from run()
+     * @param pool Buffer pool for the queued frames
+     * @param weights Bandwidth shares of the priority classes
+     */
+    frame_scheduler(gather_writer writer, const std::shared_ptr<buffer_pool>& pool,
+                    const scheduler_weights& weights = {});
+    ~frame_scheduler();
+
+    frame_scheduler(const frame_scheduler&) = delete;
+    frame_scheduler& operator=(const frame_scheduler&) = delete;
+
+    /**
+     * @brief Get a writer queueing frames by their default_priority()
+     *
+     * Each writer may only be used by one thread at a time. A PARTIAL frame is
+     * queued together with the fragment following it.
+     */
+    frame_writer writer();
+
+    /**
+     * @brief Get a writer queueing all frames in one priority class
+     */
+    frame_writer writer(frame_priority priority);
+
+    /**
+     * @brief Prepare an encoder writing through one of the writers to share the connection
+     *
+     * Gives it a range of stream ids of its own and stops it from using the
+     * string table, see encoder::set_shared_connection().
+     */
+    void attach(encoder& enc);
+
+    /**
+     * @brief Write queued frames, only call from one thread at a time
+     *
+     * @param max_bytes Stop once this many bytes were written
+     * @return Number of bytes written
+     */
+    size_t run(size_t max_bytes = std::numeric_limits<size_t>::max());
+
+    /**
+     * @brief Bytes of frames queued and not yet written
+     */
+    [[nodiscard]] size_t pending_bytes() const { return pending_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief One or more serialized frames written as one unit
+     *
+     * Lives at the start of the pooled buffer holding its bytes, so queueing
+     * a frame only takes a buffer from the pool.
+     */
+    struct queued_frame {
+        std::atomic<queued_frame*> next{nullptr};
+        frame_priority priority = frame_priority::bulk;
+        buffer_ptr data;            // The buffer holding this node
+        size_t size = 0;
+        queued_frame* link = nullptr;   // Next in its priority class once collected
+
+        uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+
+    /**
+     * @brief Intrusive multi-producer single-consumer queue
+     *
+     * Producers swap themselves into the head, the consumer walks from the
+     * tail. A stub node keeps the queue non-empty.
+     */
+    class mpsc_queue {
+    public:
+        mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+
+        void push(queued_frame* node);
+
+        // Take the oldest node, nullptr if empty or a push is in progress
+        queued_frame* pop();
+
+    private:
+        queued_frame stub_;
+        alignas(64) std::atomic<queued_frame*> head_;
+        alignas(64) queued_frame* tail_;
+    };
+
+    // Frames of one priority class in the order they were collected
+    struct frame_list {
+        queued_frame* head = nullptr;
+        queued_frame* tail = nullptr;
+
+        bool empty() const { return head == nullptr; }
+        queued_frame* front() const { return head; }
+        void push_back(queued_frame* f);
+        void pop_front();
+    };
+
+    // Writer state, a PARTIAL frame waits for the fragment it announces
+    struct producer {
+        buffer_ptr partial;
+        size_t partial_size = 0;
+    };
+
+    // Destroy a queued_frame and return its buffer to the pool
+    static void release(queued_frame* f);
+
+    // Copy a frame into a queued_frame and push it
+    void enqueue(producer& state, frame_priority priority, const frame_view& f);
+
+    // Move frames from the queue to the priority classes
+    void collect();
+
+    // Pass collected segments to the writer and free their frames
+    void write_segments();
+
+    // Move to the next priority class in the round
+    void next_class();
+
+    gather_writer writer_;
+    std::shared_ptr<buffer_pool> pool_;
+    std::array<size_t, PRIORITY_COUNT> quantum_;
+    mpsc_queue queue_;
+    std::atomic<size_t> pending_bytes_{0};
+    std::atomic<uint32_t> attached_{0};
+
+    // Consumer state
+    std::array<frame_list, PRIORITY_COUNT> classes_;
+    std::array<size_t, PRIORITY_COUNT> deficit_{};
+    size_t current_class_ = 0;
+    bool credited_ = false;
+    std::vector<byte_span> segments_;
+    std::vector<queued_frame*> written_;
+};
+
+} // namespace scene_talk
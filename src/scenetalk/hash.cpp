@@ -0,0 +1,76 @@
+#include "hash.h"
+#include "byte_order.h"
+#include <bit>
+
+namespace scene_talk {
+
+namespace {
+
+// XXH64 primes
+constexpr uint64_t P1 = 11400714785074694791ull;
+constexpr uint64_t P2 = 14029467366897019727ull;
+constexpr uint64_t P3 = 1609587929392839161ull;
+constexpr uint64_t P4 = 9650029242287828579ull;
+constexpr uint64_t P5 = 2870177450012600261ull;
+
+uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    return std::rotl(acc, 31) * P1;
+}
+
+uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * P1 + P4;
+}
+
+} // namespace
+
+uint64_t xxh64(std::span<const uint8_t> data, uint64_t seed) {
+    const uint8_t* p = data.data();
+    const uint8_t* end = p + data.size();
+    uint64_t h;
+
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read_le<uint64_t>(p));
+            v2 = xxh64_round(v2, read_le<uint64_t>(p + 8));
+            v3 = xxh64_round(v3, read_le<uint64_t>(p + 16));
+            v4 = xxh64_round(v4, read_le<uint64_t>(p + 24));
+        }
+        h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += data.size();
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read_le<uint64_t>(p));
+        h = std::rotl(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        h ^= read_le<uint32_t>(p) * P1;
+        h = std::rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * P5;
+        h = std::rotl(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace scene_talk
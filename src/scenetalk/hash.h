@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+namespace scene_talk {
+
+/**
+ * @brief XXH64 of a byte range
+ *
+ * Fast non-cryptographic hash, the same as the reference implementation so
+ * hashes can be checked against other tools.
+ */
+uint64_t xxh64(std::span<const uint8_t> data, uint64_t seed = 0);
+
+} // namespace scene_talk
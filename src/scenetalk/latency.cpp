@@ -0,0 +1,121 @@
+#include "latency.h"
+#include <algorithm>
+#include <cmath>
+
+namespace scene_talk {
+
+size_t latency_histogram::bucket_index(uint64_t value) {
+    // The top SUB_BUCKET_BITS + 1 bits pick the bucket
+    int shift = 0;
+    while ((value >> shift) >= 2 * SUB_BUCKETS) {
+        shift++;
+    }
+    return SUB_BUCKETS * shift + (value >> shift);
+}
+
+uint64_t latency_histogram::bucket_low(size_t index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    size_t shift = index / SUB_BUCKETS - 1;
+    return (index - SUB_BUCKETS * shift) << shift;
+}
+
+uint64_t latency_histogram::bucket_width(size_t index) {
+    return index < 2 * SUB_BUCKETS ? 1 : uint64_t(1) << (index / SUB_BUCKETS - 1);
+}
+
+void latency_histogram::record(duration value) {
+    uint64_t us = std::min<uint64_t>(std::max<int64_t>(value.count(), 0), (uint64_t(1) << MAX_VALUE_BITS) - 1);
+    buckets_[bucket_index(us)]++;
+    count_++;
+    sum_ += us;
+    min_ = std::min(min_, us);
+    max_ = std::max(max_, us);
+}
+
+void latency_histogram::reset() {
+    buckets_.fill(0);
+    count_ = 0;
+    sum_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+}
+
+latency_histogram::duration latency_histogram::percentile(double fraction) const {
+    if (count_ == 0) {
+        return duration(0);
+    }
+
+    auto rank = static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * count_));
+    if (rank >= count_) {
+        return duration(max_);
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets_[i];
+        if (seen >= std::max<uint64_t>(rank, 1)) {
+            // The middle of the bucket, but never outside what was recorded
+            uint64_t value = bucket_low(i) + bucket_width(i) / 2;
+            return duration(std::clamp(value, min_, max_));
+        }
+    }
+    return duration(max_);
+}
+
+latency_summary latency_histogram::summary() const {
+    latency_summary s;
+    s.count = count_;
+    s.min_us = min().count();
+    s.mean_us = mean().count();
+    s.p50_us = percentile(0.5).count();
+    s.p90_us = percentile(0.9).count();
+    s.p99_us = percentile(0.99).count();
+    s.max_us = max().count();
+    return s;
+}
+
+uint32_t latency_tracker::start_ping(clock::time_point now) {
+    if (outstanding_.size() == MAX_OUTSTANDING) {
+        outstanding_.pop_front();
+        pings_lost_++;
+    }
+    uint32_t nonce = next_nonce_++;
+    outstanding_.emplace_back(nonce, now);
+    pings_sent_++;
+    return nonce;
+}
+
+bool latency_tracker::on_pong(uint32_t nonce, clock::time_point now) {
+    auto it = std::find_if(outstanding_.begin(), outstanding_.end(),
+                           [nonce](const auto& ping) { return ping.first == nonce; });
+    if (it == outstanding_.end()) {
+        return false;
+    }
+
+    rtt_.record(std::chrono::duration_cast<latency_histogram::duration>(now - it->second));
+    outstanding_.erase(it);
+    pongs_received_++;
+    return true;
+}
+
+void latency_tracker::on_peer_ping(double sent_s, std::chrono::system_clock::time_point now) {
+    // The clock offset is part of every one-way delay, it cancels out against the lowest
+    auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    auto one_way_us = now_us - static_cast<int64_t>(std::llround(sent_s * 1e6));
+    min_one_way_us_ = std::min(min_one_way_us_, one_way_us);
+    queue_delay_.record(latency_histogram::duration(one_way_us - min_one_way_us_));
+}
+
+latency_stats latency_tracker::stats() const {
+    latency_stats s;
+    s.rtt = rtt_.summary();
+    s.queue_delay = queue_delay_.summary();
+    s.pings_sent = pings_sent_;
+    s.pongs_received = pongs_received_;
+    s.pings_lost = pings_lost_;
+    s.peer_pings = queue_delay_.count();
+    return s;
+}
+
+} // namespace scene_talk
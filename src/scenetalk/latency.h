@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace scene_talk {
+
+/**
+ * @brief Latency measurement from PING-PONG frames
+ *
+ * A side sends pings {"nonce": n, "time_ms": t} and the peer echoes them
+ * unchanged, matching the nonce gives the round trip time. The time stamp of
+ * pings from the peer gives the one-way delay up to the unknown clock offset,
+ * the delay above the lowest one seen is queueing in buffers on the way.
+ *
+ * Nothing in here depends on the rest of the library, and it sticks to
+ * C++17, so the worker can track its websocket connections with it too.
+ */
+
+/**
+ * @brief Percentiles of a latency histogram, in microseconds
+ */
+struct latency_summary {
+    uint64_t count = 0;
+    uint64_t min_us = 0;
+    uint64_t mean_us = 0;
+    uint64_t p50_us = 0;
+    uint64_t p90_us = 0;
+    uint64_t p99_us = 0;
+    uint64_t max_us = 0;
+};
+
+/**
+ * @brief Log-linear histogram of durations, as HDR histograms do
+ *
+ * Each power of two is split into 16 buckets so values are kept to within
+ * about 6%, with a fixed 4KB of counters for anything up to an hour.
+ */
+class latency_histogram {
+public:
+    using duration = std::chrono::microseconds;
+
+    void record(duration value);
+    void reset();
+
+    [[nodiscard]] uint64_t count() const { return count_; }
+    [[nodiscard]] duration min() const { return duration(count_ ? min_ : 0); }
+    [[nodiscard]] duration max() const { return duration(max_); }
+    [[nodiscard]] duration mean() const { return duration(count_ ? sum_ / count_ : 0); }
+
+    /**
+     * @brief Value below which a fraction of the recorded values fall
+     *
+     * @param fraction Between 0 and 1, 0.99 for the 99th percentile
+     */
+    [[nodiscard]] duration percentile(double fraction) const;
+
+    [[nodiscard]] latency_summary summary() const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 32;
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_low(size_t index);
+    static uint64_t bucket_width(size_t index);
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+/**
+ * @brief Latency counters of a connection
+ */
+struct latency_stats {
+    latency_summary rtt;
+    latency_summary queue_delay;
+    uint64_t pings_sent = 0;
+    uint64_t pongs_received = 0;
+    uint64_t pings_lost = 0;             // Pushed out by newer pings before their pong came
+    uint64_t peer_pings = 0;
+};
+
+/**
+ * @brief Matches pings with pongs and keeps latency histograms of a connection
+ */
+class latency_tracker {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Pings still waiting for their pong
+    static constexpr size_t MAX_OUTSTANDING = 16;
+
+    /**
+     * @param first_nonce Nonce of the first ping, pick one the peer does not
+     *                    use so its own pings are not taken for pongs
+     */
+    explicit latency_tracker(uint32_t first_nonce = 1) : next_nonce_(first_nonce) {}
+
+    /**
+     * @brief Note a ping going out
+     *
+     * @return The nonce to send with it
+     */
+    uint32_t start_ping(clock::time_point now = clock::now());
+
+    /**
+     * @brief Handle a PING-PONG carrying a nonce
+     *
+     * @return True if it was the pong of one of our pings, false if it is
+     *         a ping of the peer to echo
+     */
+    bool on_pong(uint32_t nonce, clock::time_point now = clock::now());
+
+    /**
+     * @brief Record the queueing delay of a ping from the peer
+     *
+     * @param sent_s Time stamp of the ping, seconds since the epoch
+     */
+    void on_peer_ping(double sent_s,
+                      std::chrono::system_clock::time_point now = std::chrono::system_clock::now());
+
+    [[nodiscard]] const latency_histogram& rtt() const { return rtt_; }
+    [[nodiscard]] const latency_histogram& queue_delay() const { return queue_delay_; }
+    [[nodiscard]] latency_stats stats() const;
+
+private:
+    std::deque<std::pair<uint32_t, clock::time_point>> outstanding_;
+    uint32_t next_nonce_;
+    latency_histogram rtt_;
+    latency_histogram queue_delay_;
+    int64_t min_one_way_us_ = INT64_MAX;
+    uint64_t pings_sent_ = 0;
+    uint64_t pongs_received_ = 0;
+    uint64_t pings_lost_ = 0;
+};
+
+} // namespace scene_talk
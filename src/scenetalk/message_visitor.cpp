@@ -0,0 +1,457 @@
+#include "message_visitor.h"
+#include "attribute_registry.h"
+#include "cbor_reader.h"
+#include "string_table.h"
+#include "vertex_encoding.h"
+
+namespace scene_talk {
+
+namespace {
+
+// Tags 64 to 87 are the RFC 8746 typed arrays
+constexpr uint64_t FIRST_TYPED_ARRAY_TAG = 64;
+constexpr uint64_t LAST_TYPED_ARRAY_TAG = 87;
+
+// Replace a typed vertex attribute value with an array of numbers
+void dequantize_attribute(nlohmann::json& payload) {
+    if (!payload.is_object() || !payload.contains("value") || !payload.contains("type") ||
+        !payload["type"].is_string()) {
+        return;
+    }
+
+    auto array = read_vertex_array(payload["value"], vector_components(payload["type"]));
+    if (array) {
+        payload["value"] = dequantize(*array);
+    }
+}
+
+enum class attr_field {
+    name,
+    type,
+    value,
+    removed,
+    other
+};
+
+// Key of an ATTRIBUTE map entry, a string or a compact integer key
+attr_field read_attr_key(cbor_reader& reader) {
+    if (reader.peek_major() == CBOR_UINT) {
+        switch (reader.read_uint()) {
+            case ATTR_KEY_NAME: return attr_field::name;
+            case ATTR_KEY_TYPE: return attr_field::type;
+            case ATTR_KEY_VALUE: return attr_field::value;
+            default: return attr_field::other;
+        }
+    }
+
+    std::string_view key = reader.read_text();
+    if (key == "name") {
+        return attr_field::name;
+    } else if (key == "type") {
+        return attr_field::type;
+    } else if (key == "value") {
+        return attr_field::value;
+    } else if (key == "removed") {
+        return attr_field::removed;
+    }
+    return attr_field::other;
+}
+
+// Whether the next item is a string table entry
+bool is_table_string(const cbor_reader& reader) {
+    if (reader.peek_major() != CBOR_TAG) {
+        return false;
+    }
+    cbor_reader peek = reader;
+    uint64_t tag = peek.read_tag();
+    return tag == STRING_DEFINE_TAG || tag == STRING_REF_TAG;
+}
+
+// A string, possibly a string table entry, definitions are passed to define
+template <typename Define>
+std::string_view read_string(cbor_reader& reader, const string_table* strings, Define&& define) {
+    if (reader.peek_major() != CBOR_TAG) {
+        return reader.read_text();
+    }
+
+    uint64_t tag = reader.read_tag();
+    if (tag == STRING_DEFINE_TAG) {
+        std::string_view value = reader.read_text();
+        define(value);
+        return value;
+    }
+    if (tag == STRING_REF_TAG) {
+        uint64_t index = reader.read_uint();
+        auto value = strings ? strings->get(index) : std::nullopt;
+        if (!value) {
+            throw cbor_error("unknown string table entry");
+        }
+        return *value;
+    }
+    throw cbor_error("unexpected tag on a string");
+}
+
+// Attribute name, a string or a core attribute id
+template <typename Define>
+std::string_view read_attr_name(cbor_reader& reader, const string_table* strings, Define&& define) {
+    if (reader.peek_major() != CBOR_UINT) {
+        return read_string(reader, strings, define);
+    }
+    const core_attr_info* info = core_attr_by_id(reader.read_uint());
+    if (!info) {
+        throw cbor_error("unknown attribute id");
+    }
+    return info->name;
+}
+
+// Attribute type, a string or a value type id
+template <typename Define>
+std::string_view read_attr_type(cbor_reader& reader, const string_table* strings, Define&& define) {
+    if (reader.peek_major() != CBOR_UINT) {
+        return read_string(reader, strings, define);
+    }
+    const value_type_info* info = value_type_by_id(reader.read_uint());
+    if (!info) {
+        throw cbor_error("unknown value type id");
+    }
+    return info->name;
+}
+
+// Adds definitions to the table as they are read
+auto insert_into(string_table* strings) {
+    return [strings](std::string_view value) {
+        if (strings) {
+            strings->insert(value);
+        }
+    };
+}
+
+// Only reports definitions through the prefix, the table is left alone
+auto defer_to(typed_array_prefix& prefix) {
+    return [&prefix](std::string_view value) {
+        if (prefix.defined_count == prefix.defined.size()) {
+            throw cbor_error("too many string definitions");
+        }
+        prefix.defined[prefix.defined_count++] = value;
+    };
+}
+
+std::string_view read_string(cbor_reader& reader, string_table* strings) {
+    return read_string(reader, strings, insert_into(strings));
+}
+
+std::string_view read_attr_name(cbor_reader& reader, string_table* strings) {
+    return read_attr_name(reader, strings, insert_into(strings));
+}
+
+std::string_view read_attr_type(cbor_reader& reader, string_table* strings) {
+    return read_attr_type(reader, strings, insert_into(strings));
+}
+
+// {"depth": int, "type": str, "name": str}, or {"name": str, "removed": true}
+void visit_begin(message_visitor& visitor, cbor_reader& reader, string_table* strings) {
+    std::string_view entity_type;
+    std::string_view name;
+    int64_t depth = 0;
+    bool removed = false;
+
+    for (size_t entries = reader.read_map(); entries > 0; entries--) {
+        std::string_view key = reader.read_text();
+        if (key == "depth") {
+            depth = reader.read_int();
+        } else if (key == "type") {
+            entity_type = read_string(reader, strings);
+        } else if (key == "name") {
+            name = read_string(reader, strings);
+        } else if (key == "removed") {
+            removed = reader.read_bool();
+        } else {
+            reader.skip();
+        }
+    }
+
+    if (removed) {
+        visitor.on_prim_removed(name);
+        return;
+    }
+    visitor.on_begin(entity_type, name, static_cast<int>(depth));
+}
+
+// [depth]
+void visit_end(message_visitor& visitor, cbor_reader& reader) {
+    if (reader.read_array() < 1) {
+        throw cbor_error("END without depth");
+    }
+    visitor.on_end(static_cast<int>(reader.read_int()));
+}
+
+// {"name": str, "type": str, "value": any} or its compact form, in any key order,
+// or {"name": str, "removed": true}
+void visit_attr(message_visitor& visitor, cbor_reader& reader, string_table* strings) {
+    std::string_view name;
+    std::string_view attr_type;
+    std::span<const uint8_t> value;
+    std::optional<std::string_view> string_value;
+    bool removed = false;
+
+    for (size_t entries = reader.read_map(); entries > 0; entries--) {
+        switch (read_attr_key(reader)) {
+            case attr_field::name:
+                name = read_attr_name(reader, strings);
+                break;
+            case attr_field::type:
+                attr_type = read_attr_type(reader, strings);
+                break;
+            case attr_field::value:
+                if (is_table_string(reader)) {
+                    string_value = read_string(reader, strings);
+                } else {
+                    value = reader.skip();
+                }
+                break;
+            case attr_field::removed:
+                removed = reader.read_bool();
+                break;
+            case attr_field::other:
+                reader.skip();
+                break;
+        }
+    }
+
+    if (removed) {
+        visitor.on_attr_removed(name);
+        return;
+    }
+    if (string_value) {
+        visitor.on_attr(name, attr_type, nlohmann::json(*string_value));
+        return;
+    }
+    if (value.empty()) {
+        throw cbor_error("ATTRIBUTE without value");
+    }
+
+    // Typed arrays are handed over as views, anything else as json
+    cbor_reader value_reader(value);
+    if (value_reader.peek_major() == CBOR_TAG) {
+        uint64_t tag = value_reader.read_tag();
+        if (tag >= FIRST_TYPED_ARRAY_TAG && tag <= LAST_TYPED_ARRAY_TAG &&
+            value_reader.peek_major() == CBOR_BYTES) {
+            visitor.on_attr_typed_array(name, attr_type, typed_array_view{tag, value_reader.read_bytes()});
+            return;
+        }
+    }
+
+    visitor.on_attr(name, attr_type, parse_cbor_payload(value));
+}
+
+// Bytes of a float32 typed array
+std::span<const uint8_t> read_float_bytes(cbor_reader& reader) {
+    if (reader.read_tag() != TAG_FLOAT32_LE) {
+        throw cbor_error("expected a float32 array");
+    }
+    return reader.read_bytes();
+}
+
+// Samples of an attribute, see sample_options for the layout
+void visit_animation(message_visitor& visitor, cbor_reader& reader, string_table* strings,
+                     std::vector<float>& times, std::vector<float>& samples, std::vector<float>& bounds) {
+    std::string_view name;
+    std::string_view attr_type;
+    uint64_t components = 0;
+    std::span<const uint8_t> time_bytes;
+    uint64_t values_tag = 0;
+    std::span<const uint8_t> value_bytes;
+    std::span<const uint8_t> min_bytes;
+    std::span<const uint8_t> max_bytes;
+    bool quantized = false;
+    bool delta = false;
+
+    for (size_t entries = reader.read_map(); entries > 0; entries--) {
+        std::string_view key = reader.read_text();
+        if (key == "name") {
+            name = read_attr_name(reader, strings);
+        } else if (key == "type") {
+            attr_type = read_attr_type(reader, strings);
+        } else if (key == "components") {
+            components = reader.read_uint();
+        } else if (key == "times") {
+            time_bytes = read_float_bytes(reader);
+        } else if (key == "values") {
+            values_tag = reader.read_tag();
+            value_bytes = reader.read_bytes();
+        } else if (key == "enc") {
+            if (reader.read_text() != "q16") {
+                throw cbor_error("unsupported ANIMATION encoding");
+            }
+            quantized = true;
+        } else if (key == "min") {
+            min_bytes = read_float_bytes(reader);
+        } else if (key == "max") {
+            max_bytes = read_float_bytes(reader);
+        } else if (key == "delta") {
+            delta = reader.read_bool();
+        } else {
+            reader.skip();
+        }
+    }
+
+    if (components == 0) {
+        throw cbor_error("ANIMATION without components");
+    }
+
+    times.clear();
+    read_float_array(time_bytes, times);
+    bounds.clear();
+    if (quantized) {
+        read_float_array(min_bytes, bounds);
+        read_float_array(max_bytes, bounds);
+    }
+    auto bound_span = std::span<const float>(bounds);
+    size_t bound_size = quantized ? components : 0;
+    if (bounds.size() != 2 * bound_size ||
+        !decode_samples(values_tag, value_bytes, components, delta, bound_span.first(bound_size),
+                        bound_span.subspan(bound_size), samples)) {
+        throw cbor_error("unsupported ANIMATION values");
+    }
+    if (samples.size() != times.size() * components) {
+        throw cbor_error("ANIMATION values do not match its times");
+    }
+
+    visitor.on_animation(name, attr_type, animation_samples{times, samples, components});
+}
+
+} // namespace
+
+nlohmann::json parse_cbor_payload(std::span<const uint8_t> payload) {
+    return nlohmann::json::from_cbor(payload.begin(), payload.end(), true, true,
+                                     nlohmann::json::cbor_tag_handler_t::store);
+}
+
+void message_visitor::on_message(uint8_t type, std::span<const uint8_t> payload) {
+    cbor_reader reader(payload);
+
+    switch (type) {
+        case BEGIN:
+            visit_begin(*this, reader, strings_);
+            break;
+        case END:
+            visit_end(*this, reader);
+            break;
+        case ATTRIBUTE:
+            visit_attr(*this, reader, strings_);
+            break;
+        case ANIMATION:
+            visit_animation(*this, reader, strings_, times_, samples_, bounds_);
+            break;
+        default:
+            on_other(type, parse_cbor_payload(payload));
+            break;
+    }
+}
+
+void message_visitor::on_attr_typed_array_chunk(uint32_t stream, std::string_view name, std::string_view attr_type,
+                                                uint64_t tag, size_t offset,
+                                                std::span<const uint8_t> chunk, size_t total) {
+    std::vector<uint8_t>& chunks = chunks_[stream];
+    if (offset == 0) {
+        chunks.clear();
+        chunks.reserve(total);
+    }
+    chunks.insert(chunks.end(), chunk.begin(), chunk.end());
+
+    if (offset + chunk.size() == total) {
+        on_attr_typed_array(name, attr_type, typed_array_view{tag, chunks});
+        chunks_.erase(stream);
+    }
+}
+
+void message_visitor::on_typed_array_dropped(uint32_t stream) {
+    chunks_.erase(stream);
+}
+
+prefix_status parse_typed_array_prefix(std::span<const uint8_t> data, typed_array_prefix& prefix,
+                                       const string_table* strings) {
+    prefix.defined_count = 0;
+    try {
+        cbor_reader reader(data);
+        bool has_name = false;
+        bool has_type = false;
+
+        for (size_t entries = reader.read_map(); entries > 0; entries--) {
+            attr_field field = read_attr_key(reader);
+            if (field == attr_field::name) {
+                prefix.name = read_attr_name(reader, strings, defer_to(prefix));
+                has_name = true;
+            } else if (field == attr_field::type) {
+                prefix.attr_type = read_attr_type(reader, strings, defer_to(prefix));
+                has_type = true;
+            } else if (field == attr_field::value) {
+                // Only a trailing typed array after the name and type can be streamed
+                if (entries != 1 || !has_name || !has_type || reader.peek_major() != CBOR_TAG) {
+                    return prefix_status::other;
+                }
+                prefix.tag = reader.read_tag();
+                if (prefix.tag < FIRST_TYPED_ARRAY_TAG || prefix.tag > LAST_TYPED_ARRAY_TAG ||
+                    reader.peek_major() != CBOR_BYTES) {
+                    return prefix_status::other;
+                }
+                prefix.data_size = reader.read_bytes_size();
+                prefix.data_offset = reader.position();
+                return prefix_status::typed_array;
+            } else {
+                reader.skip();
+            }
+        }
+        return prefix_status::other;
+    } catch (const cbor_truncated&) {
+        return prefix_status::incomplete;
+    } catch (const cbor_error&) {
+        return prefix_status::other;
+    }
+}
+
+nlohmann::json parse_message_payload(uint8_t type, std::span<const uint8_t> payload,
+                                     string_table* strings) {
+    cbor_reader reader(payload);
+    bool attribute = type == ATTRIBUTE || type == ANIMATION;
+    if ((type != BEGIN && !attribute) || reader.peek_major() != CBOR_MAP) {
+        return parse_cbor_payload(payload);
+    }
+
+    // Walk the top level map to expand compact keys and string table entries
+    nlohmann::json document = nlohmann::json::object();
+    for (size_t entries = reader.read_map(); entries > 0; entries--) {
+        std::string key;
+        if (type == ATTRIBUTE && reader.peek_major() == CBOR_UINT) {
+            attr_field field = read_attr_key(reader);
+            if (field == attr_field::other) {
+                reader.skip();
+                continue;
+            }
+            key = field == attr_field::name ? "name" : field == attr_field::type ? "type" : "value";
+        } else {
+            key = reader.read_text();
+        }
+
+        if (attribute && key == "name") {
+            document[key] = read_attr_name(reader, strings);
+        } else if (attribute && key == "type") {
+            document[key] = read_attr_type(reader, strings);
+        } else if (is_table_string(reader)) {
+            document[key] = read_string(reader, strings);
+        } else {
+            document[key] = parse_cbor_payload(reader.skip());
+        }
+    }
+    return document;
+}
+
+void json_visitor::on_message(uint8_t type, std::span<const uint8_t> payload) {
+    nlohmann::json document = parse_message_payload(type, payload, strings());
+    if (dequantize_ && type == ATTRIBUTE) {
+        dequantize_attribute(document);
+    }
+    handler_(type, document);
+}
+
+} // namespace scene_talk
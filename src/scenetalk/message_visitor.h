@@ -0,0 +1,203 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "animation.h"
+#include "frame.h"
+
+namespace scene_talk {
+
+class string_table;
+
+/**
+ * @brief Callback for handling decoded messages
+ */
+using message_handler = std::function<void(uint8_t type, const nlohmann::json& payload)>;
+
+/**
+ * @brief A CBOR typed array (RFC 8746) borrowed from a frame payload
+ */
+struct typed_array_view {
+    uint64_t tag;
+    std::span<const uint8_t> bytes;
+
+    /**
+     * @brief View the elements as T
+     *
+     * Empty unless the host is little endian and the data is aligned for T,
+     * callers then fall back to copying the bytes.
+     */
+    template<typename T>
+    std::span<const T> as() const {
+        if constexpr (std::endian::native != std::endian::little) {
+            return {};
+        }
+        if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(T) != 0) {
+            return {};
+        }
+        return {reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T)};
+    }
+};
+
+/**
+ * @brief Receives decoded messages without building a json document
+ *
+ * The default on_message() parses the payload in place and calls the
+ * callbacks below. Strings and typed arrays are views into the frame payload
+ * and are only valid for the duration of the call.
+ */
+class message_visitor {
+public:
+    virtual ~message_visitor() = default;
+
+    /**
+     * @brief Handle the complete CBOR payload of a message
+     *
+     * @throws cbor_error if the payload is malformed
+     */
+    virtual void on_message(uint8_t type, std::span<const uint8_t> payload);
+
+    virtual void on_begin(std::string_view /*entity_type*/, std::string_view /*name*/, int /*depth*/) {}
+
+    virtual void on_end(int /*depth*/) {}
+
+    // Attribute whose value is a typed array such as the encoder's span overloads send
+    virtual void on_attr_typed_array(std::string_view /*name*/, std::string_view /*attr_type*/,
+                                     const typed_array_view& /*value*/) {}
+
+    /**
+     * @brief Part of a typed array attribute still arriving in PARTIAL fragments
+     *
+     * Called with consecutive chunks as fragments arrive, so receivers can
+     * fill vertex buffers before the last fragment lands. Chunks may split
+     * elements, and chunks of interleaved streams may alternate. The default
+     * collects the chunks of each stream and calls on_attr_typed_array() once
+     * the array is complete.
+     *
+     * @param stream Id of the stream the array arrives in
+     * @param name Attribute name
+     * @param attr_type Attribute type
+     * @param tag Typed array tag
+     * @param offset Byte offset of the chunk in the array
+     * @param chunk The bytes, only valid for the duration of the call
+     * @param total Size of the whole array in bytes
+     */
+    virtual void on_attr_typed_array_chunk(uint32_t stream, std::string_view name, std::string_view attr_type,
+                                           uint64_t tag, size_t offset,
+                                           std::span<const uint8_t> chunk, size_t total);
+
+    // Stream dropped before its typed array was complete, no more chunks follow
+    virtual void on_typed_array_dropped(uint32_t stream);
+
+    // Attribute with any other value
+    virtual void on_attr(std::string_view /*name*/, std::string_view /*attr_type*/,
+                         const nlohmann::json& /*value*/) {}
+
+    // Attribute of the current prim removed by a delta update, see encoder::set_delta_updates()
+    virtual void on_attr_removed(std::string_view /*name*/) {}
+
+    // Prim removed by a delta update, name is its absolute path
+    virtual void on_prim_removed(std::string_view /*name*/) {}
+
+    // Batch of time samples of an attribute from an ANIMATION frame
+    virtual void on_animation(std::string_view /*name*/, std::string_view /*attr_type*/,
+                              const animation_samples& /*samples*/) {}
+
+    // Frames other than BEGIN, END, ATTRIBUTE and ANIMATION
+    virtual void on_other(uint8_t /*type*/, const nlohmann::json& /*payload*/) {}
+
+    /**
+     * @brief Resolve string table entries with this table, set by the decoder
+     */
+    void set_string_table(string_table* strings) { strings_ = strings; }
+
+    [[nodiscard]] string_table* strings() const { return strings_; }
+
+private:
+    // Chunks collected by the default on_attr_typed_array_chunk(), by stream
+    std::unordered_map<uint32_t, std::vector<uint8_t>> chunks_;
+
+    // Decoded times, values and bounds of ANIMATION frames, reused between frames
+    std::vector<float> times_;
+    std::vector<float> samples_;
+    std::vector<float> bounds_;
+
+    string_table* strings_ = nullptr;
+};
+
+/**
+ * @brief Adapter delivering whole json documents to a message_handler
+ */
+class json_visitor : public message_visitor {
+public:
+    explicit json_visitor(message_handler handler) : handler_(std::move(handler)) {}
+
+    void on_message(uint8_t type, std::span<const uint8_t> payload) override;
+
+    /**
+     * @brief Dequantize typed vertex attributes into arrays of numbers
+     */
+    void set_dequantize(bool dequantize) { dequantize_ = dequantize; }
+
+private:
+    message_handler handler_;
+    bool dequantize_ = false;
+};
+
+/**
+ * @brief Parse a CBOR payload into json, keeping typed array tags as binary subtypes
+ */
+nlohmann::json parse_cbor_payload(std::span<const uint8_t> payload);
+
+/**
+ * @brief Parse the payload of a message into json
+ *
+ * Compact ATTRIBUTE payloads with integer keys and registry ids are expanded
+ * to their string form, see attribute_registry.h. String table entries in
+ * BEGIN, ATTRIBUTE and ANIMATION payloads are resolved, and added to the table.
+ * ANIMATION values are kept as sent, see sample_options.
+ *
+ * @param strings The connection's string table, nullptr if it has none
+ */
+nlohmann::json parse_message_payload(uint8_t type, std::span<const uint8_t> payload,
+                                     string_table* strings = nullptr);
+
+/**
+ * @brief Leading part of an ATTRIBUTE payload up to its typed array data
+ */
+struct typed_array_prefix {
+    std::string_view name;
+    std::string_view attr_type;
+    uint64_t tag = 0;
+    size_t data_offset = 0;     // Offset of the array bytes in the payload
+    size_t data_size = 0;       // Size of the array in bytes
+
+    // Strings the payload adds to the string table, in order
+    std::array<std::string_view, 2> defined;
+    size_t defined_count = 0;
+};
+
+enum class prefix_status {
+    incomplete,         // More of the payload is needed
+    typed_array,        // The payload ends with a typed array value, see typed_array_prefix
+    other               // The payload has to be decoded as a whole
+};
+
+/**
+ * @brief Parse the beginning of an ATTRIBUTE payload
+ *
+ * Used to stream typed arrays that arrive in PARTIAL fragments. Only payloads
+ * whose value is a typed array following the name and type can be streamed.
+ * String table entries are looked up but not added, see typed_array_prefix::defined.
+ */
+prefix_status parse_typed_array_prefix(std::span<const uint8_t> data, typed_array_prefix& prefix,
+                                       const string_table* strings = nullptr);
+
+} // namespace scene_talk
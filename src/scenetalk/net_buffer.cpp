@@ -1,4 +1,5 @@
 #include "net_buffer.h"
+#include "compression.h"
 #include <algorithm>
 #include <cassert>
 
@@ -11,8 +12,16 @@ net_buffer::net_buffer(std::shared_ptr<buffer_pool> pool,
       handler_(handler),
       max_frame_size_(max_frame_size),
       state_(state::header),
-      header_bytes_read_(0),
-      payload_bytes_read_(0) {
+      current_type_(0),
+      current_flags_(0),
+      current_payload_size_(0),
+      payload_bytes_read_(0),
+      header_bytes_read_(0) {
+}
+
+void net_buffer::set_peer_caps(uint32_t peer_caps, size_t max_extended_size) {
+    extended_ = (SUPPORTED_CAPS & peer_caps & CAP_EXTENDED_LENGTH) != 0;
+    max_extended_size_ = max_extended_size;
 }
 
 size_t net_buffer::append(const uint8_t* data, size_t size) {
@@ -22,6 +31,15 @@ size_t net_buffer::append(const uint8_t* data, size_t size) {
         size_t remaining = size - processed;
         size_t bytes_handled = 0;
 
+        // Between frames, dispatch whole frames without copying them
+        if (state_ == state::header && header_bytes_read_ == 0) {
+            bytes_handled = process_complete_frames(data + processed, remaining);
+            if (bytes_handled > 0) {
+                processed += bytes_handled;
+                continue;
+            }
+        }
+
         if (state_ == state::header) {
             bytes_handled = process_header_state(data + processed, remaining);
         } else {
@@ -39,20 +57,54 @@ size_t net_buffer::append(const uint8_t* data, size_t size) {
     return processed;
 }
 
+size_t net_buffer::process_complete_frames(const uint8_t* data, size_t size) {
+    size_t processed = 0;
+
+    while (size - processed >= FRAME_HEADER_SIZE) {
+        const uint8_t* header = data + processed;
+        size_t header_size = frame_header_size(header[1]);
+        if (size - processed < header_size) {
+            break;
+        }
+        size_t payload_size = unpack_payload_size(header);
+
+        // Leave invalid and straddling frames to the state machine
+        bool valid = (header[1] & FLAG_EXTENDED)
+            ? extended_ && payload_size <= max_extended_size_
+            : payload_size <= max_frame_size_;
+        if (!valid || size - processed - header_size < payload_size) {
+            break;
+        }
+
+        std::span<const uint8_t> payload(header + header_size, payload_size);
+        dispatch(frame_view(header[0], header[1], payload));
+
+        processed += header_size + payload_size;
+    }
+
+    return processed;
+}
+
+size_t net_buffer::expected_header_size() const {
+    return header_bytes_read_ < 2 ? FRAME_HEADER_SIZE : frame_header_size(header_buffer_[1]);
+}
+
 size_t net_buffer::process_header_state(const uint8_t* data, size_t size) {
-    // Calculate bytes we can read for the header
-    size_t bytes_to_read = std::min(size, FRAME_HEADER_SIZE - header_bytes_read_);
+    // Calculate bytes we can read for the header, an extended header is
+    // completed by the next call
+    size_t bytes_to_read = std::min(size, expected_header_size() - header_bytes_read_);
 
     // Copy data into header buffer
     std::copy(data, data + bytes_to_read, header_buffer_ + header_bytes_read_);
     header_bytes_read_ += bytes_to_read;
 
     // If we have a complete header, extract and validate it
-    if (header_bytes_read_ == FRAME_HEADER_SIZE) {
+    if (header_bytes_read_ == expected_header_size()) {
         extract_header_fields();
 
         // Validate the payload size
         if (!validate_payload_size()) {
+            drop(current_type_, current_payload_size_);
             reset();
             return bytes_to_read;
         }
@@ -61,8 +113,9 @@ size_t net_buffer::process_header_state(const uint8_t* data, size_t size) {
         if (current_payload_size_ > 0) {
             prepare_for_payload();
 
-            // Make sure buffer is large enough
-            if (current_payload_->capacity() < current_payload_size_) {
+            // Make sure a buffer was available
+            if (current_payload_size_ > INLINE_PAYLOAD_SIZE && !current_payload_) {
+                drop(current_type_, current_payload_size_);
                 reset();
                 return bytes_to_read;
             }
@@ -83,29 +136,67 @@ size_t net_buffer::process_header_state(const uint8_t* data, size_t size) {
 void net_buffer::extract_header_fields() {
     current_type_ = header_buffer_[0];
     current_flags_ = header_buffer_[1];
-    current_payload_size_ = unpack_uint16_le(&header_buffer_[2]);
+    current_payload_size_ = unpack_payload_size(header_buffer_);
 }
 
 bool net_buffer::validate_payload_size() const {
+    if (current_flags_ & FLAG_EXTENDED) {
+        return extended_ && current_payload_size_ <= max_extended_size_;
+    }
     return current_payload_size_ <= max_frame_size_;
 }
 
+size_t net_buffer::max_payload_size() const {
+    return extended_ ? std::max(max_frame_size_, max_extended_size_) : max_frame_size_;
+}
+
 void net_buffer::prepare_for_payload() {
-    current_payload_ = pool_->get_buffer();
+    // Small payloads are read into inline storage, others into the
+    // smallest pooled buffer that fits. Extended payloads start at the size
+    // of a standard frame and grow as their bytes arrive, so a header alone
+    // does not claim the whole announced size.
+    if (current_payload_size_ > INLINE_PAYLOAD_SIZE) {
+        current_payload_ = pool_->get_buffer(std::min(current_payload_size_, MAX_PAYLOAD_SIZE));
+    }
     payload_bytes_read_ = 0;
 }
 
+bool net_buffer::reserve_payload(size_t size) {
+    if (current_payload_->capacity() >= size) {
+        return true;
+    }
+    size_t capacity = std::min(current_payload_size_, std::max(size, current_payload_->capacity() * 2));
+    buffer_ptr grown = pool_->get_buffer(capacity);
+    if (!grown) {
+        return false;
+    }
+    std::copy_n(current_payload_->data(), payload_bytes_read_, grown->data());
+    current_payload_ = std::move(grown);
+    return true;
+}
+
+uint8_t* net_buffer::payload_data() {
+    return current_payload_ ? current_payload_->data() : inline_payload_.data();
+}
+
 size_t net_buffer::process_payload_state(const uint8_t* data, size_t size) {
     // Calculate bytes to read for the payload
     size_t bytes_to_read = std::min(size, current_payload_size_ - payload_bytes_read_);
+    if (current_payload_ && !reserve_payload(payload_bytes_read_ + bytes_to_read)) {
+        drop(current_type_, current_payload_size_);
+        reset();
+        return bytes_to_read;
+    }
 
     // Copy data into payload buffer
-    std::copy(data, data + bytes_to_read, current_payload_->data() + payload_bytes_read_);
+    std::copy(data, data + bytes_to_read, payload_data() + payload_bytes_read_);
     payload_bytes_read_ += bytes_to_read;
 
     // If we have the complete payload, handle the frame
     if (payload_bytes_read_ == current_payload_size_) {
-        current_payload_->resize(current_payload_size_);
+        if (current_payload_) {
+            current_payload_->resize(current_payload_size_);
+        }
         handle_complete_frame();
         state_ = state::header;
     }
@@ -114,19 +205,53 @@ size_t net_buffer::process_payload_state(const uint8_t* data, size_t size) {
 }
 
 void net_buffer::handle_complete_frame() {
-    // Prepare the frame payload
-    std::vector<uint8_t> payload;
-
-    if (current_payload_) {
-        // Copy from the buffer to the frame
-        payload.assign(current_payload_->data(),
-                     current_payload_->data() + current_payload_->size());
-        current_payload_.reset();
+    // Dispatch a view of the payload, the handler may take the pooled buffer
+    std::span<const uint8_t> payload(payload_data(), current_payload_size_);
+    frame_view f(current_type_, current_flags_, payload,
+                 current_payload_ ? &current_payload_ : nullptr);
+    dispatch(f);
+
+    // Return the buffer to the pool unless the handler kept it
+    current_payload_.reset();
+}
+
+void net_buffer::dispatch(const frame_view& f) {
+    if (f.flags & FLAG_COMPRESSED) {
+        dispatch_compressed(f);
+    } else {
+        handler_(f);
+    }
+}
+
+void net_buffer::dispatch_compressed(const frame_view& f) {
+    // Drop frames that are malformed or decompress past the frame size limit
+    if (f.payload.size() < COMPRESSED_HEADER_SIZE) {
+        drop(f.type, f.payload.size());
+        return;
+    }
+    size_t raw_size = unpack_uint32_le(f.payload.data());
+    if (raw_size > max_payload_size()) {
+        drop(f.type, raw_size);
+        return;
     }
 
-    // Create and dispatch the frame
-    frame f(current_type_, current_flags_, std::move(payload));
-    handler_(f);
+    buffer_ptr raw = pool_->get_buffer(raw_size);
+    if (!raw || !block_decompress(f.payload.data() + COMPRESSED_HEADER_SIZE,
+                                  f.payload.size() - COMPRESSED_HEADER_SIZE,
+                                  raw->data(), raw_size)) {
+        drop(f.type, raw_size);
+        return;
+    }
+    raw->resize(raw_size);
+
+    std::span<const uint8_t> payload(raw->data(), raw_size);
+    handler_(frame_view(f.type, f.flags & ~FLAG_COMPRESSED, payload, &raw));
+}
+
+void net_buffer::drop(uint8_t type, size_t size) {
+    if (drop_handler_) {
+        drop_handler_(type, size);
+    }
 }
 
 void net_buffer::reset() {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <functional>
@@ -10,8 +11,19 @@ namespace scene_talk {
 
 /**
  * @brief Callback type for frame handling
+ *
+ * The frame payload is borrowed from the net_buffer and is only valid for the
+ * duration of the call, see frame_view.
  */
-using frame_handler = std::function<void(const frame&)>;
+using frame_handler = std::function<void(const frame_view&)>;
+
+/**
+ * @brief Callback type for frames dropped before reaching the frame handler
+ *
+ * Gets the frame type and the payload size the peer announced, the
+ * decompressed size for compressed frames.
+ */
+using drop_handler = std::function<void(uint8_t type, size_t size)>;
 
 /**
  * @brief Handles network data and assembles it into frames
@@ -23,15 +35,38 @@ public:
      *
      * @param pool Buffer pool for allocations
      * @param handler Callback function for complete frames
-     * @param max_frame_size Maximum allowed frame size
+     * @param max_frame_size Maximum allowed payload size of standard frames
      */
     net_buffer(std::shared_ptr<buffer_pool> pool,
                frame_handler handler,
                size_t max_frame_size = MAX_PAYLOAD_SIZE);
 
+    /**
+     * @brief Accept extended frames once CAP_EXTENDED_LENGTH is negotiated
+     *
+     * Until then frames with FLAG_EXTENDED are dropped.
+     *
+     * @param peer_caps Capabilities the peer advertised in HELLO
+     * @param max_extended_size Maximum allowed payload size of extended frames
+     */
+    void set_peer_caps(uint32_t peer_caps, size_t max_extended_size = MAX_EXTENDED_PAYLOAD_SIZE);
+
+    /**
+     * @brief Be told about frames that are dropped instead of handled
+     *
+     * Frames past the size limits, without a buffer to read them into or
+     * failing to decompress never reach the frame handler, this sees them.
+     */
+    void set_drop_handler(drop_handler handler) { drop_handler_ = std::move(handler); }
+
     /**
      * @brief Process incoming network data
      *
+     * Frames that are complete within the data are dispatched as views into
+     * it without copying. Only frames that straddle calls are copied into
+     * pooled buffers. Compressed frames are decompressed into pooled buffers
+     * and dispatched without FLAG_COMPRESSED.
+     *
      * @param data Pointer to data buffer
      * @param size Size of data
      * @return Number of bytes processed
@@ -55,6 +90,12 @@ private:
         payload     // Waiting for payload
     };
 
+    // Dispatch frames that are complete in the data in place
+    size_t process_complete_frames(const uint8_t* data, size_t size);
+
+    // Size of the header being read, known once the flags byte is in
+    size_t expected_header_size() const;
+
     // Process data in header state
     size_t process_header_state(const uint8_t* data, size_t size);
 
@@ -64,18 +105,39 @@ private:
     // Extract header fields from the header buffer
     void extract_header_fields();
 
-    // Validate payload size against maximum
+    // Validate the frame flags and payload size against the negotiated limits
     bool validate_payload_size() const;
 
+    // Largest payload of any frame accepted, also bounds decompressed sizes
+    size_t max_payload_size() const;
+
     // Prepare for payload processing
     void prepare_for_payload();
 
+    // Grow the pooled payload buffer to hold at least size bytes
+    bool reserve_payload(size_t size);
+
+    // Destination for the payload of the current frame
+    uint8_t* payload_data();
+
     // Handle a complete frame
     void handle_complete_frame();
 
+    // Pass a frame to the handler, decompressing it first if needed
+    void dispatch(const frame_view& f);
+
+    // Decompress a frame into a pooled buffer and pass it to the handler
+    void dispatch_compressed(const frame_view& f);
+
+    // Report a frame that is not passed to the handler
+    void drop(uint8_t type, size_t size);
+
     std::shared_ptr<buffer_pool> pool_;
     frame_handler handler_;
+    drop_handler drop_handler_;
     size_t max_frame_size_;
+    size_t max_extended_size_ = 0;
+    bool extended_ = false;
 
     // Current state
     state state_;
@@ -83,12 +145,15 @@ private:
     // Current frame data
     uint8_t current_type_;
     uint8_t current_flags_;
-    uint16_t current_payload_size_;
-    std::unique_ptr<buffer> current_payload_;
+    size_t current_payload_size_;
+    buffer_ptr current_payload_;
     size_t payload_bytes_read_;
 
+    // Storage for small payloads, avoids a pool round trip for control frames
+    std::array<uint8_t, INLINE_PAYLOAD_SIZE> inline_payload_;
+
     // Header buffer for incomplete headers
-    uint8_t header_buffer_[FRAME_HEADER_SIZE];
+    uint8_t header_buffer_[MAX_FRAME_HEADER_SIZE];
     size_t header_bytes_read_;
 };
 
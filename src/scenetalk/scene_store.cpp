@@ -0,0 +1,435 @@
+#include "scene_store.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace scene_talk {
+
+namespace {
+
+constexpr size_t ARENA_ALIGNMENT = 16;
+
+// Path of a prim's parent, empty for the root
+std::string_view parent_path(std::string_view path) {
+    if (path.size() <= 1) {
+        return {};
+    }
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string_view::npos) {
+        return {};
+    }
+    return slash == 0 ? path.substr(0, 1) : path.substr(0, slash);
+}
+
+} // namespace
+
+uint8_t* scene_arena::allocate(size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    // Large values get a block of their own, ahead of the block being filled
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        buffer_ptr block = pool_->get_buffer(size);
+        if (!block) {
+            return nullptr;
+        }
+        uint8_t* data = block->data();
+        auto position = blocks_.empty() ? blocks_.end() : std::prev(blocks_.end());
+        blocks_.insert(position, std::move(block));
+        used_ += size;
+        return data;
+    }
+
+    if (blocks_.empty() || offset_ + size > blocks_.back()->capacity()) {
+        buffer_ptr block = pool_->get_buffer(ARENA_BLOCK_SIZE);
+        if (!block) {
+            return nullptr;
+        }
+        blocks_.push_back(std::move(block));
+        offset_ = 0;
+    }
+    uint8_t* data = blocks_.back()->data() + offset_;
+    offset_ += size;
+    used_ += size;
+    return data;
+}
+
+std::string_view scene_arena::copy(std::string_view value) {
+    if (value.empty()) {
+        return {};
+    }
+    auto* data = allocate(value.size());
+    if (!data) {
+        return {};
+    }
+    std::memcpy(data, value.data(), value.size());
+    return {reinterpret_cast<const char*>(data), value.size()};
+}
+
+void scene_arena::reset() {
+    blocks_.clear();
+    offset_ = 0;
+    used_ = 0;
+}
+
+scene_store::scene_store(std::shared_ptr<buffer_pool> pool, const decoder_limits& limits)
+    : arena_(std::move(pool)),
+      max_attr_bytes_(limits.max_reassembly_bytes) {
+    add_root();
+}
+
+void scene_store::reset() {
+    paths_.clear();
+    types_.clear();
+    parents_.clear();
+    first_attrs_.clear();
+    defined_.clear();
+    child_counts_.clear();
+    free_prims_.clear();
+    index_.clear();
+
+    attr_prims_.clear();
+    attr_names_.clear();
+    attr_types_.clear();
+    attr_tags_.clear();
+    attr_data_.clear();
+    attr_sizes_.clear();
+    attr_capacities_.clear();
+    attr_next_.clear();
+    free_attrs_.clear();
+
+    open_.clear();
+    streaming_attrs_.clear();
+
+    arena_.reset();
+    unused_bytes_ = 0;
+    version_++;
+    add_root();
+}
+
+void scene_store::compact() {
+    scene_arena arena(arena_.pool());
+    for (size_t prim = 0; prim < paths_.size(); prim++) {
+        paths_[prim] = arena.copy(paths_[prim]);
+        types_[prim] = arena.copy(types_[prim]);
+    }
+
+    // Keys are views into the old arena, look them up through the prims
+    std::unordered_map<std::string_view, uint32_t> index;
+    index.reserve(index_.size());
+    for (const auto& [path, prim] : index_) {
+        index.emplace(paths_[prim], prim);
+    }
+    index_ = std::move(index);
+
+    for (size_t attr = 0; attr < attr_names_.size(); attr++) {
+        attr_names_[attr] = arena.copy(attr_names_[attr]);
+        attr_types_[attr] = arena.copy(attr_types_[attr]);
+        uint8_t* data = nullptr;
+        if (attr_sizes_[attr] > 0) {
+            data = arena.allocate(attr_sizes_[attr]);
+            std::memcpy(data, attr_data_[attr], attr_sizes_[attr]);
+        }
+        attr_data_[attr] = data;
+        attr_capacities_[attr] = attr_sizes_[attr];
+    }
+
+    arena_ = std::move(arena);
+    unused_bytes_ = 0;
+    version_++;
+}
+
+void scene_store::add_root() {
+    std::string_view path = arena_.copy("/");
+    paths_.push_back(path);
+    types_.emplace_back();
+    parents_.push_back(NO_INDEX);
+    first_attrs_.push_back(NO_INDEX);
+    defined_.push_back(1);
+    child_counts_.push_back(0);
+    index_.emplace(path, ROOT_PRIM);
+}
+
+uint32_t scene_store::find_prim(std::string_view path) const {
+    auto it = index_.find(path);
+    return it == index_.end() ? NO_INDEX : it->second;
+}
+
+uint32_t scene_store::ensure_prim(std::string_view path) {
+    if (uint32_t prim = find_prim(path); prim != NO_INDEX) {
+        return prim;
+    }
+
+    // Parents are created first, from the arena copy as path may be scratch
+    std::string_view kept = arena_.copy(path);
+    std::string_view parent = parent_path(kept);
+    uint32_t parent_prim = parent.empty() ? ROOT_PRIM : ensure_prim(parent);
+
+    // Take the index of a removed prim if there is one
+    uint32_t prim;
+    if (!free_prims_.empty()) {
+        prim = free_prims_.back();
+        free_prims_.pop_back();
+        paths_[prim] = kept;
+        parents_[prim] = parent_prim;
+    } else {
+        prim = static_cast<uint32_t>(paths_.size());
+        paths_.push_back(kept);
+        types_.emplace_back();
+        parents_.push_back(parent_prim);
+        first_attrs_.push_back(NO_INDEX);
+        defined_.push_back(0);
+        child_counts_.push_back(0);
+    }
+    child_counts_[parent_prim]++;
+    index_.emplace(kept, prim);
+    return prim;
+}
+
+std::string_view scene_store::keep(std::string_view current, std::string_view value) {
+    if (current == value) {
+        return current;
+    }
+    unused_bytes_ += current.size();
+    return arena_.copy(value);
+}
+
+void scene_store::on_begin(std::string_view entity_type, std::string_view name, int /*depth*/) {
+    // Relative names are children of the enclosing prim
+    if (name.starts_with('/')) {
+        path_.assign(name);
+    } else {
+        path_.assign(current_prim() == ROOT_PRIM ? std::string_view() : paths_[current_prim()]);
+        path_ += '/';
+        path_ += name;
+    }
+
+    uint32_t prim = ensure_prim(path_);
+    types_[prim] = keep(types_[prim], entity_type);
+    defined_[prim] = 1;
+    open_.push_back(prim);
+}
+
+void scene_store::on_end(int /*depth*/) {
+    if (!open_.empty()) {
+        open_.pop_back();
+    }
+
+    // Between top-level prims, no name of the enclosing ones is in use
+    if (open_.empty() && unused_bytes_ > ARENA_BLOCK_SIZE && unused_bytes_ > arena_.used() / 2) {
+        compact();
+    }
+}
+
+uint32_t scene_store::find_attr(uint32_t prim, std::string_view name) const {
+    for (uint32_t attr = first_attrs_[prim]; attr != NO_INDEX; attr = attr_next_[attr]) {
+        if (attr_names_[attr] == name) {
+            return attr;
+        }
+    }
+    return NO_INDEX;
+}
+
+uint32_t scene_store::store_attr(std::string_view name, std::string_view attr_type, uint64_t tag, size_t size) {
+    // The size may come from a streamed typed array, more than the decoder
+    // would reassemble is refused
+    if (size > max_attr_bytes_) {
+        return NO_INDEX;
+    }
+
+    // Values that still fit are overwritten in place
+    uint32_t prim = current_prim();
+    uint32_t attr = find_attr(prim, name);
+    size_t capacity = attr == NO_INDEX ? 0 : attr_capacities_[attr];
+    uint8_t* data = nullptr;
+    if (capacity < size) {
+        data = arena_.allocate(size);
+        if (!data) {
+            return NO_INDEX;
+        }
+    }
+
+    if (attr == NO_INDEX) {
+        std::string_view kept = arena_.copy(name);
+        if (!free_attrs_.empty()) {
+            attr = free_attrs_.back();
+            free_attrs_.pop_back();
+            attr_prims_[attr] = prim;
+            attr_names_[attr] = kept;
+            attr_next_[attr] = first_attrs_[prim];
+        } else {
+            attr = static_cast<uint32_t>(attr_names_.size());
+            attr_prims_.push_back(prim);
+            attr_names_.push_back(kept);
+            attr_types_.emplace_back();
+            attr_tags_.push_back(0);
+            attr_data_.push_back(nullptr);
+            attr_sizes_.push_back(0);
+            attr_capacities_.push_back(0);
+            attr_next_.push_back(first_attrs_[prim]);
+        }
+        first_attrs_[prim] = attr;
+    }
+
+    if (data) {
+        unused_bytes_ += attr_capacities_[attr];
+        attr_data_[attr] = data;
+        attr_capacities_[attr] = size;
+    }
+    attr_types_[attr] = keep(attr_types_[attr], attr_type);
+    attr_tags_[attr] = tag;
+    attr_sizes_[attr] = size;
+    return attr;
+}
+
+void scene_store::on_attr_typed_array(std::string_view name, std::string_view attr_type,
+                                      const typed_array_view& value) {
+    uint32_t attr = store_attr(name, attr_type, value.tag, value.bytes.size());
+    if (attr == NO_INDEX) {
+        return;
+    }
+    if (!value.bytes.empty()) {
+        std::memcpy(attr_data_[attr], value.bytes.data(), value.bytes.size());
+    }
+    stop_streaming(attr);
+}
+
+void scene_store::on_attr_typed_array_chunk(uint32_t stream, std::string_view name, std::string_view attr_type,
+                                            uint64_t tag, size_t offset,
+                                            std::span<const uint8_t> chunk, size_t total) {
+    // Chunks are copied straight into the attribute's memory
+    if (offset == 0) {
+        uint32_t attr = store_attr(name, attr_type, tag, total);
+        if (attr == NO_INDEX) {
+            streaming_attrs_.erase(stream);
+            return;
+        }
+        stop_streaming(attr);
+        streaming_attrs_[stream] = attr;
+    }
+    auto it = streaming_attrs_.find(stream);
+    if (it == streaming_attrs_.end()) {
+        return;
+    }
+    uint32_t attr = it->second;
+    if (offset + chunk.size() > attr_sizes_[attr]) {
+        streaming_attrs_.erase(it);
+        return;
+    }
+    if (!chunk.empty()) {
+        std::memcpy(attr_data_[attr] + offset, chunk.data(), chunk.size());
+    }
+    if (offset + chunk.size() == total) {
+        streaming_attrs_.erase(it);
+    }
+}
+
+void scene_store::on_typed_array_dropped(uint32_t stream) {
+    streaming_attrs_.erase(stream);
+}
+
+void scene_store::stop_streaming(uint32_t attr) {
+    std::erase_if(streaming_attrs_, [attr](const auto& entry) { return entry.second == attr; });
+}
+
+void scene_store::on_attr(std::string_view name, std::string_view attr_type, const nlohmann::json& value) {
+    value_.clear();
+    nlohmann::json::to_cbor(value, value_);
+    uint32_t attr = store_attr(name, attr_type, 0, value_.size());
+    if (attr == NO_INDEX) {
+        return;
+    }
+    std::memcpy(attr_data_[attr], value_.data(), value_.size());
+    stop_streaming(attr);
+
+    // Move the prim under its parent unless that would make a cycle
+    uint32_t prim = current_prim();
+    if (name != "parent" || !value.is_string() || prim == ROOT_PRIM) {
+        return;
+    }
+    uint32_t parent = ensure_prim(value.get_ref<const std::string&>());
+    for (uint32_t ancestor = parent; ancestor != NO_INDEX; ancestor = parents_[ancestor]) {
+        if (ancestor == prim) {
+            return;
+        }
+    }
+    uint32_t previous = parents_[prim];
+    parents_[prim] = parent;
+    child_counts_[parent]++;
+    child_counts_[previous]--;
+    release_prim(previous);
+}
+
+void scene_store::on_attr_removed(std::string_view name) {
+    uint32_t prim = current_prim();
+    for (uint32_t* link = &first_attrs_[prim]; *link != NO_INDEX; link = &attr_next_[*link]) {
+        uint32_t attr = *link;
+        if (attr_names_[attr] == name) {
+            *link = attr_next_[attr];
+            release_attr(attr);
+            return;
+        }
+    }
+}
+
+void scene_store::release_attr(uint32_t attr) {
+    unused_bytes_ += attr_capacities_[attr] + attr_names_[attr].size() + attr_types_[attr].size();
+    attr_prims_[attr] = NO_INDEX;
+    attr_names_[attr] = {};
+    attr_types_[attr] = {};
+    attr_tags_[attr] = 0;
+    attr_data_[attr] = nullptr;
+    attr_sizes_[attr] = 0;
+    attr_capacities_[attr] = 0;
+    attr_next_[attr] = NO_INDEX;
+    stop_streaming(attr);
+    free_attrs_.push_back(attr);
+}
+
+void scene_store::on_prim_removed(std::string_view name) {
+    uint32_t prim = find_prim(name);
+    if (prim == NO_INDEX || prim == ROOT_PRIM || std::ranges::find(open_, prim) != open_.end()) {
+        return;
+    }
+
+    // Its attributes are dropped with it, a prim sent at the path again starts over
+    for (uint32_t attr = first_attrs_[prim]; attr != NO_INDEX;) {
+        uint32_t next = attr_next_[attr];
+        release_attr(attr);
+        attr = next;
+    }
+    first_attrs_[prim] = NO_INDEX;
+    unused_bytes_ += types_[prim].size();
+    types_[prim] = {};
+    defined_[prim] = 0;
+    release_prim(prim);
+}
+
+void scene_store::release_prim(uint32_t prim) {
+    // Prims with children stay as undefined prims, so the children keep their parent
+    while (prim != ROOT_PRIM && !defined_[prim] && child_counts_[prim] == 0 &&
+           first_attrs_[prim] == NO_INDEX && std::ranges::find(open_, prim) == open_.end()) {
+        uint32_t parent = parents_[prim];
+        index_.erase(paths_[prim]);
+        unused_bytes_ += paths_[prim].size();
+        paths_[prim] = {};
+        parents_[prim] = NO_INDEX;
+        child_counts_[parent]--;
+        free_prims_.push_back(prim);
+        prim = parent;
+    }
+}
+
+attribute_view scene_store::attr(uint32_t index) const {
+    return {attr_names_[index], attr_types_[index], attr_tags_[index],
+            std::span<const uint8_t>(attr_data_[index], attr_sizes_[index])};
+}
+
+nlohmann::json scene_store::attr_value(uint32_t index) const {
+    attribute_view view = attr(index);
+    if (view.tag == 0) {
+        return parse_cbor_payload(view.data);
+    }
+    return nlohmann::json::binary(std::vector<uint8_t>(view.data.begin(), view.data.end()), view.tag);
+}
+
+} // namespace scene_talk
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "buffer_pool.h"
+#include "decoder.h"
+#include "message_visitor.h"
+
+namespace scene_talk {
+
+// Index of no prim or attribute
+constexpr uint32_t NO_INDEX = std::numeric_limits<uint32_t>::max();
+
+// The scene root, prims without a known parent hang off it
+constexpr uint32_t ROOT_PRIM = 0;
+
+// Size of the blocks a scene_arena takes from its pool
+constexpr size_t ARENA_BLOCK_SIZE = 256 * 1024;
+
+/**
+ * @brief Bump allocator over pooled blocks
+ *
+ * Memory is only released all at once by reset(), which hands the blocks
+ * back to the pool, or by moving what is still used to a new arena.
+ */
+class scene_arena {
+public:
+    explicit scene_arena(std::shared_ptr<buffer_pool> pool) : pool_(std::move(pool)) {}
+
+    // Allocate size bytes aligned to 16, nullptr if the pool has no buffer that large
+    uint8_t* allocate(size_t size);
+
+    // Copy a string into the arena, empty if it could not be allocated
+    std::string_view copy(std::string_view value);
+
+    // Release everything allocated so far
+    void reset();
+
+    // Bytes allocated since the last reset
+    [[nodiscard]] size_t used() const { return used_; }
+
+    [[nodiscard]] const std::shared_ptr<buffer_pool>& pool() const { return pool_; }
+
+private:
+    std::shared_ptr<buffer_pool> pool_;
+    std::vector<buffer_ptr> blocks_;
+    size_t offset_ = 0;     // Used bytes of the last block
+    size_t used_ = 0;
+};
+
+/**
+ * @brief An attribute as kept by the scene_store
+ */
+struct attribute_view {
+    std::string_view name;
+    std::string_view attr_type;
+    uint64_t tag;                     // Typed array tag, 0 for a CBOR encoded value
+    std::span<const uint8_t> data;    // Typed array bytes or the CBOR value
+};
+
+/**
+ * @brief Receiver-side scene built from BEGIN, END and ATTRIBUTE frames
+ *
+ * Pass it to a decoder as its visitor. Prims and attributes are kept in
+ * flat arrays indexed by prim and attribute index, prims are found through a
+ * hash map of their paths. Names and values live in an arena that is
+ * released by reset() when a new version of the scene starts.
+ *
+ * A BEGIN with a relative name opens a child of the enclosing prim, one with
+ * an absolute path is attached to the prim of its parent path. A "parent"
+ * attribute moves a prim under the given path. Prims referred to before
+ * their BEGIN arrives are created undefined, so partial graphs attach
+ * without searching. Sending a prim or attribute again overwrites it in
+ * place, reusing the value's memory if the new value fits.
+ *
+ * Prims and attributes removed by delta updates are no longer found or
+ * linked, see encoder::set_delta_updates(). Their indices are handed to the
+ * next prims and attributes added, so the flat arrays only grow to the most
+ * prims and attributes held at once. A removed prim that still has children
+ * stays at its path as an undefined prim until they are gone. The memory of
+ * removed names and values and of values which outgrew their place is
+ * reclaimed by compact(), which runs on its own once more than half of the
+ * arena is unused.
+ *
+ * Values larger than the decoder's max_reassembly_bytes, or than the pool
+ * can hold, are refused and the attribute keeps what it had.
+ */
+class scene_store : public message_visitor {
+public:
+    explicit scene_store(std::shared_ptr<buffer_pool> pool, const decoder_limits& limits = {});
+
+    void on_begin(std::string_view entity_type, std::string_view name, int depth) override;
+    void on_end(int depth) override;
+    void on_attr_typed_array(std::string_view name, std::string_view attr_type,
+                             const typed_array_view& value) override;
+    void on_attr_typed_array_chunk(uint32_t stream, std::string_view name, std::string_view attr_type,
+                                   uint64_t tag, size_t offset,
+                                   std::span<const uint8_t> chunk, size_t total) override;
+    void on_typed_array_dropped(uint32_t stream) override;
+    void on_attr(std::string_view name, std::string_view attr_type, const nlohmann::json& value) override;
+    void on_attr_removed(std::string_view name) override;
+    void on_prim_removed(std::string_view name) override;
+
+    /**
+     * @brief Drop the scene and start the next version
+     *
+     * All views returned so far become invalid.
+     */
+    void reset();
+
+    /**
+     * @brief Move the names and values still used to a new arena
+     *
+     * Starts the next version as all views returned so far become invalid,
+     * prim and attribute indices stay the same.
+     */
+    void compact();
+
+    // Changes whenever views returned so far become invalid
+    [[nodiscard]] uint64_t version() const { return version_; }
+
+    // Prims, including the root and the free indices of removed prims
+    [[nodiscard]] size_t prim_count() const { return paths_.size(); }
+
+    // Index of the prim with the given path, NO_INDEX if there is none
+    [[nodiscard]] uint32_t find_prim(std::string_view path) const;
+
+    [[nodiscard]] std::string_view prim_path(uint32_t prim) const { return paths_[prim]; }
+    [[nodiscard]] std::string_view prim_type(uint32_t prim) const { return types_[prim]; }
+    [[nodiscard]] uint32_t prim_parent(uint32_t prim) const { return parents_[prim]; }
+
+    // Whether the prim's BEGIN has arrived, not just a reference to it
+    [[nodiscard]] bool prim_defined(uint32_t prim) const { return defined_[prim] != 0; }
+
+    // Attributes of all prims, including the free indices of removed attributes
+    [[nodiscard]] size_t attr_count() const { return attr_names_.size(); }
+
+    // Index of a prim's attribute, NO_INDEX if it has none of that name
+    [[nodiscard]] uint32_t find_attr(uint32_t prim, std::string_view name) const;
+
+    // First attribute of a prim and the one after an attribute, NO_INDEX at the end
+    [[nodiscard]] uint32_t first_attr(uint32_t prim) const { return first_attrs_[prim]; }
+    [[nodiscard]] uint32_t next_attr(uint32_t attr) const { return attr_next_[attr]; }
+
+    [[nodiscard]] uint32_t attr_prim(uint32_t attr) const { return attr_prims_[attr]; }
+    [[nodiscard]] attribute_view attr(uint32_t index) const;
+
+    // Value of an attribute as json, typed arrays as binary with their tag as subtype
+    [[nodiscard]] nlohmann::json attr_value(uint32_t index) const;
+
+    // Bytes of the arena in use
+    [[nodiscard]] size_t arena_bytes() const { return arena_.used(); }
+
+    // Bytes of the arena no longer used by any name or value
+    [[nodiscard]] size_t unused_arena_bytes() const { return unused_bytes_; }
+
+private:
+    // Add the root prim of a new version
+    void add_root();
+
+    // Index of the prim at a path, created undefined if it does not exist yet
+    uint32_t ensure_prim(std::string_view path);
+
+    // Prim attributes are sent to, the root outside of any BEGIN
+    uint32_t current_prim() const { return open_.empty() ? ROOT_PRIM : open_.back(); }
+
+    // Free a removed prim once nothing refers to it, then its parent if that was only referred to
+    void release_prim(uint32_t prim);
+
+    // Find or add an attribute of the current prim with room for size bytes, NO_INDEX if refused
+    uint32_t store_attr(std::string_view name, std::string_view attr_type, uint64_t tag, size_t size);
+
+    // Free an attribute already unlinked from its prim
+    void release_attr(uint32_t attr);
+
+    // Stop streams writing to an attribute, which was replaced or removed
+    void stop_streaming(uint32_t attr);
+
+    // Keep a string, reusing the arena copy if it did not change
+    std::string_view keep(std::string_view current, std::string_view value);
+
+    scene_arena arena_;
+    size_t max_attr_bytes_;
+    size_t unused_bytes_ = 0;
+    uint64_t version_ = 0;
+
+    // Prims
+    std::vector<std::string_view> paths_;
+    std::vector<std::string_view> types_;
+    std::vector<uint32_t> parents_;
+    std::vector<uint32_t> first_attrs_;
+    std::vector<uint8_t> defined_;
+    std::vector<uint32_t> child_counts_;
+    std::vector<uint32_t> free_prims_;
+    std::unordered_map<std::string_view, uint32_t> index_;  // Views into the arena
+
+    // Attributes, linked per prim through attr_next_
+    std::vector<uint32_t> attr_prims_;
+    std::vector<std::string_view> attr_names_;
+    std::vector<std::string_view> attr_types_;
+    std::vector<uint64_t> attr_tags_;
+    std::vector<uint8_t*> attr_data_;
+    std::vector<size_t> attr_sizes_;
+    std::vector<size_t> attr_capacities_;
+    std::vector<uint32_t> attr_next_;
+    std::vector<uint32_t> free_attrs_;
+
+    // Prims opened by BEGIN frames
+    std::vector<uint32_t> open_;
+
+    // Attributes receiving typed array chunks, by stream
+    std::unordered_map<uint32_t, uint32_t> streaming_attrs_;
+
+    // Scratch for paths and encoded values
+    std::string path_;
+    std::vector<uint8_t> value_;
+};
+
+} // namespace scene_talk
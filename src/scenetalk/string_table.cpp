@@ -0,0 +1,51 @@
+#include "string_table.h"
+
+namespace scene_talk {
+
+uint64_t string_table::insert(std::string_view value) {
+    uint64_t index = first_index_ + entries_.size();
+
+    // Deque elements do not move, so views into them stay valid
+    const std::string& entry = entries_.emplace_back(value);
+
+    // A string added again maps to its newer entry, keyed by a view into it
+    auto [it, inserted] = indices_.try_emplace(entry, index);
+    if (!inserted) {
+        indices_.erase(it);
+        indices_.emplace(entry, index);
+    }
+    size_ += entry.size() + STRING_ENTRY_OVERHEAD;
+    return index;
+}
+
+std::optional<std::string_view> string_table::get(uint64_t index) const {
+    if (index < first_index_ || index - first_index_ >= entries_.size()) {
+        return std::nullopt;
+    }
+    return entries_[index - first_index_];
+}
+
+std::optional<uint64_t> string_table::find(std::string_view value) const {
+    auto it = indices_.find(value);
+    if (it == indices_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void string_table::evict() {
+    while (size_ > capacity_ && !entries_.empty()) {
+        const std::string& oldest = entries_.front();
+
+        auto it = indices_.find(oldest);
+        if (it != indices_.end() && it->second == first_index_) {
+            indices_.erase(it);
+        }
+
+        size_ -= oldest.size() + STRING_ENTRY_OVERHEAD;
+        entries_.pop_front();
+        first_index_++;
+    }
+}
+
+} // namespace scene_talk
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace scene_talk {
+
+/**
+ * @brief CBOR tags of string table entries
+ *
+ * Borrowed from the registered value sharing tags, but scoped to the
+ * connection instead of one item: a string tagged STRING_DEFINE_TAG is added
+ * to the table, STRING_REF_TAG followed by an index stands for a string added
+ * before.
+ */
+constexpr uint64_t STRING_DEFINE_TAG = 28;
+constexpr uint64_t STRING_REF_TAG = 29;
+
+// Bytes of strings kept by both sides of a connection
+constexpr size_t STRING_TABLE_SIZE = 64 * 1024;
+
+// Bookkeeping cost of a table entry on top of its length
+constexpr size_t STRING_ENTRY_OVERHEAD = 32;
+
+// Strings added to the table, shorter ones are not worth a reference
+constexpr size_t MIN_TABLE_STRING = 4;
+constexpr size_t MAX_TABLE_STRING = 1024;
+
+/**
+ * @brief Connection-wide table of repeated strings
+ *
+ * The encoder and decoder of a connection each keep one. Entries are indexed
+ * in the order they are added, counting up over the whole connection. evict()
+ * drops the oldest entries until the table fits its capacity. Which entries
+ * remain only depends on the strings added, so the encoder evicts right after
+ * adding and the decoder after every message, which keeps entries valid while
+ * a message is processed and never drops one the encoder can still refer to.
+ */
+class string_table {
+public:
+    explicit string_table(size_t capacity = STRING_TABLE_SIZE) : capacity_(capacity) {}
+
+    string_table(const string_table&) = delete;
+    string_table& operator=(const string_table&) = delete;
+
+    // Add a string, returns its index
+    uint64_t insert(std::string_view value);
+
+    // String at an index, nullopt if it was never added or has been evicted
+    [[nodiscard]] std::optional<std::string_view> get(uint64_t index) const;
+
+    // Index of a string, nullopt if it is not in the table
+    [[nodiscard]] std::optional<uint64_t> find(std::string_view value) const;
+
+    // Drop the oldest entries until the table fits its capacity
+    void evict();
+
+    // Whether a string is worth adding
+    static bool indexable(std::string_view value) {
+        return value.size() >= MIN_TABLE_STRING && value.size() <= MAX_TABLE_STRING;
+    }
+
+    [[nodiscard]] size_t entries() const { return entries_.size(); }
+    [[nodiscard]] size_t size() const { return size_; }
+
+private:
+    std::deque<std::string> entries_;
+    std::unordered_map<std::string_view, uint64_t> indices_;  // Views into entries_
+    uint64_t first_index_ = 0;
+    size_t size_ = 0;
+    size_t capacity_;
+};
+
+} // namespace scene_talk
@@ -0,0 +1,62 @@
+#include "buffer_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace scene_talk;
+
+/**
+ * @brief Contention benchmark for buffer_pool
+ *
+ * Every thread repeatedly takes a handful of buffers from one shared pool and
+ * returns them, the way several connections decoding on different threads
+ * would.
+ *
+ * Usage: bench_buffer_pool [iterations per thread]
+ */
+int main(int argc, char** argv) {
+    const size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+
+    std::printf("%8s %14s %10s %10s %10s %10s\n",
+                "threads", "ops/s", "hits", "steals", "misses", "high_water");
+
+    for (size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        auto pool = buffer_pool::create(64 * 1024);
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < thread_count; t++) {
+            threads.emplace_back([&pool, iterations]() {
+                std::vector<buffer_ptr> held;
+                held.reserve(8);
+                for (size_t i = 0; i < iterations; i++) {
+                    held.push_back(pool->get_buffer());
+                    if (held.size() == held.capacity()) {
+                        held.clear();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        pool_stats stats = pool->stats();
+        double ops = static_cast<double>(thread_count * iterations) / elapsed;
+
+        std::printf("%8zu %14.0f %10llu %10llu %10llu %10zu\n",
+                    thread_count, ops,
+                    static_cast<unsigned long long>(stats.hits),
+                    static_cast<unsigned long long>(stats.steals),
+                    static_cast<unsigned long long>(stats.misses),
+                    stats.high_water);
+    }
+
+    return 0;
+}
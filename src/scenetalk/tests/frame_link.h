@@ -0,0 +1,62 @@
+#pragma once
+
+#include "decoder.h"
+#include "encoder.h"
+#include "scene_store.h"
+#include <functional>
+#include <memory>
+
+namespace scene_talk {
+
+/**
+ * @brief An encoder whose frames go straight into a decoder
+ *
+ * The observer sees each frame before the decoder, returning false drops it.
+ */
+struct frame_link {
+    using frame_observer = std::function<bool(const frame_view&)>;
+
+    frame_link(const std::shared_ptr<buffer_pool>& pool, message_handler handler,
+               frame_observer observer = {}, size_t max_payload_size = MAX_PAYLOAD_SIZE)
+        : dec(std::move(handler), pool),
+          observer(std::move(observer)),
+          enc([this](const frame_view& f) { deliver(f); }, max_payload_size) {}
+
+    frame_link(const std::shared_ptr<buffer_pool>& pool, message_visitor& visitor,
+               frame_observer observer = {}, size_t max_payload_size = MAX_PAYLOAD_SIZE)
+        : dec(visitor, pool),
+          observer(std::move(observer)),
+          enc([this](const frame_view& f) { deliver(f); }, max_payload_size) {}
+
+    frame_link(const frame_link&) = delete;
+    frame_link& operator=(const frame_link&) = delete;
+
+    decoder dec;
+    frame_observer observer;
+    encoder enc;
+
+private:
+    void deliver(const frame_view& f) {
+        if (!observer || observer(f)) {
+            dec.process_frame(f);
+        }
+    }
+};
+
+// The pool and store of a scene_link, set up ahead of its frame_link
+struct scene_link_store {
+    std::shared_ptr<buffer_pool> pool = buffer_pool::create(1024);
+    scene_store store{pool};
+};
+
+/**
+ * @brief A frame_link whose decoder fills a scene_store
+ *
+ * Payloads are kept small so larger values arrive as fragments.
+ */
+struct scene_link : scene_link_store, frame_link {
+    explicit scene_link(frame_observer observer = {}, size_t max_payload_size = 1000)
+        : frame_link(pool, store, std::move(observer), max_payload_size) {}
+};
+
+} // namespace scene_talk
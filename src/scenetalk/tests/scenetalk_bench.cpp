@@ -0,0 +1,300 @@
+#include "decoder.h"
+#include "encoder.h"
+#include "frame.h"
+#include "net_buffer.h"
+#include "scene_store.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using namespace scene_talk;
+
+// Count heap allocations made through operator new
+static std::atomic<size_t> allocations{0};
+static std::atomic<size_t> allocated_bytes{0};
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// Sends a synthetic scene through an encoder
+using scene_writer = std::function<void(encoder& enc)>;
+
+struct scene {
+    const char* name;
+    scene_writer write;
+};
+
+// Grid of points with quads between them
+struct mesh_data {
+    std::vector<float> points;
+    std::vector<float> normals;
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> indices;
+
+    explicit mesh_data(size_t side) {
+        points.reserve(side * side * 3);
+        for (size_t y = 0; y < side; y++) {
+            for (size_t x = 0; x < side; x++) {
+                points.insert(points.end(), {static_cast<float>(x), 0.0f, static_cast<float>(y)});
+                normals.insert(normals.end(), {0.0f, 1.0f, 0.0f});
+            }
+        }
+        for (size_t y = 0; y + 1 < side; y++) {
+            for (size_t x = 0; x + 1 < side; x++) {
+                auto corner = static_cast<uint32_t>(y * side + x);
+                auto row = static_cast<uint32_t>(side);
+                counts.push_back(4);
+                indices.insert(indices.end(), {corner, corner + 1, corner + row + 1, corner + row});
+            }
+        }
+    }
+};
+
+void write_mesh(encoder& enc, const std::string& name, int depth, const mesh_data& mesh) {
+    enc.begin("Mesh", name, depth);
+    enc.attr(attrs::points, std::span<const float>(mesh.points));
+    enc.attr(attrs::normals, std::span<const float>(mesh.normals));
+    enc.attr(attrs::face_vertex_counts, std::span<const uint32_t>(mesh.counts));
+    enc.attr(attrs::face_vertex_indices, std::span<const uint32_t>(mesh.indices));
+    enc.end(depth);
+}
+
+// Prims with a transform and a few small attributes each
+void write_tiny_prims(encoder& enc, size_t count) {
+    enc.begin("Xform", "World", 1);
+    for (size_t i = 0; i < count; i++) {
+        auto offset = static_cast<float>(i);
+        enc.begin("Xform", "prim" + std::to_string(i), 2);
+        enc.attr(attrs::transform, attrs::mat4f{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, offset, 0, 0, 1});
+        enc.attr(attrs::purpose, "render");
+        enc.attr("visibility", "str", "inherited");
+        enc.attr("userId", "int", static_cast<int>(i));
+        enc.end(2);
+    }
+    enc.end(1);
+}
+
+std::vector<scene> make_scenes() {
+    static const mesh_data huge(1024);
+    static const mesh_data small(16);
+    static const mesh_data large(256);
+
+    return {
+        {"tiny_prims", [](encoder& enc) { write_tiny_prims(enc, 10000); }},
+        {"huge_mesh", [](encoder& enc) {
+            enc.begin("Xform", "World", 1);
+            write_mesh(enc, "terrain", 2, huge);
+            enc.end(1);
+        }},
+        {"mixed", [](encoder& enc) {
+            write_tiny_prims(enc, 1000);
+            enc.begin("Xform", "Props", 1);
+            for (size_t i = 0; i < 200; i++) {
+                write_mesh(enc, "prop" + std::to_string(i), 2, small);
+            }
+            write_mesh(enc, "ground", 2, large);
+            enc.end(1);
+        }},
+    };
+}
+
+struct allocation_count {
+    size_t count;
+    size_t bytes;
+
+    static allocation_count now() {
+        return {allocations.load(std::memory_order_relaxed), allocated_bytes.load(std::memory_order_relaxed)};
+    }
+};
+
+/**
+ * Time a stage over a number of iterations after one warm up run, so pools
+ * and scratch buffers have grown and steady state allocations are counted.
+ *
+ * @param bytes Bytes the stage handles per iteration
+ * @param frames Frames the stage handles per iteration
+ */
+nlohmann::json measure(const char* scene_name, const char* stage, size_t iterations,
+                       size_t bytes, size_t frames, const std::function<void()>& run) {
+    run();
+
+    allocation_count before = allocation_count::now();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        run();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocation_count after = allocation_count::now();
+
+    double runs = static_cast<double>(iterations);
+    double total_frames = static_cast<double>(frames) * runs;
+    return {
+        {"scene", scene_name},
+        {"stage", stage},
+        {"iterations", iterations},
+        {"bytes", bytes},
+        {"frames", frames},
+        {"seconds", seconds / runs},
+        {"mb_per_s", static_cast<double>(bytes) * runs / seconds / 1e6},
+        {"frames_per_s", total_frames / seconds},
+        {"allocs_per_frame", static_cast<double>(after.count - before.count) / total_frames},
+        {"alloc_bytes_per_frame", static_cast<double>(after.bytes - before.bytes) / total_frames},
+    };
+}
+
+// Feed wire bytes to a net_buffer in chunks of the given size
+void append_chunked(net_buffer& buffer, const std::vector<uint8_t>& wire, size_t chunk_size) {
+    for (size_t offset = 0; offset < wire.size(); offset += chunk_size) {
+        buffer.append(wire.data() + offset, std::min(chunk_size, wire.size() - offset));
+    }
+}
+
+void bench_scene(const scene& s, size_t iterations, nlohmann::json& results) {
+    auto pool = buffer_pool::create(64 * 1024);
+
+    // Frames as the encoder writes them, payloads split if they do not fit
+    std::vector<frame> frames;
+    size_t wire_bytes = 0;
+    encoder capture([&](const frame_view& f) {
+        frames.emplace_back(f);
+        wire_bytes += f.header().size() + f.payload.size();
+    });
+    s.write(capture);
+
+    size_t frame_count = frames.size();
+    size_t counted_bytes = 0;
+    size_t counted_frames = 0;
+    encoder counting([&](const frame_view& f) {
+        counted_bytes += f.header().size() + f.payload.size();
+        counted_frames++;
+    });
+    results.push_back(measure(s.name, "encode", iterations, wire_bytes, frame_count, [&] {
+        s.write(counting);
+    }));
+
+    std::vector<uint8_t> wire;
+    wire.reserve(wire_bytes);
+    results.push_back(measure(s.name, "serialize", iterations, wire_bytes, frame_count, [&] {
+        wire.clear();
+        for (const auto& f : frames) {
+            std::vector<uint8_t> bytes = f.serialize();
+            wire.insert(wire.end(), bytes.begin(), bytes.end());
+        }
+    }));
+
+    // Chunk sizes of small packets, an MTU, socket reads and the whole stream at once
+    size_t received = 0;
+    net_buffer buffer(pool, [&](const frame_view&) { received++; });
+    for (size_t chunk_size : {size_t{64}, size_t{1460}, size_t{16 * 1024}, size_t{256 * 1024}, wire.size()}) {
+        nlohmann::json row = measure(s.name, "net_buffer_append", iterations, wire_bytes, frame_count, [&] {
+            append_chunked(buffer, wire, chunk_size);
+        });
+        row["chunk_size"] = chunk_size;
+        results.push_back(std::move(row));
+    }
+
+    size_t documents = 0;
+    decoder json_decoder([&](uint8_t, const nlohmann::json&) { documents++; }, pool);
+    results.push_back(measure(s.name, "decode_json", iterations, wire_bytes, frame_count, [&] {
+        for (const auto& f : frames) {
+            json_decoder.process_frame(f);
+        }
+    }));
+
+    scene_store store(pool);
+    decoder store_decoder(store, pool);
+    results.push_back(measure(s.name, "decode_scene_store", iterations, wire_bytes, frame_count, [&] {
+        store.reset();
+        for (const auto& f : frames) {
+            store_decoder.process_frame(f);
+        }
+    }));
+
+    // Encoder to wire bytes to net_buffer to decoder, as a connection would
+    scene_store remote(pool);
+    decoder remote_decoder(remote, pool);
+    net_buffer remote_buffer(pool, [&](const frame_view& f) { remote_decoder.process_frame(f); });
+    std::vector<uint8_t> link;
+    link.reserve(wire_bytes);
+    encoder sender([&](const frame_view& f) {
+        auto header = f.header();
+        link.insert(link.end(), header.begin(), header.end());
+        link.insert(link.end(), f.payload.begin(), f.payload.end());
+    });
+    results.push_back(measure(s.name, "round_trip", iterations, wire_bytes, frame_count, [&] {
+        link.clear();
+        remote.reset();
+        s.write(sender);
+        append_chunked(remote_buffer, link, 16 * 1024);
+    }));
+
+    if (counted_bytes != wire_bytes * (iterations + 1) || counted_frames != frame_count * (iterations + 1) ||
+        received != frame_count * 5 * (iterations + 1) || remote.prim_count() != store.prim_count()) {
+        std::fprintf(stderr, "%s: stages did not see the same frames\n", s.name);
+    }
+}
+
+} // namespace
+
+/**
+ * @brief Throughput and allocation benchmark of the protocol stages
+ *
+ * Encodes synthetic scenes and runs them through frame serialization,
+ * net_buffer reassembly at several chunk sizes, decoding to json and to a
+ * scene_store, and the whole way from encoder to scene_store. Prints one
+ * JSON document with a row per scene and stage, times are per iteration
+ * and allocations are counted after a warm up run.
+ *
+ * Usage: scenetalk_bench [iterations] [scene]
+ */
+int main(int argc, char** argv) {
+    const size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5;
+    const char* only = argc > 2 ? argv[2] : nullptr;
+
+    nlohmann::json results = nlohmann::json::array();
+    for (const scene& s : make_scenes()) {
+        if (!only || std::strcmp(only, s.name) == 0) {
+            bench_scene(s, iterations > 0 ? iterations : 1, results);
+        }
+    }
+
+    nlohmann::json report = {{"benchmark", "scenetalk_bench"}, {"results", std::move(results)}};
+    std::printf("%s\n", report.dump(2).c_str());
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "encoder.h"
+#include "frame.h"
+#include "frame_scheduler.h"
+#include <utest/utest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+// Count heap allocations made through operator new
+static std::atomic<size_t> allocations{0};
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// Names longer than the small string buffer would allocate at the call site
+static const std::string mesh = "Mesh";
+static const std::string points_name = "points";
+static const std::string indices_name = "faceVertexIndices";
+
+// Send one of every frame the encoder writes in steady state
+static void encode_frames(encoder& enc, const std::string& name, const std::string& msg,
+                          std::span<const float> points, std::span<const uint32_t> indices) {
+    enc.begin(mesh, name, 1);
+    enc.attr(points_name, points, 3);
+    enc.attr(indices_name, indices);
+    enc.end(1);
+    enc.info(msg);
+    enc.warning(msg);
+    enc.error(msg);
+    enc.ping_pong();
+    enc.flow_control(2);
+}
+
+UTEST(allocations, encoder_steady_state) {
+    std::vector<float> points(3000, 1.5f);
+    std::vector<uint32_t> indices(40000, 7);
+    std::string name = "cube";
+    std::string msg = "cooking";
+
+    size_t frames = 0;
+    encoder enc([&frames](const frame_view&) {
+        frames++;
+    });
+
+    // Warm up the scratch buffers, the indices are split into fragments
+    encode_frames(enc, name, msg, points, indices);
+
+    allocations = 0;
+    for (int i = 0; i < 100; i++) {
+        encode_frames(enc, name, msg, points, indices);
+    }
+    size_t counted = allocations;
+
+    ASSERT_GT(frames, 1000u);
+    ASSERT_EQ(counted, 0u);
+}
+
+UTEST(allocations, negotiated_encoder_steady_state) {
+    std::vector<float> points(3000, 1.5f);
+    std::vector<uint32_t> indices(40000, 7);
+    std::string name = "cube";
+    std::string msg = "cooking";
+
+    // Corked gather writes with compression and stream prefixed fragments
+    size_t writes = 0;
+    encoder enc([&writes](std::span<const byte_span>) {
+        writes++;
+    }, batch_limits{}, 16 * 1024);
+    enc.set_peer_caps(CAP_COMPRESSION | CAP_STREAM_PREFIX);
+
+    {
+        cork_scope cork(enc);
+        encode_frames(enc, name, msg, points, indices);
+    }
+
+    allocations = 0;
+    for (int i = 0; i < 100; i++) {
+        cork_scope cork(enc);
+        encode_frames(enc, name, msg, points, indices);
+    }
+    size_t counted = allocations;
+
+    ASSERT_GT(writes, 100u);
+    ASSERT_EQ(counted, 0u);
+}
+
+UTEST(allocations, scheduler_steady_state) {
+    std::vector<float> points(3000, 1.5f);
+    std::vector<uint32_t> indices(40000, 7);
+    std::string name = "cube";
+    std::string msg = "cooking";
+
+    size_t written = 0;
+    auto pool = buffer_pool::create(1024);
+    frame_scheduler scheduler([&written](std::span<const byte_span> segments) {
+        written += segments.size();
+    }, pool);
+    encoder enc(scheduler.writer(), 16 * 1024);
+
+    // Warm up the pool with the queued frames of one round
+    encode_frames(enc, name, msg, points, indices);
+    scheduler.run();
+
+    allocations = 0;
+    for (int i = 0; i < 100; i++) {
+        encode_frames(enc, name, msg, points, indices);
+        scheduler.run();
+    }
+    size_t counted = allocations;
+
+    ASSERT_GT(written, 1000u);
+    ASSERT_EQ(counted, 0u);
+}
@@ -0,0 +1,205 @@
+#include "animation.h"
+#include "decoder.h"
+#include "encoder.h"
+#include <utest/utest.h>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+// Keeps the samples of the last ANIMATION frame
+struct animation_visitor : message_visitor {
+    std::string name;
+    std::string attr_type;
+    std::vector<float> times;
+    std::vector<float> values;
+    std::vector<float> channel;
+    size_t components = 0;
+    int frames = 0;
+
+    void on_animation(std::string_view name, std::string_view attr_type,
+                      const animation_samples& samples) override {
+        this->name = name;
+        this->attr_type = attr_type;
+        times.assign(samples.times.begin(), samples.times.end());
+        values.assign(samples.values.begin(), samples.values.end());
+        components = samples.components;
+        auto x = samples.channel(components > 12 ? 12 : 0);
+        channel.clear();
+        for (size_t i = 0; i < x.size(); i++) {
+            channel.push_back(x[i]);
+        }
+        frames++;
+    }
+};
+
+// A transform moving along x over 240 frames
+static std::vector<attrs::mat4f> moving_transforms(std::vector<float>& times) {
+    std::vector<attrs::mat4f> transforms;
+    for (int i = 0; i < 240; i++) {
+        times.push_back(static_cast<float>(i) / 24.0f);
+        transforms.push_back({1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0,
+                              std::sin(static_cast<float>(i) * 0.1f) * 10.0f, 0.5f, 0, 1});
+    }
+    return transforms;
+}
+
+static float max_error(const std::vector<float>& a, std::span<const float> b) {
+    float error = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        error = std::max(error, std::abs(a[i] - b[i]));
+    }
+    return error;
+}
+
+UTEST(animation, batched_transform) {
+    auto pool = buffer_pool::create(1024);
+    animation_visitor visitor;
+    decoder dec(visitor, pool);
+    std::vector<frame> frames;
+    encoder enc([&](const frame_view& f) {
+        frames.emplace_back(f.type, f.flags, std::vector<uint8_t>(f.payload.begin(), f.payload.end()));
+        dec.process_frame(f);
+    }, MAX_PAYLOAD_SIZE);
+
+    std::vector<float> times;
+    auto transforms = moving_transforms(times);
+    enc.animation(attrs::transform, times, transforms);
+
+    // One frame for all 240 samples, handed over as strided spans
+    ASSERT_EQ(frames.size(), 1u);
+    ASSERT_EQ(frames[0].type, ANIMATION);
+    ASSERT_EQ(visitor.frames, 1);
+    ASSERT_STREQ(visitor.name.c_str(), "transform");
+    ASSERT_STREQ(visitor.attr_type.c_str(), "mat4f");
+    ASSERT_EQ(visitor.components, 16u);
+    ASSERT_TRUE(visitor.times == times);
+    ASSERT_EQ(visitor.values.size(), 240u * 16u);
+    ASSERT_EQ(visitor.channel.size(), 240u);
+    ASSERT_EQ(visitor.channel[7], transforms[7][12]);
+    ASSERT_EQ(max_error(visitor.values, std::span<const float>(transforms.data()->data(), 240 * 16)), 0.0f);
+}
+
+UTEST(animation, delta_and_quantization) {
+    auto pool = buffer_pool::create(1024);
+    animation_visitor visitor;
+    decoder dec(visitor, pool);
+    // Compressed frames are expanded by the decoder's net_buffer
+    std::vector<size_t> sizes;
+    encoder enc([&](const frame_view& f) {
+        sizes.push_back(f.payload.size());
+        auto header = f.header();
+        dec.get_net_buffer().append(header.data(), header.size());
+        dec.get_net_buffer().append(f.payload.data(), f.payload.size());
+    }, MAX_PAYLOAD_SIZE);
+
+    std::vector<float> times;
+    auto transforms = moving_transforms(times);
+    std::span<const float> values(transforms.data()->data(), transforms.size() * 16);
+
+    enc.animation("transform", "mat4f", times, values);
+    enc.animation("transform", "mat4f", times, values, {.delta = true});
+    ASSERT_LT(max_error(visitor.values, values), 1e-5f);
+
+    enc.animation("transform", "mat4f", times, values, {.quantize = true});
+    ASSERT_LT(max_error(visitor.values, values), 20.0f / 65535.0f);
+
+    enc.animation("transform", "mat4f", times, values, {.delta = true, .quantize = true});
+    ASSERT_LT(max_error(visitor.values, values), 20.0f / 65535.0f);
+    ASSERT_EQ(visitor.frames, 4);
+
+    // Quantized values take half the space, and their deltas compress better
+    ASSERT_LT(sizes[2], sizes[0] * 6 / 10);
+    enc.set_peer_caps(CAP_COMPRESSION);
+    enc.animation("transform", "mat4f", times, values);
+    enc.animation("transform", "mat4f", times, values, {.delta = true, .quantize = true});
+    ASSERT_EQ(visitor.frames, 6);
+    ASSERT_LT(sizes[5], sizes[4]);
+}
+
+UTEST(animation, quantized_delta_wraps) {
+    // A jump across the whole range and back wraps the 16-bit differences
+    std::vector<float> values = {0.0f, 1.0f, 0.0f, 1.0f};
+    std::vector<float> min, max, decoded;
+    std::vector<uint16_t> quantized;
+    quantize_samples(values, 1, true, min, max, quantized);
+    ASSERT_EQ(quantized[0], 0u);
+    ASSERT_EQ(quantized[1], 65535u);
+    ASSERT_EQ(quantized[2], 1u);
+
+    std::span<const uint8_t> bytes(reinterpret_cast<const uint8_t*>(quantized.data()),
+                                   quantized.size() * sizeof(uint16_t));
+    ASSERT_TRUE(decode_samples(TAG_SINT16_LE, bytes, 1, true, min, max, decoded));
+    ASSERT_TRUE(decoded == values);
+    ASSERT_FALSE(decode_samples(TAG_UINT16_LE, bytes, 1, true, min, max, decoded));
+}
+
+UTEST(animation, json_payload) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> types;
+    std::vector<nlohmann::json> received;
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        types.push_back(type);
+        received.push_back(payload);
+    }, pool);
+    encoder enc([&](const frame_view& f) {
+        dec.process_frame(f);
+    });
+    enc.set_peer_caps(CAP_ATTRIBUTE_IDS | CAP_STRING_TABLE);
+
+    std::vector<float> times = {0.0f, 1.0f};
+    std::vector<float> values = {0, 1, 0, 0, 0, 1};
+    enc.animation("objectUp", "vec3f", times, values, {.delta = true});
+    enc.animation("myUp", "vec3f", times, values);
+    enc.animation("myUp", "vec3f", times, values);
+
+    // Registry ids and string table entries are resolved, values kept as sent
+    ASSERT_EQ(received.size(), 3u);
+    ASSERT_EQ(types[0], ANIMATION);
+    ASSERT_TRUE(received[0]["name"] == "objectUp");
+    ASSERT_TRUE(received[0]["type"] == "vec3f");
+    ASSERT_TRUE(received[0]["delta"] == true);
+    ASSERT_EQ(received[0]["values"].get_binary().subtype(), TAG_FLOAT32_LE);
+    ASSERT_TRUE(received[2]["name"] == "myUp");
+    ASSERT_EQ(received[2]["components"].get<int>(), 3);
+}
+
+UTEST(animation, rejects_mismatched_values) {
+    int frames = 0;
+    encoder enc([&](const frame_view&) { frames++; });
+
+    // Fewer values than times, and values that do not split evenly
+    std::vector<float> times = {0.0f, 1.0f, 2.0f};
+    std::vector<float> short_values = {1.0f, 2.0f};
+    std::vector<float> uneven_values = {1.0f, 2.0f, 3.0f, 4.0f};
+    bool threw = false;
+    try {
+        enc.animation("size", "float", times, short_values);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    threw = false;
+    try {
+        enc.animation("size", "float", times, uneven_values, {.quantize = true});
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_EQ(frames, 0);
+
+    // The quantizer copes with fewer values than components and with none
+    std::vector<float> min, max, samples;
+    std::vector<uint16_t> quantized;
+    quantize_samples(short_values, 3, false, min, max, quantized);
+    ASSERT_EQ(min.size(), 3u);
+    ASSERT_EQ(quantized.size(), 2u);
+    quantize_samples(short_values, 0, true, min, max, quantized);
+    ASSERT_TRUE(quantized.empty());
+    delta_encode_samples(short_values, 0, samples);
+    ASSERT_TRUE(samples == short_values);
+}
@@ -0,0 +1,47 @@
+#include "attribute_registry.h"
+#include "encoder.h"
+#include <utest/utest.h>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+// Lookups work at compile time
+static_assert(find_core_attr("points")->id == core_attr::points);
+static_assert(core_attr_by_id(static_cast<uint8_t>(core_attr::transform))->type == value_type::mat4f);
+static_assert(find_value_type("u32[]")->id == value_type::u32_array);
+static_assert(find_core_attr("myCustomAttr") == nullptr);
+static_assert(attrs::face_vertex_indices.info().name == "faceVertexIndices");
+
+// The encoder only accepts the registered value type of a core attribute
+template<typename Key, typename Value>
+concept sendable = requires(encoder& enc, Key key, Value value) { enc.attr(key, value); };
+
+static_assert(sendable<decltype(attrs::points), std::vector<float>>);
+static_assert(sendable<decltype(attrs::face_vertex_counts), std::vector<uint32_t>>);
+static_assert(sendable<decltype(attrs::type_name), const char*>);
+static_assert(sendable<decltype(attrs::transform), attrs::mat4f>);
+static_assert(!sendable<decltype(attrs::transform), attrs::vec3f>);
+static_assert(!sendable<decltype(attrs::points), std::vector<uint32_t>>);
+static_assert(!sendable<decltype(attrs::type_name), std::vector<float>>);
+
+UTEST(attribute_registry, ids_round_trip) {
+    for (const auto& info : CORE_ATTRIBUTES) {
+        ASSERT_EQ(core_attr_by_id(static_cast<uint8_t>(info.id)), &info);
+        ASSERT_EQ(find_core_attr(info.name), &info);
+        ASSERT_TRUE(value_type_by_id(static_cast<uint8_t>(info.type)) != nullptr);
+    }
+    for (const auto& info : VALUE_TYPES) {
+        ASSERT_EQ(value_type_by_id(static_cast<uint8_t>(info.id)), &info);
+        ASSERT_EQ(find_value_type(info.name), &info);
+    }
+}
+
+UTEST(attribute_registry, unknown_ids) {
+    ASSERT_TRUE(core_attr_by_id(0) == nullptr);
+    ASSERT_TRUE(core_attr_by_id(CORE_ATTRIBUTES.size() + 1) == nullptr);
+    ASSERT_TRUE(value_type_by_id(0) == nullptr);
+    ASSERT_TRUE(value_type_by_id(VALUE_TYPES.size() + 1) == nullptr);
+}
@@ -1,5 +1,9 @@
 #include "buffer_pool.h"
 #include "utest/utest.h"
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
 
 UTEST_MAIN();
 
@@ -116,4 +120,177 @@ UTEST(buffer_pool, move_semantics) {
     ASSERT_EQ(buffer2->data()[1], 2);
     ASSERT_EQ(buffer2->data()[2], 3);
     ASSERT_EQ(buffer2->data()[3], 4);
-}
\ No newline at end of file
+}
+UTEST(buffer_pool, stats) {
+    auto pool = buffer_pool::create(128, 1);
+
+    // Taken from the shared depot, then served from the thread cache
+    auto buffer1 = pool->get_buffer();
+    // Nothing left anywhere, allocated
+    auto buffer2 = pool->get_buffer();
+
+    buffer1.reset();
+    buffer2.reset();
+
+    // Both served from the thread cache
+    auto buffer3 = pool->get_buffer();
+    auto buffer4 = pool->get_buffer();
+
+    pool_stats stats = pool->stats();
+    ASSERT_EQ(stats.hits, 3);
+    ASSERT_EQ(stats.misses, 1);
+    ASSERT_EQ(stats.steals, 1);
+    ASSERT_EQ(stats.high_water, 2);
+}
+
+UTEST(buffer_pool, cross_thread) {
+    auto pool = buffer_pool::create(128, 0);
+    constexpr size_t thread_count = 4;
+    constexpr size_t iterations = 10000;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&pool, t]() {
+            std::vector<buffer_ptr> held;
+            for (size_t i = 0; i < iterations; i++) {
+                auto b = pool->get_buffer();
+                b->resize(1);
+                b->data()[0] = static_cast<uint8_t>(t);
+                held.push_back(std::move(b));
+
+                // Hold a few buffers at a time so the caches spill and refill
+                if (held.size() == 48) {
+                    for (auto& h : held) {
+                        if (h->data()[0] != static_cast<uint8_t>(t)) {
+                            std::abort();
+                        }
+                    }
+                    held.clear();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Buffers cached by the exited threads went back to the shared depot
+    pool_stats stats = pool->stats();
+    ASSERT_EQ(stats.hits + stats.misses, thread_count * iterations);
+    ASSERT_EQ(pool->pool_size(), stats.high_water);
+}
+
+UTEST(buffer_pool, size_classes) {
+    auto pool = buffer_pool::create(64 * 1024, 0);
+
+    // Requests round up to the next power of two
+    auto small = pool->get_buffer(40);
+    ASSERT_EQ(small->capacity(), MIN_BUFFER_SIZE);
+
+    auto medium = pool->get_buffer(1000);
+    ASSERT_EQ(medium->capacity(), 1024);
+
+    auto exact = pool->get_buffer(4096);
+    ASSERT_EQ(exact->capacity(), 4096);
+
+    // Larger than the default size, served from the depot directly
+    auto large = pool->get_buffer(3 * 1024 * 1024);
+    ASSERT_EQ(large->capacity(), 4 * 1024 * 1024);
+
+    // Default size
+    auto standard = pool->get_buffer();
+    ASSERT_EQ(standard->capacity(), 64 * 1024);
+
+    ASSERT_EQ(pool->stats().allocated_bytes, 64 + 1024 + 4096 + 4 * 1024 * 1024 + 64 * 1024);
+
+    // Returned buffers are reused for their own size class only
+    small.reset();
+    large.reset();
+    auto small_again = pool->get_buffer(64);
+    auto large_again = pool->get_buffer(4 * 1024 * 1024);
+    ASSERT_EQ(pool->stats().misses, 5);
+    ASSERT_EQ(pool->pool_size(), 0);
+}
+
+UTEST(buffer_pool, idle_ceiling) {
+    pool_limits limits;
+    limits.max_idle_bytes = 2 * 1024 * 1024;
+    auto pool = buffer_pool::create(1024, 0, limits);
+
+    {
+        // A burst of large buffers
+        std::vector<buffer_ptr> burst;
+        for (int i = 0; i < 4; i++) {
+            burst.push_back(pool->get_buffer(1024 * 1024));
+        }
+        ASSERT_EQ(pool->stats().allocated_bytes, 4 * 1024 * 1024);
+    }
+
+    // Only what fits under the ceiling stays pooled
+    pool_stats stats = pool->stats();
+    ASSERT_EQ(stats.idle_bytes, 2 * 1024 * 1024);
+    ASSERT_EQ(stats.allocated_bytes, 2 * 1024 * 1024);
+    ASSERT_EQ(pool->pool_size(), 2);
+}
+
+UTEST(buffer_pool, trim) {
+    pool_limits limits;
+    limits.low_water_bytes = 64 * 1024;
+    auto pool = buffer_pool::create(64 * 1024, 8, limits);
+    ASSERT_EQ(pool->stats().idle_bytes, 8 * 64 * 1024);
+
+    {
+        std::vector<buffer_ptr> burst;
+        for (int i = 0; i < 4; i++) {
+            burst.push_back(pool->get_buffer(1024 * 1024));
+            burst.push_back(pool->get_buffer(100));
+        }
+    }
+
+    // Trimming frees idle memory down to the low-water mark, largest first
+    size_t freed = pool->trim();
+    pool_stats stats = pool->stats();
+    ASSERT_LE(stats.idle_bytes, limits.low_water_bytes);
+    ASSERT_EQ(stats.allocated_bytes, stats.idle_bytes);
+    ASSERT_EQ(freed, 8 * 64 * 1024 + 4 * 1024 * 1024 + 4 * 128 - stats.idle_bytes);
+
+    // The pool keeps working after a trim
+    auto b = pool->get_buffer();
+    ASSERT_EQ(b->capacity(), 64 * 1024);
+}
+
+UTEST(buffer_pool, trim_reclaims_other_threads) {
+    pool_limits limits;
+    limits.low_water_bytes = 0;
+    auto pool = buffer_pool::create(1024, 0, limits);
+
+    // A worker returns its buffers to its own cache and stays alive
+    std::atomic<bool> returned{false};
+    std::atomic<bool> done{false};
+    std::thread worker([&]() {
+        {
+            std::vector<buffer_ptr> burst;
+            for (int i = 0; i < 20; i++) {
+                burst.push_back(pool->get_buffer());
+            }
+        }
+        returned = true;
+        while (!done) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!returned) {
+        std::this_thread::yield();
+    }
+
+    // Trimming from another thread reaches the worker's cache
+    size_t freed = pool->trim();
+    pool_stats stats = pool->stats();
+    done = true;
+    worker.join();
+
+    ASSERT_EQ(freed, 20 * 1024);
+    ASSERT_EQ(stats.allocated_bytes, 0);
+    ASSERT_EQ(pool->stats().allocated_bytes, 0);
+}
@@ -0,0 +1,90 @@
+#include <vector>
+#include <utest/utest.h>
+#include <nlohmann/json.hpp>
+#include "cbor_reader.h"
+#include "cbor_writer.h"
+
+using namespace scene_talk;
+
+UTEST_MAIN()
+
+UTEST(cbor, writer_matches_json) {
+    std::vector<uint8_t> bytes;
+    cbor_writer writer(bytes);
+    writer.map(3);
+    writer.text("a");
+    writer.integer(-1000);
+    writer.text("b");
+    writer.uint(70000);
+    writer.text("c");
+    writer.array(2);
+    writer.text(std::string(300, 'x'));
+    writer.uint(UINT64_MAX);
+
+    nlohmann::json expected = {
+        {"a", -1000},
+        {"b", 70000},
+        {"c", {std::string(300, 'x'), UINT64_MAX}}
+    };
+    ASSERT_TRUE(bytes == nlohmann::json::to_cbor(expected));
+}
+
+UTEST(cbor, reader_reads_json_output) {
+    nlohmann::json document = {
+        {"depth", -3},
+        {"name", "cube"},
+        {"nested", {{"list", {1, 2.5, nullptr, true}}}},
+        {"raw", nlohmann::json::binary({1, 2, 3}, 64)}
+    };
+    std::vector<uint8_t> bytes = nlohmann::json::to_cbor(document);
+
+    cbor_reader reader(bytes);
+    ASSERT_EQ(reader.read_map(), 4);
+    ASSERT_TRUE(reader.read_text() == "depth");
+    ASSERT_EQ(reader.read_int(), -3);
+    ASSERT_TRUE(reader.read_text() == "name");
+    ASSERT_TRUE(reader.read_text() == "cube");
+    ASSERT_TRUE(reader.read_text() == "nested");
+
+    // Skipped items come back as their encoded bytes
+    auto nested = reader.skip();
+    ASSERT_TRUE(nlohmann::json::from_cbor(nested) == document["nested"]);
+
+    ASSERT_TRUE(reader.read_text() == "raw");
+    ASSERT_EQ(reader.read_tag(), 64);
+    auto raw = reader.read_bytes();
+    ASSERT_EQ(raw.size(), 3);
+    ASSERT_EQ(raw[2], 3);
+    ASSERT_TRUE(reader.at_end());
+}
+
+UTEST(cbor, reader_skips_indefinite_items) {
+    // [_ "a", {_ "b": 1}] followed by 7
+    std::vector<uint8_t> bytes = {0x9F, 0x61, 'a', 0xBF, 0x61, 'b', 0x01, 0xFF, 0xFF, 0x07};
+
+    cbor_reader reader(bytes);
+    ASSERT_EQ(reader.skip().size(), 9);
+    ASSERT_EQ(reader.read_uint(), 7);
+}
+
+UTEST(cbor, reader_rejects_malformed_input) {
+    // Text longer than the input
+    std::vector<uint8_t> truncated = {0x65, 'a', 'b'};
+    cbor_reader reader(truncated);
+    ASSERT_EXCEPTION(reader.read_text(), cbor_error);
+
+    // Wrong item type
+    std::vector<uint8_t> number = {0x01};
+    cbor_reader number_reader(number);
+    ASSERT_EXCEPTION(number_reader.read_text(), cbor_error);
+
+    // Array claiming more items than present
+    std::vector<uint8_t> short_array = {0x9B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    cbor_reader array_reader(short_array);
+    ASSERT_EXCEPTION(array_reader.skip(), cbor_error);
+
+    // Deep nesting
+    std::vector<uint8_t> deep(1000, 0x81);
+    cbor_reader deep_reader(deep);
+    ASSERT_EXCEPTION(deep_reader.skip(), cbor_error);
+}
@@ -0,0 +1,97 @@
+#include <random>
+#include <vector>
+#include <utest/utest.h>
+#include "compression.h"
+
+using namespace scene_talk;
+
+UTEST_MAIN()
+
+// Compress and decompress data, returns the compressed size or 0 on mismatch
+static size_t round_trip(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> compressed(compress_bound(data.size()));
+    size_t compressed_size = block_compress(data.data(), data.size(), compressed.data());
+    if (compressed_size > compressed.size()) {
+        return 0;
+    }
+
+    std::vector<uint8_t> decompressed(data.size());
+    if (!block_decompress(compressed.data(), compressed_size, decompressed.data(), decompressed.size())) {
+        return 0;
+    }
+    return decompressed == data ? compressed_size : 0;
+}
+
+UTEST(compression, empty_and_small) {
+    ASSERT_GT(round_trip({}), 0);
+    ASSERT_GT(round_trip({1}), 0);
+    ASSERT_GT(round_trip({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13}), 0);
+}
+
+UTEST(compression, repetitive_data_shrinks) {
+    // An index list and a float array like the ones in mesh attributes
+    std::vector<uint8_t> indices;
+    for (uint32_t i = 0; i < 10000; i++) {
+        uint32_t index = i % 64;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&index);
+        indices.insert(indices.end(), bytes, bytes + sizeof(index));
+    }
+    size_t compressed_size = round_trip(indices);
+    ASSERT_GT(compressed_size, 0);
+    ASSERT_LT(compressed_size, indices.size() / 10);
+
+    // Long runs exercise overlapping matches
+    std::vector<uint8_t> zeros(100000, 0);
+    compressed_size = round_trip(zeros);
+    ASSERT_GT(compressed_size, 0);
+    ASSERT_LT(compressed_size, 1000);
+}
+
+UTEST(compression, random_data_round_trips) {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    for (size_t size : {15, 100, 4096, 70000}) {
+        std::vector<uint8_t> data(size);
+        for (auto& value : data) {
+            value = static_cast<uint8_t>(byte(generator));
+        }
+        size_t compressed_size = round_trip(data);
+        ASSERT_GT(compressed_size, 0);
+        ASSERT_LE(compressed_size, compress_bound(size));
+    }
+
+    // Mixed random and repeated regions
+    std::vector<uint8_t> mixed;
+    for (int block = 0; block < 50; block++) {
+        size_t run = byte(generator) + 1;
+        uint8_t value = static_cast<uint8_t>(byte(generator));
+        for (size_t i = 0; i < run; i++) {
+            mixed.push_back(block % 2 ? value : static_cast<uint8_t>(byte(generator)));
+        }
+    }
+    ASSERT_GT(round_trip(mixed), 0);
+}
+
+UTEST(compression, malformed_blocks_are_rejected) {
+    std::vector<uint8_t> data(1000, 7);
+    std::vector<uint8_t> compressed(compress_bound(data.size()));
+    size_t compressed_size = block_compress(data.data(), data.size(), compressed.data());
+    std::vector<uint8_t> output(data.size());
+
+    // Wrong output size
+    ASSERT_FALSE(block_decompress(compressed.data(), compressed_size, output.data(), output.size() - 1));
+    std::vector<uint8_t> larger(data.size() + 1);
+    ASSERT_FALSE(block_decompress(compressed.data(), compressed_size, larger.data(), larger.size()));
+
+    // Truncated input
+    ASSERT_FALSE(block_decompress(compressed.data(), compressed_size / 2, output.data(), output.size()));
+
+    // Match offset pointing before the start of the output
+    const uint8_t bad_offset[] = {0x10, 'a', 0x10, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f'};
+    ASSERT_FALSE(block_decompress(bad_offset, sizeof(bad_offset), output.data(), 10));
+
+    // Literal run longer than the input
+    const uint8_t bad_literals[] = {0xF0, 0xFF, 0x10};
+    ASSERT_FALSE(block_decompress(bad_literals, sizeof(bad_literals), output.data(), output.size()));
+}
@@ -1,10 +1,14 @@
 #include "decoder.h"
 #include "frame.h"
 #include "buffer_pool.h"
+#include "encoder.h"
+#include "scene_store.h"
 #include <utest/utest.h>
 #include <vector>
 #include <string>
 #include <nlohmann/json.hpp>
+#include <thread>
+#include <cstring>
 
 UTEST_MAIN();
 
@@ -42,8 +46,8 @@ UTEST(decoder, simple_frame) {
     // Verify result
     ASSERT_TRUE(frame_decoded);
     ASSERT_EQ(received_type, 0x42);
-    ASSERT_EQ(received_payload["key1"], "value1");
-    ASSERT_EQ(received_payload["key2"], 42);
+    ASSERT_TRUE(received_payload["key1"] == "value1");
+    ASSERT_TRUE(received_payload["key2"] == 42);
 }
 
 UTEST(decoder, process_network_data) {
@@ -73,14 +77,116 @@ UTEST(decoder, process_network_data) {
     ASSERT_EQ(processed, serialized.size());
     ASSERT_TRUE(frame_decoded);
     ASSERT_EQ(received_type, 0x12);
-    ASSERT_EQ(received_payload["test"], "network_data");
+    ASSERT_TRUE(received_payload["test"] == "network_data");
+}
+
+UTEST(decoder, extended_frame) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> types;
+    nlohmann::json received_value;
+
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        types.push_back(type);
+        received_value = payload["value"];
+    }, pool);
+
+    // Encode straight into the decoder's network buffer in small writes
+    encoder enc([&dec](const frame_view& f) {
+        auto header = f.header();
+        dec.get_net_buffer().append(header.data(), header.size());
+        for (size_t offset = 0; offset < f.payload.size(); offset += 4096) {
+            size_t size = std::min<size_t>(4096, f.payload.size() - offset);
+            dec.get_net_buffer().append(f.payload.data() + offset, size);
+        }
+    });
+    enc.set_peer_caps(CAP_EXTENDED_LENGTH);
+    dec.get_net_buffer().set_peer_caps(CAP_EXTENDED_LENGTH);
+
+    nlohmann::json points = std::vector<int>(100000, 7);
+    enc.attr("points", "int[]", points);
+
+    // Received as one frame without PARTIAL reassembly
+    ASSERT_EQ(types.size(), 1);
+    ASSERT_EQ(types[0], ATTRIBUTE);
+    ASSERT_TRUE(received_value == points);
+}
+
+UTEST(decoder, compressed_frames) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> values;
+    std::vector<uint8_t> flags;
+
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        values.push_back(payload["value"]);
+    }, pool);
+
+    std::vector<uint8_t> wire;
+    encoder enc([&](const frame_view& f) {
+        flags.push_back(f.flags);
+        auto header = f.header();
+        wire.insert(wire.end(), header.begin(), header.end());
+        wire.insert(wire.end(), f.payload.begin(), f.payload.end());
+    }, 4096);
+    enc.set_peer_caps(CAP_COMPRESSION);
+
+    // One compressed frame and one compressed PARTIAL stream
+    nlohmann::json small = std::vector<int>(1000, 1);
+    nlohmann::json large = std::vector<int>(100000, 2);
+    enc.attr("small", "int[]", small);
+    enc.attr("large", "int[]", large);
+    ASSERT_EQ(flags[0], FLAG_COMPRESSED);
+    ASSERT_EQ(flags[2], FLAG_PARTIAL | FLAG_COMPRESSED);
+
+    // Deliver in 1000 byte writes to mix in-place and buffered frames
+    for (size_t offset = 0; offset < wire.size(); offset += 1000) {
+        size_t size = std::min<size_t>(1000, wire.size() - offset);
+        dec.get_net_buffer().append(wire.data() + offset, size);
+    }
+
+    ASSERT_EQ(values.size(), 2);
+    ASSERT_TRUE(values[0] == small);
+    ASSERT_TRUE(values[1] == large);
+}
+
+UTEST(decoder, quantized_vertex_attributes) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> payloads;
+
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        payloads.push_back(payload);
+    }, pool);
+
+    encoder enc([&dec](const frame_view& f) {
+        dec.process_frame(f);
+    });
+
+    std::vector<float> points = {0.0f, 0.0f, 0.0f, 1.0f, 2.0f, 3.0f, -1.0f, 4.0f, 0.5f};
+    enc.vertex_attr("points", vertex_semantic::position, points, 3, vertex_precision::quantized);
+
+    // Raw quantized arrays by default
+    ASSERT_EQ(payloads.size(), 1);
+    ASSERT_TRUE(payloads[0]["type"] == "vec3f");
+    auto array = read_vertex_array(payloads[0]["value"], 3);
+    ASSERT_TRUE(array.has_value());
+    ASSERT_TRUE(array->encoding == vertex_encoding::q16);
+    ASSERT_EQ(array->count(), 3);
+
+    // Numbers when dequantizing
+    dec.set_dequantize(true);
+    enc.vertex_attr("points", vertex_semantic::position, points, 3, vertex_precision::quantized);
+    ASSERT_EQ(payloads.size(), 2);
+    auto values = payloads[1]["value"].get<std::vector<float>>();
+    ASSERT_EQ(values.size(), points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        ASSERT_NEAR(values[i], points[i], 1e-3f);
+    }
 }
 
 UTEST(decoder, invalid_cbor) {
     auto pool = buffer_pool::create(1024);
     bool decoder_called = false;
 
-    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+    decoder dec([&](uint8_t, const nlohmann::json&) {
         decoder_called = true;
     }, pool);
 
@@ -170,7 +276,7 @@ UTEST(decoder, partial_frames) {
     ASSERT_EQ(received_payloads[0].size(), large_payload.size());
     for (int i = 0; i < 100; i++) {
         std::string key = std::to_string(i);
-        ASSERT_EQ(received_payloads[0][key], large_payload[key]);
+        ASSERT_TRUE(received_payloads[0][key] == large_payload[key]);
     }
 }
 
@@ -178,7 +284,7 @@ UTEST(decoder, out_of_sequence_partial) {
     auto pool = buffer_pool::create(1024);
     bool message_decoded = false;
 
-    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+    decoder dec([&](uint8_t, const nlohmann::json&) {
         message_decoded = true;
     }, pool);
 
@@ -212,19 +318,21 @@ UTEST(decoder, multiple_streams) {
     auto pool = buffer_pool::create(1024);
     std::vector<nlohmann::json> received_payloads;
 
-    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
         received_payloads.push_back(payload);
     }, pool);
 
-    // Create two different partial streams
+    // Create two different partial streams, each a CBOR document split in two
     uint32_t stream_id1 = 10;
     uint32_t stream_id2 = 20;
+    std::vector<uint8_t> payload1 = nlohmann::json::to_cbor({{"name", "points"}, {"value", 1}});
+    std::vector<uint8_t> payload2 = nlohmann::json::to_cbor({{"level", "info"}, {"text", "hello"}});
 
     // First stream, first part
     nlohmann::json partial_header1 = {{"id", stream_id1}, {"seq", 1}};
     frame partial1 = create_cbor_frame(PARTIAL, 0, partial_header1);
 
-    std::vector<uint8_t> data1 = {1, 2, 3, 4};
+    std::vector<uint8_t> data1(payload1.begin(), payload1.begin() + 4);
     frame data1_frame(ATTRIBUTE, 1, data1);
 
     // Process first stream
@@ -235,7 +343,7 @@ UTEST(decoder, multiple_streams) {
     nlohmann::json partial_header2 = {{"id", stream_id2}, {"seq", 1}};
     frame partial2 = create_cbor_frame(PARTIAL, 0, partial_header2);
 
-    std::vector<uint8_t> data2 = {5, 6, 7, 8};
+    std::vector<uint8_t> data2(payload2.begin(), payload2.begin() + 4);
     frame data2_frame(LOG, 1, data2);
 
     // Process second stream
@@ -246,7 +354,7 @@ UTEST(decoder, multiple_streams) {
     nlohmann::json partial_header1_final = {{"id", stream_id1}, {"seq", 0}};
     frame partial1_final = create_cbor_frame(PARTIAL, 0, partial_header1_final);
 
-    std::vector<uint8_t> data1_final = {9, 10};
+    std::vector<uint8_t> data1_final(payload1.begin() + 4, payload1.end());
     frame data1_final_frame(ATTRIBUTE, 1, data1_final);
 
     // Process first stream completion
@@ -255,12 +363,13 @@ UTEST(decoder, multiple_streams) {
 
     // Only first stream should have completed
     ASSERT_EQ(received_payloads.size(), 1);
+    ASSERT_TRUE(received_payloads[0]["name"] == "points");
 
     // Second stream, final part
     nlohmann::json partial_header2_final = {{"id", stream_id2}, {"seq", 0}};
     frame partial2_final = create_cbor_frame(PARTIAL, 0, partial_header2_final);
 
-    std::vector<uint8_t> data2_final = {11, 12};
+    std::vector<uint8_t> data2_final(payload2.begin() + 4, payload2.end());
     frame data2_final_frame(LOG, 1, data2_final);
 
     // Process second stream completion
@@ -269,4 +378,629 @@ UTEST(decoder, multiple_streams) {
 
     // Both streams should have completed
     ASSERT_EQ(received_payloads.size(), 2);
-}
\ No newline at end of file
+    ASSERT_TRUE(received_payloads[1]["text"] == "hello");
+}
+
+// Send a PARTIAL header followed by one content fragment
+static void send_fragment(decoder& dec, uint32_t id, uint32_t seq, const std::vector<uint8_t>& data,
+                          std::optional<size_t> total_size = std::nullopt) {
+    nlohmann::json header = {{"id", id}, {"seq", seq}};
+    if (total_size) {
+        header["size"] = *total_size;
+    }
+    dec.process_frame(create_cbor_frame(PARTIAL, 0, header));
+    dec.process_frame(frame(ATTRIBUTE, FLAG_PARTIAL, data));
+}
+
+UTEST(decoder, partial_stream_is_presized) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> received;
+
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        received.push_back(payload);
+    }, pool);
+
+    std::vector<uint8_t> payload = nlohmann::json::to_cbor(std::string(10000, 'x'));
+    size_t half = payload.size() / 2;
+
+    send_fragment(dec, 7, 1, {payload.begin(), payload.begin() + half}, payload.size());
+
+    // One buffer for the whole payload was reserved up front
+    ASSERT_EQ(dec.open_streams(), 1);
+    ASSERT_EQ(dec.reassembly_bytes(), buffer_pool::class_capacity(buffer_pool::size_class(payload.size())));
+    uint64_t misses = pool->stats().misses;
+
+    send_fragment(dec, 7, 0, {payload.begin() + half, payload.end()});
+    ASSERT_EQ(pool->stats().misses, misses);
+
+    ASSERT_EQ(received.size(), 1);
+    ASSERT_TRUE(received[0] == std::string(10000, 'x'));
+    ASSERT_EQ(dec.open_streams(), 0);
+    ASSERT_EQ(dec.reassembly_bytes(), 0);
+}
+
+UTEST(decoder, partial_stream_exceeding_announced_size) {
+    auto pool = buffer_pool::create(1024);
+    bool message_decoded = false;
+
+    decoder dec([&](uint8_t, const nlohmann::json&) {
+        message_decoded = true;
+    }, pool);
+
+    send_fragment(dec, 7, 1, std::vector<uint8_t>(100, 0x60), 150);
+    send_fragment(dec, 7, 0, std::vector<uint8_t>(100, 0x60));
+
+    ASSERT_FALSE(message_decoded);
+    ASSERT_EQ(dec.open_streams(), 0);
+    ASSERT_EQ(dec.reassembly_bytes(), 0);
+}
+
+UTEST(decoder, partial_stream_limits) {
+    auto pool = buffer_pool::create(1024);
+
+    decoder_limits limits;
+    limits.max_streams = 2;
+    limits.max_reassembly_bytes = 4096;
+    decoder dec([](uint8_t, const nlohmann::json&) {}, pool, limits);
+
+    // Too many open streams
+    send_fragment(dec, 1, 1, {1, 2, 3});
+    send_fragment(dec, 2, 1, {1, 2, 3});
+    send_fragment(dec, 3, 1, {1, 2, 3});
+    ASSERT_EQ(dec.open_streams(), 2);
+
+    // Announced size over the byte limit
+    decoder dec2([](uint8_t, const nlohmann::json&) {}, pool, limits);
+    send_fragment(dec2, 1, 1, {1, 2, 3}, 10000);
+    ASSERT_EQ(dec2.open_streams(), 0);
+
+    // Unannounced stream growing past the byte limit
+    send_fragment(dec2, 2, 1, std::vector<uint8_t>(3000, 0));
+    ASSERT_EQ(dec2.open_streams(), 1);
+    send_fragment(dec2, 2, 2, std::vector<uint8_t>(3000, 0));
+    ASSERT_EQ(dec2.open_streams(), 0);
+    ASSERT_EQ(dec2.reassembly_bytes(), 0);
+}
+
+UTEST(decoder, stale_partial_streams_are_evicted) {
+    auto pool = buffer_pool::create(1024);
+
+    decoder_limits limits;
+    // Well above scheduling jitter, a stream must not expire between a
+    // PARTIAL header and its fragment
+    limits.stream_timeout = std::chrono::milliseconds(50);
+    decoder dec([](uint8_t, const nlohmann::json&) {}, pool, limits);
+
+    send_fragment(dec, 1, 1, std::vector<uint8_t>(500, 0));
+    ASSERT_EQ(dec.open_streams(), 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+    // The next PARTIAL header drops the idle stream
+    send_fragment(dec, 2, 1, {1, 2, 3});
+    ASSERT_EQ(dec.open_streams(), 1);
+    ASSERT_EQ(dec.reassembly_bytes(), buffer_pool::class_capacity(0));
+
+    // So does any other frame, or a timer once frames stop
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    dec.process_frame(frame(END, 0, {0x81, 0x01}));
+    ASSERT_EQ(dec.open_streams(), 0);
+    send_fragment(dec, 3, 1, {1, 2, 3});
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    dec.expire_streams();
+    ASSERT_EQ(dec.open_streams(), 0);
+    ASSERT_EQ(dec.reassembly_bytes(), 0);
+}
+
+UTEST(decoder, large_announced_stream_grows) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> received;
+
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        received.push_back(payload);
+    }, pool);
+
+    // Announcing 8MB only reserves room for a few fragments
+    std::vector<uint8_t> payload = nlohmann::json::to_cbor(std::string(8 * 1024 * 1024, 'x'));
+    size_t fragment = 60000;
+    send_fragment(dec, 9, 1, {payload.begin(), payload.begin() + fragment}, payload.size());
+    ASSERT_LE(dec.reassembly_bytes(), 256u * 1024u);
+
+    uint32_t seq = 2;
+    for (size_t offset = fragment; offset < payload.size(); offset += fragment, seq++) {
+        size_t end = std::min(payload.size(), offset + fragment);
+        send_fragment(dec, 9, end == payload.size() ? 0 : seq, {payload.begin() + offset, payload.begin() + end});
+    }
+
+    ASSERT_EQ(received.size(), 1);
+    ASSERT_EQ(received[0].get_ref<const std::string&>().size(), 8u * 1024 * 1024);
+    ASSERT_EQ(dec.reassembly_bytes(), 0);
+}
+
+// Records visitor callbacks as strings
+struct recording_visitor : message_visitor {
+    std::vector<std::string> events;
+    std::vector<const uint8_t*> array_data;
+    std::vector<float> floats;
+
+    void on_begin(std::string_view entity_type, std::string_view name, int depth) override {
+        events.push_back("begin " + std::string(entity_type) + " " + std::string(name) + " " +
+                         std::to_string(depth));
+    }
+
+    void on_end(int depth) override {
+        events.push_back("end " + std::to_string(depth));
+    }
+
+    void on_attr_typed_array(std::string_view name, std::string_view attr_type,
+                             const typed_array_view& value) override {
+        events.push_back("array " + std::string(name) + " " + std::string(attr_type) + " " +
+                         std::to_string(value.tag) + " " + std::to_string(value.bytes.size()));
+        array_data.push_back(value.bytes.data());
+        floats.resize(value.bytes.size() / sizeof(float));
+        std::memcpy(floats.data(), value.bytes.data(), value.bytes.size());
+    }
+
+    void on_attr(std::string_view name, std::string_view attr_type, const nlohmann::json& value) override {
+        events.push_back("attr " + std::string(name) + " " + std::string(attr_type) + " " + value.dump());
+    }
+
+    void on_other(uint8_t type, const nlohmann::json& payload) override {
+        events.push_back(std::string(1, static_cast<char>(type)) + " " + payload["text"].get<std::string>());
+    }
+};
+
+UTEST(decoder, visitor) {
+    auto pool = buffer_pool::create(1024);
+    recording_visitor visitor;
+    decoder dec(visitor, pool);
+
+    std::vector<uint8_t> wire;
+    encoder enc([&wire](const frame_view& f) {
+        auto header = f.header();
+        wire.insert(wire.end(), header.begin(), header.end());
+        wire.insert(wire.end(), f.payload.begin(), f.payload.end());
+    });
+
+    std::vector<float> points = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f};
+    enc.begin("Mesh", "cube", 1);
+    enc.attr("points", points, 3);
+    enc.attr("visible", "bool", true);
+    enc.end(1);
+    enc.info("done");
+
+    ASSERT_EQ(dec.get_net_buffer().append(wire.data(), wire.size()), wire.size());
+
+    ASSERT_EQ(visitor.events.size(), 5);
+    ASSERT_STREQ(visitor.events[0].c_str(), "begin Mesh cube 1");
+    ASSERT_STREQ(visitor.events[1].c_str(), "array points vec3f 85 24");
+    ASSERT_STREQ(visitor.events[2].c_str(), "attr visible bool true");
+    ASSERT_STREQ(visitor.events[3].c_str(), "end 1");
+    ASSERT_STREQ(visitor.events[4].c_str(), "L done");
+
+    // The typed array is a view into the received bytes
+    ASSERT_TRUE(visitor.array_data[0] >= wire.data() && visitor.array_data[0] < wire.data() + wire.size());
+    ASSERT_TRUE(visitor.floats == points);
+}
+
+UTEST(decoder, visitor_malformed_payload) {
+    auto pool = buffer_pool::create(1024);
+    recording_visitor visitor;
+    decoder dec(visitor, pool);
+
+    // BEGIN whose depth is a string
+    dec.process_frame(create_cbor_frame(BEGIN, 0, {{"depth", "one"}, {"type", "Mesh"}, {"name", "a"}}));
+
+    // ATTRIBUTE without a value
+    dec.process_frame(create_cbor_frame(ATTRIBUTE, 0, {{"name", "a"}, {"type", "bool"}}));
+
+    // Truncated payload
+    dec.process_frame(frame(END, 0, {0x81}));
+
+    ASSERT_EQ(visitor.events.size(), 0);
+}
+
+// Records typed array chunks streamed out of PARTIAL fragments
+struct chunk_visitor : recording_visitor {
+    std::vector<uint8_t> array;
+    std::vector<size_t> chunk_offsets;
+    size_t total = 0;
+    size_t dropped = 0;
+
+    void on_attr_typed_array_chunk(uint32_t /*stream*/, std::string_view, std::string_view,
+                                   uint64_t, size_t offset,
+                                   std::span<const uint8_t> chunk, size_t total_size) override {
+        chunk_offsets.push_back(offset);
+        array.insert(array.end(), chunk.begin(), chunk.end());
+        total = total_size;
+    }
+
+    void on_typed_array_dropped(uint32_t /*stream*/) override {
+        dropped++;
+    }
+};
+
+UTEST(decoder, visitor_streams_partial_typed_arrays) {
+    auto pool = buffer_pool::create(1024);
+    chunk_visitor visitor;
+    decoder dec(visitor, pool);
+
+    std::vector<uint32_t> indices(10000);
+    for (uint32_t i = 0; i < indices.size(); i++) {
+        indices[i] = i;
+    }
+
+    // Feed each frame to the decoder as it is written
+    size_t fragments = 0;
+    size_t chunks_before_last = 0;
+    size_t max_reassembly_bytes = 0;
+    encoder enc([&](const frame_view& f) {
+        dec.process_frame(f);
+        if (f.type == ATTRIBUTE) {
+            fragments++;
+            if (dec.open_streams() > 0) {
+                chunks_before_last = visitor.chunk_offsets.size();
+            }
+        }
+        max_reassembly_bytes = std::max(max_reassembly_bytes, dec.reassembly_bytes());
+    }, 4096);
+    enc.attr("faceVertexIndices", indices);
+
+    // Every fragment was handed over without reassembling the payload
+    ASSERT_GT(fragments, 2u);
+    ASSERT_EQ(visitor.chunk_offsets.size(), fragments);
+    ASSERT_EQ(chunks_before_last, fragments - 1);
+    ASSERT_EQ(max_reassembly_bytes, 0u);
+    ASSERT_EQ(dec.open_streams(), 0u);
+
+    ASSERT_EQ(visitor.total, indices.size() * sizeof(uint32_t));
+    ASSERT_EQ(visitor.array.size(), visitor.total);
+    ASSERT_EQ(std::memcmp(visitor.array.data(), indices.data(), visitor.total), 0);
+}
+
+UTEST(decoder, visitor_collects_streamed_chunks) {
+    auto pool = buffer_pool::create(1024);
+    recording_visitor visitor;
+    decoder dec(visitor, pool);
+
+    std::vector<float> values(1000);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = static_cast<float>(i) * 0.5f;
+    }
+
+    std::vector<uint8_t> payload;
+    encoder enc([&payload](const frame_view& f) {
+        payload.assign(f.payload.begin(), f.payload.end());
+    });
+    enc.attr("weights", values);
+
+    // Split the payload inside the name so the prefix spans fragments
+    send_fragment(dec, 3, 1, {payload.begin(), payload.begin() + 5}, payload.size());
+    send_fragment(dec, 3, 2, {payload.begin() + 5, payload.begin() + 40});
+    send_fragment(dec, 3, 0, {payload.begin() + 40, payload.end()});
+
+    ASSERT_EQ(visitor.events.size(), 1);
+    ASSERT_STREQ(visitor.events[0].c_str(), "array weights f32[] 85 4000");
+    ASSERT_TRUE(visitor.floats == values);
+    ASSERT_EQ(dec.open_streams(), 0u);
+    ASSERT_EQ(dec.reassembly_bytes(), 0u);
+}
+
+UTEST(decoder, visitor_buffers_unstreamable_partials) {
+    auto pool = buffer_pool::create(1024);
+    recording_visitor visitor;
+    decoder dec(visitor, pool);
+
+    // A plain array value cannot be streamed, the payload is decoded once complete
+    std::vector<uint8_t> payload = nlohmann::json::to_cbor(
+        {{"name", "ids"}, {"type", "int[]"}, {"value", std::vector<int>(2000, 7)}});
+    size_t half = payload.size() / 2;
+
+    send_fragment(dec, 4, 1, {payload.begin(), payload.begin() + half}, payload.size());
+    ASSERT_GT(dec.reassembly_bytes(), 0u);
+    send_fragment(dec, 4, 0, {payload.begin() + half, payload.end()});
+
+    ASSERT_EQ(visitor.events.size(), 1);
+    ASSERT_EQ(visitor.events[0].rfind("attr ids int[] [7,7,", 0), 0u);
+    ASSERT_EQ(dec.open_streams(), 0u);
+    ASSERT_EQ(dec.reassembly_bytes(), 0u);
+}
+
+UTEST(decoder, interleaved_stream_fragments) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<std::pair<uint8_t, nlohmann::json>> received;
+
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        received.emplace_back(type, payload);
+    }, pool);
+
+    encoder enc([&dec](const frame_view& f) {
+        dec.process_frame(f);
+    }, 2000);
+    enc.set_peer_caps(CAP_STREAM_PREFIX);
+    enc.set_interleave(true);
+
+    enc.attr("a", "int[]", std::vector<int>(3000, 1));
+    enc.attr("b", "int[]", std::vector<int>(2000, 2));
+
+    // Control frames pass while both streams are in flight
+    ASSERT_TRUE(enc.pump(3000));
+    enc.info("progress");
+    enc.ping_pong();
+    ASSERT_FALSE(enc.pump());
+
+    ASSERT_EQ(received.size(), 4u);
+    ASSERT_EQ(received[0].first, LOG);
+    ASSERT_EQ(received[1].first, PING_PONG);
+    ASSERT_TRUE(received[2].second["name"] == "a");
+    ASSERT_EQ(received[2].second["value"].size(), 3000u);
+    ASSERT_TRUE(received[3].second["name"] == "b");
+    ASSERT_EQ(received[3].second["value"].size(), 2000u);
+    ASSERT_EQ(dec.open_streams(), 0u);
+    ASSERT_EQ(dec.reassembly_bytes(), 0u);
+}
+
+UTEST(decoder, interleaved_streams_inside_prims) {
+    auto pool = buffer_pool::create(1024);
+    scene_store store(pool);
+    decoder store_dec(store, pool);
+    std::vector<uint8_t> types;
+    decoder json_dec([&](uint8_t type, const nlohmann::json&) {
+        types.push_back(type);
+    }, pool);
+
+    encoder enc([&](const frame_view& f) {
+        store_dec.process_frame(f);
+        json_dec.process_frame(f);
+    }, 2000);
+    enc.set_peer_caps(CAP_STREAM_PREFIX);
+    enc.set_interleave(true);
+
+    // Two typed arrays of each prim stream at once, chunks alternate between them
+    std::vector<float> a_points(3000, 1.0f);
+    std::vector<float> a_normals(3000, 2.0f);
+    std::vector<float> b_points(1500, 3.0f);
+    enc.begin("Mesh", "a", 1);
+    enc.attr(attrs::points, std::span<const float>(a_points));
+    enc.attr(attrs::normals, std::span<const float>(a_normals));
+    ASSERT_TRUE(enc.pump(5000));
+    ASSERT_EQ(store_dec.open_streams(), 2u);
+    enc.end(1);
+    ASSERT_EQ(enc.queued_streams(), 0u);
+    enc.begin("Mesh", "b", 1);
+    enc.attr(attrs::points, std::span<const float>(b_points));
+    enc.end(1);
+    ASSERT_FALSE(enc.pump());
+
+    // Queued fragments went out before the END of their prim
+    std::vector<uint8_t> expected = {BEGIN, ATTRIBUTE, ATTRIBUTE, END, BEGIN, ATTRIBUTE, END};
+    ASSERT_TRUE(types == expected);
+
+    uint32_t a = store.find_prim("/a");
+    uint32_t b = store.find_prim("/b");
+    ASSERT_NE(a, NO_INDEX);
+    ASSERT_NE(b, NO_INDEX);
+    attribute_view points = store.attr(store.find_attr(a, "points"));
+    attribute_view normals = store.attr(store.find_attr(a, "normals"));
+    ASSERT_EQ(points.data.size(), a_points.size() * sizeof(float));
+    ASSERT_EQ(std::memcmp(points.data.data(), a_points.data(), points.data.size()), 0);
+    ASSERT_EQ(std::memcmp(normals.data.data(), a_normals.data(), normals.data.size()), 0);
+    attribute_view b_view = store.attr(store.find_attr(b, "points"));
+    ASSERT_EQ(b_view.data.size(), b_points.size() * sizeof(float));
+    ASSERT_EQ(std::memcmp(b_view.data.data(), b_points.data(), b_view.data.size()), 0);
+    ASSERT_EQ(store.find_attr(b, "normals"), NO_INDEX);
+}
+
+UTEST(decoder, dropped_stream_releases_chunks) {
+    auto pool = buffer_pool::create(1024);
+    chunk_visitor visitor;
+    decoder dec(visitor, pool);
+
+    std::vector<float> values(1000, 1.0f);
+    std::vector<uint8_t> payload;
+    encoder enc([&](const frame_view& f) {
+        payload.assign(f.payload.begin(), f.payload.end());
+    });
+    enc.attr("weights", std::span<const float>(values));
+
+    // The second fragment is out of sequence, the stream is dropped midway
+    send_fragment(dec, 5, 1, {payload.begin(), payload.begin() + 100}, payload.size());
+    send_fragment(dec, 5, 3, {payload.begin() + 100, payload.end()});
+    ASSERT_EQ(visitor.dropped, 1u);
+    ASSERT_EQ(dec.open_streams(), 0u);
+}
+
+UTEST(decoder, oversized_typed_array_prefix) {
+    auto pool = buffer_pool::create(1024);
+    recording_visitor visitor;
+    decoder_limits limits;
+    limits.max_reassembly_bytes = 1024 * 1024;
+    decoder dec(visitor, pool, limits);
+
+    // {"name": "w", "type": "f32[]", "value": 85(bytes)} with an 8 byte length claiming 1TB
+    std::vector<uint8_t> payload = {0xA3, 0x64, 'n', 'a', 'm', 'e', 0x61, 'w',
+                                    0x64, 't', 'y', 'p', 'e', 0x65, 'f', '3', '2', '[', ']',
+                                    0x65, 'v', 'a', 'l', 'u', 'e', 0xD8, 85,
+                                    0x5B, 0, 0, 0x01, 0, 0, 0, 0, 0};
+    payload.resize(payload.size() + 64, 0);
+
+    // More than the announced payload
+    send_fragment(dec, 1, 1, payload, payload.size() + 64);
+    ASSERT_EQ(dec.open_streams(), 0u);
+
+    // More than the reassembly limit when no size was announced
+    send_fragment(dec, 2, 1, payload);
+    ASSERT_EQ(dec.open_streams(), 0u);
+
+    // Later fragments of the rejected streams are ignored
+    send_fragment(dec, 2, 0, std::vector<uint8_t>(64, 0));
+    ASSERT_EQ(visitor.events.size(), 0u);
+    ASSERT_EQ(dec.reassembly_bytes(), 0u);
+}
+
+UTEST(decoder, malformed_stream_prefix) {
+    auto pool = buffer_pool::create(1024);
+    size_t received = 0;
+
+    decoder dec([&](uint8_t, const nlohmann::json&) {
+        received++;
+    }, pool);
+
+    // Too short for a prefix
+    dec.process_frame(frame(ATTRIBUTE, FLAG_PARTIAL | FLAG_STREAM, {1, 0, 0}));
+
+    // First fragment without its total size
+    dec.process_frame(frame(ATTRIBUTE, FLAG_PARTIAL | FLAG_STREAM, {1, 0, 0, 0, 1, 0, 0, 0, 0x60}));
+
+    // Fragment of a stream that was never started
+    dec.process_frame(frame(ATTRIBUTE, FLAG_PARTIAL | FLAG_STREAM, {2, 0, 0, 0, 2, 0, 0, 0, 0x60}));
+
+    ASSERT_EQ(received, 0u);
+    ASSERT_EQ(dec.open_streams(), 0u);
+}
+
+UTEST(decoder, compact_attribute_keys) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> received;
+    decoder json_dec([&](uint8_t, const nlohmann::json& payload) {
+        received.push_back(payload);
+    }, pool);
+
+    recording_visitor visitor;
+    decoder visitor_dec(visitor, pool);
+
+    encoder enc([&](const frame_view& f) {
+        json_dec.process_frame(f);
+        visitor_dec.process_frame(f);
+    }, 1000);
+    enc.set_peer_caps(CAP_ATTRIBUTE_IDS);
+
+    std::vector<float> points(600, 0.25f);
+    attrs::mat4f identity = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    enc.attr(attrs::type_name, "Mesh");
+    enc.attr(attrs::transform, identity);
+    enc.attr(attrs::points, points);
+    enc.attr("myAttr", "int", 5);
+
+    ASSERT_EQ(received.size(), 4u);
+    ASSERT_TRUE(received[0] == nlohmann::json({{"name", "typeName"}, {"type", "str"}, {"value", "Mesh"}}));
+    ASSERT_TRUE(received[1]["name"] == "transform");
+    ASSERT_TRUE(received[1]["type"] == "mat4f");
+    ASSERT_EQ(received[1]["value"].size(), 16u);
+    ASSERT_TRUE(received[2]["name"] == "points");
+    ASSERT_TRUE(received[2]["type"] == "vec3f");
+    ASSERT_EQ(received[2]["value"].get_binary().size(), points.size() * sizeof(float));
+    ASSERT_TRUE(received[3] == nlohmann::json({{"name", "myAttr"}, {"type", "int"}, {"value", 5}}));
+
+    // The split points are streamed to the visitor under their registered name
+    ASSERT_EQ(visitor.events.size(), 4u);
+    ASSERT_STREQ(visitor.events[0].c_str(), "attr typeName str \"Mesh\"");
+    ASSERT_EQ(visitor.events[1].rfind("attr transform mat4f [1.0,0.0", 0), 0u);
+    ASSERT_STREQ(visitor.events[2].c_str(), "array points vec3f 85 2400");
+    ASSERT_STREQ(visitor.events[3].c_str(), "attr myAttr int 5");
+    ASSERT_TRUE(visitor.floats == points);
+}
+
+UTEST(decoder, string_table) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<nlohmann::json> received;
+    decoder json_dec([&](uint8_t, const nlohmann::json& payload) {
+        received.push_back(payload);
+    }, pool);
+
+    recording_visitor visitor;
+    decoder visitor_dec(visitor, pool);
+
+    encoder enc([&](const frame_view& f) {
+        json_dec.process_frame(f);
+        visitor_dec.process_frame(f);
+    }, 1000);
+    enc.set_peer_caps(CAP_STRING_TABLE | CAP_ATTRIBUTE_IDS | CAP_STREAM_PREFIX);
+
+    // The split array defines its name in the streamed prefix
+    std::vector<float> weights(600, 0.5f);
+    enc.begin("Mesh", "/World/cube", 1);
+    enc.attr("weights", weights, 1);
+    enc.begin("Mesh", "/World/cube", 2);
+    enc.attr("purpose", "token", "render");
+    enc.attr("weights", weights, 1);
+
+    ASSERT_EQ(received.size(), 5u);
+    ASSERT_TRUE(received[2] == nlohmann::json({{"depth", 2}, {"name", "/World/cube"}, {"type", "Mesh"}}));
+    ASSERT_TRUE(received[3] == nlohmann::json({{"name", "purpose"}, {"type", "token"}, {"value", "render"}}));
+    ASSERT_TRUE(received[4]["name"] == "weights");
+
+    ASSERT_EQ(visitor.events.size(), 5u);
+    ASSERT_STREQ(visitor.events[1].c_str(), "array weights f32[] 85 2400");
+    ASSERT_STREQ(visitor.events[2].c_str(), "begin Mesh /World/cube 2");
+    ASSERT_STREQ(visitor.events[3].c_str(), "attr purpose token \"render\"");
+    ASSERT_STREQ(visitor.events[4].c_str(), "array weights f32[] 85 2400");
+}
+
+UTEST(decoder, string_table_eviction) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<std::string> names;
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        names.push_back(payload["name"]);
+    }, pool);
+
+    size_t bytes = 0;
+    encoder enc([&](const frame_view& f) {
+        bytes += f.payload.size();
+        dec.process_frame(f);
+    });
+    enc.set_peer_caps(CAP_STRING_TABLE);
+
+    // More names than the table holds, then the most recent ones again
+    std::vector<std::string> sent;
+    for (int i = 0; i < 2000; i++) {
+        sent.push_back("/World/instances/instance_" + std::to_string(i));
+    }
+    for (int i = 1900; i < 2000; i++) {
+        sent.push_back(sent[static_cast<size_t>(i)]);
+    }
+    size_t defined_bytes = 0;
+    for (size_t i = 0; i < sent.size(); i++) {
+        enc.begin("Xform", sent[i], 1);
+        if (i == 1999) {
+            defined_bytes = bytes;
+        }
+    }
+
+    // The repeated names are sent as references
+    ASSERT_TRUE(names == sent);
+    ASSERT_LT(bytes - defined_bytes, defined_bytes / 20 * 2 / 3);
+}
+
+UTEST(decoder, dropped_frame_fails_string_table) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<std::string> names;
+    decoder dec([&](uint8_t, const nlohmann::json& payload) {
+        names.push_back(payload["name"]);
+    }, pool);
+    dec.set_peer_caps(CAP_STRING_TABLE);
+
+    std::vector<frame> frames;
+    encoder enc([&](const frame_view& f) { frames.emplace_back(f); });
+    enc.set_peer_caps(CAP_STRING_TABLE);
+    enc.begin("Xform", "/World/first", 1);
+    enc.begin("Xform", "/World/second", 1);
+    enc.begin("Xform", "/World/second", 1);
+    ASSERT_EQ(frames.size(), 3u);
+
+    // The frame defining the second name is lost, its reference cannot be trusted
+    dec.process_frame(frames[0]);
+    frames[1].payload[0] = 0xff;
+    dec.process_frame(frames[1]);
+    ASSERT_TRUE(dec.failed());
+    dec.process_frame(frames[2]);
+    ASSERT_EQ(names.size(), 1u);
+
+    // Without the string table a bad frame is only skipped
+    decoder plain([&](uint8_t, const nlohmann::json& payload) {
+        names.push_back(payload["name"]);
+    }, pool);
+    std::vector<uint8_t> bad = {0xff};
+    plain.process_frame(frame_view(BEGIN, 0, std::span<const uint8_t>(bad)));
+    ASSERT_FALSE(plain.failed());
+}
@@ -0,0 +1,240 @@
+#include "delta_tracker.h"
+#include "scene_store.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "frame_link.h"
+#include <utest/utest.h>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+// Frames and bytes a link sent
+struct traffic {
+    size_t frames = 0;
+    size_t bytes = 0;
+
+    frame_link::frame_observer counter() {
+        return [this](const frame_view& f) {
+            frames++;
+            bytes += f.header().size() + f.payload.size();
+            return true;
+        };
+    }
+};
+
+// A grid of meshes, one of them moved by the slider
+static void send_scene(encoder& enc, float slider, size_t prims = 50, bool with_colors = true) {
+    std::vector<float> points(3 * 256);
+    for (size_t i = 0; i < points.size(); i++) {
+        points[i] = static_cast<float>(i % 17) * 0.25f;
+    }
+    std::vector<uint32_t> counts(64, 4);
+    std::vector<float> colors(3, 0.5f);
+
+    enc.begin_update();
+    enc.begin("Xform", "World", 1);
+    for (size_t i = 0; i < prims; i++) {
+        float offset = i == 0 ? slider : static_cast<float>(i);
+        enc.begin("Mesh", "mesh" + std::to_string(i), 2);
+        enc.attr(attrs::transform, attrs::mat4f{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, offset, 0, 0, 1});
+        enc.attr(attrs::points, std::span<const float>(points));
+        enc.attr(attrs::face_vertex_counts, std::span<const uint32_t>(counts));
+        enc.attr(attrs::purpose, "render");
+        enc.attr("userLabel", "str", "mesh " + std::to_string(i));
+        if (with_colors) {
+            enc.attr("primvars:color", std::span<const float>(colors), 3);
+        }
+        enc.end(2);
+    }
+    enc.end(1);
+    enc.end_update();
+}
+
+UTEST(delta_tracker, unchanged_values) {
+    delta_tracker tracker;
+    tracker.begin_update();
+    tracker.begin_prim("World");
+    ASSERT_FALSE(tracker.unchanged("a", 1));
+    ASSERT_FALSE(tracker.unchanged("b", 2));
+    std::vector<std::string> removed;
+    tracker.end_prim(removed);
+    ASSERT_TRUE(removed.empty());
+    std::vector<std::string> removed_prims;
+    tracker.end_update(removed_prims, removed);
+    ASSERT_TRUE(removed_prims.empty());
+
+    // Same path through a relative or an absolute name
+    tracker.begin_update();
+    tracker.begin_prim("/World");
+    ASSERT_TRUE(tracker.unchanged("a", 1));
+    ASSERT_FALSE(tracker.unchanged("b", 3));
+    ASSERT_TRUE(tracker.unchanged("b", 3));
+    tracker.end_prim(removed);
+    tracker.end_update(removed_prims, removed);
+
+    const auto& stats = tracker.stats();
+    ASSERT_EQ(stats.attrs_sent, 3u);
+    ASSERT_EQ(stats.attrs_unchanged, 2u);
+    ASSERT_EQ(tracker.prim_count(), 1u);
+}
+
+UTEST(delta_tracker, removed_attributes_and_prims) {
+    delta_tracker tracker;
+    std::vector<std::string> removed;
+    std::vector<std::string> removed_prims;
+    tracker.begin_update();
+    tracker.unchanged("upAxis", 1);
+    tracker.begin_prim("World");
+    tracker.begin_prim("a");
+    tracker.unchanged("x", 1);
+    tracker.unchanged("y", 2);
+    tracker.end_prim(removed);
+    tracker.begin_prim("b");
+    tracker.begin_prim("c");
+    tracker.end_prim(removed);
+    tracker.end_prim(removed);
+    tracker.end_prim(removed);
+    tracker.end_update(removed_prims, removed);
+
+    tracker.begin_update();
+    tracker.begin_prim("World");
+    tracker.begin_prim("a");
+    tracker.unchanged("y", 2);
+    tracker.end_prim(removed);
+    ASSERT_EQ(removed.size(), 1u);
+    ASSERT_TRUE(removed[0] == "x");
+    tracker.end_prim(removed);
+    ASSERT_TRUE(removed.empty());
+    tracker.end_update(removed_prims, removed);
+
+    // Parents come first, attributes outside of prims are reported too
+    ASSERT_EQ(removed_prims.size(), 2u);
+    ASSERT_TRUE(removed_prims[0] == "/World/b");
+    ASSERT_TRUE(removed_prims[1] == "/World/b/c");
+    ASSERT_EQ(removed.size(), 1u);
+    ASSERT_TRUE(removed[0] == "upAxis");
+    ASSERT_EQ(tracker.prim_count(), 2u);
+    ASSERT_EQ(tracker.stats().attrs_removed, 2u);
+    ASSERT_EQ(tracker.stats().prims_removed, 2u);
+}
+
+UTEST(delta_tracker, slider_change_sends_one_attribute) {
+    traffic sent;
+    scene_link link(sent.counter());
+    link.enc.set_delta_updates(true);
+    send_scene(link.enc, 0.0f);
+    size_t full_bytes = sent.bytes;
+    size_t full_frames = sent.frames;
+    ASSERT_EQ(link.enc.delta_stats().attrs_unchanged, 0u);
+
+    sent = {};
+    send_scene(link.enc, 0.5f);
+
+    // BEGIN and END of every prim plus the transform that moved
+    ASSERT_EQ(sent.frames, 2 + 2 * 50 + 1u);
+    ASSERT_LT(sent.bytes * 10, full_bytes);
+    ASSERT_LT(sent.frames, full_frames);
+    ASSERT_EQ(link.enc.delta_stats().attrs_unchanged, 6 * 50 - 1u);
+
+    // The receiver still has every value
+    auto& store = link.store;
+    uint32_t moved = store.find_prim("/World/mesh0");
+    uint32_t transform = store.find_attr(moved, "transform");
+    ASSERT_NE(transform, NO_INDEX);
+    ASSERT_TRUE(store.attr_value(transform)[12] == 0.5f);
+    uint32_t other = store.find_prim("/World/mesh7");
+    ASSERT_NE(store.find_attr(other, "points"), NO_INDEX);
+    ASSERT_TRUE(store.attr_value(store.find_attr(other, "userLabel")) == "mesh 7");
+}
+
+UTEST(delta_tracker, removals_keep_the_store_in_step) {
+    scene_link link;
+    link.enc.set_delta_updates(true);
+    link.enc.set_peer_caps(CAP_ATTRIBUTE_IDS | CAP_STRING_TABLE);
+    send_scene(link.enc, 0.0f, 3);
+
+    // Drops the colors of every mesh and the last mesh
+    send_scene(link.enc, 0.0f, 2, false);
+
+    auto& store = link.store;
+    uint32_t mesh0 = store.find_prim("/World/mesh0");
+    ASSERT_NE(mesh0, NO_INDEX);
+    ASSERT_EQ(store.find_attr(mesh0, "primvars:color"), NO_INDEX);
+    ASSERT_NE(store.find_attr(mesh0, "points"), NO_INDEX);
+    ASSERT_EQ(store.find_prim("/World/mesh2"), NO_INDEX);
+    ASSERT_NE(store.find_prim("/World/mesh1"), NO_INDEX);
+
+    const auto& stats = link.enc.delta_stats();
+    ASSERT_EQ(stats.attrs_removed, 2u);
+    ASSERT_EQ(stats.prims_removed, 1u);
+
+    // Sent again the prim starts over
+    send_scene(link.enc, 0.0f, 3, false);
+    uint32_t mesh2 = store.find_prim("/World/mesh2");
+    ASSERT_NE(mesh2, NO_INDEX);
+    ASSERT_NE(store.find_attr(mesh2, "transform"), NO_INDEX);
+    ASSERT_EQ(store.find_attr(mesh2, "primvars:color"), NO_INDEX);
+}
+
+UTEST(delta_tracker, markers_reach_json_handlers) {
+    std::vector<nlohmann::json> attrs;
+    std::vector<nlohmann::json> prims;
+    auto pool = buffer_pool::create(1024);
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == ATTRIBUTE) {
+            attrs.push_back(payload);
+        } else if (type == BEGIN) {
+            prims.push_back(payload);
+        }
+    }, pool);
+    encoder enc([&](const frame_view& f) { dec.process_frame(f); });
+    enc.set_delta_updates(true);
+
+    enc.begin_update();
+    enc.begin("Mesh", "/cube", 1);
+    enc.attr("size", "float", 2.0);
+    enc.attr("label", "str", "cube");
+    enc.end(1);
+    enc.begin("Mesh", "/sphere", 1);
+    enc.end(1);
+    enc.end_update();
+
+    attrs.clear();
+    prims.clear();
+    enc.begin_update();
+    enc.begin("Mesh", "/cube", 1);
+    enc.attr("size", "float", 3.0);
+    enc.end(1);
+    enc.end_update();
+
+    ASSERT_EQ(attrs.size(), 2u);
+    ASSERT_TRUE(attrs[0]["value"] == 3.0);
+    ASSERT_TRUE(attrs[1] == (nlohmann::json{{"name", "label"}, {"removed", true}}));
+    ASSERT_EQ(prims.size(), 2u);
+    ASSERT_TRUE(prims[1] == (nlohmann::json{{"name", "/sphere"}, {"removed", true}}));
+}
+
+UTEST(delta_tracker, reset_sends_everything_again) {
+    traffic sent;
+    scene_link link(sent.counter());
+    link.enc.set_delta_updates(true);
+    send_scene(link.enc, 0.0f, 4);
+    size_t full_bytes = sent.bytes;
+
+    // A receiver starting over gets the whole scene
+    link.store.reset();
+    link.enc.reset_delta();
+    sent = {};
+    send_scene(link.enc, 0.0f, 4);
+    ASSERT_EQ(sent.bytes, full_bytes);
+    ASSERT_NE(link.store.find_attr(link.store.find_prim("/World/mesh3"), "points"), NO_INDEX);
+
+    // Without delta updates nothing is skipped
+    link.enc.set_delta_updates(false);
+    sent = {};
+    send_scene(link.enc, 0.0f, 4);
+    ASSERT_EQ(sent.bytes, full_bytes);
+}
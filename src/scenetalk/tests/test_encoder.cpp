@@ -2,8 +2,10 @@
 #include "frame.h"
 #include "file_ref.h"
 #include <utest/utest.h>
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <cstring>
 
 #include "net_buffer.h"
 
@@ -46,9 +48,9 @@ UTEST(encoder, begin_frame) {
 
     // Check payload contents
     nlohmann::json payload = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload["type"], "test_entity");
-    ASSERT_EQ(payload["name"], "test_name");
-    ASSERT_EQ(payload["depth"], 42);
+    ASSERT_TRUE(payload["type"] == "test_entity");
+    ASSERT_TRUE(payload["name"] == "test_name");
+    ASSERT_TRUE(payload["depth"] == 42);
 }
 
 UTEST(encoder, end_frame) {
@@ -73,7 +75,7 @@ UTEST(encoder, end_frame) {
     nlohmann::json payload = get_payload_json(captured_frames[0]);
     ASSERT_TRUE(payload.is_array());
     ASSERT_EQ(payload.size(), 1);
-    ASSERT_EQ(payload[0], 7);
+    ASSERT_TRUE(payload[0] == 7);
 }
 
 UTEST(encoder, attr_frame) {
@@ -103,11 +105,11 @@ UTEST(encoder, attr_frame) {
 
     // Check payload contents
     nlohmann::json payload = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload["name"], "test_attr");
-    ASSERT_EQ(payload["type"], "object");
-    ASSERT_EQ(payload["value"]["string"], "test");
-    ASSERT_EQ(payload["value"]["number"], 42);
-    ASSERT_EQ(payload["value"]["boolean"], true);
+    ASSERT_TRUE(payload["name"] == "test_attr");
+    ASSERT_TRUE(payload["type"] == "object");
+    ASSERT_TRUE(payload["value"]["string"] == "test");
+    ASSERT_TRUE(payload["value"]["number"] == 42);
+    ASSERT_TRUE(payload["value"]["boolean"] == true);
 }
 
 UTEST(encoder, ping_pong_frame) {
@@ -153,22 +155,22 @@ UTEST(encoder, log_frames) {
     ASSERT_EQ(captured_frames[0].type, LOG);
     ASSERT_TRUE(is_valid_cbor(captured_frames[0]));
     nlohmann::json info_payload = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(info_payload["level"], "info");
-    ASSERT_EQ(info_payload["text"], "Info message");
+    ASSERT_TRUE(info_payload["level"] == "info");
+    ASSERT_TRUE(info_payload["text"] == "Info message");
 
     // Verify warning frame
     ASSERT_EQ(captured_frames[1].type, LOG);
     ASSERT_TRUE(is_valid_cbor(captured_frames[1]));
     nlohmann::json warning_payload = get_payload_json(captured_frames[1]);
-    ASSERT_EQ(warning_payload["level"], "warning");
-    ASSERT_EQ(warning_payload["text"], "Warning message");
+    ASSERT_TRUE(warning_payload["level"] == "warning");
+    ASSERT_TRUE(warning_payload["text"] == "Warning message");
 
     // Verify error frame
     ASSERT_EQ(captured_frames[2].type, LOG);
     ASSERT_TRUE(is_valid_cbor(captured_frames[2]));
     nlohmann::json error_payload = get_payload_json(captured_frames[2]);
-    ASSERT_EQ(error_payload["level"], "error");
-    ASSERT_EQ(error_payload["text"], "Error message");
+    ASSERT_TRUE(error_payload["level"] == "error");
+    ASSERT_TRUE(error_payload["text"] == "Error message");
 }
 
 UTEST(encoder, file_frame) {
@@ -179,7 +181,7 @@ UTEST(encoder, file_frame) {
     });
 
     // Create a file reference
-    file_ref ref("file123", "test.txt", "text/plain", 1024);
+    file_ref ref("test.txt", "file123", "text/plain", std::nullopt, 1024);
 
     // Send a file frame
     enc.file(ref);
@@ -194,11 +196,11 @@ UTEST(encoder, file_frame) {
 
     // Check payload contents
     nlohmann::json payload = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload["file_id"], "file123");
-    ASSERT_EQ(payload["filename"], "test.txt");
-    ASSERT_EQ(payload["content_type"], "text/plain");
-    ASSERT_EQ(payload["size"], 1024);
-    ASSERT_EQ(payload["status"], false);
+    ASSERT_TRUE(payload["file_id"] == "file123");
+    ASSERT_TRUE(payload["filename"] == "test.txt");
+    ASSERT_TRUE(payload["content_type"] == "text/plain");
+    ASSERT_TRUE(payload["size"] == 1024);
+    ASSERT_TRUE(payload["status"] == false);
 
     // Test with status=true
     captured_frames.clear();
@@ -206,7 +208,7 @@ UTEST(encoder, file_frame) {
 
     ASSERT_EQ(captured_frames.size(), 1);
     nlohmann::json payload2 = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload2["status"], true);
+    ASSERT_TRUE(payload2["status"] == true);
 }
 
 UTEST(encoder, hello_frame) {
@@ -229,9 +231,10 @@ UTEST(encoder, hello_frame) {
 
     // Check payload contents
     nlohmann::json payload = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload["ver"], 0);
-    ASSERT_EQ(payload["client"], "test_client");
+    ASSERT_TRUE(payload["ver"] == 0);
+    ASSERT_TRUE(payload["client"] == "test_client");
     ASSERT_TRUE(payload.contains("nonce"));
+    ASSERT_TRUE(payload["caps"] == SUPPORTED_CAPS);
     ASSERT_FALSE(payload.contains("auth_token"));
 
     // Send hello frame with auth token
@@ -243,7 +246,7 @@ UTEST(encoder, hello_frame) {
 
     // Check payload contents
     nlohmann::json payload2 = get_payload_json(captured_frames[0]);
-    ASSERT_EQ(payload2["auth_token"], "auth123");
+    ASSERT_TRUE(payload2["auth_token"] == "auth123");
 }
 
 UTEST(encoder, large_payload) {
@@ -335,4 +338,445 @@ UTEST(encoder, large_payload) {
     ASSERT_EQ(partial_frames, content_frames);
     ASSERT_EQ(content_frames + partial_frames, captured_frames.size());
     ASSERT_TRUE(found_end);
-}
\ No newline at end of file
+
+    // The first partial frame announces the total size
+    ASSERT_TRUE(get_payload_json(captured_frames[0])["size"] == payload_encoded);
+    ASSERT_FALSE(get_payload_json(captured_frames[2]).contains("size"));
+}
+
+UTEST(encoder, extended_frames_after_negotiation) {
+    std::vector<frame> captured_frames;
+
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    });
+
+    nlohmann::json points = std::vector<float>(50000, 1.5f);
+
+    // Without negotiation the attribute is fragmented
+    enc.attr("points", "vec3", points);
+    ASSERT_GT(captured_frames.size(), 2);
+    ASSERT_EQ(captured_frames[0].type, PARTIAL);
+
+    // Peers without the capability keep getting standard frames
+    enc.set_peer_caps(0);
+    ASSERT_EQ(enc.caps(), 0);
+
+    // Once both sides support it the attribute is sent in one frame
+    captured_frames.clear();
+    enc.set_peer_caps(CAP_EXTENDED_LENGTH);
+    ASSERT_EQ(enc.caps(), CAP_EXTENDED_LENGTH);
+    enc.attr("points", "vec3", points);
+
+    ASSERT_EQ(captured_frames.size(), 1);
+    ASSERT_EQ(captured_frames[0].type, ATTRIBUTE);
+    ASSERT_EQ(captured_frames[0].flags, FLAG_EXTENDED);
+    ASSERT_GT(captured_frames[0].payload.size(), MAX_PAYLOAD_SIZE);
+
+    auto header = frame_view(captured_frames[0]).header();
+    ASSERT_EQ(header.size(), EXTENDED_HEADER_SIZE);
+
+    // Small frames keep the standard header
+    captured_frames.clear();
+    enc.end(1);
+    ASSERT_EQ(captured_frames[0].flags, 0);
+    ASSERT_EQ(frame_view(captured_frames[0]).header().size(), FRAME_HEADER_SIZE);
+}
+
+UTEST(encoder, no_extended_frames_before_negotiation) {
+    std::vector<frame> captured_frames;
+
+    // A payload limit past 16 bits only applies once the peer accepts extended frames
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    }, 1024 * 1024);
+
+    enc.attr("points", "vec3", std::vector<float>(50000, 1.5f));
+    ASSERT_GT(captured_frames.size(), 2);
+    for (const auto& f : captured_frames) {
+        ASSERT_EQ(f.flags & FLAG_EXTENDED, 0);
+        ASSERT_LE(f.payload.size(), MAX_PAYLOAD_SIZE);
+        ASSERT_EQ(frame_view(f).header().size(), FRAME_HEADER_SIZE);
+    }
+}
+
+UTEST(encoder, large_payload_slices_are_not_copied) {
+    std::vector<const uint8_t*> chunk_begins;
+    std::vector<size_t> chunk_sizes;
+
+    encoder enc([&](const frame_view& f) {
+        if (f.type == ATTRIBUTE) {
+            chunk_begins.push_back(f.payload.data());
+            chunk_sizes.push_back(f.payload.size());
+        }
+    }, 32);
+
+    nlohmann::json large_value;
+    for (int i = 0; i < 100; i++) {
+        large_value[std::to_string(i)] = std::string(10, 'a' + (i % 26));
+    }
+    enc.attr("large_attr", "object", large_value);
+
+    // Every fragment is a slice of one encoded payload
+    ASSERT_GT(chunk_begins.size(), 1);
+    for (size_t i = 1; i < chunk_begins.size(); i++) {
+        ASSERT_TRUE(chunk_begins[i] == chunk_begins[i - 1] + chunk_sizes[i - 1]);
+    }
+}
+
+UTEST(encoder, gather_writer) {
+    std::vector<std::vector<uint8_t>> writes;
+    std::vector<size_t> segment_counts;
+    std::vector<size_t> header_sizes;
+
+    encoder enc(make_gather_writer([&](std::span<const byte_span> segments) {
+        segment_counts.push_back(segments.size());
+        header_sizes.push_back(segments[0].size());
+
+        std::vector<uint8_t> bytes;
+        for (const auto& segment : segments) {
+            bytes.insert(bytes.end(), segment.begin(), segment.end());
+        }
+        writes.push_back(std::move(bytes));
+    }));
+
+    enc.begin("Mesh", "cube", 1);
+    enc.end(1);
+
+    // One gather write per frame: header then payload
+    ASSERT_EQ(writes.size(), 2);
+    for (size_t i = 0; i < writes.size(); i++) {
+        ASSERT_EQ(segment_counts[i], 2);
+        ASSERT_EQ(header_sizes[i], FRAME_HEADER_SIZE);
+    }
+
+    // Gathered bytes match the serialized frames
+    std::vector<frame> frames;
+    auto pool = buffer_pool::create(1024);
+    net_buffer buffer(pool, [&frames](const frame& f) {
+        frames.push_back(f);
+    });
+    for (const auto& bytes : writes) {
+        ASSERT_EQ(buffer.append(bytes.data(), bytes.size()), bytes.size());
+    }
+
+    ASSERT_EQ(frames.size(), 2);
+    ASSERT_EQ(frames[0].type, BEGIN);
+    ASSERT_TRUE(get_payload_json(frames[0])["name"] == "cube");
+    ASSERT_EQ(frames[1].type, END);
+    ASSERT_TRUE(writes[1] == frames[1].serialize());
+}
+
+UTEST(encoder, cork_coalesces_frames) {
+    std::vector<std::vector<uint8_t>> writes;
+    std::vector<size_t> segment_counts;
+
+    batch_limits limits;
+    limits.max_delay = std::chrono::seconds(60);
+    encoder enc([&](std::span<const byte_span> segments) {
+        segment_counts.push_back(segments.size());
+        std::vector<uint8_t> bytes;
+        for (const auto& segment : segments) {
+            bytes.insert(bytes.end(), segment.begin(), segment.end());
+        }
+        writes.push_back(std::move(bytes));
+    }, limits);
+
+    {
+        cork_scope cork(enc);
+        for (int i = 0; i < 100; i++) {
+            enc.begin("Mesh", "prim" + std::to_string(i), 1);
+            enc.attr("visible", "bool", true);
+            enc.end(1);
+        }
+
+        // Nothing is written while corked
+        ASSERT_EQ(writes.size(), 0);
+    }
+
+    // All frames go out in a single write
+    ASSERT_EQ(writes.size(), 1);
+    ASSERT_EQ(segment_counts[0], 1);
+
+    std::vector<uint8_t> types;
+    auto pool = buffer_pool::create(1024);
+    net_buffer buffer(pool, [&types](const frame_view& f) {
+        types.push_back(f.type);
+    });
+    ASSERT_EQ(buffer.append(writes[0].data(), writes[0].size()), writes[0].size());
+
+    ASSERT_EQ(types.size(), 300);
+    ASSERT_EQ(types[0], BEGIN);
+    ASSERT_EQ(types[1], ATTRIBUTE);
+    ASSERT_EQ(types[299], END);
+
+    // Uncorked frames are written one at a time
+    writes.clear();
+    segment_counts.clear();
+    enc.end(0);
+    enc.end(0);
+    ASSERT_EQ(writes.size(), 2);
+    ASSERT_EQ(segment_counts[0], 2);
+}
+
+UTEST(encoder, cork_flushes_at_size_limit) {
+    std::vector<size_t> write_sizes;
+
+    batch_limits limits;
+    limits.max_bytes = 256;
+    limits.max_delay = std::chrono::seconds(60);
+    encoder enc([&](std::span<const byte_span> segments) {
+        size_t size = 0;
+        for (const auto& segment : segments) {
+            size += segment.size();
+        }
+        write_sizes.push_back(size);
+    }, limits);
+
+    enc.cork();
+    enc.cork();
+    for (int i = 0; i < 100; i++) {
+        enc.end(i);
+    }
+
+    // Full batches are written while still corked
+    size_t corked_writes = write_sizes.size();
+    ASSERT_GT(corked_writes, 1);
+    for (size_t size : write_sizes) {
+        ASSERT_LE(size, 256);
+    }
+
+    // A frame larger than the batch is written on its own behind the pending ones
+    enc.attr("large", "string", std::string(1000, 'x'));
+    ASSERT_EQ(write_sizes.size(), corked_writes + 2);
+    ASSERT_GT(write_sizes.back(), 1000);
+
+    // Only the outermost uncork flushes
+    enc.end(0);
+    enc.uncork();
+    ASSERT_EQ(write_sizes.size(), corked_writes + 2);
+    enc.uncork();
+    ASSERT_EQ(write_sizes.size(), corked_writes + 3);
+}
+
+UTEST(encoder, cork_flushes_after_delay) {
+    size_t writes = 0;
+
+    batch_limits limits;
+    limits.max_delay = std::chrono::microseconds(0);
+    encoder enc([&writes](std::span<const byte_span>) {
+        writes++;
+    }, limits);
+
+    // With no delay allowed every corked frame is flushed as it is written
+    cork_scope cork(enc);
+    enc.end(1);
+    enc.end(2);
+    ASSERT_EQ(writes, 2);
+}
+
+UTEST(encoder, compression_after_negotiation) {
+    std::vector<frame> captured_frames;
+
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    });
+
+    nlohmann::json indices = std::vector<int>(5000, 3);
+
+    // Not compressed until the peer advertises it
+    enc.attr("indices", "int[]", indices);
+    ASSERT_EQ(captured_frames.back().flags & FLAG_COMPRESSED, 0);
+    size_t raw_size = captured_frames.back().payload.size();
+
+    enc.set_peer_caps(CAP_COMPRESSION);
+    captured_frames.clear();
+    enc.attr("indices", "int[]", indices);
+    ASSERT_EQ(captured_frames.size(), 1);
+    ASSERT_EQ(captured_frames[0].flags, FLAG_COMPRESSED);
+    ASSERT_LT(captured_frames[0].payload.size(), raw_size / 10);
+
+    // Small frames stay uncompressed
+    captured_frames.clear();
+    enc.end(1);
+    ASSERT_EQ(captured_frames[0].flags, 0);
+
+    // As do frames below a raised threshold
+    enc.set_compression_threshold(raw_size + 1);
+    captured_frames.clear();
+    enc.attr("indices", "int[]", indices);
+    ASSERT_EQ(captured_frames[0].flags, 0);
+}
+
+UTEST(encoder, typed_array_attrs) {
+    std::vector<frame> captured_frames;
+
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    });
+
+    std::vector<float> points = {0.0f, 1.0f, 2.0f, 3.5f, -4.0f, 5.25f};
+    std::vector<uint32_t> indices = {0, 1, 2, 70000, UINT32_MAX};
+    enc.attr("points", points, 3);
+    enc.attr("faceVertexIndices", indices);
+
+    ASSERT_EQ(captured_frames.size(), 2);
+    ASSERT_EQ(captured_frames[0].type, ATTRIBUTE);
+
+    auto payload = nlohmann::json::from_cbor(captured_frames[0].payload, true, true,
+                                             nlohmann::json::cbor_tag_handler_t::store);
+    ASSERT_TRUE(payload["name"] == "points");
+    ASSERT_TRUE(payload["type"] == "vec3f");
+    const auto& point_bytes = payload["value"].get_binary();
+    ASSERT_EQ(point_bytes.subtype(), TAG_FLOAT32_LE);
+    ASSERT_EQ(point_bytes.size(), points.size() * sizeof(float));
+    ASSERT_EQ(std::memcmp(point_bytes.data(), points.data(), point_bytes.size()), 0);
+
+    payload = nlohmann::json::from_cbor(captured_frames[1].payload, true, true,
+                                        nlohmann::json::cbor_tag_handler_t::store);
+    ASSERT_TRUE(payload["type"] == "u32[]");
+    const auto& index_bytes = payload["value"].get_binary();
+    ASSERT_EQ(index_bytes.subtype(), TAG_UINT32_LE);
+    ASSERT_EQ(index_bytes.size(), indices.size() * sizeof(uint32_t));
+    ASSERT_EQ(std::memcmp(index_bytes.data(), indices.data(), index_bytes.size()), 0);
+
+    // Single component floats
+    enc.attr("opacity", std::vector<float>{0.5f});
+    payload = nlohmann::json::from_cbor(captured_frames[2].payload, true, true,
+                                        nlohmann::json::cbor_tag_handler_t::store);
+    ASSERT_TRUE(payload["type"] == "f32[]");
+}
+
+UTEST(encoder, large_typed_array_attr) {
+    std::vector<uint8_t> reassembled;
+    std::vector<uint32_t> indices(100000);
+    for (uint32_t i = 0; i < indices.size(); i++) {
+        indices[i] = i;
+    }
+
+    // Typed arrays are fragmented like any other payload
+    encoder enc([&reassembled](const frame_view& f) {
+        if (f.type == ATTRIBUTE) {
+            reassembled.insert(reassembled.end(), f.payload.begin(), f.payload.end());
+        }
+    });
+    enc.attr("faceVertexIndices", indices);
+
+    auto payload = nlohmann::json::from_cbor(reassembled, true, true,
+                                             nlohmann::json::cbor_tag_handler_t::store);
+    const auto& bytes = payload["value"].get_binary();
+    ASSERT_EQ(bytes.size(), indices.size() * sizeof(uint32_t));
+    ASSERT_EQ(std::memcmp(bytes.data(), indices.data(), bytes.size()), 0);
+}
+
+UTEST(encoder, interleaved_streams) {
+    std::vector<frame> captured_frames;
+
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    }, 1000);
+    enc.set_peer_caps(CAP_STREAM_PREFIX);
+    enc.set_interleave(true);
+
+    std::vector<uint32_t> indices(1000, 7);
+    enc.attr("a", indices);
+    enc.attr("b", indices);
+    enc.info("not held up");
+
+    // Split payloads wait for pump(), other frames go out right away
+    ASSERT_EQ(enc.queued_streams(), 2u);
+    ASSERT_EQ(captured_frames.size(), 1u);
+    ASSERT_EQ(captured_frames[0].type, LOG);
+
+    ASSERT_FALSE(enc.pump());
+    ASSERT_EQ(enc.queued_streams(), 0u);
+
+    // Fragments carry their stream, alternate between streams and need no PARTIAL frames
+    std::vector<uint32_t> ids;
+    for (size_t i = 1; i < captured_frames.size(); i++) {
+        const frame& f = captured_frames[i];
+        ASSERT_EQ(f.type, ATTRIBUTE);
+        ASSERT_EQ(f.flags, FLAG_PARTIAL | FLAG_STREAM);
+        ASSERT_LE(f.payload.size(), 1000u);
+
+        stream_prefix prefix;
+        ASSERT_GT(unpack_stream_prefix(f.payload, prefix), 0u);
+        ids.push_back(prefix.id);
+        if (i <= 2) {
+            ASSERT_EQ(prefix.seq, 1u);
+            ASSERT_GT(prefix.total_size, indices.size() * sizeof(uint32_t));
+        }
+    }
+    ASSERT_GT(ids.size(), 4u);
+    ASSERT_NE(ids[0], ids[1]);
+    ASSERT_EQ(ids[0], ids[2]);
+    ASSERT_EQ(ids[1], ids[3]);
+}
+
+UTEST(encoder, compact_attribute_keys) {
+    std::vector<frame> captured_frames;
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    });
+
+    // Without negotiation core attributes use string keys
+    enc.attr(attrs::type_name, "Mesh");
+    auto payload = get_payload_json(captured_frames[0]);
+    ASSERT_TRUE(payload["name"] == "typeName");
+    ASSERT_TRUE(payload["type"] == "str");
+    ASSERT_TRUE(payload["value"] == "Mesh");
+
+    enc.set_peer_caps(CAP_ATTRIBUTE_IDS);
+    enc.attr(attrs::type_name, "Mesh");
+    enc.attr("typeName", "str", "Mesh");
+    enc.attr("myAttr", "str", "Mesh");
+
+    // {0: id, 1: id, 2: "Mesh"}
+    std::vector<uint8_t> expected = {0xa3, 0x00, static_cast<uint8_t>(core_attr::type_name),
+                                     0x01, static_cast<uint8_t>(value_type::str),
+                                     0x02, 0x64, 'M', 'e', 's', 'h'};
+    ASSERT_TRUE(captured_frames[1].payload == expected);
+    ASSERT_TRUE(captured_frames[2].payload == expected);
+    ASSERT_LT(captured_frames[1].payload.size(), captured_frames[0].payload.size() / 2);
+
+    // Custom names keep their string
+    ASSERT_EQ(captured_frames[3].payload[2], 0x66);
+}
+
+UTEST(encoder, string_table) {
+    std::vector<frame> captured_frames;
+    encoder enc([&captured_frames](const frame& f) {
+        captured_frames.push_back(f);
+    });
+    enc.set_peer_caps(CAP_STRING_TABLE);
+
+    enc.begin("Mesh", "/World/cube", 1);
+    enc.begin("Mesh", "/World/cube", 1);
+    enc.attr("myAttr", "str", "/World/cube");
+
+    // The first BEGIN defines both strings, the second refers to them
+    auto& first = captured_frames[0].payload;
+    auto& second = captured_frames[1].payload;
+    ASSERT_EQ(std::count(first.begin(), first.end(), 0xd8), 2);
+    std::vector<uint8_t> define = {0xd8, 0x1c, 0x64, 'M', 'e', 's', 'h'};
+    ASSERT_TRUE(std::search(first.begin(), first.end(), define.begin(), define.end()) != first.end());
+    ASSERT_LT(second.size(), first.size() - 10);
+
+    // {"depth": 1, "name": 29(0), "type": 29(1)}
+    std::vector<uint8_t> expected = {0xa3, 0x65, 'd', 'e', 'p', 't', 'h', 0x01,
+                                     0x64, 'n', 'a', 'm', 'e', 0xd8, 0x1d, 0x00,
+                                     0x64, 't', 'y', 'p', 'e', 0xd8, 0x1d, 0x01};
+    ASSERT_TRUE(second == expected);
+
+    // String values share the table, "str" is too short to be added
+    auto& attr = captured_frames[2].payload;
+    std::vector<uint8_t> value_ref = {0xd8, 0x1d, 0x00};
+    ASSERT_TRUE(std::equal(value_ref.begin(), value_ref.end(), attr.end() - 3));
+    std::vector<uint8_t> short_type = {0x63, 's', 't', 'r'};
+    ASSERT_TRUE(std::search(attr.begin(), attr.end(), short_type.begin(), short_type.end()) != attr.end());
+
+    // Interleaved payloads complete out of order, so they send plain strings
+    enc.set_interleave(true);
+    enc.begin("Mesh", "/World/cube", 1);
+    ASSERT_EQ(std::count(captured_frames[3].payload.begin(), captured_frames[3].payload.end(), 0xd8), 0);
+}
@@ -172,6 +172,6 @@ UTEST(file_ref, content_hash_access) {
     ASSERT_FALSE(ref.content_type().has_value());
     ASSERT_FALSE(ref.size().has_value());
     ASSERT_TRUE(ref.content_hash().has_value());
-    ASSERT_EQ(ref.content_hash().value(), content_hash);
+    ASSERT_TRUE(ref.content_hash().value() == content_hash);
 }
 
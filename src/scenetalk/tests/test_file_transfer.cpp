@@ -0,0 +1,161 @@
+#include "file_transfer.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "frame_link.h"
+#include <utest/utest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+static std::vector<uint8_t> bytes_of(std::string_view text) {
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static std::shared_ptr<const std::vector<uint8_t>> test_content(size_t size) {
+    auto content = std::make_shared<std::vector<uint8_t>>(size);
+    for (size_t i = 0; i < size; i++) {
+        (*content)[i] = static_cast<uint8_t>(i * 31 + i / 7);
+    }
+    return content;
+}
+
+// A sender and a receiver connected both ways
+struct transfer_link {
+    std::shared_ptr<buffer_pool> pool = buffer_pool::create(1024);
+    size_t chunks = 0;
+    std::vector<std::string> received;
+
+    // Sender to receiver, counting the chunks on the way
+    frame_link forward{pool, [this](uint8_t type, const nlohmann::json& payload) {
+        if (type == FILE_REF) {
+            receiver->handle(payload);
+        }
+    }, [this](const frame_view& f) {
+        chunks += f.type == FILE_REF && nlohmann::json::from_cbor(f.payload).contains("data");
+        return true;
+    }};
+
+    // Receiver back to sender
+    frame_link backward{pool, [this](uint8_t type, const nlohmann::json& payload) {
+        if (type == FILE_REF) {
+            sender->handle(payload);
+        }
+    }};
+
+    std::unique_ptr<file_sender> sender;
+    std::unique_ptr<file_receiver> receiver;
+
+    explicit transfer_link(file_store& store)
+        : sender(std::make_unique<file_sender>(forward.enc, 1024)),
+          receiver(std::make_unique<file_receiver>(backward.enc, store,
+              [this](const file_ref& ref, std::span<const uint8_t>) { received.push_back(ref.name()); })) {}
+};
+
+UTEST(file_transfer, content_hash_is_xxh64) {
+    ASSERT_TRUE(content_hash({}) == "xxh64:ef46db3751d8e999");
+    ASSERT_TRUE(content_hash(bytes_of("abc")) == "xxh64:44bc2cf5ad770999");
+    ASSERT_TRUE(content_hash(bytes_of("Nobody inspects the spammish repetition")) == "xxh64:fbcea83c8a378bf1");
+}
+
+UTEST(file_transfer, store_tracks_missing_ranges) {
+    file_store store;
+    std::vector<uint8_t> content = bytes_of("0123456789");
+    std::string hash = content_hash(content);
+    std::span<const uint8_t> all(content);
+
+    auto missing = store.missing(hash, content.size());
+    ASSERT_TRUE(missing.has_value());
+    ASSERT_EQ(missing->size(), 1u);
+    ASSERT_TRUE((*missing)[0] == (byte_range{0, 10}));
+
+    // Chunks may arrive in any order
+    ASSERT_TRUE(store.write(hash, 6, all.subspan(6, 2)));
+    ASSERT_TRUE(store.write(hash, 0, all.subspan(0, 3)));
+    ASSERT_FALSE(store.write(hash, 8, all.subspan(0, 3)));
+    ASSERT_FALSE(store.write("xxh64:unknown", 0, all));
+    missing = store.missing(hash, content.size());
+    ASSERT_EQ(missing->size(), 2u);
+    ASSERT_TRUE((*missing)[0] == (byte_range{3, 3}));
+    ASSERT_TRUE((*missing)[1] == (byte_range{8, 2}));
+    ASSERT_TRUE(store.finish(hash) == file_store::file_status::incomplete);
+
+    ASSERT_TRUE(store.write(hash, 3, all.subspan(3, 3)));
+    ASSERT_TRUE(store.write(hash, 8, all.subspan(8, 2)));
+    ASSERT_FALSE(store.has(hash));
+    ASSERT_TRUE(store.finish(hash) == file_store::file_status::complete);
+    ASSERT_TRUE(store.has(hash));
+    ASSERT_TRUE(std::equal(content.begin(), content.end(), store.get(hash).begin()));
+    ASSERT_EQ(store.bytes(), 10u);
+
+    // Content not matching its hash is received again
+    std::string other = content_hash(bytes_of("abcdefghij"));
+    store.missing(other, 10);
+    ASSERT_TRUE(store.write(other, 0, all));
+    ASSERT_TRUE(store.finish(other) == file_store::file_status::corrupt);
+    ASSERT_EQ(store.missing(other, 10)->size(), 1u);
+}
+
+UTEST(file_transfer, store_limits) {
+    file_store store({.max_file_size = 1000, .max_total_bytes = 1500});
+
+    // Refused before anything is allocated
+    ASSERT_FALSE(store.missing("xxh64:large", 1001).has_value());
+    ASSERT_FALSE(store.missing("xxh64:huge", UINT64_MAX).has_value());
+    ASSERT_EQ(store.bytes(), 0u);
+
+    ASSERT_TRUE(store.missing("xxh64:a", 1000).has_value());
+    ASSERT_FALSE(store.missing("xxh64:b", 600).has_value());
+    ASSERT_TRUE(store.missing("xxh64:b", 500).has_value());
+    ASSERT_EQ(store.bytes(), 1500u);
+
+    // A partial file may shrink in place
+    ASSERT_TRUE(store.missing("xxh64:a", 900).has_value());
+    ASSERT_EQ(store.bytes(), 1400u);
+}
+
+UTEST(file_transfer, oversized_offer_is_refused) {
+    file_store store({.max_file_size = 4096});
+    transfer_link link(store);
+    link.sender->offer(file_ref("scan.vdb"), test_content(5000));
+
+    ASSERT_EQ(link.chunks, 0u);
+    ASSERT_EQ(link.sender->pending(), 0u);
+    ASSERT_EQ(store.bytes(), 0u);
+}
+
+UTEST(file_transfer, wrong_hash_gives_up) {
+    file_store store;
+    transfer_link link(store);
+    auto content = test_content(2000);
+    file_ref ref("brick.png", std::nullopt, std::nullopt, content_hash(bytes_of("other")), std::nullopt);
+
+    // The receiver finds every round corrupt, the sender stops after a few
+    link.sender->offer(ref, content);
+    ASSERT_EQ(link.received.size(), 0u);
+    ASSERT_EQ(link.chunks, 2u * MAX_FILE_SEND_ROUNDS);
+    ASSERT_EQ(link.sender->pending(), 0u);
+}
+
+UTEST(file_transfer, malformed_need_ranges) {
+    std::vector<nlohmann::json> sent;
+    encoder enc([&sent](const frame_view& f) {
+        sent.push_back(nlohmann::json::from_cbor(f.payload));
+    });
+    file_sender sender(enc, 1024);
+    auto content = test_content(2000);
+    sender.offer(file_ref("brick.png"), content);
+
+    // Ranges that are not unsigned numbers are skipped, as decoded from CBOR
+    nlohmann::json need = {{"hash", content_hash(*content)},
+                           {"need", {{"a", 10u}, {-1, 10u}, {0u, 1.5}, {0u, 1024u}}}};
+    ASSERT_TRUE(sender.handle(need));
+
+    // The offer, one chunk and the offer again
+    ASSERT_EQ(sent.size(), 3u);
+    ASSERT_TRUE(sent[1]["offset"] == 0);
+    ASSERT_EQ(sent[1]["data"].get_binary().size(), 1024u);
+}
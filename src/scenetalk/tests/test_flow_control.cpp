@@ -0,0 +1,283 @@
+#include "flow_control.h"
+#include "compression.h"
+#include "decoder.h"
+#include "encoder.h"
+#include <utest/utest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+UTEST(flow_control, receive_window_batches_grants) {
+    std::vector<size_t> grants;
+    receive_window window(1000, [&](size_t credit) { grants.push_back(credit); });
+    window.open();
+    ASSERT_EQ(grants.size(), 1u);
+    ASSERT_EQ(grants[0], 1000u);
+
+    // Credit goes back once a quarter of the window was consumed
+    window.consumed(100);
+    window.consumed(100);
+    ASSERT_EQ(grants.size(), 1u);
+    ASSERT_EQ(window.stats().pending_bytes, 200u);
+    window.consumed(100);
+    ASSERT_EQ(grants.size(), 2u);
+    ASSERT_EQ(grants[1], 300u);
+    ASSERT_EQ(window.stats().pending_bytes, 0u);
+    ASSERT_EQ(window.stats().consumed_bytes, 300u);
+    ASSERT_EQ(window.stats().granted_bytes, 1300u);
+}
+
+UTEST(flow_control, compressed_frames_count_decompressed_size) {
+    auto size_bytes = pack_uint32_le(5000);
+    std::vector<uint8_t> payload(size_bytes.begin(), size_bytes.end());
+    payload.resize(40);
+
+    ASSERT_EQ(flow_size(frame_view(LOG, FLAG_COMPRESSED, payload)), 5000u);
+    ASSERT_EQ(flow_size(frame_view(LOG, 0, payload)), 40u);
+    ASSERT_FALSE(flow_controlled(PING_PONG));
+    ASSERT_FALSE(flow_controlled(FLOW));
+    ASSERT_TRUE(flow_controlled(ATTRIBUTE));
+    ASSERT_TRUE(flow_controlled(PARTIAL));
+}
+
+UTEST(flow_control, dropped_frames_return_credit) {
+    auto pool = buffer_pool::create(1024);
+    size_t received = 0;
+    decoder dec([&](uint8_t type, const nlohmann::json&) {
+        if (type == LOG) {
+            received++;
+        }
+    }, pool);
+    std::vector<size_t> grants;
+    dec.enable_flow_control(1000, [&](size_t credit) { grants.push_back(credit); });
+
+    auto append = [&](const frame_view& f, bool with_payload) {
+        frame_header header = f.header();
+        dec.get_net_buffer().append(header.data(), header.size());
+        if (with_payload) {
+            dec.get_net_buffer().append(f.payload.data(), f.payload.size());
+        }
+    };
+
+    // A compressed frame that does not decompress
+    auto size_bytes = pack_uint32_le(600);
+    std::vector<uint8_t> garbage(size_bytes.begin(), size_bytes.end());
+    garbage.resize(40, 0xFF);
+    append(frame_view(LOG, FLAG_COMPRESSED, garbage), true);
+    ASSERT_EQ(grants.size(), 2u);
+    ASSERT_EQ(grants[1], 600u);
+
+    // An extended frame before CAP_EXTENDED_LENGTH was negotiated
+    std::vector<uint8_t> payload(300);
+    append(frame_view(LOG, FLAG_EXTENDED, payload), false);
+    ASSERT_EQ(grants.size(), 3u);
+    ASSERT_EQ(grants[2], 300u);
+
+    // Neither was handled, yet the whole window is back
+    ASSERT_EQ(received, 0u);
+    ASSERT_EQ(dec.flow_stats().consumed_bytes, 900u);
+    ASSERT_EQ(dec.flow_stats().granted_bytes, 1900u);
+    ASSERT_EQ(dec.flow_stats().pending_bytes, 0u);
+}
+
+UTEST(flow_control, sender_queues_without_credit) {
+    std::vector<frame> sent;
+    encoder enc([&](const frame_view& f) { sent.emplace_back(f); });
+
+    // Without the capability nothing is held back
+    enc.info("first");
+    ASSERT_EQ(sent.size(), 1u);
+    ASSERT_FALSE(enc.would_block());
+
+    enc.set_peer_caps(CAP_FLOW_CREDIT);
+    ASSERT_TRUE(enc.would_block());
+    enc.info("second");
+    enc.info("third");
+    ASSERT_EQ(sent.size(), 1u);
+    ASSERT_EQ(enc.flow_stats().backlog_frames, 2u);
+    ASSERT_EQ(enc.flow_stats().stalls, 1u);
+
+    // Control frames are not counted
+    enc.ping_pong();
+    ASSERT_EQ(sent.size(), 2u);
+    ASSERT_EQ(sent[1].type, PING_PONG);
+
+    // Any credit lets one frame through, overshooting it
+    enc.add_credit(1);
+    ASSERT_TRUE(enc.pump());
+    ASSERT_EQ(sent.size(), 3u);
+    ASSERT_LT(enc.flow_stats().credit, 0);
+    ASSERT_TRUE(enc.would_block());
+
+    enc.add_credit(1000);
+    ASSERT_FALSE(enc.pump());
+    ASSERT_EQ(sent.size(), 4u);
+    ASSERT_FALSE(enc.would_block());
+    ASSERT_EQ(enc.flow_stats().backlog_frames, 0u);
+    ASSERT_EQ(enc.flow_stats().backlog_bytes, 0u);
+
+    // Frames keep their order
+    std::vector<std::string> texts;
+    for (const auto& f : sent) {
+        if (f.type == LOG) {
+            texts.push_back(nlohmann::json::from_cbor(f.payload)["text"]);
+        }
+    }
+    ASSERT_EQ(texts.size(), 3u);
+    ASSERT_TRUE(texts[1] == "second");
+    ASSERT_TRUE(texts[2] == "third");
+
+    auto stats = enc.flow_stats();
+    ASSERT_EQ(stats.granted_bytes, 1001u);
+    ASSERT_EQ(static_cast<int64_t>(stats.granted_bytes - stats.sent_bytes), stats.credit);
+}
+
+UTEST(flow_control, credit_round_trip) {
+    auto pool = buffer_pool::create(1024);
+    std::unique_ptr<encoder> sender;
+    std::unique_ptr<encoder> receiver;
+
+    // Grants flow back from the receiver to the sender
+    decoder sender_dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == FLOW && payload.contains("credit")) {
+            sender->add_credit(payload["credit"].get<size_t>());
+        }
+    }, pool);
+    size_t received = 0;
+    decoder receiver_dec([&](uint8_t type, const nlohmann::json&) {
+        if (type == LOG) {
+            received++;
+        }
+    }, pool);
+
+    std::vector<frame> in_flight;
+    sender = std::make_unique<encoder>([&](const frame_view& f) { in_flight.emplace_back(f); });
+    receiver = std::make_unique<encoder>([&](const frame_view& f) { sender_dec.process_frame(f); });
+    sender->set_peer_caps(CAP_FLOW_CREDIT);
+    receiver->set_peer_caps(CAP_FLOW_CREDIT);
+    receiver_dec.enable_flow_control(4096, [&](size_t credit) { receiver->grant_credit(credit); });
+
+    // The receiver handles frames in rounds, the sender never gets far ahead
+    std::string text(100, 'x');
+    size_t max_in_flight = 0;
+    for (int i = 0; i < 200; i++) {
+        sender->info(text);
+        if (i % 64 == 63) {
+            size_t bytes = 0;
+            for (const auto& f : in_flight) {
+                bytes += f.payload.size();
+            }
+            max_in_flight = std::max(max_in_flight, bytes);
+            std::vector<frame> frames = std::move(in_flight);
+            in_flight.clear();
+            for (const auto& f : frames) {
+                receiver_dec.process_frame(f);
+            }
+            sender->pump();
+        }
+    }
+    while (!in_flight.empty()) {
+        std::vector<frame> frames = std::move(in_flight);
+        in_flight.clear();
+        for (const auto& f : frames) {
+            receiver_dec.process_frame(f);
+        }
+        sender->pump();
+    }
+
+    ASSERT_EQ(received, 200u);
+    ASSERT_LT(max_in_flight, 4096u + 200u);
+    ASSERT_GT(sender->flow_stats().stalls, 0u);
+    ASSERT_EQ(sender->flow_stats().backlog_frames, 0u);
+    ASSERT_EQ(receiver_dec.flow_stats().consumed_bytes, sender->flow_stats().sent_bytes);
+}
+
+UTEST(flow_control, block_mode_waits_for_credit) {
+    std::atomic<int> sent{0};
+    encoder enc([&](const frame_view&) { sent++; });
+    enc.set_peer_caps(CAP_FLOW_CREDIT);
+    enc.set_flow_mode(flow_mode::block);
+
+    std::thread granter([&] {
+        while (sent < 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            enc.add_credit(64);
+        }
+    });
+    for (int i = 0; i < 10; i++) {
+        enc.info("blocking");
+    }
+    granter.join();
+
+    auto stats = enc.flow_stats();
+    ASSERT_EQ(sent.load(), 10);
+    ASSERT_GT(stats.stalls, 0u);
+    ASSERT_GT(stats.blocked.count(), 0);
+    ASSERT_EQ(stats.backlog_frames, 0u);
+}
+
+UTEST(flow_control, block_mode_flushes_corked_frames) {
+    // The peer grants credit for what it read, corked frames are not read yet
+    std::atomic<size_t> written{0};
+    encoder enc([&](std::span<const byte_span> segments) {
+        for (const auto& segment : segments) {
+            written += segment.size();
+        }
+    }, batch_limits{});
+    enc.set_peer_caps(CAP_FLOW_CREDIT);
+    enc.set_flow_mode(flow_mode::block);
+    enc.add_credit(256);
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> stuck{false};
+    std::thread granter([&] {
+        size_t granted = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                stuck = true;
+                enc.disable_flow_control();
+                break;
+            }
+            size_t read = written;
+            if (read > granted) {
+                enc.add_credit(read - granted);
+                granted = read;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::string text(100, 'x');
+    enc.cork();
+    for (int i = 0; i < 20; i++) {
+        enc.info(text);
+    }
+    enc.uncork();
+    done = true;
+    granter.join();
+
+    ASSERT_FALSE(stuck.load());
+    ASSERT_GT(enc.flow_stats().stalls, 0u);
+    ASSERT_GT(written.load(), 20u * 100u);
+}
+
+UTEST(flow_control, disable_wakes_blocked_writer) {
+    std::atomic<int> sent{0};
+    encoder enc([&](const frame_view&) { sent++; });
+    enc.set_peer_caps(CAP_FLOW_CREDIT);
+    enc.set_flow_mode(flow_mode::block);
+
+    std::thread writer([&] { enc.info("closing"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    enc.disable_flow_control();
+    writer.join();
+
+    ASSERT_EQ(sent.load(), 1);
+    ASSERT_FALSE(enc.would_block());
+}
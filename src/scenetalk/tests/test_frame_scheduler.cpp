@@ -0,0 +1,199 @@
+#include "frame_scheduler.h"
+#include "decoder.h"
+#include "encoder.h"
+#include <utest/utest.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+// Collects everything the scheduler writes
+static gather_writer collect_into(std::vector<uint8_t>& wire) {
+    return [&wire](std::span<const byte_span> segments) {
+        for (const auto& segment : segments) {
+            wire.insert(wire.end(), segment.begin(), segment.end());
+        }
+    };
+}
+
+// Split written bytes back into frames
+static std::vector<frame> parse_frames(const std::vector<uint8_t>& wire) {
+    std::vector<frame> frames;
+    size_t offset = 0;
+    while (offset < wire.size()) {
+        auto f = frame::deserialize(wire.data() + offset, wire.size() - offset);
+        if (!f) {
+            break;
+        }
+        offset += frame_view(*f).header().size() + f->payload.size();
+        frames.push_back(std::move(*f));
+    }
+    return frames;
+}
+
+UTEST(frame_scheduler, default_priority) {
+    ASSERT_EQ(default_priority(PING_PONG), frame_priority::control);
+    ASSERT_EQ(default_priority(FLOW), frame_priority::control);
+    ASSERT_EQ(default_priority(HELLO), frame_priority::control);
+    ASSERT_EQ(default_priority(LOG), frame_priority::log);
+    ASSERT_EQ(default_priority(ATTRIBUTE), frame_priority::bulk);
+    ASSERT_EQ(default_priority(BEGIN), frame_priority::bulk);
+}
+
+UTEST(frame_scheduler, control_frames_pass_bulk) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> wire;
+    frame_scheduler scheduler(collect_into(wire), pool);
+    encoder enc(scheduler.writer());
+
+    std::vector<uint32_t> values(7500, 1);
+    for (int i = 0; i < 20; i++) {
+        enc.attr("points", values);
+    }
+    size_t queued = scheduler.pending_bytes();
+    ASSERT_GT(queued, 20 * values.size() * sizeof(uint32_t));
+
+    // Start on the bulk frames, then ping
+    ASSERT_GT(scheduler.run(1), 0u);
+    size_t first_run = wire.size();
+    enc.ping_pong();
+
+    scheduler.run();
+    ASSERT_EQ(scheduler.pending_bytes(), 0u);
+
+    // The ping goes out before the remaining bulk frames
+    std::vector<uint8_t> rest(wire.begin() + static_cast<ptrdiff_t>(first_run), wire.end());
+    auto frames = parse_frames(rest);
+    ASSERT_EQ(frames.size(), 20u);
+    ASSERT_EQ(frames[0].type, PING_PONG);
+    for (size_t i = 1; i < frames.size(); i++) {
+        ASSERT_EQ(frames[i].type, ATTRIBUTE);
+    }
+}
+
+UTEST(frame_scheduler, weighted_shares) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> wire;
+    frame_scheduler scheduler(collect_into(wire), pool);
+    encoder logs(scheduler.writer());
+    encoder geometry(scheduler.writer());
+
+    std::vector<uint32_t> values(250, 1);
+    for (int i = 0; i < 1000; i++) {
+        logs.info(std::string(1000, 'x'));
+        geometry.attr("points", values);
+    }
+
+    scheduler.run(1024 * 1024);
+
+    size_t log_bytes = 0;
+    size_t bulk_bytes = 0;
+    for (const auto& f : parse_frames(wire)) {
+        (f.type == LOG ? log_bytes : bulk_bytes) += f.payload.size();
+    }
+
+    // Logs get about four times the bandwidth of bulk frames
+    ASSERT_GT(bulk_bytes, 0u);
+    ASSERT_GT(log_bytes, 3 * bulk_bytes);
+    ASSERT_LT(log_bytes, 5 * bulk_bytes);
+}
+
+UTEST(frame_scheduler, concurrent_producers) {
+    constexpr int PRODUCERS = 4;
+    constexpr int MESSAGES = 50;
+
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> wire;
+    frame_scheduler scheduler(collect_into(wire), pool);
+
+    // Each producer has its own encoder splitting larger payloads
+    std::atomic<int> running = PRODUCERS;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&, p] {
+            encoder enc(scheduler.writer(), 1000);
+            enc.set_next_stream_id(static_cast<uint32_t>(p) << 24 | 1);
+            for (int i = 0; i < MESSAGES; i++) {
+                std::vector<uint32_t> values(static_cast<size_t>(i) * 20, static_cast<uint32_t>(p));
+                enc.attr(std::to_string(p) + "-" + std::to_string(i), values);
+                enc.info("progress");
+            }
+            running--;
+        });
+    }
+
+    while (running > 0 || scheduler.pending_bytes() > 0) {
+        scheduler.run(64 * 1024);
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+
+    // Every payload arrives intact and in order per producer
+    std::vector<int> next(PRODUCERS, 0);
+    int logs = 0;
+    bool in_order = true;
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == LOG) {
+            logs++;
+            return;
+        }
+        std::string name = payload["name"];
+        int p = std::stoi(name.substr(0, name.find('-')));
+        int i = std::stoi(name.substr(name.find('-') + 1));
+        in_order = in_order && i == next[p] &&
+                   payload["value"].get_binary().size() == static_cast<size_t>(i) * 20 * sizeof(uint32_t);
+        next[p] = i + 1;
+    }, pool);
+    ASSERT_EQ(dec.get_net_buffer().append(wire.data(), wire.size()), wire.size());
+
+    ASSERT_TRUE(in_order);
+    ASSERT_EQ(logs, PRODUCERS * MESSAGES);
+    for (int p = 0; p < PRODUCERS; p++) {
+        ASSERT_EQ(next[p], MESSAGES);
+    }
+}
+
+UTEST(frame_scheduler, attached_encoders_skip_the_string_table) {
+    auto pool = buffer_pool::create(1024);
+    std::vector<uint8_t> wire;
+    frame_scheduler scheduler(collect_into(wire), pool);
+
+    // Both producers negotiated the string table with the same peer
+    encoder a(scheduler.writer(), 1000);
+    encoder b(scheduler.writer(frame_priority::log), 1000);
+    scheduler.attach(a);
+    scheduler.attach(b);
+    a.set_peer_caps(CAP_STRING_TABLE | CAP_STREAM_PREFIX);
+    b.set_peer_caps(CAP_STRING_TABLE | CAP_STREAM_PREFIX);
+
+    for (int i = 0; i < 3; i++) {
+        a.begin("Mesh", "/World/first", 1);
+        a.attr("points", std::vector<uint32_t>(1000, 1));
+        a.end(1);
+        b.begin("Xform", "/World/second", 1);
+        b.end(1);
+    }
+    while (scheduler.pending_bytes() > 0) {
+        scheduler.run(4096);
+    }
+
+    std::vector<std::string> names;
+    decoder dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == BEGIN) {
+            names.push_back(payload["type"].get<std::string>() + " " + payload["name"].get<std::string>());
+        }
+    }, pool);
+    dec.set_peer_caps(CAP_STRING_TABLE | CAP_STREAM_PREFIX);
+    ASSERT_EQ(dec.get_net_buffer().append(wire.data(), wire.size()), wire.size());
+
+    ASSERT_FALSE(dec.failed());
+    ASSERT_EQ(names.size(), 6u);
+    ASSERT_EQ(std::count(names.begin(), names.end(), "Mesh /World/first"), 3);
+    ASSERT_EQ(std::count(names.begin(), names.end(), "Xform /World/second"), 3);
+}
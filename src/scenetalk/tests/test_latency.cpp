@@ -0,0 +1,129 @@
+#include "latency.h"
+#include "decoder.h"
+#include "encoder.h"
+#include <utest/utest.h>
+#include <memory>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+using namespace std::chrono_literals;
+
+UTEST(latency, histogram_percentiles) {
+    latency_histogram h;
+    ASSERT_EQ(h.percentile(0.5).count(), 0);
+
+    for (int i = 1; i <= 1000; i++) {
+        h.record(std::chrono::microseconds(i * 10));
+    }
+    ASSERT_EQ(h.count(), 1000u);
+    ASSERT_EQ(h.min().count(), 10);
+    ASSERT_EQ(h.max().count(), 10000);
+    ASSERT_EQ(h.mean().count(), 5005);
+
+    // Buckets keep values to within about 6%
+    auto near = [](std::chrono::microseconds value, double expected) {
+        return std::abs(value.count() - expected) <= expected * 0.07;
+    };
+    ASSERT_TRUE(near(h.percentile(0.5), 5000));
+    ASSERT_TRUE(near(h.percentile(0.9), 9000));
+    ASSERT_TRUE(near(h.percentile(0.99), 9900));
+    ASSERT_EQ(h.percentile(1.0).count(), 10000);
+
+    // Small values are exact, huge ones are clamped
+    latency_histogram exact;
+    exact.record(3us);
+    exact.record(17us);
+    exact.record(std::chrono::hours(10));
+    ASSERT_EQ(exact.percentile(0.0).count(), 3);
+    ASSERT_EQ(exact.percentile(0.5).count(), 17);
+    ASSERT_EQ(exact.max().count(), (int64_t(1) << 32) - 1);
+
+    auto summary = h.summary();
+    ASSERT_EQ(summary.count, 1000u);
+    ASSERT_EQ(summary.min_us, 10u);
+    h.reset();
+    ASSERT_EQ(h.count(), 0u);
+    ASSERT_EQ(h.summary().p99_us, 0u);
+}
+
+UTEST(latency, tracker_matches_nonces) {
+    latency_tracker tracker(100);
+    auto start = latency_tracker::clock::now();
+
+    uint32_t first = tracker.start_ping(start);
+    uint32_t second = tracker.start_ping(start + 1ms);
+    ASSERT_EQ(first, 100u);
+    ASSERT_EQ(second, 101u);
+
+    // Pongs may come back in any order, unknown nonces are pings of the peer
+    ASSERT_TRUE(tracker.on_pong(second, start + 5ms));
+    ASSERT_TRUE(tracker.on_pong(first, start + 20ms));
+    ASSERT_FALSE(tracker.on_pong(first, start + 30ms));
+    ASSERT_FALSE(tracker.on_pong(7, start + 30ms));
+
+    auto stats = tracker.stats();
+    ASSERT_EQ(stats.pings_sent, 2u);
+    ASSERT_EQ(stats.pongs_received, 2u);
+    ASSERT_EQ(stats.rtt.count, 2u);
+    ASSERT_EQ(stats.rtt.min_us, 4000u);
+    ASSERT_EQ(stats.rtt.max_us, 20000u);
+
+    // Pings without pong are given up once too many are outstanding
+    for (size_t i = 0; i < latency_tracker::MAX_OUTSTANDING + 3; i++) {
+        tracker.start_ping(start);
+    }
+    ASSERT_EQ(tracker.stats().pings_lost, 3u);
+}
+
+UTEST(latency, queue_delay_ignores_clock_offset) {
+    latency_tracker tracker;
+    auto now = std::chrono::system_clock::time_point(std::chrono::seconds(1000000));
+    double now_s = std::chrono::duration<double>(now.time_since_epoch()).count();
+
+    // The peer clock runs 2s ahead, pings take 10ms when nothing is queued
+    double offset_s = 2.0;
+    tracker.on_peer_ping(now_s + offset_s - 0.010, now);
+    tracker.on_peer_ping(now_s + offset_s - 0.010, now + 1s);
+    tracker.on_peer_ping(now_s + 2.0 + offset_s - 0.060, now + 2s);
+
+    auto stats = tracker.stats();
+    ASSERT_EQ(stats.peer_pings, 3u);
+    ASSERT_EQ(stats.queue_delay.min_us, 0u);
+    ASSERT_TRUE(stats.queue_delay.max_us >= 999000u && stats.queue_delay.max_us <= 1001000u);
+}
+
+UTEST(latency, ping_pong_round_trip) {
+    auto pool = buffer_pool::create(1024);
+    latency_tracker tracker(1000);
+    std::unique_ptr<encoder> local;
+    std::unique_ptr<encoder> remote;
+    int echoed = 0;
+
+    // The remote echoes pings, the local side matches the pongs
+    decoder local_dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == PING_PONG && payload.contains("nonce")) {
+            tracker.on_pong(payload["nonce"].get<uint32_t>());
+        }
+    }, pool);
+    decoder remote_dec([&](uint8_t type, const nlohmann::json& payload) {
+        if (type == PING_PONG) {
+            echoed++;
+            remote->echo_ping_pong(payload);
+        }
+    }, pool);
+    local = std::make_unique<encoder>([&](const frame_view& f) { remote_dec.process_frame(f); });
+    remote = std::make_unique<encoder>([&](const frame_view& f) { local_dec.process_frame(f); });
+
+    for (int i = 0; i < 5; i++) {
+        local->ping_pong(tracker.start_ping());
+    }
+    local->ping_pong();
+
+    auto stats = tracker.stats();
+    ASSERT_EQ(echoed, 6);
+    ASSERT_EQ(stats.pings_sent, 5u);
+    ASSERT_EQ(stats.pongs_received, 5u);
+    ASSERT_EQ(stats.pings_lost, 0u);
+    ASSERT_EQ(stats.rtt.count, 5u);
+}
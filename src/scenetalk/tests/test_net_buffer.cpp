@@ -183,4 +183,289 @@ UTEST(net_buffer, reset) {
     // Send complete frame
     buffer.append(serialized.data(), serialized.size());
     ASSERT_TRUE(frame_received);
-}
\ No newline at end of file
+}
+UTEST(net_buffer, small_payload_uses_inline_storage) {
+    auto pool = buffer_pool::create(1024, 1);
+    bool pooled = true;
+
+    net_buffer buffer(pool, [&pooled](const frame_view& f) {
+        pooled = f.take_buffer() != nullptr;
+    });
+
+    // END sized frame, should never touch the pool
+    frame test_frame(END, 0x00, {0x81, 0x07});
+    std::vector<uint8_t> serialized = test_frame.serialize();
+    buffer.append(serialized.data(), serialized.size());
+
+    ASSERT_FALSE(pooled);
+    ASSERT_EQ(pool->pool_size(), 1);
+}
+
+UTEST(net_buffer, large_payload_is_not_copied) {
+    auto pool = buffer_pool::create(1024, 0);
+    const uint8_t* payload_data = nullptr;
+    buffer_ptr kept;
+
+    net_buffer buffer(pool, [&](const frame_view& f) {
+        payload_data = f.payload.data();
+        kept = f.take_buffer();
+    });
+
+    std::vector<uint8_t> payload(INLINE_PAYLOAD_SIZE * 4);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    frame test_frame(ATTRIBUTE, 0x00, payload);
+    std::vector<uint8_t> serialized = test_frame.serialize();
+
+    // Straddle two appends so the payload is assembled in a pooled buffer
+    buffer.append(serialized.data(), 10);
+    buffer.append(serialized.data() + 10, serialized.size() - 10);
+
+    // The handler sees the pooled buffer itself and may keep it
+    ASSERT_TRUE(kept != nullptr);
+    ASSERT_TRUE(payload_data == kept->data());
+    ASSERT_EQ(kept->size(), payload.size());
+    ASSERT_EQ(kept->data()[payload.size() - 1], static_cast<uint8_t>(payload.size() - 1));
+    ASSERT_EQ(pool->pool_size(), 0);
+
+    // Dropping it returns the buffer to the pool
+    kept.reset();
+    ASSERT_EQ(pool->pool_size(), 1);
+}
+
+UTEST(net_buffer, untaken_buffer_returns_to_pool) {
+    auto pool = buffer_pool::create(1024, 0);
+    size_t received_size = 0;
+
+    net_buffer buffer(pool, [&received_size](const frame_view& f) {
+        received_size = f.payload.size();
+    });
+
+    frame test_frame(ATTRIBUTE, 0x00, std::vector<uint8_t>(512, 0xAB));
+    std::vector<uint8_t> serialized = test_frame.serialize();
+    buffer.append(serialized.data(), 10);
+    buffer.append(serialized.data() + 10, serialized.size() - 10);
+
+    ASSERT_EQ(received_size, 512);
+    ASSERT_EQ(pool->pool_size(), 1);
+}
+
+UTEST(net_buffer, buffer_sized_from_header) {
+    auto pool = buffer_pool::create(64 * 1024, 0);
+    size_t capacity = 0;
+
+    net_buffer buffer(pool, [&capacity](const frame_view& f) {
+        capacity = f.take_buffer()->capacity();
+    });
+
+    // A 100 byte payload should not pin a full 64 KB buffer
+    frame test_frame(ATTRIBUTE, 0x00, std::vector<uint8_t>(100, 0x01));
+    std::vector<uint8_t> serialized = test_frame.serialize();
+    buffer.append(serialized.data(), 10);
+    buffer.append(serialized.data() + 10, serialized.size() - 10);
+
+    ASSERT_EQ(capacity, 128);
+}
+
+UTEST(net_buffer, whole_frames_dispatched_in_place) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<const uint8_t*> payloads;
+    std::vector<bool> pooled;
+
+    net_buffer buffer(pool, [&](const frame_view& f) {
+        payloads.push_back(f.payload.data());
+        pooled.push_back(f.take_buffer() != nullptr);
+    });
+
+    frame frame1(ATTRIBUTE, 0x00, std::vector<uint8_t>(200, 0x01));
+    frame frame2(END, 0x00, {0x81, 0x01});
+    frame frame3(ATTRIBUTE, 0x00, std::vector<uint8_t>(300, 0x03));
+
+    std::vector<uint8_t> combined;
+    for (const auto& f : {frame1, frame2, frame3}) {
+        auto serialized = f.serialize();
+        combined.insert(combined.end(), serialized.begin(), serialized.end());
+    }
+
+    // Deliver the last frame split across two appends
+    size_t split = combined.size() - 100;
+    buffer.append(combined.data(), split);
+    buffer.append(combined.data() + split, combined.size() - split);
+
+    ASSERT_EQ(payloads.size(), 3);
+
+    // Complete frames point straight into the input
+    ASSERT_TRUE(payloads[0] == combined.data() + FRAME_HEADER_SIZE);
+    ASSERT_TRUE(payloads[1] == combined.data() + 2 * FRAME_HEADER_SIZE + 200);
+    ASSERT_FALSE(pooled[0]);
+    ASSERT_FALSE(pooled[1]);
+
+    // Only the straddling frame was copied into a pooled buffer
+    ASSERT_TRUE(pooled[2]);
+    ASSERT_EQ(pool->stats().misses, 1);
+}
+
+UTEST(net_buffer, oversized_frame_after_complete_frames) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<uint8_t> types;
+
+    net_buffer buffer(pool, [&types](const frame_view& f) {
+        types.push_back(f.type);
+    }, 64);
+
+    frame valid(BEGIN, 0x00, {1, 2, 3});
+    frame oversized(ATTRIBUTE, 0x00, std::vector<uint8_t>(100, 0x01));
+
+    std::vector<uint8_t> combined = valid.serialize();
+    auto serialized = oversized.serialize();
+    combined.insert(combined.end(), serialized.begin(), serialized.end());
+
+    buffer.append(combined.data(), combined.size());
+
+    // The valid frame is delivered, the oversized one is rejected
+    ASSERT_EQ(types.size(), 1);
+    ASSERT_EQ(types[0], BEGIN);
+}
+
+UTEST(net_buffer, extended_frame_in_place) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<const uint8_t*> payloads;
+    std::vector<size_t> sizes;
+
+    net_buffer buffer(pool, [&](const frame_view& f) {
+        payloads.push_back(f.payload.data());
+        sizes.push_back(f.payload.size());
+    });
+    buffer.set_peer_caps(CAP_EXTENDED_LENGTH);
+
+    frame large(ATTRIBUTE, FLAG_EXTENDED, std::vector<uint8_t>(100000, 0x01));
+    frame small(END, 0x00, {0x81, 0x01});
+
+    std::vector<uint8_t> combined = large.serialize();
+    auto serialized = small.serialize();
+    combined.insert(combined.end(), serialized.begin(), serialized.end());
+
+    ASSERT_EQ(buffer.append(combined.data(), combined.size()), combined.size());
+
+    ASSERT_EQ(sizes.size(), 2);
+    ASSERT_EQ(sizes[0], 100000);
+    ASSERT_TRUE(payloads[0] == combined.data() + EXTENDED_HEADER_SIZE);
+    ASSERT_EQ(sizes[1], 2);
+    ASSERT_EQ(pool->stats().misses, 0);
+}
+
+UTEST(net_buffer, extended_frame_split_header) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<uint8_t> received;
+    uint8_t flags = 0;
+    size_t capacity = 0;
+
+    net_buffer buffer(pool, [&](const frame_view& f) {
+        flags = f.flags;
+        received.assign(f.payload.begin(), f.payload.end());
+        capacity = f.take_buffer()->capacity();
+    });
+    buffer.set_peer_caps(CAP_EXTENDED_LENGTH);
+
+    std::vector<uint8_t> payload(70000);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    frame large(ATTRIBUTE, FLAG_EXTENDED, payload);
+    std::vector<uint8_t> serialized = large.serialize();
+    ASSERT_EQ(serialized.size(), EXTENDED_HEADER_SIZE + payload.size());
+
+    // Split inside the extended header and again inside the payload
+    buffer.append(serialized.data(), 3);
+    buffer.append(serialized.data() + 3, 1000);
+    buffer.append(serialized.data() + 1003, serialized.size() - 1003);
+
+    ASSERT_EQ(flags, FLAG_EXTENDED);
+    ASSERT_TRUE(received == payload);
+
+    // Grown from a standard frame's buffer into one that fits
+    ASSERT_EQ(capacity, 128 * 1024);
+}
+
+UTEST(net_buffer, extended_frame_needs_negotiation) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<uint8_t> types;
+
+    net_buffer buffer(pool, [&types](const frame_view& f) {
+        types.push_back(f.type);
+    });
+
+    // Dropped in place and when the header arrives on its own
+    frame extended(ATTRIBUTE, FLAG_EXTENDED, std::vector<uint8_t>(100, 0x01));
+    std::vector<uint8_t> serialized = extended.serialize();
+    buffer.append(serialized.data(), serialized.size());
+    ASSERT_TRUE(types.empty());
+    buffer.reset();
+    buffer.append(serialized.data(), EXTENDED_HEADER_SIZE);
+    ASSERT_FALSE(buffer.in_payload());
+
+    buffer.set_peer_caps(CAP_EXTENDED_LENGTH);
+    buffer.append(serialized.data(), serialized.size());
+    ASSERT_EQ(types.size(), 1u);
+}
+
+UTEST(net_buffer, extended_payload_grows_as_it_arrives) {
+    auto pool = buffer_pool::create(1024, 0);
+    size_t received = 0;
+
+    net_buffer buffer(pool, [&received](const frame_view& f) {
+        received = f.payload.size();
+    });
+    buffer.set_peer_caps(CAP_EXTENDED_LENGTH);
+
+    // A header announcing 32MB only takes a standard frame's buffer
+    frame large(ATTRIBUTE, FLAG_EXTENDED, std::vector<uint8_t>(32 * 1024 * 1024, 0x01));
+    std::vector<uint8_t> serialized = large.serialize();
+    buffer.append(serialized.data(), EXTENDED_HEADER_SIZE + 100);
+    ASSERT_TRUE(buffer.in_payload());
+    ASSERT_LE(pool->stats().allocated_bytes, 64u * 1024u);
+
+    buffer.append(serialized.data() + EXTENDED_HEADER_SIZE + 100, serialized.size() - EXTENDED_HEADER_SIZE - 100);
+    ASSERT_EQ(received, large.payload.size());
+}
+
+UTEST(net_buffer, oversized_extended_frame) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<uint8_t> types;
+
+    net_buffer buffer(pool, [&types](const frame_view& f) {
+        types.push_back(f.type);
+    }, 1024);
+    buffer.set_peer_caps(CAP_EXTENDED_LENGTH, 1024);
+
+    frame oversized(ATTRIBUTE, FLAG_EXTENDED, std::vector<uint8_t>(2048, 0x01));
+    std::vector<uint8_t> serialized = oversized.serialize();
+    buffer.append(serialized.data(), 4);
+
+    // Rejected as soon as the header is complete
+    ASSERT_EQ(buffer.append(serialized.data() + 4, 2), 2);
+    ASSERT_FALSE(buffer.in_payload());
+    ASSERT_EQ(pool->stats().misses, 0);
+}
+
+UTEST(net_buffer, corrupt_compressed_frame_is_dropped) {
+    auto pool = buffer_pool::create(1024, 0);
+    std::vector<uint8_t> types;
+
+    net_buffer buffer(pool, [&types](const frame_view& f) {
+        types.push_back(f.type);
+    });
+
+    // Claims 1000 bytes but holds a three byte literal block
+    frame corrupt(ATTRIBUTE, FLAG_COMPRESSED, {0xE8, 0x03, 0x00, 0x00, 0x30, 'a', 'b', 'c'});
+    frame valid(END, 0x00, {0x81, 0x01});
+
+    std::vector<uint8_t> combined = corrupt.serialize();
+    auto serialized = valid.serialize();
+    combined.insert(combined.end(), serialized.begin(), serialized.end());
+
+    ASSERT_EQ(buffer.append(combined.data(), combined.size()), combined.size());
+    ASSERT_EQ(types.size(), 1);
+    ASSERT_EQ(types[0], END);
+}
@@ -0,0 +1,227 @@
+#include "scene_store.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "frame_link.h"
+#include <utest/utest.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+UTEST(scene_store, hierarchy) {
+    scene_link link;
+    link.enc.begin("Xform", "World", 1);
+    link.enc.begin("Mesh", "cube", 2);
+    link.enc.attr(attrs::purpose, "render");
+    link.enc.end(2);
+    link.enc.begin("Mesh", "sphere", 2);
+    link.enc.end(2);
+    link.enc.end(1);
+
+    auto& store = link.store;
+    ASSERT_EQ(store.prim_count(), 4u);
+    uint32_t world = store.find_prim("/World");
+    uint32_t cube = store.find_prim("/World/cube");
+    uint32_t sphere = store.find_prim("/World/sphere");
+    ASSERT_NE(cube, NO_INDEX);
+    ASSERT_EQ(store.prim_parent(world), ROOT_PRIM);
+    ASSERT_EQ(store.prim_parent(cube), world);
+    ASSERT_EQ(store.prim_parent(sphere), world);
+    ASSERT_TRUE(store.prim_type(cube) == "Mesh");
+    ASSERT_TRUE(store.prim_defined(sphere));
+
+    uint32_t purpose = store.find_attr(cube, "purpose");
+    ASSERT_NE(purpose, NO_INDEX);
+    ASSERT_EQ(store.attr_prim(purpose), cube);
+    ASSERT_TRUE(store.attr(purpose).attr_type == "str");
+    ASSERT_TRUE(store.attr_value(purpose) == "render");
+    ASSERT_EQ(store.find_attr(sphere, "purpose"), NO_INDEX);
+}
+
+UTEST(scene_store, partial_graphs) {
+    scene_link link;
+
+    // The arm arrives before its parent, which is attached once it is sent
+    link.enc.begin("Mesh", "arm", 1);
+    link.enc.attr(attrs::parent, "/World/Character");
+    link.enc.end(1);
+
+    auto& store = link.store;
+    uint32_t arm = store.find_prim("/arm");
+    uint32_t character = store.find_prim("/World/Character");
+    ASSERT_EQ(store.prim_parent(arm), character);
+    ASSERT_FALSE(store.prim_defined(character));
+    ASSERT_EQ(store.prim_parent(character), store.find_prim("/World"));
+
+    link.enc.begin("SkelRoot", "/World/Character", 1);
+    link.enc.end(1);
+    ASSERT_EQ(store.find_prim("/World/Character"), character);
+    ASSERT_TRUE(store.prim_defined(character));
+    ASSERT_TRUE(store.prim_type(character) == "SkelRoot");
+
+    // A parent below the prim itself would make a cycle and is ignored
+    link.enc.begin("Xform", "/World", 1);
+    link.enc.attr(attrs::parent, "/World/Character");
+    link.enc.end(1);
+    ASSERT_EQ(store.prim_parent(store.find_prim("/World")), ROOT_PRIM);
+}
+
+UTEST(scene_store, overwrite_in_place) {
+    scene_link link;
+    std::vector<float> points(3000, 1.0f);
+
+    // The points are split into fragments and streamed into the arena
+    link.enc.begin("Mesh", "/World/cube", 1);
+    link.enc.attr(attrs::points, points);
+    link.enc.end(1);
+
+    auto& store = link.store;
+    uint32_t cube = store.find_prim("/World/cube");
+    uint32_t attr = store.find_attr(cube, "points");
+    attribute_view first = store.attr(attr);
+    ASSERT_EQ(first.data.size(), points.size() * sizeof(float));
+    ASSERT_EQ(first.tag, TAG_FLOAT32_LE);
+    size_t arena_bytes = store.arena_bytes();
+
+    // Sending the prim again reuses its memory
+    std::fill(points.begin(), points.end(), 2.0f);
+    link.enc.begin("Mesh", "/World/cube", 1);
+    link.enc.attr(attrs::points, std::span<const float>(points).first(1500));
+    link.enc.end(1);
+
+    attribute_view second = store.attr(attr);
+    ASSERT_EQ(store.prim_count(), 3u);
+    ASSERT_EQ(store.attr_count(), 1u);
+    ASSERT_EQ(second.data.data(), first.data.data());
+    ASSERT_EQ(second.data.size(), 1500 * sizeof(float));
+    ASSERT_EQ(store.arena_bytes(), arena_bytes);
+
+    float value;
+    std::memcpy(&value, second.data.data() + 1499 * sizeof(float), sizeof(float));
+    ASSERT_EQ(value, 2.0f);
+}
+
+UTEST(scene_store, versions) {
+    scene_link link;
+    link.enc.attr(attrs::scene_scale_mm, 1000u);
+    link.enc.begin("Mesh", "/World/cube", 1);
+    link.enc.end(1);
+
+    auto& store = link.store;
+    ASSERT_NE(store.find_attr(ROOT_PRIM, "sceneScaleMM"), NO_INDEX);
+    ASSERT_EQ(store.version(), 0u);
+
+    store.reset();
+    ASSERT_EQ(store.version(), 1u);
+    ASSERT_EQ(store.prim_count(), 1u);
+    ASSERT_EQ(store.attr_count(), 0u);
+    ASSERT_EQ(store.find_prim("/World/cube"), NO_INDEX);
+    ASSERT_EQ(store.find_prim("/"), ROOT_PRIM);
+}
+
+UTEST(scene_store, compacts_unused_arena) {
+    scene_link link;
+    link.enc.set_delta_updates(true);
+    auto& store = link.store;
+
+    // Each update grows the points past their place and drops a prim
+    size_t most_bytes = 0;
+    for (size_t i = 1; i <= 40; i++) {
+        std::vector<float> points(i * 3000, static_cast<float>(i));
+        link.enc.begin_update();
+        link.enc.begin("Mesh", "/World/cube", 1);
+        link.enc.attr(attrs::points, points);
+        link.enc.end(1);
+        link.enc.begin("Mesh", "/World/temp" + std::to_string(i), 1);
+        link.enc.attr(attrs::points, points);
+        link.enc.end(1);
+        link.enc.end_update();
+        most_bytes = std::max(most_bytes, store.arena_bytes());
+    }
+    ASSERT_GT(store.version(), 0u);
+
+    // Each new temp prim takes the index of one removed before
+    ASSERT_LE(store.prim_count(), 5u);
+    ASSERT_LE(store.attr_count(), 3u);
+
+    // Without compaction all 40 versions of both values would be kept
+    size_t live = 2 * 40 * 3000 * sizeof(float);
+    ASSERT_LT(most_bytes, 4 * live);
+    uint32_t cube = store.find_prim("/World/cube");
+    uint32_t temp = store.find_prim("/World/temp40");
+    ASSERT_EQ(store.find_prim("/World/temp39"), NO_INDEX);
+    attribute_view points = store.attr(store.find_attr(temp, "points"));
+    ASSERT_EQ(points.data.size(), live / 2);
+    ASSERT_TRUE(store.prim_path(cube) == "/World/cube");
+
+    store.compact();
+    ASSERT_EQ(store.unused_arena_bytes(), 0u);
+    ASSERT_EQ(store.find_prim("/World/cube"), cube);
+    ASSERT_EQ(store.find_prim("/World/temp40"), temp);
+    float value;
+    std::memcpy(&value, store.attr(store.find_attr(cube, "points")).data.data(), sizeof(float));
+    ASSERT_EQ(value, 40.0f);
+}
+
+UTEST(scene_store, removed_slots_are_reused) {
+    scene_link link;
+    auto& store = link.store;
+
+    link.enc.begin("Xform", "/World", 1);
+    link.enc.begin("Mesh", "cube", 2);
+    link.enc.attr(attrs::purpose, "render");
+    link.enc.end(2);
+    link.enc.end(1);
+    uint32_t world = store.find_prim("/World");
+    uint32_t cube = store.find_prim("/World/cube");
+
+    // A removed prim with children stays undefined so they keep their parent
+    store.on_prim_removed("/World");
+    ASSERT_EQ(store.find_prim("/World"), world);
+    ASSERT_FALSE(store.prim_defined(world));
+    ASSERT_EQ(store.prim_parent(cube), world);
+
+    // Removing the last child frees both
+    store.on_prim_removed("/World/cube");
+    ASSERT_EQ(store.find_prim("/World/cube"), NO_INDEX);
+    ASSERT_EQ(store.find_prim("/World"), NO_INDEX);
+    ASSERT_EQ(store.prim_count(), 3u);
+    ASSERT_EQ(store.attr_count(), 1u);
+
+    // New prims and attributes take the freed indices
+    link.enc.begin("Mesh", "/sphere", 1);
+    link.enc.attr(attrs::purpose, "proxy");
+    link.enc.end(1);
+    uint32_t sphere = store.find_prim("/sphere");
+    ASSERT_TRUE(sphere == world || sphere == cube);
+    ASSERT_EQ(store.prim_parent(sphere), ROOT_PRIM);
+    ASSERT_EQ(store.prim_count(), 3u);
+    ASSERT_EQ(store.attr_count(), 1u);
+    ASSERT_TRUE(store.attr_value(store.find_attr(sphere, "purpose")) == "proxy");
+}
+
+UTEST(scene_store, oversized_values_are_refused) {
+    auto pool = buffer_pool::create(1024);
+    decoder_limits limits;
+    limits.max_reassembly_bytes = 64 * 1024;
+    scene_store store(pool, limits);
+
+    std::vector<uint8_t> bytes(1024, 1);
+    store.on_attr_typed_array("points", "f32[]", typed_array_view{TAG_FLOAT32_LE, bytes});
+    uint32_t points = store.find_attr(ROOT_PRIM, "points");
+    ASSERT_NE(points, NO_INDEX);
+
+    // A streamed size past the limit, or past what the pool can hold, keeps the old value
+    store.on_attr_typed_array_chunk(1, "points", "f32[]", TAG_FLOAT32_LE, 0, bytes, 1024 * 1024);
+    store.on_attr_typed_array_chunk(2, "normals", "f32[]", TAG_FLOAT32_LE, 0, bytes, SIZE_MAX / 2);
+    ASSERT_EQ(store.attr(points).data.size(), bytes.size());
+    ASSERT_EQ(store.find_attr(ROOT_PRIM, "normals"), NO_INDEX);
+
+    scene_store unlimited(pool, decoder_limits{SIZE_MAX});
+    unlimited.on_attr_typed_array_chunk(1, "points", "f32[]", TAG_FLOAT32_LE, 0, bytes, SIZE_MAX / 2);
+    ASSERT_EQ(unlimited.attr_count(), 0u);
+}
@@ -0,0 +1,61 @@
+#include "string_table.h"
+#include <utest/utest.h>
+#include <string>
+
+UTEST_MAIN();
+
+using namespace scene_talk;
+
+UTEST(string_table, indices) {
+    string_table table;
+    ASSERT_EQ(table.insert("/World/Mesh"), 0u);
+    ASSERT_EQ(table.insert("points"), 1u);
+
+    ASSERT_TRUE(table.get(0) == "/World/Mesh");
+    ASSERT_TRUE(table.get(1) == "points");
+    ASSERT_FALSE(table.get(2).has_value());
+    ASSERT_EQ(*table.find("points"), 1u);
+    ASSERT_FALSE(table.find("normals").has_value());
+    ASSERT_EQ(table.size(), 17 + 2 * STRING_ENTRY_OVERHEAD);
+}
+
+UTEST(string_table, duplicates) {
+    string_table table;
+    table.insert("points");
+    table.insert("normals");
+    ASSERT_EQ(table.insert("points"), 2u);
+
+    // Lookups find the newer entry, the older one keeps its index
+    ASSERT_EQ(*table.find("points"), 2u);
+    ASSERT_TRUE(table.get(0) == "points");
+    ASSERT_EQ(table.entries(), 3u);
+}
+
+UTEST(string_table, eviction) {
+    string_table table(3 * (10 + STRING_ENTRY_OVERHEAD));
+    for (int i = 0; i < 5; i++) {
+        table.insert("string-" + std::to_string(100 + i));
+    }
+    ASSERT_EQ(table.entries(), 5u);
+
+    // Indices keep counting after the oldest entries are dropped
+    table.evict();
+    ASSERT_EQ(table.entries(), 3u);
+    ASSERT_FALSE(table.get(1).has_value());
+    ASSERT_FALSE(table.find("string-100").has_value());
+    ASSERT_TRUE(table.get(2) == "string-102");
+    ASSERT_EQ(table.insert("string-105"), 5u);
+
+    // A dropped duplicate does not remove the lookup of its newer entry
+    table.insert("string-103");
+    table.evict();
+    ASSERT_FALSE(table.get(3).has_value());
+    ASSERT_EQ(*table.find("string-103"), 6u);
+}
+
+UTEST(string_table, indexable) {
+    ASSERT_FALSE(string_table::indexable("str"));
+    ASSERT_TRUE(string_table::indexable("Mesh"));
+    ASSERT_TRUE(string_table::indexable(std::string(MAX_TABLE_STRING, 'x')));
+    ASSERT_FALSE(string_table::indexable(std::string(MAX_TABLE_STRING + 1, 'x')));
+}
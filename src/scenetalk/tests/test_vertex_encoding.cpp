@@ -0,0 +1,144 @@
+#include <cmath>
+#include <random>
+#include <vector>
+#include <utest/utest.h>
+#include "vertex_encoding.h"
+
+using namespace scene_talk;
+
+UTEST_MAIN()
+
+// Random points in a box and random unit normals
+static std::vector<float> random_points(size_t count, float scale) {
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> coordinate(-scale, scale);
+    std::vector<float> points(count * 3);
+    for (auto& v : points) {
+        v = coordinate(generator);
+    }
+    return points;
+}
+
+static std::vector<float> random_normals(size_t count) {
+    std::vector<float> normals = random_points(count, 1.0f);
+    for (size_t i = 0; i < normals.size(); i += 3) {
+        float length = std::sqrt(normals[i] * normals[i] + normals[i + 1] * normals[i + 1] +
+                                 normals[i + 2] * normals[i + 2]);
+        normals[i] /= length;
+        normals[i + 1] /= length;
+        normals[i + 2] /= length;
+    }
+    return normals;
+}
+
+// Decode a value through CBOR the way the decoder does
+static nlohmann::json through_cbor(const nlohmann::json& value) {
+    auto bytes = nlohmann::json::to_cbor(value);
+    return nlohmann::json::from_cbor(bytes, true, true, nlohmann::json::cbor_tag_handler_t::store);
+}
+
+static float max_error(const std::vector<float>& a, const std::vector<float>& b) {
+    float error = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        error = std::max(error, std::abs(a[i] - b[i]));
+    }
+    return error;
+}
+
+UTEST(vertex_encoding, vector_components) {
+    ASSERT_EQ(vector_components("vec3f"), 3);
+    ASSERT_EQ(vector_components("vec4f"), 4);
+    ASSERT_EQ(vector_components("f32[]"), 1);
+    ASSERT_EQ(vector_components("str"), 1);
+}
+
+UTEST(vertex_encoding, float32_is_exact) {
+    std::vector<float> points = random_points(100, 10.0f);
+    auto value = through_cbor(encode_vertex_array(points, 3, vertex_semantic::position,
+                                                  vertex_precision::float32));
+
+    auto array = read_vertex_array(value, 3);
+    ASSERT_TRUE(array.has_value());
+    ASSERT_TRUE(array->encoding == vertex_encoding::float32);
+    ASSERT_EQ(array->count(), 100);
+    ASSERT_TRUE(dequantize(*array) == points);
+}
+
+UTEST(vertex_encoding, quantized_positions) {
+    std::vector<float> points = random_points(1000, 50.0f);
+    auto value = through_cbor(encode_vertex_array(points, 3, vertex_semantic::position,
+                                                  vertex_precision::quantized));
+
+    auto array = read_vertex_array(value, 3);
+    ASSERT_TRUE(array.has_value());
+    ASSERT_TRUE(array->encoding == vertex_encoding::q16);
+    ASSERT_EQ(array->count(), 1000);
+    ASSERT_EQ(array->data.size(), 1000 * 3 * sizeof(uint16_t));
+
+    // Error is within half a quantization step of the 100 unit range
+    ASSERT_LT(max_error(dequantize(*array), points), 100.0f / 65535.0f);
+}
+
+UTEST(vertex_encoding, quantized_normals) {
+    std::vector<float> normals = random_normals(1000);
+    normals[0] = 0.0f;
+    normals[1] = 0.0f;
+    normals[2] = -1.0f;
+
+    auto value = through_cbor(encode_vertex_array(normals, 3, vertex_semantic::normal,
+                                                  vertex_precision::quantized));
+
+    auto array = read_vertex_array(value, 3);
+    ASSERT_TRUE(array.has_value());
+    ASSERT_TRUE(array->encoding == vertex_encoding::oct16);
+    ASSERT_EQ(array->count(), 1000);
+    ASSERT_EQ(array->data.size(), 1000 * 2 * sizeof(int16_t));
+    ASSERT_LT(max_error(dequantize(*array), normals), 1e-3f);
+}
+
+UTEST(vertex_encoding, quantized_colors) {
+    std::vector<float> colors = {0.0f, 0.5f, 1.0f, 0.25f, 2.0f, -1.0f};
+    auto value = through_cbor(encode_vertex_array(colors, 3, vertex_semantic::color,
+                                                  vertex_precision::quantized));
+
+    auto array = read_vertex_array(value, 3);
+    ASSERT_TRUE(array.has_value());
+    ASSERT_TRUE(array->encoding == vertex_encoding::unorm8);
+    ASSERT_EQ(array->count(), 2);
+
+    // Out of range colors are clamped
+    std::vector<float> expected = {0.0f, 0.5f, 1.0f, 0.25f, 1.0f, 0.0f};
+    ASSERT_LT(max_error(dequantize(*array), expected), 0.5f / 255.0f + 1e-6f);
+}
+
+UTEST(vertex_encoding, encoded_sizes) {
+    std::vector<float> points = random_points(10000, 10.0f);
+    std::vector<float> normals = random_normals(10000);
+
+    auto bytes_per_vertex = [](const std::vector<float>& values, vertex_semantic semantic,
+                               vertex_precision precision) {
+        auto value = encode_vertex_array(values, 3, semantic, precision);
+        return nlohmann::json::to_cbor(value).size() / (values.size() / 3);
+    };
+
+    // Each float is at least a 5 byte CBOR number without typed arrays
+    ASSERT_GE(bytes_per_vertex(points, vertex_semantic::position, vertex_precision::full), 15);
+    ASSERT_EQ(bytes_per_vertex(points, vertex_semantic::position, vertex_precision::float32), 12);
+    ASSERT_EQ(bytes_per_vertex(points, vertex_semantic::position, vertex_precision::quantized), 6);
+    ASSERT_EQ(bytes_per_vertex(normals, vertex_semantic::normal, vertex_precision::quantized), 4);
+    ASSERT_EQ(bytes_per_vertex(normals, vertex_semantic::color, vertex_precision::quantized), 3);
+}
+
+UTEST(vertex_encoding, plain_values_are_not_vertex_arrays) {
+    ASSERT_FALSE(read_vertex_array(nlohmann::json::array({1.0, 2.0, 3.0}), 3).has_value());
+    ASSERT_FALSE(read_vertex_array(nlohmann::json("points"), 3).has_value());
+    ASSERT_FALSE(read_vertex_array(nlohmann::json::binary({1, 2, 3, 4}), 1).has_value());
+
+    nlohmann::json bad_bounds = {
+        {"enc", "q16"},
+        {"min", {0.0}},
+        {"max", {1.0}},
+        {"data", nlohmann::json::binary({0, 0, 0, 0, 0, 0}, TAG_UINT16_LE)}
+    };
+    ASSERT_FALSE(read_vertex_array(bad_bounds, 3).has_value());
+}
@@ -0,0 +1,285 @@
+#include "vertex_encoding.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace scene_talk {
+
+namespace {
+
+using json = nlohmann::json;
+
+constexpr float SNORM16_SCALE = 32767.0f;
+constexpr float UNORM8_SCALE = 255.0f;
+
+// Append values to a typed array in little endian byte order
+template<typename T>
+void append_le(std::vector<uint8_t>& bytes, T value) {
+    auto raw = std::bit_cast<std::array<uint8_t, sizeof(T)>>(value);
+    if constexpr (std::endian::native == std::endian::big) {
+        std::reverse(raw.begin(), raw.end());
+    }
+    bytes.insert(bytes.end(), raw.begin(), raw.end());
+}
+
+json typed_array(std::vector<uint8_t> bytes, uint64_t tag) {
+    return json::binary(std::move(bytes), tag);
+}
+
+float sign_not_zero(float v) {
+    return v < 0.0f ? -1.0f : 1.0f;
+}
+
+json encode_float32(std::span<const float> values) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(values.size() * sizeof(float));
+    for (float v : values) {
+        append_le(bytes, v);
+    }
+    return typed_array(std::move(bytes), TAG_FLOAT32_LE);
+}
+
+json encode_q16(std::span<const float> values, size_t components) {
+    std::vector<float> min;
+    std::vector<float> max;
+    q16_bounds(values, components, min, max);
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(values.size() * sizeof(uint16_t));
+    for (size_t i = 0; i < values.size(); i++) {
+        size_t c = i % components;
+        append_le(bytes, q16_quantize(values[i], min[c], max[c]));
+    }
+
+    return {
+        {"enc", "q16"},
+        {"min", min},
+        {"max", max},
+        {"data", typed_array(std::move(bytes), TAG_UINT16_LE)}
+    };
+}
+
+json encode_oct16(std::span<const float> values) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(values.size() / 3 * 2 * sizeof(int16_t));
+    for (size_t i = 0; i + 2 < values.size(); i += 3) {
+        // Project onto the octahedron and fold the lower hemisphere over
+        float x = values[i], y = values[i + 1], z = values[i + 2];
+        float l1 = std::abs(x) + std::abs(y) + std::abs(z);
+        if (l1 > 0.0f) {
+            x /= l1;
+            y /= l1;
+        }
+        if (z < 0.0f) {
+            float folded_x = (1.0f - std::abs(y)) * sign_not_zero(x);
+            y = (1.0f - std::abs(x)) * sign_not_zero(y);
+            x = folded_x;
+        }
+        append_le(bytes, static_cast<int16_t>(std::lround(std::clamp(x, -1.0f, 1.0f) * SNORM16_SCALE)));
+        append_le(bytes, static_cast<int16_t>(std::lround(std::clamp(y, -1.0f, 1.0f) * SNORM16_SCALE)));
+    }
+
+    return {
+        {"enc", "oct16"},
+        {"data", typed_array(std::move(bytes), TAG_SINT16_LE)}
+    };
+}
+
+json encode_unorm8(std::span<const float> values) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(values.size());
+    for (float v : values) {
+        bytes.push_back(static_cast<uint8_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * UNORM8_SCALE)));
+    }
+
+    return {
+        {"enc", "unorm8"},
+        {"data", typed_array(std::move(bytes), TAG_UINT8)}
+    };
+}
+
+// Typed array bytes of a value if it carries the expected tag
+std::optional<std::span<const uint8_t>> typed_array_bytes(const json& value, uint64_t tag) {
+    if (!value.is_binary()) {
+        return std::nullopt;
+    }
+    const auto& binary = value.get_binary();
+    if (!binary.has_subtype() || binary.subtype() != tag) {
+        return std::nullopt;
+    }
+    return std::span<const uint8_t>(binary.data(), binary.size());
+}
+
+} // namespace
+
+void q16_bounds(std::span<const float> values, size_t components, std::vector<float>& min, std::vector<float>& max) {
+    min.assign(components, 0.0f);
+    max.assign(components, 0.0f);
+    if (components == 0) {
+        return;
+    }
+    size_t first = std::min(components, values.size());
+    std::copy_n(values.begin(), first, min.begin());
+    std::copy_n(values.begin(), first, max.begin());
+    for (size_t i = 0; i < values.size(); i++) {
+        size_t c = i % components;
+        min[c] = std::min(min[c], values[i]);
+        max[c] = std::max(max[c], values[i]);
+    }
+}
+
+uint16_t q16_quantize(float value, float min, float max) {
+    float range = max - min;
+    float q = range > 0.0f ? (value - min) / range * Q16_SCALE : 0.0f;
+    return static_cast<uint16_t>(std::lround(q));
+}
+
+size_t vertex_array::count() const {
+    switch (encoding) {
+        case vertex_encoding::float32:
+            return data.size() / sizeof(float) / components;
+        case vertex_encoding::q16:
+            return data.size() / sizeof(uint16_t) / components;
+        case vertex_encoding::oct16:
+            return data.size() / (2 * sizeof(int16_t));
+        case vertex_encoding::unorm8:
+            return data.size() / components;
+    }
+    return 0;
+}
+
+size_t vector_components(const std::string& attr_type) {
+    // "vec3f", "vec4f" and so on
+    if (attr_type.size() >= 4 && attr_type.compare(0, 3, "vec") == 0 &&
+        attr_type[3] >= '1' && attr_type[3] <= '9') {
+        return static_cast<size_t>(attr_type[3] - '0');
+    }
+    return 1;
+}
+
+json encode_vertex_array(std::span<const float> values, size_t components,
+                         vertex_semantic semantic, vertex_precision precision) {
+    switch (precision) {
+        case vertex_precision::full:
+            return json(std::vector<float>(values.begin(), values.end()));
+        case vertex_precision::float32:
+            return encode_float32(values);
+        case vertex_precision::quantized:
+            break;
+    }
+
+    // Without components there are no bounds to quantize within
+    if (components == 0) {
+        return encode_float32(values);
+    }
+
+    switch (semantic) {
+        case vertex_semantic::normal:
+            if (components == 3) {
+                return encode_oct16(values);
+            }
+            break;
+        case vertex_semantic::color:
+            return encode_unorm8(values);
+        case vertex_semantic::position:
+            break;
+    }
+    return encode_q16(values, components);
+}
+
+std::optional<vertex_array> read_vertex_array(const json& value, size_t components) {
+    if (components == 0) {
+        return std::nullopt;
+    }
+
+    if (auto bytes = typed_array_bytes(value, TAG_FLOAT32_LE)) {
+        return vertex_array{vertex_encoding::float32, components, *bytes, {}, {}};
+    }
+
+    if (!value.is_object() || !value.contains("enc") || !value.contains("data")) {
+        return std::nullopt;
+    }
+
+    const auto& enc = value["enc"];
+    const auto& data = value["data"];
+    if (enc == "q16") {
+        auto bytes = typed_array_bytes(data, TAG_UINT16_LE);
+        if (!bytes || !value.contains("min") || !value.contains("max")) {
+            return std::nullopt;
+        }
+        try {
+            vertex_array array{vertex_encoding::q16, components, *bytes,
+                               value["min"].get<std::vector<float>>(),
+                               value["max"].get<std::vector<float>>()};
+            if (array.min.size() != components || array.max.size() != components) {
+                return std::nullopt;
+            }
+            return array;
+        } catch (const json::exception&) {
+            return std::nullopt;
+        }
+    }
+    if (enc == "oct16" && components == 3) {
+        if (auto bytes = typed_array_bytes(data, TAG_SINT16_LE)) {
+            return vertex_array{vertex_encoding::oct16, components, *bytes, {}, {}};
+        }
+    }
+    if (enc == "unorm8") {
+        if (auto bytes = typed_array_bytes(data, TAG_UINT8)) {
+            return vertex_array{vertex_encoding::unorm8, components, *bytes, {}, {}};
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<float> dequantize(const vertex_array& array) {
+    std::vector<float> values;
+    values.reserve(array.count() * array.components);
+    const uint8_t* data = array.data.data();
+
+    switch (array.encoding) {
+        case vertex_encoding::float32:
+            for (size_t i = 0; i < array.count() * array.components; i++) {
+                values.push_back(read_le<float>(data + i * sizeof(float)));
+            }
+            break;
+
+        case vertex_encoding::q16:
+            for (size_t i = 0; i < array.count() * array.components; i++) {
+                size_t c = i % array.components;
+                float q = read_le<uint16_t>(data + i * sizeof(uint16_t));
+                values.push_back(array.min[c] + q / Q16_SCALE * (array.max[c] - array.min[c]));
+            }
+            break;
+
+        case vertex_encoding::oct16:
+            for (size_t i = 0; i < array.count(); i++) {
+                // Unfold the lower hemisphere and renormalize
+                float x = read_le<int16_t>(data + i * 4) / SNORM16_SCALE;
+                float y = read_le<int16_t>(data + i * 4 + 2) / SNORM16_SCALE;
+                float z = 1.0f - std::abs(x) - std::abs(y);
+                if (z < 0.0f) {
+                    float unfolded_x = (1.0f - std::abs(y)) * sign_not_zero(x);
+                    y = (1.0f - std::abs(x)) * sign_not_zero(y);
+                    x = unfolded_x;
+                }
+                float length = std::sqrt(x * x + y * y + z * z);
+                values.push_back(x / length);
+                values.push_back(y / length);
+                values.push_back(z / length);
+            }
+            break;
+
+        case vertex_encoding::unorm8:
+            for (size_t i = 0; i < array.count() * array.components; i++) {
+                values.push_back(data[i] / UNORM8_SCALE);
+            }
+            break;
+    }
+
+    return values;
+}
+
+} // namespace scene_talk
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "byte_order.h"
+
+namespace scene_talk {
+
+// CBOR typed array tags (RFC 8746)
+constexpr uint64_t TAG_UINT8 = 64;
+constexpr uint64_t TAG_UINT16_LE = 69;
+constexpr uint64_t TAG_UINT32_LE = 70;
+constexpr uint64_t TAG_SINT16_LE = 77;
+constexpr uint64_t TAG_FLOAT32_LE = 85;
+
+// q16 values map the per-component bounds to 0 and Q16_SCALE
+constexpr float Q16_SCALE = 65535.0f;
+
+/**
+ * @brief Per-component bounds of interleaved values for q16 quantization
+ *
+ * Values of an incomplete last vertex count towards their components.
+ * Bounds are zero for components without values.
+ */
+void q16_bounds(std::span<const float> values, size_t components, std::vector<float>& min, std::vector<float>& max);
+
+/**
+ * @brief Quantize a value to 16 bits within its bounds
+ */
+uint16_t q16_quantize(float value, float min, float max);
+
+/**
+ * @brief Meaning of a vertex attribute, selects its quantized encoding
+ */
+enum class vertex_semantic {
+    position,   // 16-bit values within per-component bounds
+    normal,     // Octahedral snorm16, three components
+    color       // unorm8, components in [0, 1]
+};
+
+/**
+ * @brief Precision of an encoded vertex attribute
+ */
+enum class vertex_precision {
+    full,       // Array of float64 numbers
+    float32,    // float32 typed array
+    quantized   // Quantized typed array chosen by the semantic
+};
+
+/**
+ * @brief Wire encoding of a typed vertex attribute value
+ *
+ * Full precision values are plain arrays of numbers.
+ */
+enum class vertex_encoding {
+    float32,    // Typed array tagged TAG_FLOAT32_LE
+    q16,        // {"enc": "q16", "min": [...], "max": [...], "data": TAG_UINT16_LE}
+    oct16,      // {"enc": "oct16", "data": TAG_SINT16_LE}, two values per normal
+    unorm8      // {"enc": "unorm8", "data": TAG_UINT8}
+};
+
+/**
+ * @brief A vertex attribute value as sent, without dequantizing it
+ *
+ * GPU consumers can upload the data directly, others can call dequantize().
+ */
+struct vertex_array {
+    vertex_encoding encoding;
+    size_t components;              // Components per vertex after dequantizing
+    std::span<const uint8_t> data;  // Little endian typed array, borrowed from the value
+    std::vector<float> min;         // Per-component bounds of q16 positions
+    std::vector<float> max;
+
+    // Number of vertices
+    size_t count() const;
+};
+
+/**
+ * @brief Number of components of a vector attribute type such as "vec3f", 1 otherwise
+ */
+size_t vector_components(const std::string& attr_type);
+
+/**
+ * @brief Encode a flat array of vertex values
+ *
+ * @param values Components of all vertices, interleaved
+ * @param components Components per vertex
+ * @param semantic What the values are, selects the quantized encoding
+ * @param precision Precision to encode at
+ * @return The attribute value
+ */
+nlohmann::json encode_vertex_array(std::span<const float> values, size_t components,
+                                   vertex_semantic semantic, vertex_precision precision);
+
+/**
+ * @brief Read a typed vertex attribute value
+ *
+ * The value must have been decoded with CBOR tags stored.
+ *
+ * @param value The attribute value
+ * @param components Components per vertex, see vector_components()
+ * @return The array, std::nullopt if the value is not a typed vertex array
+ */
+std::optional<vertex_array> read_vertex_array(const nlohmann::json& value, size_t components);
+
+/**
+ * @brief Dequantize a typed vertex array to floats
+ */
+std::vector<float> dequantize(const vertex_array& array);
+
+} // namespace scene_talk
@@ -3,6 +3,7 @@
 #include "websocket.h"
 #include <UT/UT_JSONValue.h>
 
+#include <chrono>
 #include <iostream>
 #include <mutex>
 
@@ -12,17 +13,21 @@ struct WebSocketThreadConfig
     std::string m_admin_endpoint;
     mg_mgr& m_mgr;
     MessageQueue& m_queue;
+    LatencyMonitor& m_latency;
 };
 
 struct WebSocketThreadState
 {
     std::map<int, struct mg_connection*> connection_map;
     MessageQueue& m_queue;
+    LatencyMonitor& m_latency;
 };
 
-bool peek_op(const std::string& message, std::string& op)
+// Interval of worker pings to clients that send ping_pong ops
+static const auto PING_INTERVAL = std::chrono::seconds(1);
+
+bool peek_op(const std::string& message, std::string& op, UT_JSONValue& root)
 {
-    UT_JSONValue root;
     if (!root.parseValue(message) || !root.isMap())
     {
         return false;
@@ -38,6 +43,78 @@ bool peek_op(const std::string& message, std::string& op)
     return true;
 }
 
+// Feed a ping_pong op {"data": {"nonce": n, "time_ms": t}} to the latency monitor,
+// returns true if it was the pong of a worker ping and must not be echoed
+static bool track_ping_pong(LatencyMonitor& latency, int connection_id, const UT_JSONValue& root)
+{
+    const UT_JSONValue* data = root.get("data");
+    if (!data || !data->isMap())
+    {
+        latency.on_client_ping(connection_id, std::nullopt);
+        return false;
+    }
+
+    const UT_JSONValue* nonce = data->get("nonce");
+    if (nonce && nonce->getType() == UT_JSONValue::JSON_INT &&
+        latency.on_pong(connection_id, (uint32_t)nonce->getI()))
+    {
+        return true;
+    }
+
+    // The time stamp is in seconds despite its name
+    std::optional<double> sent_s;
+    const UT_JSONValue* time = data->get("time_ms");
+    if (time && (time->getType() == UT_JSONValue::JSON_REAL || time->getType() == UT_JSONValue::JSON_INT))
+    {
+        sent_s = time->getF();
+    }
+    latency.on_client_ping(connection_id, sent_s);
+    return false;
+}
+
+static std::string build_summary_json(const scene_talk::latency_summary& summary)
+{
+    return "{\"count\":" + std::to_string(summary.count) +
+        ",\"min_us\":" + std::to_string(summary.min_us) +
+        ",\"mean_us\":" + std::to_string(summary.mean_us) +
+        ",\"p50_us\":" + std::to_string(summary.p50_us) +
+        ",\"p90_us\":" + std::to_string(summary.p90_us) +
+        ",\"p99_us\":" + std::to_string(summary.p99_us) +
+        ",\"max_us\":" + std::to_string(summary.max_us) + "}";
+}
+
+// {"op": "stats", "data": {"latency": {"<connection id>": {...}}}}
+static std::string build_stats_message(const std::map<int, scene_talk::latency_stats>& stats)
+{
+    std::string json = "{\"op\":\"stats\",\"data\":{\"latency\":{";
+    for (auto it = stats.begin(); it != stats.end(); ++it)
+    {
+        if (it != stats.begin())
+        {
+            json += ",";
+        }
+        const scene_talk::latency_stats& s = it->second;
+        json += "\"" + std::to_string(it->first) + "\":{";
+        json += "\"rtt\":" + build_summary_json(s.rtt);
+        json += ",\"queue_delay\":" + build_summary_json(s.queue_delay);
+        json += ",\"pings_sent\":" + std::to_string(s.pings_sent);
+        json += ",\"pongs_received\":" + std::to_string(s.pongs_received);
+        json += ",\"pings_lost\":" + std::to_string(s.pings_lost);
+        json += ",\"client_pings\":" + std::to_string(s.peer_pings);
+        json += "}";
+    }
+    json += "}}}\n";
+    return json;
+}
+
+static std::string build_ping_message(uint32_t nonce)
+{
+    auto now = std::chrono::system_clock::now();
+    double timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() / 1000.0;
+    return "{\"op\":\"ping_pong\",\"data\":{\"nonce\":" + std::to_string(nonce) +
+        ",\"time_ms\":" + std::to_string(timestamp) + "}}\n";
+}
+
 template<bool is_admin>
 static void fn_ws(struct mg_connection* c, int ev, void* ev_data)
 {
@@ -68,9 +145,17 @@ static void fn_ws(struct mg_connection* c, int ev, void* ev_data)
         util::log() << "Received message from connection " << c->id << ": " << (message.length() > 100 ? message.substr(0, 97) + "..." : message) << std::endl;
 
         std::string op;
-        if (peek_op(message, op)) {
+        UT_JSONValue root;
+        if (peek_op(message, op, root)) {
             if (op == "ping_pong") {
-                mg_ws_send(c, wm->data.buf, wm->data.len, WEBSOCKET_OP_TEXT);
+                if (!track_ping_pong(state->m_latency, c->id, root)) {
+                    mg_ws_send(c, wm->data.buf, wm->data.len, WEBSOCKET_OP_TEXT);
+                }
+                return;
+            }
+            if (is_admin && op == "stats") {
+                std::string stats = build_stats_message(state->m_latency.stats());
+                mg_ws_send(c, stats.c_str(), stats.length(), WEBSOCKET_OP_TEXT);
                 return;
             }
         }
@@ -87,6 +172,7 @@ static void fn_ws(struct mg_connection* c, int ev, void* ev_data)
     {
         util::log() << "Connection closed " << c->id << std::endl;
         state->connection_map.erase(c->id);
+        state->m_latency.remove_connection(c->id);
 
         StreamMessage msg;
         msg.connection_id = c->id;
@@ -99,7 +185,8 @@ static void fn_ws(struct mg_connection* c, int ev, void* ev_data)
 
 static void websocket_thread(const WebSocketThreadConfig& config)
 {
-    WebSocketThreadState state{{}, config.m_queue};
+    WebSocketThreadState state{{}, config.m_queue, config.m_latency};
+    auto last_ping = std::chrono::steady_clock::now();
 
     mg_http_listen(&config.m_mgr, config.m_client_endpoint.c_str(), fn_ws<false>, &state);
     mg_http_listen(&config.m_mgr, config.m_admin_endpoint.c_str(), fn_ws<true>, &state);
@@ -122,10 +209,73 @@ static void websocket_thread(const WebSocketThreadConfig& config)
             }
         }
 
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_ping >= PING_INTERVAL)
+        {
+            last_ping = now;
+            for (const auto& connection : state.connection_map)
+            {
+                uint32_t nonce;
+                if (config.m_latency.start_ping(connection.first, nonce))
+                {
+                    std::string ping = build_ping_message(nonce);
+                    mg_ws_send(connection.second, ping.c_str(), ping.length(), WEBSOCKET_OP_TEXT);
+                }
+            }
+        }
+
         mg_mgr_poll(&config.m_mgr, 1000);
     }
 }
 
+bool LatencyMonitor::start_ping(int connection_id, uint32_t& nonce)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_trackers.find(connection_id);
+    if (it == m_trackers.end())
+    {
+        return false;
+    }
+
+    nonce = it->second.start_ping();
+    return true;
+}
+
+bool LatencyMonitor::on_pong(int connection_id, uint32_t nonce)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_trackers.find(connection_id);
+    return it != m_trackers.end() && it->second.on_pong(nonce);
+}
+
+void LatencyMonitor::on_client_ping(int connection_id, std::optional<double> sent_s)
+{
+    // Clients are pinged back once they ping
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& tracker = m_trackers.try_emplace(connection_id, FIRST_NONCE).first->second;
+    if (sent_s)
+    {
+        tracker.on_peer_ping(*sent_s);
+    }
+}
+
+void LatencyMonitor::remove_connection(int connection_id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trackers.erase(connection_id);
+}
+
+std::map<int, scene_talk::latency_stats> LatencyMonitor::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<int, scene_talk::latency_stats> stats;
+    for (const auto& tracker : m_trackers)
+    {
+        stats[tracker.first] = tracker.second.stats();
+    }
+    return stats;
+}
+
 void MessageQueue::push_request(const StreamMessage& message)
 {
     {
@@ -172,7 +322,7 @@ WebSocket::WebSocket(const std::string& client_endpoint, const std::string& admi
     mg_mgr_init(&m_mgr);
     mg_wakeup_init(&m_mgr);
 
-    WebSocketThreadConfig config = { client_endpoint, admin_endpoint, m_mgr, m_queue };
+    WebSocketThreadConfig config = { client_endpoint, admin_endpoint, m_mgr, m_queue, m_latency };
     m_thread = std::thread([config]{ websocket_thread(config); });
 }
 
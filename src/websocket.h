@@ -1,10 +1,12 @@
 #pragma once
 
 #include "mongoose.h"
+#include "scenetalk/latency.h"
 
 #include <condition_variable>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <queue>
@@ -42,6 +44,25 @@ private:
     std::queue<StreamMessage> m_responses;
 };
 
+// Round trip and queueing delay of the connections that send ping_pong ops
+class LatencyMonitor
+{
+public:
+    // Worker nonces start high so they are not mistaken for client nonces
+    static const uint32_t FIRST_NONCE = 0x80000000u;
+
+    bool start_ping(int connection_id, uint32_t& nonce);
+    bool on_pong(int connection_id, uint32_t nonce);
+    void on_client_ping(int connection_id, std::optional<double> sent_s);
+    void remove_connection(int connection_id);
+
+    std::map<int, scene_talk::latency_stats> stats() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<int, scene_talk::latency_tracker> m_trackers;
+};
+
 class WebSocket
 {
 public:
@@ -51,8 +72,12 @@ public:
     bool try_pop_request(StreamMessage& message, int timeout_ms);
     void push_response(int connection_id, const std::string& message);
 
+    // Latency of each connection, the admin channel gets it with the "stats" op
+    std::map<int, scene_talk::latency_stats> latency_stats() const { return m_latency.stats(); }
+
 private:
     mg_mgr m_mgr;
+    LatencyMonitor m_latency;
 
     std::thread m_thread;
     MessageQueue m_queue;